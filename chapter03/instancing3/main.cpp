@@ -4,6 +4,7 @@
 #include "vutils.h"
 #include "vmath.h"
 #include "vbm.h"
+#include "vcull.h"
 #include "GL/freeglut.h"
 
 using namespace std;
@@ -24,6 +25,15 @@ VBObject vbmObj;
 
 #define INSTANCE_COUNT 100
 
+// Bounding sphere of armadillo_low.vbm in model space (center, radius), as
+// printed by "vbmconv bounds"
+static const vec4 object_sphere(0.0115f, 21.5887f, -0.3383f, 92.6347f);
+
+// Per-instance colors, and the instances left after frustum culling each
+// frame, packed to the front so the shader can index them with gl_InstanceID
+vec4 colors[INSTANCE_COUNT];
+VFrustumCuller culler;
+
 //---------------------------------------------------------------------
 //
 // init
@@ -139,8 +149,6 @@ init(void)
     glBindTexture(GL_TEXTURE_BUFFER, TO_color[0]);
     
     // Generate the colors of the objects for each instance.
-    vec4 colors[INSTANCE_COUNT];
-
     for (int n = 0; n < INSTANCE_COUNT; n++)
     {
         float a = float(n) / 4.0f;
@@ -153,10 +161,11 @@ init(void)
         colors[n][3] = 1.0f;
     }
     
-    // Create a texture buffer object and upload data to it.
+    // Create a texture buffer object. The colors of the visible instances are
+    // uploaded in display call, as they move along with the model matrices.
     glGenBuffers(1, TBO_color);
     glBindBuffer(GL_TEXTURE_BUFFER, TBO_color[0]);
-    glBufferData(GL_TEXTURE_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(colors), NULL, GL_DYNAMIC_DRAW);
     
     // Attach the texture buffer object data to the texture object
     glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, TBO_color[0]);
@@ -210,23 +219,37 @@ display(void)
                       translate(10.0f + a, 40.0f + b, 50.0f + c);
     }
     
-    // Bind the TBO for model_matrix and change its data, since we want the model matrix updated at each display call
+    // Set up the view and projection matrices
+    mat4 view_matrix(translate(0.0f, 0.0f, -1500.0f) * rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
+    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
+
+    // Drop the instances outside the view, keeping the model matrices and
+    // colors of the rest together
+    mat4 visible_matrices[INSTANCE_COUNT];
+    vec4 visible_colors[INSTANCE_COUNT];
+
+    culler.SetFrustum(projection_matrix * view_matrix);
+    unsigned int visible = culler.Cull(object_sphere, matrices, colors, INSTANCE_COUNT, visible_matrices, visible_colors);
+
+    // Bind the TBOs for model_matrix and color and change their data, since we want them updated at each display call.
+    // Only the visible instances are uploaded.
     glActiveTexture(GL_TEXTURE1);
     glBindBuffer(GL_TEXTURE_BUFFER, TBO_model_matrix[0]);
-    glBufferData(GL_TEXTURE_BUFFER, sizeof(matrices), matrices, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, visible * sizeof(mat4), visible_matrices);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBuffer(GL_TEXTURE_BUFFER, TBO_color[0]);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, visible * sizeof(vec4), visible_colors);
     
     // Use shader program
     glUseProgram(gProgram);
-    
-    // Set up the view and projection matrices
-    mat4 view_matrix(translate(0.0f, 0.0f, -1500.0f) * rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
-    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
 
     glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix);
     glUniformMatrix4fv(render_projection_matrix_loc, 1, GL_FALSE, projection_matrix);
 
-    // Render INSTANCE_COUNT objects
-    vbmObj.Render(0, INSTANCE_COUNT);
+    // Render the visible objects. An instance count of 0 would draw one
+    // object without instancing, so skip the draw instead.
+    if (visible != 0)
+        vbmObj.Render(0, visible);
     
     glutSwapBuffers();
     if (auto_redraw)
@@ -0,0 +1,91 @@
+#ifndef __VBCN_H__
+#define __VBCN_H__
+
+#include <stddef.h>
+
+class VThreadPool;
+struct vglImageData;
+
+// Block compression of RGBA8 images into the BCn formats, for offline
+// cooking, and decompression back to RGBA8 for machines without a GPU.
+// Images are rows of 4-byte RGBA texels; each 4x4 block of them becomes 8
+// (BC1, BC4) or 16 (BC2, BC3, BC5, BC7) bytes. Edge blocks of images
+// that aren't a multiple of 4 repeat their last row and column.
+//
+// Endpoints come from the principal axis of the block's colors, refined by
+// least squares, and every texel takes the closest palette entry. That
+// search runs over four texels at a time with SSE2 where the compiler
+// targets it. BC7 blocks are all mode 6 (one subset, 7.7.7.7 endpoints with
+// a p-bit each, 4-bit indices): half the size of RGBA8 per texel and much
+// closer to the source than BC1/BC3, without the cost of searching
+// partitions.
+//
+// Decoders take any block a GPU would, including BC1's three-color mode
+// and every BC7 mode, and produce what it samples, bit for bit where the
+// format pins the arithmetic down. BC7 palettes are interpolated two
+// entries at a time with SSE2 where the compiler targets it; the others
+// are small enough that a lookup per texel beats anything wider.
+//
+// Nothing here touches GL, so it can run on a machine without one;
+// DecodeImage only reads a vglImageData's description.
+class VBCnCodec
+{
+public:
+    enum Format
+    {
+        BC1,            // RGB, or 1-bit alpha when decoding
+        BC2,            // RGB + 4-bit alpha
+        BC3,            // RGB + BC4 alpha
+        BC4,            // R
+        BC5,            // RG, e.g. normal maps
+        BC7,            // RGBA
+        FORMAT_COUNT
+    };
+
+    // Bytes per 4x4 block
+    static unsigned int GetBlockSize(Format format);
+
+    // Bytes for a whole image of width x height texels
+    static size_t GetImageSize(Format format, unsigned int width, unsigned int height);
+
+    // The channels (of RGBA) a format keeps, for error measurement
+    static unsigned int GetChannelCount(Format format);
+
+    // Compresses 16 texels, row after row, into one block. Returns the sum
+    // of squared differences between the texels and what a decoder will
+    // produce, over the channels the format keeps.
+    static double EncodeBlock(Format format, const unsigned char texels[64], unsigned char * block);
+
+    // Compresses a whole image, block rows spread over pool (or run on the
+    // calling thread if pool is NULL). Returns the sum of squared errors
+    // over every texel, as EncodeBlock.
+    static double Encode(Format format, const unsigned char * rgba, unsigned int width, unsigned int height,
+                         unsigned char * blocks, VThreadPool * pool = NULL);
+
+    // Expands one block into 16 texels, row after row. Channels the format
+    // doesn't keep read as a GPU samples them: 0 for green and blue, 255
+    // for alpha.
+    static void DecodeBlock(Format format, const unsigned char * block, unsigned char texels[64]);
+
+    // Expands a whole image into rows of RGBA8 texels, block rows spread
+    // over pool (or run on the calling thread if pool is NULL)
+    static void Decode(Format format, const unsigned char * blocks, unsigned int width, unsigned int height,
+                       unsigned char * rgba, VThreadPool * pool = NULL);
+
+    // The format of a GL block-compressed internal format, and whether it
+    // is sRGB. Signed and float formats have no RGBA8 equivalent, so
+    // those are false, as is anything uncompressed.
+    static bool GetFormat(unsigned int internal_format, Format & format, bool & srgb);
+
+    // Expands every mip of every slice of a block-compressed image, as
+    // vglLoadImage leaves it, into an RGBA8 image laid out the same way:
+    // GL_RGBA8 or GL_SRGB8_ALPHA8, the mips on the heap for vglUnloadImage
+    // to free. All the blocks of all the mips are spread over pool together.
+    // False, with rgba untouched, if GetFormat doesn't know the format.
+    static bool DecodeImage(const vglImageData & image, vglImageData & rgba, VThreadPool * pool = NULL);
+
+    // "sse2" or "scalar"
+    static const char * GetPath(void);
+};
+
+#endif /* __VBCN_H__ */
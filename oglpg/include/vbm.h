@@ -10,12 +10,69 @@
 #ifndef VBM_FILE_TYPES_ONLY
   #include "vgl.h"
   #include "vmath.h"
+  #include "vmmap.h"
 #endif
 
+#define VBM_MAGIC                   0x56424D31      // 'VBM1'
+#define VBM_MAGIC_V2                0x56424D32      // 'VBM2' - same layout, attributes may be quantized
+#define VBM_MAGIC_SBM               0x314D4253      // "SBM1" - older files using VBM_HEADER_SBM
+#define VBM_MAGIC_COMPRESSED        0x5A4D4256      // "VBMZ" - any of the above, compressed; see vbmz.h
+
 #define VBM_FLAG_HAS_VERTICES       0x00000001
 #define VBM_FLAG_HAS_INDICES        0x00000002
 #define VBM_FLAG_HAS_FRAMES         0x00000004
 #define VBM_FLAG_HAS_MATERIALS      0x00000008
+#define VBM_FLAG_INTERLEAVED        0x00000010      // One vertex after another, stride rounded up to 16 bytes
+#define VBM_FLAG_HAS_BLOCKS         0x00000020      // Extension blocks follow the render chunks
+
+// VBM_ATTRIB_HEADER::flags
+#define VBM_ATTRIB_FLAG_NORMALIZED  0x00000001      // Integer data is normalized to [0,1] / [-1,1]
+#define VBM_ATTRIB_FLAG_OCTAHEDRAL  0x00000002      // Unit vector stored as two components, see VBM_GLSL_OCT_DECODE
+
+// Extension block types (VBM_BLOCK_HEADER::type)
+#define VBM_BLOCK_ATTRIB_QUANT      0x544E5551      // "QUNT" - one VBM_ATTRIB_QUANT per attribute
+#define VBM_BLOCK_LOD               0x53444F4C      // "LODS" - one VBM_LOD per level of detail, finest first
+#define VBM_BLOCK_MESHLETS          0x4C48534D      // "MSHL" - one VBM_MESHLET per cluster of frame 0
+#define VBM_BLOCK_INDEX_RANGES      0x474E5249      // "IRNG" - VBM_INDEX_RANGEs covering a 16-bit index buffer
+#define VBM_BLOCK_BOUNDS            0x53444E42      // "BNDS" - one VBM_BOUNDS per frame, then one per render chunk
+
+// How a block of a compressed file was filtered before LZ compression
+// (VBM_COMPRESSED_BLOCK::filter). The shuffle groups the bytes of every
+// 4-byte word by position, so that the sign and exponent bytes of float
+// data end up next to each other.
+#define VBM_FILTER_NONE             0
+#define VBM_FILTER_SHUFFLE          1
+#define VBM_FILTER_SHUFFLE_DELTA    2               // Shuffled, then each byte minus the previous one of its group
+#define VBM_FILTER_STORED           3               // Not compressed at all
+
+// Encodings for VBObject::Quantize
+#define VBM_ENCODING_FLOAT          0               // Leave the attribute alone
+#define VBM_ENCODING_HALF           1               // GL_HALF_FLOAT
+#define VBM_ENCODING_NORM16         2               // Normalized 16-bit integers, scale and bias from the bounds
+#define VBM_ENCODING_INT_2_10_10_10 3               // GL_INT_2_10_10_10_REV, for unit vectors
+#define VBM_ENCODING_OCTAHEDRAL     4               // Two normalized GL_SHORTs, for unit vectors
+
+// Shader code for attributes with VBM_ATTRIB_FLAG_OCTAHEDRAL
+#define VBM_GLSL_OCT_DECODE                                                 \
+    "vec3 vbm_oct_decode(vec2 e)\n"                                         \
+    "{\n"                                                                   \
+    "    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"                    \
+    "    float t = max(-v.z, 0.0);\n"                                       \
+    "    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);\n"         \
+    "    return normalize(v);\n"                                            \
+    "}\n"
+
+// Flags for VBObject::LoadFromVBM and VBObject::MapVBM
+#define VBM_LOAD_INTERLEAVE         0x00000001      // Re-pack planar attribute blocks into interleaved vertices
+#define VBM_LOAD_OPTIMIZE           0x00000002      // Run VBObject::Optimize with every step before uploading
+#define VBM_LOAD_COMPACT_INDICES    0x00000004      // Store indices in 16 bits, see VBObject::CompactIndices
+#define VBM_LOAD_TANGENTS           0x00000008      // Run VBObject::GenerateTangents if the file has no tangents
+
+// Steps for VBObject::Optimize
+#define VBM_OPTIMIZE_VERTEX_CACHE   0x00000001      // Reorder triangles for the post-transform cache (Tipsify)
+#define VBM_OPTIMIZE_OVERDRAW       0x00000002      // Then reorder triangle clusters front to back from the outside
+#define VBM_OPTIMIZE_VERTEX_FETCH   0x00000004      // Renumber vertices in the order the indices first use them
+#define VBM_OPTIMIZE_ALL            0x00000007
 
 typedef struct VBM_HEADER_t
 {
@@ -32,6 +89,21 @@ typedef struct VBM_HEADER_t
     unsigned int flags;
 } VBM_HEADER;
 
+// Header used by SBM1 files (armadillo_low.vbm, ninja.vbm, ...). It has no
+// chunk or material counts, so num_vertices sits where VBM_HEADER keeps
+// num_chunks. The loader converts it to a VBM_HEADER.
+typedef struct VBM_HEADER_SBM_t
+{
+    unsigned int magic;
+    unsigned int size;
+    char name[64];
+    unsigned int num_attribs;
+    unsigned int num_frames;
+    unsigned int num_vertices;
+    unsigned int num_indices;
+    unsigned int index_type;
+} VBM_HEADER_SBM;
+
 typedef struct VBM_ATTRIB_HEADER_t
 {
     char name[64];
@@ -54,6 +126,87 @@ typedef struct VBM_RENDER_CHUNK_t
     unsigned int count;
 } VBM_RENDER_CHUNK;
 
+// Extension blocks are stored back to back after the render chunks, each
+// padded to a multiple of four bytes. Readers skip types they don't know.
+typedef struct VBM_BLOCK_HEADER_t
+{
+    unsigned int type;
+    unsigned int size;          // Payload bytes following this header, excluding padding
+} VBM_BLOCK_HEADER;
+
+// Dequantization of one attribute: value = stored * scale + bias, applied
+// after normalization. Identity for attributes that aren't quantized.
+typedef struct VBM_ATTRIB_QUANT_t
+{
+    float scale[4];
+    float bias[4];
+} VBM_ATTRIB_QUANT;
+
+// One level of detail: a range of the index buffer drawn instead of frame 0,
+// and the largest distance (in model units) of its surface from the original
+typedef struct VBM_LOD_t
+{
+    unsigned int first;
+    unsigned int count;
+    float error;
+} VBM_LOD;
+
+// A cluster of frame 0's triangles, contiguous in the index buffer, with
+// bounds to cull it as a whole. Every triangle normal lies within cone_axis;
+// the cluster faces away from an eye position when
+// dot(center - eye, cone_axis) >= cone_cutoff * length(center - eye) + radius.
+typedef struct VBM_MESHLET_t
+{
+    unsigned int first;         // First index
+    unsigned int count;         // Number of indices
+    unsigned int vertex_count;  // Distinct vertices referenced
+    float center[3];            // Bounding sphere
+    float radius;
+    float cone_axis[3];
+    float cone_cutoff;          // 1 if the normals are too spread out to ever cull
+} VBM_MESHLET;
+
+// A run of a 16-bit index buffer whose indices are relative to base_vertex.
+// Ranges follow each other from the first index to the last, so objects
+// with more than 65536 vertices can still use 16-bit indices.
+typedef struct VBM_INDEX_RANGE_t
+{
+    unsigned int first;
+    unsigned int count;
+    unsigned int base_vertex;
+} VBM_INDEX_RANGE;
+
+// Model space bounds of a frame or render chunk: an axis aligned box and a
+// sphere around its center. Empty ranges get an empty box at the origin.
+typedef struct VBM_BOUNDS_t
+{
+    float min[3];
+    float max[3];
+    float center[3];
+    float radius;
+} VBM_BOUNDS;
+
+// Compressed files start with a VBM_COMPRESSED_HEADER, then one
+// VBM_COMPRESSED_BLOCK per block, then the blocks' data. Block i holds bytes
+// [i * block_size, (i + 1) * block_size) of the original file, compressed on
+// its own so that blocks can be decoded in parallel.
+typedef struct VBM_COMPRESSED_HEADER_t
+{
+    unsigned int magic;
+    unsigned int size;          // Of this header
+    unsigned int raw_size;      // Of the original file
+    unsigned int block_size;    // Multiple of four; the last block may be shorter
+    unsigned int num_blocks;
+    unsigned int flags;
+} VBM_COMPRESSED_HEADER;
+
+typedef struct VBM_COMPRESSED_BLOCK_t
+{
+    unsigned int offset;        // From the start of the file
+    unsigned int size;          // Compressed bytes
+    unsigned int filter;        // VBM_FILTER_*
+} VBM_COMPRESSED_BLOCK;
+
 typedef struct VBM_VEC4F_t
 {
     float x;
@@ -94,14 +247,221 @@ typedef struct VBM_MATERIAL_t
 
 #ifndef VBM_FILE_TYPES_ONLY
 
+// Bytes one vertex uses for this attribute
+static inline unsigned int vbmAttribSize(const VBM_ATTRIB_HEADER & attrib)
+{
+    switch (attrib.type)
+    {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return attrib.components;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            return attrib.components * 2;
+        case GL_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_2_10_10_10_REV:
+            return 4;
+        default:
+            return attrib.components * 4;
+    }
+}
+
+// Results of VBObject::AnalyzeVertexCache
+typedef struct VBM_CACHE_STATS_t
+{
+    unsigned int triangles;
+    unsigned int vertices;          // Distinct vertices referenced
+    unsigned int transformed;       // Cache misses
+    float acmr;                     // Transformed vertices per triangle, 0.5 - 3.0
+    float atvr;                     // Transformed per distinct vertex, 1.0 is ideal
+} VBM_CACHE_STATS;
+
+// One command of a glMultiDrawArraysIndirect buffer, laid out as GL reads it
+typedef struct VBM_DRAW_COMMAND_t
+{
+    unsigned int count;
+    unsigned int instance_count;
+    unsigned int first;
+    unsigned int base_instance;
+} VBM_DRAW_COMMAND;
+
+// One command of a glMultiDrawElementsIndirect buffer
+typedef struct VBM_DRAW_ELEMENTS_COMMAND_t
+{
+    unsigned int count;
+    unsigned int instance_count;
+    unsigned int first_index;
+    int base_vertex;
+    unsigned int base_instance;
+} VBM_DRAW_ELEMENTS_COMMAND;
+
+class VBGeometryPool;
+class VThreadPool;
+
+// Shader storage binding RenderIndirect puts the per-draw material indices
+// on by default. Shaders read them as materials[gl_DrawIDARB].
+#define VBM_MATERIAL_INDEX_BINDING  0
+
 class VBObject
 {
 public:
     VBObject(void);
     virtual ~VBObject(void);
 
-    bool LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index);
-    void Render(unsigned int frame_index = 0, unsigned int instances = 0);
+    bool LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags = 0);
+
+    // LoadFromVBM in two steps. MapVBM maps and validates the file without
+    // touching GL, so it may run on any thread. UploadVBM creates the vertex
+    // array and buffers straight from the mapping and needs a current context.
+    // Compressed files (see vbmz.h) are decoded by MapVBM, in parallel on
+    // VThreadPool::GetDefault(), into a buffer UploadVBM then reads instead.
+    bool MapVBM(const char * filename, unsigned int flags = 0);
+    bool UploadVBM(int vertexIndex, int normalIndex, int texCoord0Index);
+
+    // Alternative to UploadVBM that puts the object in pool's shared buffers
+    // (see vbmpool.h). Planar objects are interleaved and non-indexed ones
+    // indexed first, but only once the pool has taken the data: on failure
+    // the object is left as it was. The pool must outlive the object's upload.
+    bool UploadToPool(VBGeometryPool * pool, int vertexIndex, int normalIndex, int texCoord0Index);
+
+    // Where the object's vertices and indices start in its pool's buffers,
+    // 0 when it has buffers of its own
+    unsigned int GetBaseVertex(void) const;
+    unsigned int GetFirstIndex(void) const;
+
+    // Writes the object, in its current vertex layout, as a VBM1 file (VBM2
+    // if any attribute is quantized). Works on mapped objects, so converters
+    // don't need a GL context.
+    bool SaveToVBM(const char * filename) const;
+
+    // Re-encodes the vertex attributes of a mapped, planar object, choosing
+    // the attribute by its name: position, normal/tangent, or map*/texcoord*.
+    // Encodings are VBM_ENCODING_*. Objects without vertices are left as
+    // they are.
+    bool Quantize(unsigned int position_encoding, unsigned int normal_encoding, unsigned int texcoord_encoding);
+
+    // Decodes attribute index of every vertex of a mapped object into four
+    // floats each, applying normalization and dequantization. Missing
+    // components are filled from (0, 0, 0, 1).
+    bool DecodeAttribute(unsigned int index, float * out) const;
+
+    // Computes a MikkTSpace style tangent for every vertex of a mapped,
+    // planar object from its positions, normals and first texture
+    // coordinates, on pool (VThreadPool::GetDefault() if 0). The result is
+    // a four float "tangent" attribute, appended or replacing the existing
+    // one, with the bitangent's sign in w: bitangent = w * cross(normal,
+    // tangent.xyz). Appended to position, normal and texture coordinates, it
+    // binds to location 3. SaveToVBM keeps it, so it need only be computed
+    // once.
+    bool GenerateTangents(VThreadPool * pool = 0);
+
+    // Indexes the object if it isn't already, welding identical vertices,
+    // then applies the VBM_OPTIMIZE_* steps to each frame's triangles. The
+    // result always uses 32-bit indices. Objects with render chunks are not
+    // supported, as chunks address the vertices directly.
+    bool Optimize(unsigned int steps = VBM_OPTIMIZE_ALL, unsigned int cache_size = 16);
+
+    // Converts 32-bit indices to 16 bits, halving the index buffer. Where
+    // the indices span more than 65536 vertices the buffer is split, between
+    // triangles, into ranges drawn with a base vertex; the ranges are stored
+    // in a VBM_BLOCK_INDEX_RANGES block. The rare triangle that spans more
+    // than that by itself gets copies of its vertices appended. Optimize,
+    // GenerateLODs and BuildMeshlets go back to 32-bit indices, so compact
+    // after them.
+    bool CompactIndices(void);
+
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, GL_NONE for non-indexed objects
+    GLenum GetIndexType(void) const
+    {
+        return m_header.num_indices ? m_header.index_type : GL_NONE;
+    }
+
+    // Simulates a FIFO post-transform cache of cache_size entries over the
+    // triangles of every frame.
+    VBM_CACHE_STATS AnalyzeVertexCache(unsigned int cache_size = 16) const;
+
+    // Builds levels - 1 coarser versions of frame 0 with a quadric error
+    // edge collapse simplifier, each keeping about ratio of the triangles of
+    // the level before. All levels share the vertex data; their indices are
+    // appended to the index buffer (indexing the object first if needed) and
+    // the table is stored in a VBM_BLOCK_LOD block.
+    bool GenerateLODs(unsigned int levels, float ratio = 0.5f);
+
+    // Objects without a LOD table have a single level, frame 0
+    unsigned int GetLODCount(void) const;
+    float GetLODError(unsigned int lod) const;
+
+    // Coarsest level whose error covers at most pixel_error pixels when seen
+    // from distance. projection_scale is the viewport height divided by
+    // 2 * tan(fovy / 2); scale distance by the inverse of any model scaling.
+    unsigned int SelectLOD(float distance, float projection_scale, float pixel_error = 1.0f) const;
+
+    // Draws one level, e.g. for a bucket of instances sharing it. A non-zero
+    // base_instance offsets instanced attributes (GL 4.2). Levels past the
+    // last draw the last; objects without levels are drawn by Render.
+    void RenderLOD(unsigned int lod, unsigned int instances = 0, unsigned int base_instance = 0);
+
+    // Splits frame 0 into meshlets of at most max_vertices distinct vertices
+    // and max_triangles triangles, grown greedily across shared vertices.
+    // Frame 0's triangles are reordered so that each meshlet is contiguous,
+    // and the meshlets are stored in a VBM_BLOCK_MESHLETS block.
+    bool BuildMeshlets(unsigned int max_vertices = 64, unsigned int max_triangles = 124);
+    unsigned int GetMeshletCount(void) const;
+
+    // Tests every meshlet against the frustum of model_view_projection and
+    // against its backface cone as seen from eye (in model space), returning
+    // the number visible. Until DisableMeshletCulling is called, Render then
+    // draws frame 0 as only the visible meshlets, with runs of adjacent ones
+    // merged into a single range of one glMultiDrawElements call (split
+    // where they cross into another index range).
+    unsigned int CullMeshlets(const vmath::mat4 & model_view_projection, const vmath::vec3 & eye);
+    void DisableMeshletCulling(void);
+
+    // Recomputes the VBM_BLOCK_BOUNDS block from the positions (attribute
+    // 0). MapVBM does this for files saved without one, and Quantize after
+    // re-encoding the positions.
+    bool ComputeBounds(void);
+
+    // NULL when out of range or the object has no positions
+    const VBM_BOUNDS * GetFrameBounds(unsigned int frame = 0) const;
+    const VBM_BOUNDS * GetChunkBounds(unsigned int chunk) const;
+
+    // Nearest triangle of frame that the model space ray from origin hits,
+    // if it is closer than *distance (in multiples of direction's length),
+    // which is then updated. Tests every triangle once the ray passes the
+    // frame's bounds, so it is meant for picking, e.g. as the exact test of
+    // VInstanceBVH::Raycast, rather than for every frame.
+    bool IntersectRay(const vmath::vec3 & origin, const vmath::vec3 & direction, float * distance, unsigned int frame = 0) const;
+
+    // Extension blocks. GetBlock returns NULL if the object has no block of
+    // that type. SetBlock copies the data, replacing any block of that type.
+    const void * GetBlock(unsigned int type, unsigned int * size = 0) const;
+    bool SetBlock(unsigned int type, const void * data, unsigned int size);
+    void RemoveBlock(unsigned int type);
+
+    // Scale and bias the application must apply to an attribute that was
+    // quantized with VBM_ENCODING_NORM16, e.g. through a uniform.
+    vmath::vec4 GetAttributeScale(unsigned int index) const;
+    vmath::vec4 GetAttributeBias(unsigned int index) const;
+
+    // Objects with render chunks are drawn chunk by chunk in material order,
+    // binding each material's textures only where they differ from what
+    // the previous chunk left bound. A non-zero base_instance offsets
+    // instanced attributes (GL 4.2), as RenderLOD's does.
+    void Render(unsigned int frame_index = 0, unsigned int instances = 0, unsigned int base_instance = 0);
+
+    // Draws every chunk with one glMultiDrawArraysIndirect. Textures are not
+    // bound; the shader picks the material from the buffer on
+    // material_binding instead. Falls back to Render without GL 4.3.
+    void RenderIndirect(unsigned int instances = 0, GLuint material_binding = VBM_MATERIAL_INDEX_BINDING);
+
+    // GL calls the last Render issued, binds included
+    unsigned int GetRenderCallCount(void) const
+    {
+        return m_render_calls;
+    }
+
     bool Free(void);
 
     unsigned int GetVertexCount(unsigned int frame = 0)
@@ -109,6 +469,18 @@ public:
         return frame < m_header.num_frames ? m_frame[frame].count : 0;
     }
 
+    // Distance between vertices in the attribute buffer, 0 for planar data
+    GLsizei GetVertexStride(void) const
+    {
+        return m_vertex_stride;
+    }
+
+    // Bytes of vertex and index data, as uploaded
+    size_t GetDataSize(void) const
+    {
+        return m_vertex_data_size + m_index_data_size;
+    }
+
     unsigned int GetAttributeCount(void) const
     {
         return m_header.num_attribs;
@@ -119,6 +491,11 @@ public:
         return index < m_header.num_attribs ? m_attrib[index].name : 0;
     }
 
+    unsigned int GetAttributeSize(unsigned int index) const
+    {
+        return index < m_header.num_attribs ? vbmAttribSize(m_attrib[index]) : 0;
+    }
+
     unsigned int GetFrameCount(void) const
     {
         return m_header.num_frames;
@@ -180,16 +557,85 @@ public:
     }
 
 protected:
+    friend class VBGeometryPool;
+    friend class VBMorphTargets;
+
+    bool ParseVBM(unsigned char * data, size_t size);
+    void Unmap(void);
+
+    // Deletes what UploadVBM made, or leaves the pool UploadToPool put the
+    // object in
+    void ReleaseGL(void);
+
+    bool IsMapped(void) const
+    {
+        return m_file.IsOpen() || m_decompressed_data != 0;
+    }
+
+    bool Interleave(void);
+    // The vertex data Interleave switches to, on the heap, without changing
+    // the object. NULL if an attribute can't be interleaved.
+    unsigned char * InterleavedCopy(GLsizei * stride, size_t * size) const;
+    size_t GetAttributeOffset(unsigned int index) const;
+    void SetConvertedVertexData(unsigned char * data, size_t size);
+    void SetConvertedIndexData(unsigned int * data, unsigned int count);
+    void SetConvertedIndexData(unsigned short * data, unsigned int count);
+    void BuildChunkDraws(void);
+    unsigned int GetIndex(unsigned int element) const;
+    const VBM_INDEX_RANGE * GetIndexRanges(unsigned int * count) const;
+    unsigned int FindIndexRange(const VBM_INDEX_RANGE * ranges, unsigned int count, unsigned int element) const;
+    unsigned int DrawIndices(unsigned int first, unsigned int count, unsigned int instances, unsigned int base_instance);
+    const unsigned char * GetPositions(size_t * step, float ** decoded) const;
+
     GLuint m_vao;
     GLuint m_attribute_buffer;
     GLuint m_index_buffer;
 
+    // Set when the object lives in a VBGeometryPool; m_vao is then the
+    // pool's and the buffers above stay 0
+    VBGeometryPool * m_pool;
+    unsigned int m_pool_handle;
+
+    // The file stays mapped while the object is loaded. Everything below
+    // except m_header points into the mapping, apart from m_vertex_data and
+    // m_index_data when they were converted at load time; those live in
+    // m_converted_vertex_data and m_converted_index_data, and m_attrib once
+    // GenerateTangents has grown it, which lives in m_converted_attrib.
+    // Compressed files are decompressed into m_decompressed_data, which then
+    // stands in for the mapping.
+    VMappedFile m_file;
+    unsigned char * m_decompressed_data;
+    const unsigned char * m_vertex_data;
+    size_t m_vertex_data_size;
+    unsigned char * m_converted_vertex_data;
+    GLsizei m_vertex_stride;
+    const unsigned char * m_index_data;
+    size_t m_index_data_size;
+    unsigned int * m_converted_index_data;
+    unsigned short * m_converted_short_index_data;
+
     VBM_HEADER m_header;
     VBM_ATTRIB_HEADER * m_attrib;
+    VBM_ATTRIB_HEADER * m_converted_attrib;
     VBM_FRAME_HEADER * m_frame;
     VBM_MATERIAL * m_material;
     VBM_RENDER_CHUNK * m_chunks;
 
+    enum { MAX_BLOCKS = 16 };
+
+    // Extension blocks in file order. data points into the mapping, or at
+    // owned when the block was set with SetBlock.
+    struct block
+    {
+        unsigned int type;
+        unsigned int size;
+        const unsigned char * data;
+        unsigned char * owned;
+    };
+
+    block m_blocks[MAX_BLOCKS];
+    unsigned int m_num_blocks;
+
     struct material_texture
     {
         GLuint diffuse;
@@ -198,6 +644,24 @@ protected:
     };
 
     material_texture * m_material_textures;
+
+    // Chunks sorted by material and merged where they continue each other,
+    // built at load time: one draw each, plus the material it uses. The
+    // same commands back the indirect buffer.
+    VBM_DRAW_COMMAND * m_chunk_draws;
+    unsigned int * m_chunk_materials;
+    unsigned int m_chunk_draw_count;
+    GLuint m_indirect_buffer;
+    GLuint m_material_index_buffer;
+    unsigned int m_indirect_instances;      // instance_count in m_indirect_buffer
+    unsigned int m_render_calls;
+
+    // Draw list of the last CullMeshlets, for glMultiDrawElements
+    GLsizei * m_draw_counts;
+    const GLvoid ** m_draw_offsets;
+    GLint * m_draw_base_vertices;
+    unsigned int m_draw_count;
+    bool m_meshlet_culling;
 };
 #endif /* VBM_FILE_TYPES_ONLY */
 
@@ -0,0 +1,97 @@
+#ifndef __VBMLOADER_H__
+#define __VBMLOADER_H__
+
+#include <stdio.h>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "vbm.h"
+#include "vthread.h"
+
+// Timings of one asset, in milliseconds since the loader was created
+struct VBMLoadStats
+{
+    std::string filename;
+    bool success;
+    double queued;              // Load() called
+    double mapped;              // Worker finished reading and validating the file
+    double uploaded;            // GL objects created; the object can be drawn
+
+    double GetLatency(void) const
+    {
+        return uploaded - queued;
+    }
+};
+
+// Loads VBObjects in the background. File I/O and validation run on a
+// thread pool; the GL side (buffers and vertex array) is created by Update(),
+// which must be called on the GL thread, typically once per frame. An object
+// must not be used until its callback has run.
+class VBMAsyncLoader
+{
+public:
+    typedef std::function<void (VBObject * object, const VBMLoadStats & stats)> Callback;
+
+    // pool == 0 uses VThreadPool::GetDefault()
+    explicit VBMAsyncLoader(VThreadPool * pool = 0);
+    ~VBMAsyncLoader(void);
+
+    // flags are VBM_LOAD_* and are applied on the worker thread
+    void Load(VBObject * object, const char * filename,
+              int vertexIndex, int normalIndex, int texCoord0Index,
+              unsigned int flags = 0,
+              const Callback & callback = Callback());
+
+    // Uploads finished objects until budget_ms has been spent. At least one
+    // object is uploaded per call if any is ready. Returns the number uploaded.
+    unsigned int Update(double budget_ms);
+
+    // Objects queued and not yet uploaded (or failed)
+    unsigned int GetPendingCount(void) const
+    {
+        return m_pending;
+    }
+
+    // Stats for every finished object, in completion order
+    const std::vector<VBMLoadStats> & GetStats(void) const
+    {
+        return m_stats;
+    }
+
+    void PrintStats(FILE * f) const;
+
+    double GetTime(void) const;
+
+private:
+    VBMAsyncLoader(const VBMAsyncLoader &);
+    VBMAsyncLoader & operator=(const VBMAsyncLoader &);
+
+    struct Request
+    {
+        VBObject * object;
+        int vertexIndex;
+        int normalIndex;
+        int texCoord0Index;
+        unsigned int flags;
+        Callback callback;
+        VBMLoadStats stats;
+    };
+
+    VThreadPool * m_pool;
+    double m_start;
+
+    // Requests the workers are done with, waiting for the GL thread
+    std::mutex m_mutex;
+    std::condition_variable m_worker_done;
+    std::deque<Request *> m_ready;
+    unsigned int m_in_flight;
+
+    unsigned int m_pending;
+    std::vector<VBMLoadStats> m_stats;
+};
+
+#endif /* __VBMLOADER_H__ */
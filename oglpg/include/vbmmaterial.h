@@ -0,0 +1,154 @@
+#ifndef __VBMMATERIAL_H__
+#define __VBMMATERIAL_H__
+
+#include <string>
+#include <vector>
+
+#include "vbm.h"
+#include "vermilion.h"
+
+class VThreadPool;
+
+// Texture units and shader storage binding VBMaterialArrays::Bind uses by
+// default. The diffuse array goes on VBM_MATERIAL_ARRAY_UNIT, specular on
+// the unit after it and normal maps on the one after that. The layer table
+// sits next to RenderIndirect's per-draw material indices.
+#define VBM_MATERIAL_ARRAY_UNIT     0
+#define VBM_MATERIAL_LAYER_BINDING  1
+
+// Where one material's maps are in the arrays, as the layer buffer holds it
+// (std430). -1 for a map the material doesn't have or that failed to load.
+typedef struct VBM_MATERIAL_LAYERS_t
+{
+    int diffuse;
+    int specular;
+    int normal;
+    int reserved;
+} VBM_MATERIAL_LAYERS;
+
+// Shader code for the default bindings. Pass the material from the vertex
+// shader, where RenderIndirect's draw ID picks it, as a flat int, and get a
+// map with e.g.
+// vbm_sample_map(vbm_diffuse_maps, vbm_layers[material].diffuse, uv, vec4(1.0)).
+// The map is sampled whether or not there is one, so that derivatives stay
+// defined, and missing is returned in its place.
+#define VBM_GLSL_MATERIAL_ARRAYS                                            \
+    "layout (binding = 0) uniform sampler2DArray vbm_diffuse_maps;\n"       \
+    "layout (binding = 1) uniform sampler2DArray vbm_specular_maps;\n"      \
+    "layout (binding = 2) uniform sampler2DArray vbm_normal_maps;\n"        \
+    "\n"                                                                    \
+    "struct vbm_material_layers\n"                                          \
+    "{\n"                                                                   \
+    "    int diffuse;\n"                                                    \
+    "    int specular;\n"                                                   \
+    "    int normal;\n"                                                     \
+    "    int reserved;\n"                                                   \
+    "};\n"                                                                  \
+    "\n"                                                                    \
+    "layout (std430, binding = 1) readonly buffer vbm_material_layer_buffer\n" \
+    "{\n"                                                                   \
+    "    vbm_material_layers vbm_layers[];\n"                               \
+    "};\n"                                                                  \
+    "\n"                                                                    \
+    "vec4 vbm_sample_map(sampler2DArray maps, int layer, vec2 uv, vec4 missing)\n" \
+    "{\n"                                                                   \
+    "    vec4 texel = texture(maps, vec3(uv, float(max(layer, 0))));\n"     \
+    "    return layer >= 0 ? texel : missing;\n"                            \
+    "}\n"
+
+// Compiles the maps VBM_MATERIALs name into one GL_TEXTURE_2D_ARRAY per kind
+// of map (diffuse, specular, normal) and a shader storage buffer giving each
+// material its layers, so that a model with many materials draws with one
+// RenderIndirect and no texture binds in between.
+//
+// Like MapVBM and UploadVBM, building is split in two. Load reads the maps
+// the object's materials name, on a thread pool, scales every map of a kind
+// to the same size and builds their mipmaps with VMipGenerator; it doesn't
+// touch GL, so it may run on any thread. Upload then creates the arrays and
+// the layer buffer on the GL thread, copying every level in as it is. Maps
+// named by several materials are loaded once.
+//
+// Maps are uncompressed or RLE TGA files (8, 24 or 32 bits), uncompressed
+// 8-bit DDS files or BC1-BC5 and BC7 DDS files, all loaded as RGBA8.
+class VBMaterialArrays
+{
+public:
+    enum Kind
+    {
+        DIFFUSE,
+        SPECULAR,
+        NORMAL,
+        KIND_COUNT
+    };
+
+    VBMaterialArrays(void);
+    ~VBMaterialArrays(void);
+
+    // Map names are taken relative to directory (NULL for the current one),
+    // with backslashes read as slashes. Each kind's size is that of its
+    // largest map, capped at max_size on each side. pool == 0 uses
+    // VThreadPool::GetDefault(). Maps that can't be loaded get layer -1 and
+    // are listed by GetMissingMaps; Load fails only if the object has no
+    // materials.
+    bool Load(const VBObject & object, const char * directory, unsigned int max_size = 1024, VThreadPool * pool = 0);
+    bool Upload(void);
+
+    bool Build(const VBObject & object, const char * directory, unsigned int max_size = 1024)
+    {
+        return Load(object, directory, max_size) && Upload();
+    }
+
+    // Binds the arrays to first_unit onwards and the layer buffer to
+    // binding. Leaves first_unit active.
+    void Bind(GLuint first_unit = VBM_MATERIAL_ARRAY_UNIT, GLuint binding = VBM_MATERIAL_LAYER_BINDING) const;
+
+    void Free(void);
+
+    // 0 if no material has a map of that kind
+    GLuint GetTexture(Kind kind) const
+    {
+        return m_textures[kind];
+    }
+
+    unsigned int GetLayerCount(Kind kind) const
+    {
+        return m_arrays[kind].layers;
+    }
+
+    const VBM_MATERIAL_LAYERS * GetLayers(unsigned int material) const
+    {
+        return material < m_layers.size() ? &m_layers[material] : 0;
+    }
+
+    const std::vector<std::string> & GetMissingMaps(void) const
+    {
+        return m_missing;
+    }
+
+    // Texel data uploaded, mipmaps included
+    size_t GetDataSize(void) const;
+
+private:
+    VBMaterialArrays(const VBMaterialArrays &);
+    VBMaterialArrays & operator=(const VBMaterialArrays &);
+
+    // One kind's array as Load leaves it for Upload: every layer scaled to
+    // width x height RGBA8, with its mipmaps, as a GL_TEXTURE_2D_ARRAY image
+    // (mip[0].data is NULL once uploaded)
+    struct array
+    {
+        unsigned int width;
+        unsigned int height;
+        unsigned int layers;
+        vglImageData mips;
+    };
+
+    array m_arrays[KIND_COUNT];
+    std::vector<VBM_MATERIAL_LAYERS> m_layers;
+    std::vector<std::string> m_missing;
+
+    GLuint m_textures[KIND_COUNT];
+    GLuint m_layer_buffer;
+};
+
+#endif /* __VBMMATERIAL_H__ */
@@ -0,0 +1,125 @@
+#ifndef __VBMMORPH_H__
+#define __VBMMORPH_H__
+
+#include <vector>
+
+#include "vbm.h"
+
+// Texture unit VBMorphTargets::Bind uses by default, after the three of
+// VBMaterialArrays
+#define VBM_MORPH_TARGET_UNIT       3
+
+// Shader code for the default unit. vbm_morph blends up to four targets with
+// the given weights for the vertex being processed; weights of 0 cost
+// nothing. Set the two uniforms with VBMorphTargets::SetUniforms. Each
+// instance of a crowd can get its own targets and weights, e.g. from an
+// instanced attribute, so that the whole crowd is one instanced draw.
+#define VBM_GLSL_MORPH_TARGETS                                              \
+    "layout (binding = 3) uniform samplerBuffer vbm_morph_targets;\n"       \
+    "uniform int vbm_morph_vertex_count;\n"                                 \
+    "uniform int vbm_morph_first_vertex;\n"                                 \
+    "\n"                                                                    \
+    "void vbm_morph(ivec4 targets, vec4 weights, out vec3 position, out vec3 normal)\n" \
+    "{\n"                                                                   \
+    "    int vertex = gl_VertexID - vbm_morph_first_vertex;\n"              \
+    "    position = vec3(0.0);\n"                                           \
+    "    normal = vec3(0.0);\n"                                             \
+    "    for (int i = 0; i < 4; i++)\n"                                     \
+    "    {\n"                                                               \
+    "        if (weights[i] == 0.0)\n"                                      \
+    "            continue;\n"                                               \
+    "        int texel = (targets[i] * vbm_morph_vertex_count + vertex) * 2;\n" \
+    "        position += texelFetch(vbm_morph_targets, texel).xyz * weights[i];\n" \
+    "        normal += texelFetch(vbm_morph_targets, texel + 1).xyz * weights[i];\n" \
+    "    }\n"                                                               \
+    "    normal = normalize(normal);\n"                                     \
+    "}\n"
+
+// Keyframe animation from the frames of a VBM file. Each frame is a morph
+// target: the same triangles over vertices of their own, in the same order.
+// For non-indexed objects that means frames of equal length, one after the
+// other; indexed frames must have the same indices up to an offset per
+// frame. Drawing frame 0 then gives the topology, and the positions and
+// normals come from blending targets.
+//
+// Like VBMaterialArrays, Load decodes the targets without touching GL and
+// Upload puts them in a texture buffer, two RGBA32F texels (position and
+// normal) per vertex and target, for VBM_GLSL_MORPH_TARGETS to fetch by
+// gl_VertexID. Without texture buffers, UploadBlend blends on the CPU
+// instead and feeds the result to the object's vertex array.
+class VBMorphTargets
+{
+public:
+    VBMorphTargets(void);
+    ~VBMorphTargets(void);
+
+    // Fails if the object's frames aren't morph targets of each other.
+    // Objects without normals get (0, 0, 1).
+    bool Load(const VBObject & object);
+    bool Upload(void);
+
+    bool Build(const VBObject & object)
+    {
+        return Load(object) && Upload();
+    }
+
+    void Bind(GLuint unit = VBM_MORPH_TARGET_UNIT) const;
+
+    // Sets the uniforms of VBM_GLSL_MORPH_TARGETS in program. Pass
+    // object.GetBaseVertex() as base_vertex for objects in a VBGeometryPool.
+    void SetUniforms(GLuint program, unsigned int base_vertex = 0) const;
+
+    // CPU version of vbm_morph for every vertex at once, with SSE2 where
+    // available: out gets a position and a normal, four floats each, per
+    // vertex. Normals are blended but not renormalized. Targets out of
+    // range are skipped.
+    void Blend(const unsigned int * targets, const float * weights, unsigned int count, float * out) const;
+
+    // Fallback for drawing without texture buffers: blends into a stream
+    // buffer of this object's and points the object's position and normal
+    // attributes at it, so that Render(0) draws the blend. Call it again
+    // for each new set of weights. Not for objects in a VBGeometryPool,
+    // whose vertex array is shared.
+    bool UploadBlend(VBObject & object, const unsigned int * targets, const float * weights, unsigned int count,
+                     GLuint position_location = 0, GLuint normal_location = 1);
+
+    void Free(void);
+
+    unsigned int GetTargetCount(void) const
+    {
+        return m_targets;
+    }
+
+    unsigned int GetVertexCount(void) const
+    {
+        return m_vertices;
+    }
+
+    // The vertex number frame 0's vertices start at
+    unsigned int GetFirstVertex(void) const
+    {
+        return m_first_vertex;
+    }
+
+    GLuint GetTexture(void) const
+    {
+        return m_texture;
+    }
+
+private:
+    VBMorphTargets(const VBMorphTargets &);
+    VBMorphTargets & operator=(const VBMorphTargets &);
+
+    // Target after target, each a position and a normal per vertex as the
+    // texture buffer holds them. Kept after Upload for Blend.
+    std::vector<float> m_data;
+    unsigned int m_targets;
+    unsigned int m_vertices;
+    unsigned int m_first_vertex;
+
+    GLuint m_buffer;
+    GLuint m_texture;
+    GLuint m_blend_buffer;
+};
+
+#endif /* __VBMMORPH_H__ */
@@ -0,0 +1,156 @@
+#ifndef __VBMPOOL_H__
+#define __VBMPOOL_H__
+
+#include <vector>
+
+#include "vbm.h"
+
+// Sub-allocates the vertices and indices of many VBObjects out of a few
+// large buffers. Objects sharing a vertex format (attribute types, stride
+// and attribute locations) and index type share one vertex buffer, one
+// index buffer and one vertex array, so a scene of different meshes can be
+// drawn with a single glMultiDrawElementsIndirect per format.
+//
+// Objects join with VBObject::UploadToPool instead of UploadVBM. They can
+// still be drawn on their own with Render; Queue and Flush batch them.
+class VBGeometryPool
+{
+public:
+    // Initial capacity of each format's buffers, in bytes. Buffers grow by
+    // doubling when they run out.
+    explicit VBGeometryPool(size_t vertex_bytes = 4 << 20, size_t index_bytes = 2 << 20);
+    ~VBGeometryPool(void);
+
+    // Adds a draw of frame of object, which must be in this pool, to its
+    // format's batch. Frames are drawn as plain index ranges; render chunk
+    // materials are left to the application.
+    void Queue(const VBObject & object, unsigned int frame = 0, unsigned int instances = 1);
+
+    // Draws and clears every batch. Returns the number of draw calls made.
+    unsigned int Flush(void);
+
+    // Moves every format's allocations to the start of their buffers,
+    // releasing the space freed objects left between them. Objects using
+    // meshlet culling must call CullMeshlets again afterwards.
+    void Defragment(void);
+
+    // Frees the buffers and vertex arrays. Objects still in the pool must
+    // not be drawn afterwards.
+    void Free(void);
+
+    unsigned int GetFormatCount(void) const
+    {
+        return (unsigned int)m_formats.size();
+    }
+
+    // Bytes allocated to objects, and bytes of buffer storage in total
+    size_t GetUsedBytes(void) const;
+    size_t GetCapacityBytes(void) const;
+
+protected:
+    friend class VBObject;
+
+    // Offsets into one of a format's buffers, in vertices or indices. Best
+    // fit over a list of free blocks kept sorted by offset, so that
+    // neighbours merge as soon as both are free.
+    class RangeAllocator
+    {
+    public:
+        void Reset(unsigned int capacity, unsigned int used = 0);
+
+        // ~0u if no free block is big enough
+        unsigned int Allocate(unsigned int count);
+        void Release(unsigned int offset, unsigned int count);
+
+        unsigned int GetCapacity(void) const
+        {
+            return m_capacity;
+        }
+
+        unsigned int GetUsed(void) const
+        {
+            return m_used;
+        }
+
+    private:
+        struct block
+        {
+            unsigned int offset;
+            unsigned int count;
+        };
+
+        std::vector<block> m_free;
+        unsigned int m_capacity;
+        unsigned int m_used;
+    };
+
+    struct attribute
+    {
+        GLenum type;
+        GLint components;
+        GLboolean normalized;
+        GLuint location;
+        size_t offset;
+    };
+
+    struct format
+    {
+        std::vector<attribute> attributes;
+        GLsizei stride;
+        GLenum index_type;
+
+        GLuint vao;
+        GLuint vertex_buffer;
+        GLuint index_buffer;
+        GLuint indirect_buffer;
+        RangeAllocator vertices;
+        RangeAllocator indices;
+
+        std::vector<VBM_DRAW_ELEMENTS_COMMAND> batch;
+    };
+
+    struct allocation
+    {
+        unsigned int format;
+        unsigned int first_vertex;
+        unsigned int vertex_count;
+        unsigned int first_index;
+        unsigned int index_count;
+        bool live;
+    };
+
+    // Called by VBObject. Add copies the object's (interleaved) vertices and
+    // indices in and returns a handle, or ~0u on failure.
+    unsigned int Add(const format & layout, const void * vertices, unsigned int vertex_count,
+                     const void * indices, unsigned int index_count);
+    void Release(unsigned int handle);
+
+    const allocation & GetAllocation(unsigned int handle) const
+    {
+        return m_allocations[handle];
+    }
+
+    GLuint GetVertexArray(unsigned int handle) const
+    {
+        return m_formats[m_allocations[handle].format].vao;
+    }
+
+    unsigned int FindFormat(const format & layout);
+    void SetupVertexArray(format & f);
+
+    // Moves the live allocations of format index into new buffers of the
+    // given capacities, packed from the start
+    void Repack(unsigned int index, unsigned int vertex_capacity, unsigned int index_capacity);
+
+    size_t m_vertex_bytes;
+    size_t m_index_bytes;
+    std::vector<format> m_formats;
+    std::vector<allocation> m_allocations;
+    std::vector<unsigned int> m_free_handles;
+
+private:
+    VBGeometryPool(const VBGeometryPool &);
+    VBGeometryPool & operator=(const VBGeometryPool &);
+};
+
+#endif /* __VBMPOOL_H__ */
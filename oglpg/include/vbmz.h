@@ -0,0 +1,34 @@
+#ifndef __VBMZ_H__
+#define __VBMZ_H__
+
+// Compressed VBM files (VBM_MAGIC_COMPRESSED, laid out as described at
+// VBM_COMPRESSED_HEADER in vbm.h). The file is cut into fixed size blocks,
+// each filtered (VBM_FILTER_*) and compressed with a small LZ77 codec of
+// the LZ4 family on its own, so that blocks decode independently and in
+// parallel. Decompressing gives back the original file byte for byte, so
+// any VBM file can be compressed and VBObject::MapVBM takes either.
+
+#include <stddef.h>
+
+#include <vector>
+
+class VThreadPool;
+
+// Default VBM_COMPRESSED_HEADER::block_size
+#define VBM_COMPRESSED_BLOCK_SIZE   (256 * 1024)
+
+// Compresses a whole VBM file held in data into out, trying every filter
+// on every block and keeping the smallest result. block_size is rounded up
+// to a multiple of four. Blocks are compressed on pool when it isn't NULL.
+// Fails for files of 4 GB or more.
+bool vbmCompress(const unsigned char * data, size_t size, std::vector<unsigned char> & out,
+                 unsigned int block_size = VBM_COMPRESSED_BLOCK_SIZE, VThreadPool * pool = 0);
+
+// Size of the original file, or 0 if data isn't a valid compressed file
+size_t vbmGetDecompressedSize(const unsigned char * data, size_t size);
+
+// Decodes every block straight into out, which must hold
+// vbmGetDecompressedSize bytes. Returns false for corrupt data.
+bool vbmDecompress(const unsigned char * data, size_t size, unsigned char * out, VThreadPool * pool = 0);
+
+#endif /* __VBMZ_H__ */
@@ -0,0 +1,138 @@
+#ifndef __VBVH_H__
+#define __VBVH_H__
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "vmath.h"
+
+class VThreadPool;
+
+// Bounding volume hierarchy over the world space boxes of a scene's
+// instances, for frustum culling and ray picking in time that grows with
+// what is visible or hit rather than with the number of instances.
+//
+// The tree is built top down with a binned surface area heuristic. When
+// instances move, SetInstances followed by Refit updates the boxes without
+// changing the tree; NeedsRebuild tells when the refitted tree has become
+// bad enough that a Build pays off. Instances are reported by their index
+// in the arrays given to SetInstances / SetBoxes.
+class VInstanceBVH
+{
+public:
+    // With a pool, SetInstances and Build spread their work over its threads
+    explicit VInstanceBVH(VThreadPool * pool = NULL);
+
+    // World space boxes of count instances of one mesh: the mesh's model
+    // space box (see VBObject::GetFrameBounds) under each model matrix
+    void SetInstances(const vmath::vec3 & box_min, const vmath::vec3 & box_max,
+                      const vmath::mat4 * matrices, unsigned int count);
+
+    // Or the world space boxes themselves, for a mix of meshes
+    void SetBoxes(const vmath::vec3 * box_min, const vmath::vec3 * box_max, unsigned int count);
+
+    void Build(void);
+
+    // Updates the tree for the current boxes. False if the number of
+    // instances changed since Build, which then has to be called instead.
+    bool Refit(void);
+
+    // True once refitting has grown the tree's cost past max_growth times
+    // what it was when built
+    bool NeedsRebuild(float max_growth = 1.5f) const;
+
+    // Appends the instances at least partly inside the frustum of
+    // view_projection (projection * view) to visible. Returns how many.
+    unsigned int QueryFrustum(const vmath::mat4 & view_projection, std::vector<unsigned int> & visible) const;
+
+    // Exact test of one instance, for Raycast. Returns true and sets
+    // distance when the ray hits it closer than distance already is.
+    typedef std::function<bool (unsigned int instance, const vmath::vec3 & origin,
+                                const vmath::vec3 & direction, float & distance)> RayTest;
+
+    struct RayHit
+    {
+        unsigned int instance;
+        float distance;             // Along direction, in multiples of its length
+    };
+
+    // Nearest instance the ray from origin hits within max_distance. Without
+    // a test, instances are hit where the ray enters their box; with one,
+    // boxes are visited nearest first and test decides.
+    bool Raycast(const vmath::vec3 & origin, const vmath::vec3 & direction, RayHit & hit,
+                 float max_distance = 1e30f, const RayTest & test = RayTest()) const;
+
+    // World space ray through (x, y) in normalized device coordinates, for
+    // picking with the mouse. view must be a rotation and translation and
+    // projection a perspective one (vmath::frustum or vmath::perspective).
+    static void GetPickRay(const vmath::mat4 & view, const vmath::mat4 & projection, float x, float y,
+                           vmath::vec3 & origin, vmath::vec3 & direction);
+
+    unsigned int GetNodeCount(void) const
+    {
+        return (unsigned int)m_nodes.size();
+    }
+
+    // Surface area heuristic cost of the tree, relative to the root's box
+    float GetCost(void) const;
+
+protected:
+    struct box
+    {
+        float min[3];
+        float max[3];
+    };
+
+    // Every node covers the instances m_order[first, first + count).
+    // Children are allocated in pairs after their parent, so walking the
+    // array backwards visits children before parents.
+    struct node
+    {
+        box bounds;
+        unsigned int first;
+        unsigned int count;
+        unsigned int left;          // First of two children, 0 for leaves
+    };
+
+    // An instance's box while building, moved around with it
+    struct reference
+    {
+        box bounds;
+        unsigned int instance;
+    };
+
+    // A node still to be split, the range of m_references it covers and
+    // the bounds of their boxes and centroids
+    struct task
+    {
+        unsigned int node;
+        unsigned int first;
+        unsigned int count;
+        box bounds;
+        box centroids;
+    };
+
+    // Splits task and everything below it. Subtrees of no more than
+    // defer_count instances are appended to deferred instead, if it is set.
+    void BuildSubtree(const task & root, unsigned int defer_count, std::vector<task> * deferred);
+    bool Split(const task & t, task & left, task & right);
+    static void Grow(task & t, const box & b);
+    unsigned int AllocateNodes(void);
+    void RefitNode(unsigned int index);
+
+    VThreadPool * m_pool;
+    std::vector<box> m_boxes;
+    std::vector<unsigned int> m_order;
+    std::vector<node> m_nodes;
+    std::vector<reference> m_references;
+    std::atomic<unsigned int> m_node_count;
+    unsigned int m_built_count;
+    float m_built_cost;
+
+private:
+    VInstanceBVH(const VInstanceBVH &);
+    VInstanceBVH & operator=(const VInstanceBVH &);
+};
+
+#endif /* __VBVH_H__ */
@@ -0,0 +1,116 @@
+#ifndef __VCACHE_H__
+#define __VCACHE_H__
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vbm.h"
+
+// Shares meshes and textures between everything that loads them. Resources
+// are found by canonical path first, which costs no I/O at all, and then by
+// a hash of the file contents, so that identical copies of an asset in
+// different directories are loaded once. Each Acquire takes a reference and
+// must be paired with a Release of the returned object or texture.
+//
+// Resources nobody references any more are kept, most recently used first,
+// while they fit in the unused budget, so that a scene that releases and
+// reacquires an asset doesn't reload it. A path hit assumes the file hasn't
+// changed since it was loaded. GL thread only.
+class VResourceCache
+{
+public:
+    enum Type
+    {
+        MESH,
+        TEXTURE
+    };
+
+    // What is about to be freed, for the eviction callback
+    struct Resource
+    {
+        Type type;
+        const char * path;              // Canonical path the resource was first loaded from
+        VBObject * object;              // MESH
+        GLuint texture;                 // TEXTURE
+        size_t bytes;                   // Vertex, index and texel data
+    };
+
+    typedef std::function<void (const Resource & resource)> EvictCallback;
+
+    explicit VResourceCache(size_t unused_budget = 0);
+    ~VResourceCache(void);
+
+    // Returns NULL / 0 if the file can't be loaded. Meshes loaded with
+    // different attribute locations or flags are different resources.
+    VBObject * AcquireMesh(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags = 0);
+    GLuint AcquireTexture(const char * filename);
+
+    void Release(VBObject * object);
+    void ReleaseTexture(GLuint texture);
+
+    // Called just before a resource is freed
+    void SetEvictCallback(const EvictCallback & callback)
+    {
+        m_evict_callback = callback;
+    }
+
+    // Frees every resource with no references left, whatever the budget
+    void EvictUnused(void);
+
+    struct Stats
+    {
+        unsigned int path_hits;         // Found by path
+        unsigned int content_hits;      // Found by contents under another path
+        unsigned int loads;             // Actually loaded
+        unsigned int resident;          // Resources in the cache
+        size_t resident_bytes;
+        size_t unused_bytes;            // Part of resident_bytes nobody references
+    };
+
+    const Stats & GetStats(void) const
+    {
+        return m_stats;
+    }
+
+    // Absolute, normalized form of filename used as the path key
+    static std::string GetCanonicalPath(const char * filename);
+
+    // 64-bit FNV-1a of the file's contents; false if it can't be read
+    static bool HashFile(const char * filename, unsigned long long * hash);
+
+private:
+    VResourceCache(const VResourceCache &);
+    VResourceCache & operator=(const VResourceCache &);
+
+    struct entry
+    {
+        Resource resource;
+        std::string path;
+        std::string content_key;
+        std::vector<std::string> path_keys;
+        unsigned int refs;
+        unsigned long long last_used;
+    };
+
+    entry * Find(const std::string & path_key, const std::string & content_key_prefix,
+                 const char * filename, std::string * content_key);
+    entry * Insert(Type type, const std::string & path, const std::string & path_key, const std::string & content_key);
+    void AddRef(entry * e);
+    void ReleaseEntry(entry * e);
+    void Evict(entry * e);
+    void Trim(void);
+
+    std::map<std::string, entry *> m_by_path;
+    std::map<std::string, entry *> m_by_content;
+    std::map<VBObject *, entry *> m_by_object;
+    std::map<GLuint, entry *> m_by_texture;
+
+    size_t m_unused_budget;
+    unsigned long long m_clock;
+    EvictCallback m_evict_callback;
+    Stats m_stats;
+};
+
+#endif /* __VCACHE_H__ */
@@ -0,0 +1,40 @@
+#ifndef __VCULL_H__
+#define __VCULL_H__
+
+#include "vmath.h"
+
+// Frustum culling for instances of one mesh. Each instance is the mesh's
+// bounding sphere moved by its model matrix. The matrices and colors of the
+// instances that survive are copied, in order, to compacted arrays, so that
+// only those are uploaded and the returned count can be passed straight to
+// VBObject::Render as the instance count.
+//
+// Spheres are tested eight at a time with AVX, four at a time with SSE2, or
+// one by one, depending on what the compiler targets (-mavx for the first).
+class VFrustumCuller
+{
+public:
+    VFrustumCuller(void);
+
+    // Extracts the six planes of view_projection (projection * view), so
+    // that instances are culled in world space
+    void SetFrustum(const vmath::mat4 & view_projection);
+
+    // sphere holds the mesh's model space bounding sphere, center in xyz and
+    // radius in w. Matrices may scale; the radius grows with the largest
+    // axis. colors and out_colors may be NULL. Returns the survivors.
+    unsigned int Cull(const vmath::vec4 & sphere, const vmath::mat4 * matrices, const vmath::vec4 * colors,
+                      unsigned int count, vmath::mat4 * out_matrices, vmath::vec4 * out_colors);
+
+    // "avx", "sse2" or "scalar"
+    static const char * GetPath(void);
+
+    // Normalized planes of a view_projection matrix, pointing inwards, as
+    // (a, b, c, d) with a * x + b * y + c * z + d >= 0 inside
+    static void ExtractPlanes(const vmath::mat4 & view_projection, float planes[6][4]);
+
+private:
+    float m_planes[6][4];
+};
+
+#endif /* __VCULL_H__ */
@@ -42,13 +42,15 @@ struct vglImageData
     GLenum target;                              // Texture target (1D, 2D, cubemap, array, etc.)
     GLenum internalFormat;                      // Recommended internal format (GL_RGBA32F, etc).
     GLenum format;                              // Format in memory
-    GLenum type;                                // Type in memory (GL_RED, GL_RGB, etc.)
+    GLenum type;                                // Type in memory (GL_RED, GL_RGB, etc.), GL_NONE if block-compressed
     GLenum swizzle[4];                          // Swizzle for RGBA
     GLsizei mipLevels;                          // Number of present mipmap levels
     GLsizei slices;                             // Number of slices (for arrays)
     GLsizeiptr sliceStride;                     // Distance in bytes between slices of an array texture
     GLsizeiptr totalDataSize;                   // Complete amount of data allocated for texture
     vglImageMipData mip[MAX_TEXTURE_MIPS];      // Actual mipmap data
+    GLvoid* mapping;                            // Read-only view of the file the mip data points into, or NULL if it was copied to the heap
+    GLsizeiptr mappingSize;                     // Size of that view (the whole file)
 };
 
 void vglLoadImage(const char* filename, vglImageData* image);
@@ -0,0 +1,55 @@
+#ifndef __VMIPGEN_H__
+#define __VMIPGEN_H__
+
+#include <stddef.h>
+
+class VThreadPool;
+struct vglImageData;
+
+// Mip chains for 8-bit images, built on the CPU, for textures that come
+// without authored mips: they can then be uploaded level by level like any
+// DDS file instead of waiting on glGenerateMipmap on the GL thread.
+//
+// Each level is filtered from the one above it, separably, rows then
+// columns. Sizes that are odd round down and the filter stretches to fit,
+// with texels past the edges clamped. Images with an sRGB internal format
+// are filtered in linear light and rounded to the nearest sRGB code, so
+// their mips don't darken; alpha is always linear.
+//
+// Levels are cut into 64x64 tiles, every tile of every slice one pool
+// task. Source rows are widened so that each destination texel's taps are
+// adjacent, which lets both passes run eight floats at a time with AVX2, or
+// four with SSE2, where the compiler targets them.
+//
+// The mips of cutout textures such as foliage lose coverage as filtering
+// pulls alpha toward the middle, so they thin out with distance. Given the
+// cutoff of their alpha test, each level's alpha is scaled so that as many
+// of its texels pass as did in the top level.
+class VMipGenerator
+{
+public:
+    enum Filter
+    {
+        BOX,            // Average of the texels covered, the cheapest
+        KAISER,         // Kaiser-windowed sinc, 3 lobes: sharp, rings little
+        LANCZOS         // Lanczos 3: a little sharper, rings more
+    };
+
+    // Fills mips with a copy of image with every level from its top one
+    // down to 1x1 (or MAX_TEXTURE_MIPS levels), laid out as vglLoadImage
+    // lays out slices, on the heap for vglUnloadImage to free. Levels image
+    // already has below the top are replaced. Images must be GL_UNSIGNED_BYTE
+    // GL_RED, GL_RG, GL_RGB, GL_BGR, GL_RGBA or GL_BGRA, and not 3D.
+    //
+    // alpha_cutoff in (0, 1] preserves the coverage of an alpha test
+    // against it, on alpha, or on red for GL_RED images such as masks.
+    // Levels are spread over pool, or run on the calling thread if pool is
+    // NULL. False, with mips untouched, for images this can't filter.
+    static bool Generate(const vglImageData & image, vglImageData & mips, Filter filter = KAISER,
+                         float alpha_cutoff = -1.0f, VThreadPool * pool = NULL);
+
+    // "avx2", "sse2" or "scalar"
+    static const char * GetPath(void);
+};
+
+#endif /* __VMIPGEN_H__ */
@@ -0,0 +1,53 @@
+#ifndef __VMMAP_H__
+#define __VMMAP_H__
+
+#include <stddef.h>
+
+// A whole file mapped into the address space. The mapping is private
+// (copy-on-write), so callers may patch the data in place without touching
+// the file on disk - only the pages that actually get written are copied.
+class VMappedFile
+{
+public:
+    VMappedFile(void);
+    ~VMappedFile(void);
+
+    bool Open(const char * filename);
+    void Close(void);
+
+    // Reads every page of the mapping so that later accesses (from another
+    // thread, or the driver inside glBufferData) don't stall on disk I/O.
+    void Prefault(void) const;
+
+    bool IsOpen(void) const
+    {
+        return m_data != 0;
+    }
+
+    unsigned char * GetData(void) const
+    {
+        return m_data;
+    }
+
+    size_t GetSize(void) const
+    {
+        return m_size;
+    }
+
+private:
+    // Not copyable - the mapping has exactly one owner
+    VMappedFile(const VMappedFile &);
+    VMappedFile & operator=(const VMappedFile &);
+
+    unsigned char * m_data;
+    size_t m_size;
+
+#ifdef _WIN32
+    void * m_file;
+    void * m_mapping;
+#else
+    int m_fd;
+#endif
+};
+
+#endif /* __VMMAP_H__ */
@@ -0,0 +1,18 @@
+#ifndef __VTARGA_H__
+#define __VTARGA_H__
+
+#include "vgl.h"
+
+namespace vtarga
+{
+
+// Loads an uncompressed or RLE TGA file, grayscale or 16, 24 or 32-bit true
+// color. Returns the texels, bottom row first as GL expects, in format
+// (GL_RED, GL_BGR or GL_BGRA; 16-bit files are widened to GL_BGRA) with
+// unsigned bytes, or NULL if the file can't be read. Free the result with
+// delete [].
+unsigned char * load_targa(const char * filename, GLenum &format, int &width, int &height);
+
+}
+
+#endif /* __VTARGA_H__ */
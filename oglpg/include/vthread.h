@@ -0,0 +1,54 @@
+#ifndef __VTHREAD_H__
+#define __VTHREAD_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads. Tasks run in submission order, but with
+// more than one worker they may finish in any order.
+class VThreadPool
+{
+public:
+    // num_threads == 0 means one worker per hardware thread
+    explicit VThreadPool(unsigned int num_threads = 0);
+    ~VThreadPool(void);
+
+    void Submit(const std::function<void (void)> & task);
+
+    // Blocks until every task submitted so far has finished
+    void Wait(void);
+
+    // Calls func(begin, end) over [0, count) in ranges of at most grain
+    // items, on the workers and the calling thread, and returns once all
+    // ranges are done. The caller works through ranges itself, so this is
+    // safe to use from inside a pool task.
+    void ParallelFor(unsigned int count, unsigned int grain, const std::function<void (unsigned int, unsigned int)> & func);
+
+    unsigned int GetThreadCount(void) const
+    {
+        return (unsigned int)m_threads.size();
+    }
+
+    // Process-wide pool, created on first use
+    static VThreadPool & GetDefault(void);
+
+private:
+    VThreadPool(const VThreadPool &);
+    VThreadPool & operator=(const VThreadPool &);
+
+    void WorkerMain(void);
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void (void)> > m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_task_ready;
+    std::condition_variable m_all_done;
+    unsigned int m_busy;
+    bool m_quit;
+};
+
+#endif /* __VTHREAD_H__ */
@@ -1,42 +1,40 @@
 #include <stdio.h>
-#include "vgl.h"
+#include <string.h>
+#include "vtarga.h"
 
 namespace vtarga
 {
 
-#ifdef _MSC_VER
-#pragma pack (push, 1)
-#endif
-
+// The 18 byte header, read field by field rather than through a struct so
+// that compiler packing doesn't matter
 struct targa_header
 {
     unsigned char           id_length;
     unsigned char           cmap_type;
     unsigned char           image_type;
-    struct
-    {
-        unsigned short      cmap_table_offset;
-        unsigned short      cmap_entry_count;
-        unsigned char       cmap_entry_size;
-    } cmap_spec;
-    struct
-    {
-        unsigned short      x_origin;
-        unsigned short      y_origin;
-        unsigned short      width;
-        unsigned short      height;
-        unsigned char       bits_per_pixel;
-        struct {
-            unsigned char   alpha_depth : 4;
-            unsigned char   image_origin : 2;
-            unsigned char   : 2;
-        };
-    } image_spec;
+    unsigned short          width;
+    unsigned short          height;
+    unsigned char           bits_per_pixel;
+    unsigned char           descriptor;
 };
 
-#ifdef _MSC_VER
-#pragma pack (pop)
-#endif
+static bool read_targa_header(FILE * f, targa_header &header)
+{
+    unsigned char data[18];
+
+    if (fread(data, sizeof(data), 1, f) != 1)
+        return false;
+
+    header.id_length = data[0];
+    header.cmap_type = data[1];
+    header.image_type = data[2];
+    header.width = (unsigned short)(data[12] | (data[13] << 8));
+    header.height = (unsigned short)(data[14] | (data[15] << 8));
+    header.bits_per_pixel = data[16];
+    header.descriptor = data[17];
+
+    return true;
+}
 
 static bool is_compressed_targa(const targa_header &header)
 {
@@ -53,55 +51,91 @@ static bool get_targa_format_type_and_size(const targa_header &header, GLenum &f
     // By default...
     type = GL_UNSIGNED_BYTE;
 
-    switch (header.image_spec.bits_per_pixel)
+    switch (header.bits_per_pixel)
     {
         case 8:
             format = GL_RED;
             size = 1;
-            return true;
+            return (header.image_type & 0x07) == 3;
         case 16:
-            switch (header.image_spec.alpha_depth)
-            {
-                case 0:
-                    format = GL_RG8;
-                    break;
-                case 8:
-                    format = GL_RG;
-                    break;
-                default:
-                    return false;
-            }
+            // X1R5G5B5 or A1R5G5B5, read as is and widened to BGRA once
+            // loaded
+            format = GL_BGRA;
             size = 2;
-            return true;
+            return (header.image_type & 0x07) == 2;
         case 24:
-            switch (header.image_spec.alpha_depth)
-            {
-                case 0:
-                    format = GL_BGR;
-                    break;
-                default:
-                    // Huh, 24 bits per pixel, non-0 alpha - Red-Green-Alpha?
-                    return false;
-            }
+            format = GL_BGR;
             size = 3;
-            return true;
+            return (header.image_type & 0x07) == 2;
         case 32:
-            switch (header.image_spec.alpha_depth)
-            {
-                case 8:
-                    format = GL_ABGR_EXT;
-                    break;
-                default:
-                    // 32-bit image without alpha.
-                    return false;
-            }
+            // Blue, green, red and alpha in memory
+            format = GL_BGRA;
             size = 4;
-            return true;
+            return (header.image_type & 0x07) == 2;
         default:
             return false;
     }
 }
 
+// Run length encoded packets: a count byte, then either one pixel repeated
+// (top bit set) or count raw pixels
+static bool read_targa_rle(FILE * f, unsigned char * data, size_t pixels, int size)
+{
+    size_t n = 0;
+
+    while (n < pixels)
+    {
+        int packet = fgetc(f);
+
+        if (packet == EOF)
+            return false;
+
+        size_t count = (size_t)(packet & 0x7F) + 1;
+
+        if (count > pixels - n)
+            return false;
+
+        if (packet & 0x80)
+        {
+            if (fread(data + n * size, size, 1, f) != 1)
+                return false;
+            for (size_t i = 1; i < count; i++)
+                memcpy(data + (n + i) * size, data + n * size, size);
+        }
+        else if (fread(data + n * size, size, count, f) != count)
+        {
+            return false;
+        }
+
+        n += count;
+    }
+
+    return true;
+}
+
+// Widens 16-bit pixels to BGRA8, replicating the top bits of each 5-bit
+// channel into the bottom ones. The top bit is alpha only if the
+// descriptor gives the image an alpha bit.
+static unsigned char * expand_targa_16(const unsigned char * data, size_t pixels, bool alpha)
+{
+    unsigned char * out = new unsigned char [pixels * 4];
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        unsigned int p = data[i * 2] | (data[i * 2 + 1] << 8);
+        unsigned int b = p & 0x1F;
+        unsigned int g = (p >> 5) & 0x1F;
+        unsigned int r = (p >> 10) & 0x1F;
+
+        out[i * 4 + 0] = (unsigned char)((b << 3) | (b >> 2));
+        out[i * 4 + 1] = (unsigned char)((g << 3) | (g >> 2));
+        out[i * 4 + 2] = (unsigned char)((r << 3) | (r >> 2));
+        out[i * 4 + 3] = (!alpha || (p & 0x8000)) ? 255 : 0;
+    }
+
+    return out;
+}
+
 unsigned char * load_targa(const char * filename, GLenum &format, int &width, int &height)
 {
     targa_header header;
@@ -112,29 +146,68 @@ unsigned char * load_targa(const char * filename, GLenum &format, int &width, in
     if (!f)
         return 0;
 
-    fread(&header, sizeof(header), 1, f);
-
-    width = header.image_spec.width;
-    height = header.image_spec.height;
-
     GLenum type;
     int size;
 
-    get_targa_format_type_and_size(header, format, type, size);
+    if (!read_targa_header(f, header) || !get_targa_format_type_and_size(header, format, type, size) ||
+        header.width == 0 || header.height == 0 || fseek(f, header.id_length, SEEK_CUR) != 0)
+    {
+        fclose(f);
+        return 0;
+    }
 
-    unsigned char * data = new unsigned char [width * height * size];
+    width = header.width;
+    height = header.height;
+
+    size_t pixels = (size_t)width * height;
+    unsigned char * data = new unsigned char [pixels * size];
+    bool ok;
 
     if (is_compressed_targa(header))
     {
-        // TODO: Handle compressed targa files
+        ok = read_targa_rle(f, data, pixels, size);
     }
     else
     {
-        fread(data, width * height, size, f);
+        ok = fread(data, size, pixels, f) == pixels;
     }
 
     fclose(f);
 
+    if (!ok)
+    {
+        delete [] data;
+        return 0;
+    }
+
+    if (header.bits_per_pixel == 16)
+    {
+        unsigned char * expanded = expand_targa_16(data, pixels, (header.descriptor & 0x0F) != 0);
+
+        delete [] data;
+        data = expanded;
+        size = 4;
+    }
+
+    // Bit 5 of the descriptor puts the first row at the top
+    if (header.descriptor & 0x20)
+    {
+        size_t pitch = (size_t)width * size;
+        unsigned char * row = new unsigned char [pitch];
+
+        for (int y = 0; y < height / 2; y++)
+        {
+            unsigned char * a = data + y * pitch;
+            unsigned char * b = data + (height - 1 - y) * pitch;
+
+            memcpy(row, a, pitch);
+            memcpy(a, b, pitch);
+            memcpy(b, row, pitch);
+        }
+
+        delete [] row;
+    }
+
     return data;
 }
 
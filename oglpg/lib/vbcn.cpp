@@ -0,0 +1,707 @@
+#include "vbcn.h"
+#include "vthread.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBCN_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Texels of one block as floats, a row of 16 per channel. Blocks at the
+// edge of an image are padded with copies of its last texels; those have a
+// count of 0, so that they don't add to the error a second time.
+struct vbcnBlock
+{
+    float c[4][16];
+    float count[16];
+};
+
+// Interpolation weights of BC7's 4-bit indices, out of 64
+static const int vbcnWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// For every texel, the index of the closest of count palette entries over
+// channels [first, first + channels). Returns the summed squared error,
+// exact as long as palette and texels hold whole numbers.
+static float vbcnFindClosest(const vbcnBlock & block, unsigned int first, unsigned int channels,
+                             const float (*palette)[4], unsigned int count, unsigned char * indices)
+{
+    float error = 0.0f;
+    unsigned int c, p;
+
+#ifdef VBCN_USE_SSE2
+    for (unsigned int t = 0; t < 16; t += 4)
+    {
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i best_index = _mm_setzero_si128();
+
+        for (p = 0; p < count; p++)
+        {
+            __m128 e = _mm_setzero_ps();
+
+            for (c = first; c < first + channels; c++)
+            {
+                __m128 d = _mm_sub_ps(_mm_loadu_ps(&block.c[c][t]), _mm_set1_ps(palette[p][c]));
+                e = _mm_add_ps(e, _mm_mul_ps(d, d));
+            }
+
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(e, best));
+            best = _mm_min_ps(e, best);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)p)),
+                                      _mm_andnot_si128(closer, best_index));
+        }
+
+        float e[4];
+        int i[4];
+
+        _mm_storeu_ps(e, _mm_mul_ps(best, _mm_loadu_ps(&block.count[t])));
+        _mm_storeu_si128((__m128i *)i, best_index);
+
+        for (c = 0; c < 4; c++)
+        {
+            indices[t + c] = (unsigned char)i[c];
+            error += e[c];
+        }
+    }
+#else
+    for (unsigned int t = 0; t < 16; t++)
+    {
+        float best = 1e30f;
+
+        for (p = 0; p < count; p++)
+        {
+            float e = 0.0f;
+
+            for (c = first; c < first + channels; c++)
+            {
+                float d = block.c[c][t] - palette[p][c];
+                e += d * d;
+            }
+
+            if (e < best)
+            {
+                best = e;
+                indices[t] = (unsigned char)p;
+            }
+        }
+
+        error += best * block.count[t];
+    }
+#endif
+
+    return error;
+}
+
+// Endpoints along the principal axis of the block's colors over channels
+// [0, channels): the extreme projections of the texels onto the axis
+// through their mean. e0 ends up at the larger end.
+static void vbcnPrincipalEndpoints(const vbcnBlock & block, unsigned int channels, float e0[4], float e1[4])
+{
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float cov[4][4];
+    float axis[4];
+    unsigned int c, d, t;
+
+    for (c = 0; c < channels; c++)
+    {
+        float lo = block.c[c][0];
+        float hi = lo;
+
+        for (t = 0; t < 16; t++)
+        {
+            mean[c] += block.c[c][t];
+            lo = block.c[c][t] < lo ? block.c[c][t] : lo;
+            hi = block.c[c][t] > hi ? block.c[c][t] : hi;
+        }
+
+        mean[c] /= 16.0f;
+        axis[c] = hi - lo;
+    }
+
+    for (c = 0; c < channels; c++)
+    {
+        for (d = c; d < channels; d++)
+        {
+            float s = 0.0f;
+
+            for (t = 0; t < 16; t++)
+                s += (block.c[c][t] - mean[c]) * (block.c[d][t] - mean[d]);
+
+            cov[c][d] = cov[d][c] = s;
+        }
+    }
+
+    // Power iteration from the extent of the block, which is already close
+    for (unsigned int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4];
+        float length = 0.0f;
+
+        for (c = 0; c < channels; c++)
+        {
+            next[c] = 0.0f;
+            for (d = 0; d < channels; d++)
+                next[c] += cov[c][d] * axis[d];
+            length = fabsf(next[c]) > length ? fabsf(next[c]) : length;
+        }
+
+        if (length == 0.0f)
+            break;
+
+        for (c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float length = 0.0f;
+
+    for (c = 0; c < channels; c++)
+        length += axis[c] * axis[c];
+
+    float lo = 0.0f;
+    float hi = 0.0f;
+
+    if (length > 0.0f)
+    {
+        for (c = 0; c < channels; c++)
+            axis[c] /= sqrtf(length);
+
+        for (t = 0; t < 16; t++)
+        {
+            float s = 0.0f;
+
+            for (c = 0; c < channels; c++)
+                s += (block.c[c][t] - mean[c]) * axis[c];
+
+            lo = s < lo ? s : lo;
+            hi = s > hi ? s : hi;
+        }
+    }
+
+    for (c = 0; c < channels; c++)
+    {
+        e0[c] = mean[c] + axis[c] * hi;
+        e1[c] = mean[c] + axis[c] * lo;
+    }
+}
+
+// Least squares endpoints for fixed indices, whose weight of e0 is weight[].
+// Returns false if every texel has the same weight.
+static bool vbcnFitEndpoints(const vbcnBlock & block, unsigned int channels, const float * weight,
+                             const unsigned char * indices, float e0[4], float e1[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ap[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float bp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    unsigned int c, t;
+
+    for (t = 0; t < 16; t++)
+    {
+        float a = weight[indices[t]];
+        float b = 1.0f - a;
+
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+
+        for (c = 0; c < channels; c++)
+        {
+            ap[c] += a * block.c[c][t];
+            bp[c] += b * block.c[c][t];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+
+    if (fabsf(det) < 1e-6f)
+        return false;
+
+    for (c = 0; c < channels; c++)
+    {
+        e0[c] = (bb * ap[c] - ab * bp[c]) / det;
+        e1[c] = (aa * bp[c] - ab * ap[c]) / det;
+    }
+
+    return true;
+}
+
+static int vbcnClamp(float x, int hi)
+{
+    int i = (int)floorf(x + 0.5f);
+    return i < 0 ? 0 : (i > hi ? hi : i);
+}
+
+static unsigned int vbcnPack565(const float e[4])
+{
+    return (vbcnClamp(e[0] * 31.0f / 255.0f, 31) << 11) |
+           (vbcnClamp(e[1] * 63.0f / 255.0f, 63) << 5) |
+            vbcnClamp(e[2] * 31.0f / 255.0f, 31);
+}
+
+static void vbcnUnpack565(unsigned int c, float out[4])
+{
+    unsigned int r = (c >> 11) & 31;
+    unsigned int g = (c >> 5) & 63;
+    unsigned int b = c & 31;
+
+    out[0] = (float)((r << 3) | (r >> 2));
+    out[1] = (float)((g << 2) | (g >> 4));
+    out[2] = (float)((b << 3) | (b >> 2));
+    out[3] = 255.0f;
+}
+
+// Four-color BC1 palette of c0 > c1, as a decoder builds it
+static void vbcnPaletteBC1(unsigned int c0, unsigned int c1, float palette[4][4])
+{
+    vbcnUnpack565(c0, palette[0]);
+    vbcnUnpack565(c1, palette[1]);
+
+    for (unsigned int c = 0; c < 4; c++)
+    {
+        int a = (int)palette[0][c];
+        int b = (int)palette[1][c];
+
+        palette[2][c] = (float)((2 * a + b + 1) / 3);
+        palette[3][c] = (float)((a + 2 * b + 1) / 3);
+    }
+}
+
+// The color half of BC1 and BC3: always four colors, so alpha is ignored
+static float vbcnEncodeColor(const vbcnBlock & block, unsigned char * out)
+{
+    // Weight of color0 for each index
+    static const float weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    float e0[4], e1[4];
+    float palette[4][4];
+    unsigned char indices[16];
+    unsigned char best_indices[16];
+    unsigned int best_c0 = 0, best_c1 = 0;
+    float best = 1e30f;
+
+    vbcnPrincipalEndpoints(block, 3, e0, e1);
+
+    for (unsigned int iteration = 0; iteration < 3; iteration++)
+    {
+        unsigned int c0 = vbcnPack565(e0);
+        unsigned int c1 = vbcnPack565(e1);
+        float error;
+
+        if (c0 < c1)
+        {
+            unsigned int c = c0;
+            c0 = c1;
+            c1 = c;
+        }
+
+        if (c0 == c1)
+        {
+            // Equal endpoints would mean three colors and black; index 0
+            // is the only color there is anyway
+            vbcnUnpack565(c0, palette[0]);
+            error = vbcnFindClosest(block, 0, 3, palette, 1, indices);
+        }
+        else
+        {
+            vbcnPaletteBC1(c0, c1, palette);
+            error = vbcnFindClosest(block, 0, 3, palette, 4, indices);
+        }
+
+        if (error < best)
+        {
+            best = error;
+            best_c0 = c0;
+            best_c1 = c1;
+            memcpy(best_indices, indices, 16);
+        }
+
+        if (error == 0.0f || c0 == c1 || !vbcnFitEndpoints(block, 3, weight, indices, e0, e1))
+            break;
+    }
+
+    out[0] = (unsigned char)(best_c0 & 0xFF);
+    out[1] = (unsigned char)(best_c0 >> 8);
+    out[2] = (unsigned char)(best_c1 & 0xFF);
+    out[3] = (unsigned char)(best_c1 >> 8);
+
+    for (unsigned int row = 0; row < 4; row++)
+    {
+        const unsigned char * i = best_indices + row * 4;
+        out[4 + row] = (unsigned char)(i[0] | (i[1] << 2) | (i[2] << 4) | (i[3] << 6));
+    }
+
+    return best;
+}
+
+// BC4 palette as a decoder builds it: eight values if a0 > a1, otherwise
+// six plus 0 and 255
+static void vbcnPaletteBC4(unsigned int channel, int a0, int a1, float palette[8][4])
+{
+    palette[0][channel] = (float)a0;
+    palette[1][channel] = (float)a1;
+
+    if (a0 > a1)
+    {
+        for (int i = 2; i < 8; i++)
+            palette[i][channel] = (float)(((8 - i) * a0 + (i - 1) * a1 + 3) / 7);
+    }
+    else
+    {
+        for (int i = 2; i < 6; i++)
+            palette[i][channel] = (float)(((6 - i) * a0 + (i - 1) * a1 + 2) / 5);
+        palette[6][channel] = 0.0f;
+        palette[7][channel] = 255.0f;
+    }
+}
+
+// One channel into a BC4 block. Blocks with texels at 0 or 255, like the
+// edges of masks, also try the six-value mode, which has those two exactly.
+static float vbcnEncodeChannel(const vbcnBlock & block, unsigned int channel, unsigned char * out)
+{
+    const float * v = block.c[channel];
+    int lo = 255, hi = 0;
+    int inner_lo = 255, inner_hi = 0;
+    bool extremes = false;
+    unsigned int t;
+
+    for (t = 0; t < 16; t++)
+    {
+        int x = (int)v[t];
+
+        lo = x < lo ? x : lo;
+        hi = x > hi ? x : hi;
+
+        if (x == 0 || x == 255)
+        {
+            extremes = true;
+            continue;
+        }
+
+        inner_lo = x < inner_lo ? x : inner_lo;
+        inner_hi = x > inner_hi ? x : inner_hi;
+    }
+
+    float palette[8][4];
+    unsigned char indices[16];
+    unsigned char best_indices[16];
+    int a0 = hi, a1 = lo;
+    float best;
+
+    // Equal values take the six-value mode, where index 0 is still a0
+    vbcnPaletteBC4(channel, a0, a1, palette);
+    best = vbcnFindClosest(block, channel, 1, palette, 8, best_indices);
+
+    if (extremes && best > 0.0f)
+    {
+        if (inner_lo > inner_hi)
+            inner_lo = inner_hi = lo;
+
+        vbcnPaletteBC4(channel, inner_lo, inner_hi, palette);
+        float error = vbcnFindClosest(block, channel, 1, palette, 8, indices);
+
+        if (error < best)
+        {
+            best = error;
+            a0 = inner_lo;
+            a1 = inner_hi;
+            memcpy(best_indices, indices, 16);
+        }
+    }
+
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+
+    for (unsigned int half = 0; half < 2; half++)
+    {
+        unsigned int bits = 0;
+
+        for (t = 0; t < 8; t++)
+            bits |= (unsigned int)best_indices[half * 8 + t] << (t * 3);
+
+        out[2 + half * 3] = (unsigned char)(bits & 0xFF);
+        out[3 + half * 3] = (unsigned char)((bits >> 8) & 0xFF);
+        out[4 + half * 3] = (unsigned char)((bits >> 16) & 0xFF);
+    }
+
+    return best;
+}
+
+// BC2's alpha half: 4 bits per texel, stored outright
+static float vbcnEncodeAlpha4(const vbcnBlock & block, unsigned char * out)
+{
+    float error = 0.0f;
+
+    memset(out, 0, 8);
+
+    for (unsigned int t = 0; t < 16; t++)
+    {
+        int q = vbcnClamp(block.c[3][t] * 15.0f / 255.0f, 15);
+        float d = (float)(q * 17) - block.c[3][t];
+
+        error += d * d * block.count[t];
+        out[t >> 1] |= (unsigned char)(q << ((t & 1) * 4));
+    }
+
+    return error;
+}
+
+// An endpoint as BC7 mode 6 stores it: 7 bits per channel and a p-bit
+// shared by the four, whichever of the two p-bits lands closer
+static void vbcnQuantizeMode6(const float e[4], int q[4], int & p)
+{
+    float best = 1e30f;
+
+    for (int bit = 0; bit < 2; bit++)
+    {
+        int candidate[4];
+        float error = 0.0f;
+
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            candidate[c] = vbcnClamp((e[c] - bit) * 0.5f, 127);
+            float d = (float)(candidate[c] * 2 + bit) - e[c];
+            error += d * d;
+        }
+
+        if (error < best)
+        {
+            best = error;
+            p = bit;
+            memcpy(q, candidate, sizeof(candidate));
+        }
+    }
+}
+
+// Little-endian bit stream into a 16-byte block
+struct vbcnBitWriter
+{
+    unsigned char * out;
+    unsigned int position;
+
+    void Write(unsigned int value, unsigned int bits)
+    {
+        for (unsigned int i = 0; i < bits; i++, position++)
+        {
+            if (value & (1u << i))
+                out[position >> 3] |= (unsigned char)(1u << (position & 7));
+        }
+    }
+};
+
+static float vbcnEncodeBC7(const vbcnBlock & block, unsigned char * out)
+{
+    float weight[16];
+    float e0[4], e1[4];
+    float palette[16][4];
+    unsigned char indices[16];
+    unsigned char best_indices[16];
+    int best_q[2][4] = { { 0 } };
+    int best_p[2] = { 0, 0 };
+    float best = 1e30f;
+    unsigned int c, i;
+
+    for (i = 0; i < 16; i++)
+        weight[i] = 1.0f - vbcnWeights4[i] / 64.0f;
+
+    vbcnPrincipalEndpoints(block, 4, e0, e1);
+
+    for (unsigned int iteration = 0; iteration < 3; iteration++)
+    {
+        int q[2][4];
+        int p[2];
+
+        vbcnQuantizeMode6(e0, q[0], p[0]);
+        vbcnQuantizeMode6(e1, q[1], p[1]);
+
+        for (i = 0; i < 16; i++)
+        {
+            for (c = 0; c < 4; c++)
+            {
+                int a = q[0][c] * 2 + p[0];
+                int b = q[1][c] * 2 + p[1];
+                palette[i][c] = (float)(((64 - vbcnWeights4[i]) * a + vbcnWeights4[i] * b + 32) >> 6);
+            }
+        }
+
+        float error = vbcnFindClosest(block, 0, 4, palette, 16, indices);
+
+        if (error < best)
+        {
+            best = error;
+            memcpy(best_q, q, sizeof(q));
+            memcpy(best_p, p, sizeof(p));
+            memcpy(best_indices, indices, 16);
+        }
+
+        if (error == 0.0f || !vbcnFitEndpoints(block, 4, weight, indices, e0, e1))
+            break;
+    }
+
+    // The first texel's index has its top bit implied 0; the palette is
+    // symmetric, so swapping the endpoints and mirroring the indices gets
+    // it there
+    if (best_indices[0] >= 8)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            int x = best_q[0][c];
+            best_q[0][c] = best_q[1][c];
+            best_q[1][c] = x;
+        }
+
+        int x = best_p[0];
+        best_p[0] = best_p[1];
+        best_p[1] = x;
+
+        for (i = 0; i < 16; i++)
+            best_indices[i] = (unsigned char)(15 - best_indices[i]);
+    }
+
+    vbcnBitWriter writer = { out, 0 };
+
+    memset(out, 0, 16);
+    writer.Write(1u << 6, 7);
+
+    for (c = 0; c < 4; c++)
+    {
+        writer.Write((unsigned int)best_q[0][c], 7);
+        writer.Write((unsigned int)best_q[1][c], 7);
+    }
+
+    writer.Write((unsigned int)best_p[0], 1);
+    writer.Write((unsigned int)best_p[1], 1);
+    writer.Write(best_indices[0], 3);
+
+    for (i = 1; i < 16; i++)
+        writer.Write(best_indices[i], 4);
+
+    return best;
+}
+
+unsigned int VBCnCodec::GetBlockSize(Format format)
+{
+    return (format == BC1 || format == BC4) ? 8 : 16;
+}
+
+size_t VBCnCodec::GetImageSize(Format format, unsigned int width, unsigned int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+unsigned int VBCnCodec::GetChannelCount(Format format)
+{
+    switch (format)
+    {
+        case BC1:
+            return 3;
+        case BC4:
+            return 1;
+        case BC5:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+static double vbcnEncode(VBCnCodec::Format format, const vbcnBlock & b, unsigned char * block)
+{
+    switch (format)
+    {
+        case VBCnCodec::BC1:
+            return vbcnEncodeColor(b, block);
+        case VBCnCodec::BC2:
+            return (double)vbcnEncodeAlpha4(b, block) + vbcnEncodeColor(b, block + 8);
+        case VBCnCodec::BC3:
+            return (double)vbcnEncodeChannel(b, 3, block) + vbcnEncodeColor(b, block + 8);
+        case VBCnCodec::BC4:
+            return vbcnEncodeChannel(b, 0, block);
+        case VBCnCodec::BC5:
+            return (double)vbcnEncodeChannel(b, 0, block) + vbcnEncodeChannel(b, 1, block + 8);
+        case VBCnCodec::BC7:
+            return vbcnEncodeBC7(b, block);
+        default:
+            break;
+    }
+
+    return 0.0;
+}
+
+double VBCnCodec::EncodeBlock(Format format, const unsigned char texels[64], unsigned char * block)
+{
+    vbcnBlock b;
+
+    for (unsigned int t = 0; t < 16; t++)
+    {
+        for (unsigned int c = 0; c < 4; c++)
+            b.c[c][t] = (float)texels[t * 4 + c];
+        b.count[t] = 1.0f;
+    }
+
+    return vbcnEncode(format, b, block);
+}
+
+double VBCnCodec::Encode(Format format, const unsigned char * rgba, unsigned int width, unsigned int height,
+                         unsigned char * blocks, VThreadPool * pool)
+{
+    unsigned int block_width = (width + 3) / 4;
+    unsigned int block_height = (height + 3) / 4;
+    unsigned int block_size = GetBlockSize(format);
+    std::vector<double> row_error(block_height);
+
+    std::function<void (unsigned int, unsigned int)> encode_rows = [&](unsigned int begin, unsigned int end)
+    {
+        vbcnBlock b;
+
+        for (unsigned int by = begin; by < end; by++)
+        {
+            unsigned char * out = blocks + (size_t)by * block_width * block_size;
+            double error = 0.0;
+
+            for (unsigned int bx = 0; bx < block_width; bx++, out += block_size)
+            {
+                for (unsigned int y = 0; y < 4; y++)
+                {
+                    unsigned int sy = by * 4 + y < height ? by * 4 + y : height - 1;
+
+                    for (unsigned int x = 0; x < 4; x++)
+                    {
+                        unsigned int sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+                        const unsigned char * texel = rgba + ((size_t)sy * width + sx) * 4;
+                        unsigned int t = y * 4 + x;
+
+                        for (unsigned int c = 0; c < 4; c++)
+                            b.c[c][t] = (float)texel[c];
+                        b.count[t] = (sx == bx * 4 + x && sy == by * 4 + y) ? 1.0f : 0.0f;
+                    }
+                }
+
+                error += vbcnEncode(format, b, out);
+            }
+
+            row_error[by] = error;
+        }
+    };
+
+    if (pool != NULL)
+        pool->ParallelFor(block_height, 1, encode_rows);
+    else
+        encode_rows(0, block_height);
+
+    double error = 0.0;
+
+    for (unsigned int by = 0; by < block_height; by++)
+        error += row_error[by];
+
+    return error;
+}
+
+const char * VBCnCodec::GetPath(void)
+{
+#ifdef VBCN_USE_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
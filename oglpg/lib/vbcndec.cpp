@@ -0,0 +1,692 @@
+#include "vbcn.h"
+#include "vthread.h"
+#include "vermilion.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBCN_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Texels are decoded as 32-bit words with red in the lowest byte, which is
+// RGBA8 in memory on the little-endian machines this runs on
+
+static inline unsigned int vbcnTexel(unsigned int r, unsigned int g, unsigned int b, unsigned int a)
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+// Writes each of 16 texels, rows pitch texels apart, as the palette entry
+// its index picks, or ORs that in if combine is set. Indices are bits wide,
+// packed from texel 0 up. This stays a table lookup even with SSE2:
+// comparing four indices at a time against every entry came out slower for
+// palettes of four and eight.
+static void vbcnSelect(unsigned long long indices, unsigned int bits, const unsigned int * palette,
+                       unsigned int * texels, unsigned int pitch, bool combine)
+{
+    unsigned int mask = (1u << bits) - 1;
+
+    for (unsigned int y = 0; y < 4; y++, texels += pitch)
+    {
+        if (combine)
+        {
+            for (unsigned int x = 0; x < 4; x++, indices >>= bits)
+                texels[x] |= palette[indices & mask];
+        }
+        else
+        {
+            for (unsigned int x = 0; x < 4; x++, indices >>= bits)
+                texels[x] = palette[indices & mask];
+        }
+    }
+}
+
+static unsigned long long vbcnLoad64(const unsigned char * p)
+{
+    unsigned long long x = 0;
+
+    for (unsigned int i = 0; i < 8; i++)
+        x |= (unsigned long long)p[i] << (i * 8);
+
+    return x;
+}
+
+// The color half of BC1, BC2 and BC3. Only BC1 has the three-color mode,
+// for c0 <= c1, with transparent black as the fourth; the others always
+// have four colors, and leave alpha 0 for their own half to fill in.
+static void vbcnDecodeColor(const unsigned char * block, bool bc1, unsigned int * texels, unsigned int pitch)
+{
+    unsigned int c0 = block[0] | (block[1] << 8);
+    unsigned int c1 = block[2] | (block[3] << 8);
+    unsigned int alpha = bc1 ? 255 : 0;
+    unsigned int palette[4];
+    unsigned int e[2][3];
+
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        unsigned int c = i ? c1 : c0;
+        unsigned int r = (c >> 11) & 31;
+        unsigned int g = (c >> 5) & 63;
+        unsigned int b = c & 31;
+
+        e[i][0] = (r << 3) | (r >> 2);
+        e[i][1] = (g << 2) | (g >> 4);
+        e[i][2] = (b << 3) | (b >> 2);
+    }
+
+    palette[0] = vbcnTexel(e[0][0], e[0][1], e[0][2], alpha);
+    palette[1] = vbcnTexel(e[1][0], e[1][1], e[1][2], alpha);
+
+    if (c0 > c1 || !bc1)
+    {
+        palette[2] = vbcnTexel((2 * e[0][0] + e[1][0] + 1) / 3, (2 * e[0][1] + e[1][1] + 1) / 3,
+                               (2 * e[0][2] + e[1][2] + 1) / 3, alpha);
+        palette[3] = vbcnTexel((e[0][0] + 2 * e[1][0] + 1) / 3, (e[0][1] + 2 * e[1][1] + 1) / 3,
+                               (e[0][2] + 2 * e[1][2] + 1) / 3, alpha);
+    }
+    else
+    {
+        palette[2] = vbcnTexel((e[0][0] + e[1][0] + 1) / 2, (e[0][1] + e[1][1] + 1) / 2,
+                               (e[0][2] + e[1][2] + 1) / 2, alpha);
+        palette[3] = 0;
+    }
+
+    vbcnSelect(vbcnLoad64(block) >> 32, 2, palette, texels, pitch, false);
+}
+
+// A BC4 block into the byte of each texel at shift. The first channel
+// written sets the rest of the texel to base; later ones are ORed in.
+static void vbcnDecodeChannel(const unsigned char * block, unsigned int shift, unsigned int base, bool combine,
+                              unsigned int * texels, unsigned int pitch)
+{
+    unsigned int a0 = block[0];
+    unsigned int a1 = block[1];
+    unsigned int palette[8];
+    unsigned int i;
+
+    palette[0] = a0;
+    palette[1] = a1;
+
+    if (a0 > a1)
+    {
+        for (i = 2; i < 8; i++)
+            palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+    }
+    else
+    {
+        for (i = 2; i < 6; i++)
+            palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    for (i = 0; i < 8; i++)
+        palette[i] = (palette[i] << shift) | base;
+
+    vbcnSelect(vbcnLoad64(block) >> 16, 3, palette, texels, pitch, combine);
+}
+
+// BC2's alpha half, 4 bits a texel, ORed into the color
+static void vbcnDecodeAlpha4(const unsigned char * block, unsigned int * texels, unsigned int pitch)
+{
+    static const unsigned int palette[16] =
+    {
+        0x00000000, 0x11000000, 0x22000000, 0x33000000, 0x44000000, 0x55000000, 0x66000000, 0x77000000,
+        0x88000000, 0x99000000, 0xAA000000, 0xBB000000, 0xCC000000, 0xDD000000, 0xEE000000, 0xFF000000
+    };
+
+    vbcnSelect(vbcnLoad64(block), 4, palette, texels, pitch, true);
+}
+
+// BC7 block layouts, by mode
+struct vbcnModeBC7
+{
+    unsigned int subsets;
+    unsigned int partition_bits;
+    unsigned int rotation_bits;
+    unsigned int selector_bits;
+    unsigned int color_bits;
+    unsigned int alpha_bits;
+    unsigned int endpoint_pbits;            // A p-bit per endpoint
+    unsigned int shared_pbits;              // A p-bit per subset
+    unsigned int index_bits;
+    unsigned int index_bits2;               // Separate alpha indices, if any
+};
+
+static const vbcnModeBC7 vbcnModesBC7[8] =
+{
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+// Two-subset partitions: bit t set puts texel t in subset 1
+static const unsigned short vbcnPartitions2[64] =
+{
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+    0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+    0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+    0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+    0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+    0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+    0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+};
+
+static const unsigned char vbcnPartitions3[64][16] =
+{
+    { 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 1, 2, 2, 2, 2 }, { 0, 0, 0, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 2, 0, 0, 1, 2, 2, 1, 1, 2, 2, 1, 1 }, { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 1, 0, 1, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2 }, { 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1 }, { 0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 }, { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2 },
+    { 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2, 0, 1, 1, 2 }, { 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2, 0, 1, 2, 2 },
+    { 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2, 1, 2, 2, 2 }, { 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0, 2, 2, 2, 0 },
+    { 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 1, 2, 1, 1, 2, 2 }, { 0, 1, 1, 1, 0, 0, 1, 1, 2, 0, 0, 1, 2, 2, 0, 0 },
+    { 0, 0, 0, 0, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2 }, { 0, 0, 2, 2, 0, 0, 2, 2, 0, 0, 2, 2, 1, 1, 1, 1 },
+    { 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2, 0, 2, 2, 2 }, { 0, 0, 0, 1, 0, 0, 0, 1, 2, 2, 2, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2 }, { 0, 0, 0, 0, 1, 1, 0, 0, 2, 2, 1, 0, 2, 2, 1, 0 },
+    { 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1, 0, 0, 0, 0 }, { 0, 0, 1, 2, 0, 0, 1, 2, 1, 1, 2, 2, 2, 2, 2, 2 },
+    { 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1, 0, 1, 1, 0 }, { 0, 0, 0, 0, 0, 1, 1, 0, 1, 2, 2, 1, 1, 2, 2, 1 },
+    { 0, 0, 2, 2, 1, 1, 0, 2, 1, 1, 0, 2, 0, 0, 2, 2 }, { 0, 1, 1, 0, 0, 1, 1, 0, 2, 0, 0, 2, 2, 2, 2, 2 },
+    { 0, 0, 1, 1, 0, 1, 2, 2, 0, 1, 2, 2, 0, 0, 1, 1 }, { 0, 0, 0, 0, 2, 0, 0, 0, 2, 2, 1, 1, 2, 2, 2, 1 },
+    { 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 2, 2, 2 }, { 0, 2, 2, 2, 0, 0, 2, 2, 0, 0, 1, 2, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 0, 0, 1, 2, 0, 0, 2, 2, 0, 2, 2, 2 }, { 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 2, 0 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0 }, { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+    { 0, 1, 2, 0, 2, 0, 1, 2, 1, 2, 0, 1, 0, 1, 2, 0 }, { 0, 0, 1, 1, 2, 2, 0, 0, 1, 1, 2, 2, 0, 0, 1, 1 },
+    { 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 0, 0, 0, 0, 1, 1 }, { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1 }, { 0, 0, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2, 1, 1, 2, 2 },
+    { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 2, 2, 0, 0, 1, 1 }, { 0, 2, 2, 0, 1, 2, 2, 1, 0, 2, 2, 0, 1, 2, 2, 1 },
+    { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 0, 1, 0, 1 }, { 0, 0, 0, 0, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1, 2, 1 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 }, { 0, 2, 2, 2, 0, 1, 1, 1, 0, 2, 2, 2, 0, 1, 1, 1 },
+    { 0, 0, 0, 2, 1, 1, 1, 2, 0, 0, 0, 2, 1, 1, 1, 2 }, { 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2, 2, 1, 1, 2 },
+    { 0, 2, 2, 2, 0, 1, 1, 1, 0, 1, 1, 1, 0, 2, 2, 2 }, { 0, 0, 0, 2, 1, 1, 1, 2, 1, 1, 1, 2, 0, 0, 0, 2 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2 }, { 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2, 2, 1, 1, 2 },
+    { 0, 1, 1, 0, 0, 1, 1, 0, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 0, 2, 2, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 2, 2 },
+    { 0, 0, 2, 2, 1, 1, 2, 2, 1, 1, 2, 2, 0, 0, 2, 2 }, { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 1, 1, 2 },
+    { 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1 }, { 0, 2, 2, 2, 1, 2, 2, 2, 0, 2, 2, 2, 1, 2, 2, 2 },
+    { 0, 1, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 }, { 0, 1, 1, 1, 2, 0, 1, 1, 2, 2, 0, 1, 2, 2, 2, 0 }
+};
+
+// Texels whose index has its top bit implied 0, besides texel 0: subset 1's
+// for two subsets, and subsets 1 and 2's for three
+static const unsigned char vbcnAnchors2[64] =
+{
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+static const unsigned char vbcnAnchors3a[64] =
+{
+     3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+     3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+     8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+     3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+};
+
+static const unsigned char vbcnAnchors3b[64] =
+{
+    15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+    15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+    15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+    15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+};
+
+// Interpolation weights out of 64, by index size
+static const int vbcnWeights2[4] = { 0, 21, 43, 64 };
+static const int vbcnWeights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int vbcnWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static const int * vbcnWeightsBC7(unsigned int bits)
+{
+    return bits == 2 ? vbcnWeights2 : (bits == 3 ? vbcnWeights3 : vbcnWeights4);
+}
+
+// Little-endian bit stream out of a 16-byte block
+struct vbcnBitReader
+{
+    unsigned long long lo;
+    unsigned long long hi;
+
+    unsigned int Read(unsigned int bits)
+    {
+        if (bits == 0)
+            return 0;
+
+        unsigned int value = (unsigned int)(lo & ((1ull << bits) - 1));
+
+        lo = (lo >> bits) | (hi << (64 - bits));
+        hi >>= bits;
+
+        return value;
+    }
+};
+
+// The 2^bits entries between two RGBA endpoints, two at a time with SSE2
+static void vbcnInterpolateBC7(const unsigned int e0[4], const unsigned int e1[4], unsigned int bits, unsigned int * palette)
+{
+    const int * weights = vbcnWeightsBC7(bits);
+    unsigned int count = 1u << bits;
+
+#ifdef VBCN_USE_SSE2
+    __m128i a = _mm_set_epi16((short)e0[3], (short)e0[2], (short)e0[1], (short)e0[0],
+                              (short)e0[3], (short)e0[2], (short)e0[1], (short)e0[0]);
+    __m128i b = _mm_set_epi16((short)e1[3], (short)e1[2], (short)e1[1], (short)e1[0],
+                              (short)e1[3], (short)e1[2], (short)e1[1], (short)e1[0]);
+    __m128i full = _mm_set1_epi16(64);
+    __m128i round = _mm_set1_epi16(32);
+
+    for (unsigned int i = 0; i < count; i += 4)
+    {
+        __m128i entries[2];
+
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            short w0 = (short)weights[i + j * 2];
+            short w1 = (short)weights[i + j * 2 + 1];
+            __m128i w = _mm_set_epi16(w1, w1, w1, w1, w0, w0, w0, w0);
+            __m128i sum = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(full, w), a), _mm_mullo_epi16(w, b));
+
+            entries[j] = _mm_srli_epi16(_mm_add_epi16(sum, round), 6);
+        }
+
+        _mm_storeu_si128((__m128i *)(palette + i), _mm_packus_epi16(entries[0], entries[1]));
+    }
+#else
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned int w = (unsigned int)weights[i];
+        unsigned int c[4];
+
+        for (unsigned int k = 0; k < 4; k++)
+            c[k] = ((64 - w) * e0[k] + w * e1[k] + 32) >> 6;
+
+        palette[i] = vbcnTexel(c[0], c[1], c[2], c[3]);
+    }
+#endif
+}
+
+static void vbcnDecodeBC7(const unsigned char * block, unsigned int * out, unsigned int pitch)
+{
+    unsigned int texels[16];
+    unsigned int mode = 0;
+    unsigned int i, c, s, t;
+
+    while (mode < 8 && !(block[0] & (1u << mode)))
+        mode++;
+
+    // Reserved mode: a GPU samples 0 everywhere
+    if (mode == 8)
+    {
+        for (t = 0; t < 4; t++)
+            memset(out + t * pitch, 0, 16);
+        return;
+    }
+
+    const vbcnModeBC7 & m = vbcnModesBC7[mode];
+    vbcnBitReader reader = { vbcnLoad64(block), vbcnLoad64(block + 8) };
+
+    reader.Read(mode + 1);
+
+    unsigned int partition = reader.Read(m.partition_bits);
+    unsigned int rotation = reader.Read(m.rotation_bits);
+    unsigned int selector = reader.Read(m.selector_bits);
+    unsigned int endpoints = m.subsets * 2;
+    unsigned int e[6][4];
+
+    for (c = 0; c < 3; c++)
+    {
+        for (i = 0; i < endpoints; i++)
+            e[i][c] = reader.Read(m.color_bits);
+    }
+
+    for (i = 0; i < endpoints; i++)
+        e[i][3] = reader.Read(m.alpha_bits);
+
+    // Stored bits, p-bit included, then replicated up to 8
+    unsigned int color_bits = m.color_bits + (m.endpoint_pbits | m.shared_pbits);
+    unsigned int alpha_bits = m.alpha_bits ? m.alpha_bits + (m.endpoint_pbits | m.shared_pbits) : 0;
+
+    if (m.endpoint_pbits || m.shared_pbits)
+    {
+        unsigned int pbit = 0;
+
+        for (i = 0; i < endpoints; i++)
+        {
+            if (m.endpoint_pbits || (i & 1) == 0)
+                pbit = reader.Read(1);
+
+            for (c = 0; c < 4; c++)
+                e[i][c] = (e[i][c] << 1) | pbit;
+        }
+    }
+
+    for (i = 0; i < endpoints; i++)
+    {
+        for (c = 0; c < 3; c++)
+            e[i][c] = (e[i][c] << (8 - color_bits)) | (e[i][c] >> (2 * color_bits - 8));
+
+        e[i][3] = alpha_bits ? (e[i][3] << (8 - alpha_bits)) | (e[i][3] >> (2 * alpha_bits - 8)) : 255;
+    }
+
+    unsigned char subset[16];
+    unsigned char index[16];
+    unsigned char index2[16];
+
+    for (t = 0; t < 16; t++)
+    {
+        if (m.subsets == 2)
+            subset[t] = (unsigned char)((vbcnPartitions2[partition] >> t) & 1);
+        else if (m.subsets == 3)
+            subset[t] = vbcnPartitions3[partition][t];
+        else
+            subset[t] = 0;
+    }
+
+    for (t = 0; t < 16; t++)
+    {
+        bool anchor = t == 0 ||
+                      (m.subsets == 2 && t == vbcnAnchors2[partition]) ||
+                      (m.subsets == 3 && (t == vbcnAnchors3a[partition] || t == vbcnAnchors3b[partition]));
+
+        index[t] = (unsigned char)reader.Read(m.index_bits - (anchor ? 1 : 0));
+    }
+
+    for (t = 0; t < 16 && m.index_bits2; t++)
+        index2[t] = (unsigned char)reader.Read(m.index_bits2 - (t == 0 ? 1 : 0));
+
+    unsigned int palette[3][16];
+
+    if (m.index_bits2 == 0)
+    {
+        for (s = 0; s < m.subsets; s++)
+            vbcnInterpolateBC7(e[s * 2], e[s * 2 + 1], m.index_bits, palette[s]);
+
+        for (t = 0; t < 16; t++)
+            texels[t] = palette[subset[t]][index[t]];
+    }
+    else
+    {
+        // Color and alpha from separate indices, the selector swapping
+        // which takes the wider ones
+        const unsigned char * color_index = selector ? index2 : index;
+        const unsigned char * alpha_index = selector ? index : index2;
+
+        vbcnInterpolateBC7(e[0], e[1], selector ? m.index_bits2 : m.index_bits, palette[0]);
+        vbcnInterpolateBC7(e[0], e[1], selector ? m.index_bits : m.index_bits2, palette[1]);
+
+        for (t = 0; t < 16; t++)
+            texels[t] = (palette[0][color_index[t]] & 0x00FFFFFF) | (palette[1][alpha_index[t]] & 0xFF000000);
+    }
+
+    // Rotation swaps alpha with red, green or blue
+    if (rotation != 0)
+    {
+        unsigned int shift = (rotation - 1) * 8;
+
+        for (t = 0; t < 16; t++)
+        {
+            unsigned int x = texels[t];
+            unsigned int a = x >> 24;
+            unsigned int other = (x >> shift) & 0xFF;
+
+            x &= ~((0xFFu << shift) | 0xFF000000u);
+            texels[t] = x | (a << shift) | (other << 24);
+        }
+    }
+
+    for (t = 0; t < 4; t++)
+        memcpy(out + t * pitch, texels + t * 4, 16);
+}
+
+// One block into four rows of texels, pitch texels apart
+static void vbcnDecode(VBCnCodec::Format format, const unsigned char * block, unsigned int * texels, unsigned int pitch)
+{
+    switch (format)
+    {
+        case VBCnCodec::BC1:
+            vbcnDecodeColor(block, true, texels, pitch);
+            break;
+        case VBCnCodec::BC2:
+            vbcnDecodeColor(block + 8, false, texels, pitch);
+            vbcnDecodeAlpha4(block, texels, pitch);
+            break;
+        case VBCnCodec::BC3:
+            vbcnDecodeColor(block + 8, false, texels, pitch);
+            vbcnDecodeChannel(block, 24, 0, true, texels, pitch);
+            break;
+        case VBCnCodec::BC4:
+            vbcnDecodeChannel(block, 0, 0xFF000000, false, texels, pitch);
+            break;
+        case VBCnCodec::BC5:
+            vbcnDecodeChannel(block, 0, 0xFF000000, false, texels, pitch);
+            vbcnDecodeChannel(block + 8, 8, 0, true, texels, pitch);
+            break;
+        case VBCnCodec::BC7:
+            vbcnDecodeBC7(block, texels, pitch);
+            break;
+        default:
+            for (unsigned int y = 0; y < 4; y++)
+                memset(texels + y * pitch, 0, 16);
+            break;
+    }
+}
+
+// Block rows [begin, end) of an image
+static void vbcnDecodeRows(VBCnCodec::Format format, const unsigned char * blocks, unsigned int width, unsigned int height,
+                           unsigned char * rgba, unsigned int begin, unsigned int end)
+{
+    unsigned int block_width = (width + 3) / 4;
+    unsigned int block_size = VBCnCodec::GetBlockSize(format);
+    unsigned int texels[16];
+
+    for (unsigned int by = begin; by < end; by++)
+    {
+        const unsigned char * block = blocks + (size_t)by * block_width * block_size;
+        unsigned int rows = height - by * 4 < 4 ? height - by * 4 : 4;
+
+        for (unsigned int bx = 0; bx < block_width; bx++, block += block_size)
+        {
+            unsigned int columns = width - bx * 4 < 4 ? width - bx * 4 : 4;
+            unsigned char * out = rgba + ((size_t)by * 4 * width + bx * 4) * 4;
+
+            // Whole blocks go straight into the image, those on its edges
+            // through a copy
+            if (rows == 4 && columns == 4)
+            {
+                vbcnDecode(format, block, (unsigned int *)out, width);
+                continue;
+            }
+
+            vbcnDecode(format, block, texels, 4);
+
+            for (unsigned int y = 0; y < rows; y++)
+                memcpy(out + (size_t)y * width * 4, texels + y * 4, columns * 4);
+        }
+    }
+}
+
+void VBCnCodec::DecodeBlock(Format format, const unsigned char * block, unsigned char texels[64])
+{
+    unsigned int words[16];
+
+    vbcnDecode(format, block, words, 4);
+    memcpy(texels, words, sizeof(words));
+}
+
+void VBCnCodec::Decode(Format format, const unsigned char * blocks, unsigned int width, unsigned int height,
+                       unsigned char * rgba, VThreadPool * pool)
+{
+    unsigned int block_height = (height + 3) / 4;
+
+    if (pool != NULL)
+    {
+        pool->ParallelFor(block_height, 16, [&](unsigned int begin, unsigned int end)
+        {
+            vbcnDecodeRows(format, blocks, width, height, rgba, begin, end);
+        });
+    }
+    else
+    {
+        vbcnDecodeRows(format, blocks, width, height, rgba, 0, block_height);
+    }
+}
+
+bool VBCnCodec::GetFormat(unsigned int internal_format, Format & format, bool & srgb)
+{
+    switch (internal_format)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            format = BC1, srgb = false;
+            return true;
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            format = BC1, srgb = true;
+            return true;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+            format = BC2, srgb = false;
+            return true;
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+            format = BC2, srgb = true;
+            return true;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            format = BC3, srgb = false;
+            return true;
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            format = BC3, srgb = true;
+            return true;
+        case GL_COMPRESSED_RED_RGTC1:
+            format = BC4, srgb = false;
+            return true;
+        case GL_COMPRESSED_RG_RGTC2:
+            format = BC5, srgb = false;
+            return true;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+            format = BC7, srgb = false;
+            return true;
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB:
+            format = BC7, srgb = true;
+            return true;
+    }
+
+    return false;
+}
+
+// One 2D image of blocks among all those of a texture
+struct vbcnDecodeJob
+{
+    const unsigned char * blocks;
+    unsigned char * rgba;
+    unsigned int width;
+    unsigned int height;
+};
+
+bool VBCnCodec::DecodeImage(const vglImageData & image, vglImageData & rgba, VThreadPool * pool)
+{
+    Format format;
+    bool srgb;
+
+    if (image.mip[0].data == NULL || !GetFormat(image.internalFormat, format, srgb))
+        return false;
+
+    unsigned int faces = (image.target == GL_TEXTURE_CUBE_MAP || image.target == GL_TEXTURE_CUBE_MAP_ARRAY) ? 6 : 1;
+    unsigned int layers = (unsigned int)image.slices * faces;
+    vglImageData out = image;
+    GLsizeiptr offset = 0;
+    int level;
+
+    out.internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    out.format = GL_RGBA;
+    out.type = GL_UNSIGNED_BYTE;
+    out.mapping = NULL;
+    out.mappingSize = 0;
+
+    for (level = 0; level < image.mipLevels; level++)
+    {
+        const vglImageMipData & mip = image.mip[level];
+
+        out.mip[level].mipStride = (GLsizeiptr)mip.width * mip.height * mip.depth * 4;
+        offset += out.mip[level].mipStride;
+    }
+
+    out.sliceStride = offset;
+    out.totalDataSize = out.sliceStride * layers;
+
+    unsigned char * data = new unsigned char [out.totalDataSize];
+
+    // Every depth slice of every mip of every layer is an image of its own;
+    // their block rows are numbered one after the other from first_row
+    std::vector<vbcnDecodeJob> jobs;
+    std::vector<unsigned int> first_row;
+    unsigned int rows = 0;
+
+    for (unsigned int layer = 0; layer < layers; layer++)
+    {
+        const unsigned char * src = (const unsigned char *)image.mip[0].data + (size_t)image.sliceStride * layer;
+        unsigned char * dst = data + (size_t)out.sliceStride * layer;
+
+        for (level = 0; level < image.mipLevels; level++)
+        {
+            const vglImageMipData & mip = image.mip[level];
+            size_t src_size = GetImageSize(format, mip.width, mip.height);
+            size_t dst_size = (size_t)mip.width * mip.height * 4;
+
+            for (int z = 0; z < mip.depth; z++)
+            {
+                vbcnDecodeJob job = { src + src_size * z, dst + dst_size * z, (unsigned int)mip.width, (unsigned int)mip.height };
+
+                jobs.push_back(job);
+                first_row.push_back(rows);
+                rows += (job.height + 3) / 4;
+            }
+
+            src += image.mip[level].mipStride;
+            dst += out.mip[level].mipStride;
+        }
+    }
+
+    first_row.push_back(rows);
+
+    std::function<void (unsigned int, unsigned int)> decode_rows = [&](unsigned int begin, unsigned int end)
+    {
+        size_t j = std::upper_bound(first_row.begin(), first_row.end(), begin) - first_row.begin() - 1;
+
+        while (begin < end)
+        {
+            unsigned int last = end < first_row[j + 1] ? end : first_row[j + 1];
+            const vbcnDecodeJob & job = jobs[j];
+
+            vbcnDecodeRows(format, job.blocks, job.width, job.height, job.rgba, begin - first_row[j], last - first_row[j]);
+            begin = last;
+            j++;
+        }
+    };
+
+    if (pool != NULL)
+        pool->ParallelFor(rows, 16, decode_rows);
+    else
+        decode_rows(0, rows);
+
+    for (level = 0, offset = 0; level < image.mipLevels; level++)
+    {
+        out.mip[level].data = data + offset;
+        offset += out.mip[level].mipStride;
+    }
+
+    rgba = out;
+
+    return true;
+}
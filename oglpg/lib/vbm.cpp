@@ -2,18 +2,57 @@
 
 #include "vbm.h"
 #include "vgl.h"
+#include "vbmpool.h"
+#include "vbmz.h"
+#include "vthread.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBM_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 VBObject::VBObject(void)
     : m_vao(0),
       m_attribute_buffer(0),
       m_index_buffer(0),
+      m_pool(0),
+      m_pool_handle(0),
+      m_decompressed_data(0),
+      m_vertex_data(0),
+      m_vertex_data_size(0),
+      m_converted_vertex_data(0),
+      m_vertex_stride(0),
+      m_index_data(0),
+      m_index_data_size(0),
+      m_converted_index_data(0),
+      m_converted_short_index_data(0),
       m_attrib(0),
+      m_converted_attrib(0),
       m_frame(0),
-      m_material(0)
+      m_material(0),
+      m_chunks(0),
+      m_num_blocks(0),
+      m_material_textures(0),
+      m_chunk_draws(0),
+      m_chunk_materials(0),
+      m_chunk_draw_count(0),
+      m_indirect_buffer(0),
+      m_material_index_buffer(0),
+      m_indirect_instances(0),
+      m_render_calls(0),
+      m_draw_counts(0),
+      m_draw_offsets(0),
+      m_draw_base_vertices(0),
+      m_draw_count(0),
+      m_meshlet_culling(false)
 {
-
+    memset(&m_header, 0, sizeof(m_header));
 }
 
 VBObject::~VBObject(void)
@@ -21,51 +60,302 @@ VBObject::~VBObject(void)
     Free();
 }
 
-bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index)
+bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags)
+{
+    if (!MapVBM(filename, flags))
+        return false;
+
+    return UploadVBM(vertexIndex, normalIndex, texCoord0Index);
+}
+
+bool VBObject::MapVBM(const char * filename, unsigned int flags)
 {
-    FILE * f = NULL;
+    // No Free() - this may run without a GL context
+    Unmap();
 
-    f = fopen(filename, "rb");
-    if(f == NULL)
+    if (!m_file.Open(filename))
         return false;
 
-    fseek(f, 0, SEEK_END);
-    size_t filesize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    unsigned char * data = m_file.GetData();
+    size_t size = m_file.GetSize();
+
+    // Compressed files are decoded block by block, in parallel, straight
+    // into the memory the upload reads from; the compressed file is only
+    // needed until then.
+    if (size >= sizeof(unsigned int) && *(const unsigned int *)data == VBM_MAGIC_COMPRESSED)
+    {
+        size = vbmGetDecompressedSize(data, size);
+        m_decompressed_data = size ? new unsigned char [size] : NULL;
 
-    unsigned char * data = new unsigned char [filesize];
-    unsigned char * raw_data;
-    fread(data, filesize, 1, f);
-    fclose(f);
+        if (m_decompressed_data == NULL ||
+            !vbmDecompress(m_file.GetData(), m_file.GetSize(), m_decompressed_data, &VThreadPool::GetDefault()))
+        {
+            Unmap();
+            return false;
+        }
 
-    VBM_HEADER * header = (VBM_HEADER *)data;
-    raw_data = data + header->size + header->num_attribs * sizeof(VBM_ATTRIB_HEADER) + header->num_frames * sizeof(VBM_FRAME_HEADER);
-    VBM_ATTRIB_HEADER * attrib_header = (VBM_ATTRIB_HEADER *)(data + header->size);
-    VBM_FRAME_HEADER * frame_header = (VBM_FRAME_HEADER *)(data + header->size + header->num_attribs * sizeof(VBM_ATTRIB_HEADER));
-    unsigned int total_data_size = 0;
+        m_file.Close();
+        data = m_decompressed_data;
+    }
 
-    memcpy(&m_header, header, header->size < sizeof(VBM_HEADER) ? header->size : sizeof(VBM_HEADER));
-    m_attrib = new VBM_ATTRIB_HEADER[header->num_attribs];
-    memcpy(m_attrib, attrib_header, header->num_attribs * sizeof(VBM_ATTRIB_HEADER));
-    m_frame = new VBM_FRAME_HEADER[header->num_frames];
-    memcpy(m_frame, frame_header, header->num_frames * sizeof(VBM_FRAME_HEADER));
+    if (!ParseVBM(data, size))
+    {
+        Unmap();
+        return false;
+    }
 
-    glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
-    glGenBuffers(1, &m_attribute_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_attribute_buffer);
+    // Do the disk I/O here rather than inside glBufferData on the GL thread
+    m_file.Prefault();
+
+    BuildChunkDraws();
+
+    if ((flags & VBM_LOAD_OPTIMIZE) && m_header.num_chunks == 0 && !Optimize())
+    {
+        Unmap();
+        return false;
+    }
+
+    // Objects without normals or texture coordinates simply go without
+    if ((flags & VBM_LOAD_TANGENTS) && m_vertex_stride == 0)
+    {
+        bool has_tangents = false;
+
+        for (unsigned int i = 0; i < m_header.num_attribs; i++)
+            has_tangents = has_tangents || strcmp(m_attrib[i].name, "tangent") == 0;
+
+        if (!has_tangents)
+            GenerateTangents();
+    }
+
+    if ((flags & VBM_LOAD_INTERLEAVE) && m_vertex_stride == 0 && !Interleave())
+    {
+        Unmap();
+        return false;
+    }
+
+    // Last, as the steps above write 32-bit indices. Objects that can't be
+    // compacted simply keep theirs.
+    if (flags & VBM_LOAD_COMPACT_INDICES)
+        CompactIndices();
+
+    // Files saved since bounds were added carry them already
+    if (GetBlock(VBM_BLOCK_BOUNDS) == NULL)
+        ComputeBounds();
+
+    return true;
+}
+
+// Validates the file in place and points the attribute, frame, material and
+// chunk tables plus the vertex and index data at their location in the
+// mapping. Nothing but the header is copied.
+bool VBObject::ParseVBM(unsigned char * data, size_t size)
+{
+    const VBM_HEADER * header = (const VBM_HEADER *)data;
+
+    if (size < sizeof(VBM_HEADER_SBM) || header->size > size)
+        return false;
+
+    memset(&m_header, 0, sizeof(m_header));
+
+    if (header->magic == VBM_MAGIC_SBM)
+    {
+        const VBM_HEADER_SBM * sbm = (const VBM_HEADER_SBM *)data;
+
+        if (sbm->size < sizeof(VBM_HEADER_SBM))
+            return false;
+
+        m_header.magic = sbm->magic;
+        m_header.size = sbm->size;
+        memcpy(m_header.name, sbm->name, sizeof(m_header.name));
+        m_header.num_attribs = sbm->num_attribs;
+        m_header.num_frames = sbm->num_frames;
+        m_header.num_vertices = sbm->num_vertices;
+        m_header.num_indices = sbm->num_indices;
+        m_header.index_type = sbm->index_type;
+    }
+    else if (header->magic == VBM_MAGIC || header->magic == VBM_MAGIC_V2)
+    {
+        memcpy(&m_header, header, header->size < sizeof(VBM_HEADER) ? header->size : sizeof(VBM_HEADER));
+    }
+    else
+    {
+        return false;
+    }
 
+    // 64-bit arithmetic so that corrupt counts can't wrap around the checks
+    unsigned long long offset = m_header.size;
+    unsigned long long next;
     unsigned int i;
 
-    for (i = 0; i < header->num_attribs; i++) {
-        total_data_size += m_attrib[i].components * sizeof(GLfloat) * header->num_vertices;
+    next = offset + (unsigned long long)m_header.num_attribs * sizeof(VBM_ATTRIB_HEADER);
+    if (next > size)
+        return false;
+    m_attrib = (VBM_ATTRIB_HEADER *)(data + offset);
+    offset = next;
+
+    next = offset + (unsigned long long)m_header.num_frames * sizeof(VBM_FRAME_HEADER);
+    if (next > size)
+        return false;
+    m_frame = (VBM_FRAME_HEADER *)(data + offset);
+    offset = next;
+
+    unsigned long long vertex_size = 0;
+    for (i = 0; i < m_header.num_attribs; i++)
+        vertex_size += vbmAttribSize(m_attrib[i]);
+
+    if (m_header.flags & VBM_FLAG_INTERLEAVED)
+    {
+        vertex_size = (vertex_size + 15) & ~15ULL;
+        m_vertex_stride = (GLsizei)vertex_size;
     }
 
-    glBufferData(GL_ARRAY_BUFFER, total_data_size, raw_data, GL_STATIC_DRAW);
+    next = offset + vertex_size * m_header.num_vertices;
+    if (next > size)
+        return false;
+    m_vertex_data = data + offset;
+    m_vertex_data_size = (size_t)(next - offset);
+    offset = next;
+
+    unsigned int element_size = m_header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    next = offset + (unsigned long long)m_header.num_indices * element_size;
+    if (next > size)
+        return false;
+    m_index_data = m_header.num_indices ? data + offset : 0;
+    m_index_data_size = (size_t)(next - offset);
+    offset = next;
+
+    next = offset + (unsigned long long)m_header.num_materials * sizeof(VBM_MATERIAL);
+    if (next > size)
+        return false;
+    m_material = m_header.num_materials ? (VBM_MATERIAL *)(data + offset) : 0;
+    offset = next;
+
+    next = offset + (unsigned long long)m_header.num_chunks * sizeof(VBM_RENDER_CHUNK);
+    if (next > size)
+        return false;
+    m_chunks = m_header.num_chunks ? (VBM_RENDER_CHUNK *)(data + offset) : 0;
+    offset = next;
+
+    m_num_blocks = 0;
+
+    if (m_header.flags & VBM_FLAG_HAS_BLOCKS)
+    {
+        // Quantized vertices or 16-bit indices can leave the chunks
+        // unaligned; blocks never are
+        offset = (offset + 3) & ~3ULL;
+
+        while (offset + sizeof(VBM_BLOCK_HEADER) <= size)
+        {
+            const VBM_BLOCK_HEADER * block = (const VBM_BLOCK_HEADER *)(data + offset);
+
+            next = offset + sizeof(VBM_BLOCK_HEADER) + block->size;
+            if (next > size)
+                return false;
+
+            // Blocks beyond what we can track are dropped, not fatal
+            if (m_num_blocks < MAX_BLOCKS)
+            {
+                m_blocks[m_num_blocks].type = block->type;
+                m_blocks[m_num_blocks].size = block->size;
+                m_blocks[m_num_blocks].data = data + offset + sizeof(VBM_BLOCK_HEADER);
+                m_blocks[m_num_blocks].owned = 0;
+                m_num_blocks++;
+            }
+
+            offset = (next + 3) & ~3ULL;
+        }
+    }
 
-    total_data_size = 0;
+    unsigned int quant_size;
+    if (GetBlock(VBM_BLOCK_ATTRIB_QUANT, &quant_size) && quant_size < m_header.num_attribs * sizeof(VBM_ATTRIB_QUANT))
+        return false;
 
-    for (i = 0; i < header->num_attribs; i++) {
+    // Every range we hand to GL later must lie inside the buffers
+    unsigned int element_count = m_header.num_indices ? m_header.num_indices : m_header.num_vertices;
+
+    for (i = 0; i < m_header.num_frames; i++)
+    {
+        if ((unsigned long long)m_frame[i].first + m_frame[i].count > element_count)
+            return false;
+    }
+
+    for (i = 0; i < m_header.num_chunks; i++)
+    {
+        if ((unsigned long long)m_chunks[i].first + m_chunks[i].count > m_header.num_vertices ||
+            m_chunks[i].material_index >= m_header.num_materials)
+            return false;
+    }
+
+    unsigned int lod_size = 0;
+    const VBM_LOD * lod = (const VBM_LOD *)GetBlock(VBM_BLOCK_LOD, &lod_size);
+
+    for (i = 0; lod && i < lod_size / sizeof(VBM_LOD); i++)
+    {
+        if ((unsigned long long)lod[i].first + lod[i].count > m_header.num_indices)
+            return false;
+    }
+
+    unsigned int meshlet_size = 0;
+    const VBM_MESHLET * meshlet = (const VBM_MESHLET *)GetBlock(VBM_BLOCK_MESHLETS, &meshlet_size);
+
+    for (i = 0; meshlet && i < meshlet_size / sizeof(VBM_MESHLET); i++)
+    {
+        if ((unsigned long long)meshlet[i].first + meshlet[i].count > m_header.num_indices)
+            return false;
+    }
+
+    // Index ranges must cover a 16-bit index buffer back to back
+    unsigned int range_size = 0;
+    const VBM_INDEX_RANGE * range = (const VBM_INDEX_RANGE *)GetBlock(VBM_BLOCK_INDEX_RANGES, &range_size);
+
+    if (range)
+    {
+        unsigned long long end = 0;
+
+        if (m_header.index_type != GL_UNSIGNED_SHORT || range_size < sizeof(VBM_INDEX_RANGE))
+            return false;
+
+        for (i = 0; i < range_size / sizeof(VBM_INDEX_RANGE); i++)
+        {
+            if (range[i].first != end || range[i].base_vertex >= m_header.num_vertices)
+                return false;
+            end += range[i].count;
+        }
+
+        if (end != m_header.num_indices)
+            return false;
+    }
+
+    // One set of bounds per frame and chunk
+    unsigned int bounds_size = 0;
+
+    if (GetBlock(VBM_BLOCK_BOUNDS, &bounds_size) &&
+        bounds_size != (m_header.num_frames + m_header.num_chunks) * sizeof(VBM_BOUNDS))
+        return false;
+
+    return true;
+}
+
+bool VBObject::UploadVBM(int vertexIndex, int normalIndex, int texCoord0Index)
+{
+    if (!IsMapped())
+        return false;
+
+    // A reload replaces whatever the last upload made
+    ReleaseGL();
+
+    glGenVertexArrays(1, &m_vao);
+    glBindVertexArray(m_vao);
+    glGenBuffers(1, &m_attribute_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_attribute_buffer);
+
+    // Straight from the mapping - the driver's copy is the only one made
+    glBufferData(GL_ARRAY_BUFFER, m_vertex_data_size, m_vertex_data, GL_STATIC_DRAW);
+
+    unsigned int i;
+
+    for (i = 0; i < m_header.num_attribs; i++) {
         int attribIndex = i;
 
         if(attribIndex == 0)
@@ -75,112 +365,634 @@ bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalInd
          else if(attribIndex == 2)
             attribIndex = texCoord0Index;
 
-        glVertexAttribPointer(attribIndex, m_attrib[i].components, m_attrib[i].type, GL_FALSE, 0, (GLvoid *)total_data_size);
+        GLboolean normalized = (m_attrib[i].flags & VBM_ATTRIB_FLAG_NORMALIZED) ? GL_TRUE : GL_FALSE;
+
+        glVertexAttribPointer(attribIndex, m_attrib[i].components, m_attrib[i].type, normalized, m_vertex_stride, BUFFER_OFFSET(GetAttributeOffset(i)));
         glEnableVertexAttribArray(attribIndex);
-        total_data_size += m_attrib[i].components * sizeof(GLfloat) * header->num_vertices;
     }
 
-    if (header->num_indices) {
+    if (m_header.num_indices) {
         glGenBuffers(1, &m_index_buffer);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
-        unsigned int element_size;
-        switch (header->index_type) {
-            case GL_UNSIGNED_SHORT:
-                element_size = sizeof(GLushort);
-                break;
-            default:
-                element_size = sizeof(GLuint);
-                break;
-        }
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->num_indices * element_size, raw_data + total_data_size, GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_index_data_size, m_index_data, GL_STATIC_DRAW);
     }
 
     glBindVertexArray(0);
 
     if (m_header.num_materials != 0)
     {
-        m_material = new VBM_MATERIAL[m_header.num_materials];
-        memcpy(m_material, raw_data + total_data_size, m_header.num_materials * sizeof(VBM_MATERIAL));
-        total_data_size += m_header.num_materials * sizeof(VBM_MATERIAL);
         m_material_textures = new VBObject::material_texture[m_header.num_materials];
         memset(m_material_textures, 0, m_header.num_materials * sizeof(*m_material_textures));
     }
 
-    if (m_header.num_chunks != 0)
+    // Indirect draws and the material each one uses, for RenderIndirect
+    if (m_chunk_draw_count != 0 && glMultiDrawArraysIndirect != NULL)
     {
-        m_chunks = new VBM_RENDER_CHUNK[m_header.num_chunks];
-        memcpy(m_chunks, raw_data + total_data_size, m_header.num_chunks * sizeof(VBM_RENDER_CHUNK));
-        total_data_size += m_header.num_chunks * sizeof(VBM_RENDER_CHUNK);
+        glGenBuffers(1, &m_indirect_buffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirect_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, m_chunk_draw_count * sizeof(VBM_DRAW_COMMAND), m_chunk_draws, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        m_indirect_instances = 1;
+
+        glGenBuffers(1, &m_material_index_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_material_index_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_chunk_draw_count * sizeof(unsigned int), m_chunk_materials, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     }
 
-    delete [] data;
-
     return true;
 }
 
 bool VBObject::Free(void)
 {
-    glDeleteBuffers(1, &m_index_buffer);
-    m_index_buffer = 0;
-    glDeleteBuffers(1, &m_attribute_buffer);
-    m_attribute_buffer = 0;
-    glDeleteVertexArrays(1, &m_vao);
+    ReleaseGL();
+    Unmap();
+
+    return true;
+}
+
+void VBObject::ReleaseGL(void)
+{
+    // The vertex array belongs to the pool
+    if (m_pool)
+    {
+        m_pool->Release(m_pool_handle);
+        m_pool = NULL;
+        m_pool_handle = 0;
+        m_vao = 0;
+    }
+
+    // Only what was made is deleted, so that objects that were never
+    // uploaded, such as vbmconv's, don't need a GL context to go away
+    GLuint * buffers[] = { &m_index_buffer, &m_attribute_buffer, &m_indirect_buffer, &m_material_index_buffer };
+
+    for (unsigned int i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+    {
+        if (*buffers[i] != 0)
+            glDeleteBuffers(1, buffers[i]);
+        *buffers[i] = 0;
+    }
+
+    if (m_vao != 0)
+        glDeleteVertexArrays(1, &m_vao);
     m_vao = 0;
+    m_indirect_instances = 0;
 
-    delete [] m_attrib;
-    m_attrib = NULL;
+    delete [] m_material_textures;
+    m_material_textures = NULL;
+}
 
-    delete [] m_frame;
+void VBObject::Unmap(void)
+{
+    // These all point into the mapping
+    m_attrib = NULL;
+    delete [] m_converted_attrib;
+    m_converted_attrib = NULL;
     m_frame = NULL;
-
-    delete [] m_material;
     m_material = NULL;
+    m_chunks = NULL;
+    m_vertex_data = NULL;
+    m_vertex_data_size = 0;
+    delete [] m_converted_vertex_data;
+    m_converted_vertex_data = NULL;
+    m_vertex_stride = 0;
+    m_index_data = NULL;
+    m_index_data_size = 0;
+    delete [] m_converted_index_data;
+    m_converted_index_data = NULL;
+    delete [] m_converted_short_index_data;
+    m_converted_short_index_data = NULL;
+    m_file.Close();
+    delete [] m_decompressed_data;
+    m_decompressed_data = NULL;
+
+    for (unsigned int i = 0; i < m_num_blocks; i++)
+        delete [] m_blocks[i].owned;
+    m_num_blocks = 0;
+
+    delete [] m_material_textures;
+    m_material_textures = NULL;
+
+    delete [] m_chunk_draws;
+    m_chunk_draws = NULL;
+    delete [] m_chunk_materials;
+    m_chunk_materials = NULL;
+    m_chunk_draw_count = 0;
+
+    DisableMeshletCulling();
+
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+const void * VBObject::GetBlock(unsigned int type, unsigned int * size) const
+{
+    for (unsigned int i = 0; i < m_num_blocks; i++)
+    {
+        if (m_blocks[i].type == type)
+        {
+            if (size)
+                *size = m_blocks[i].size;
+            return m_blocks[i].data;
+        }
+    }
+
+    return NULL;
+}
+
+bool VBObject::SetBlock(unsigned int type, const void * data, unsigned int size)
+{
+    unsigned int i;
+
+    for (i = 0; i < m_num_blocks; i++)
+    {
+        if (m_blocks[i].type == type)
+            break;
+    }
+
+    if (i == MAX_BLOCKS)
+        return false;
+
+    unsigned char * copy = new unsigned char [size];
+    memcpy(copy, data, size);
+
+    if (i == m_num_blocks)
+        m_num_blocks++;
+    else
+        delete [] m_blocks[i].owned;
+
+    m_blocks[i].type = type;
+    m_blocks[i].size = size;
+    m_blocks[i].data = copy;
+    m_blocks[i].owned = copy;
 
     return true;
 }
 
-void VBObject::Render(unsigned int frame_index, unsigned int instances)
+void VBObject::RemoveBlock(unsigned int type)
 {
-    unsigned int t = GetTickCount();
+    for (unsigned int i = 0; i < m_num_blocks; i++)
+    {
+        if (m_blocks[i].type == type)
+        {
+            delete [] m_blocks[i].owned;
+            memmove(&m_blocks[i], &m_blocks[i + 1], (m_num_blocks - i - 1) * sizeof(block));
+            m_num_blocks--;
+            return;
+        }
+    }
+}
 
-    if (frame_index >= m_header.num_frames)
+// Takes ownership of data, which replaces the vertex data
+void VBObject::SetConvertedVertexData(unsigned char * data, size_t size)
+{
+    delete [] m_converted_vertex_data;
+    m_converted_vertex_data = data;
+    m_vertex_data = data;
+    m_vertex_data_size = size;
+}
+
+// Takes ownership of data, which replaces the index data
+void VBObject::SetConvertedIndexData(unsigned int * data, unsigned int count)
+{
+    delete [] m_converted_index_data;
+    m_converted_index_data = data;
+    delete [] m_converted_short_index_data;
+    m_converted_short_index_data = NULL;
+    m_index_data = (const unsigned char *)data;
+    m_index_data_size = count * sizeof(GLuint);
+    m_header.num_indices = count;
+    m_header.index_type = GL_UNSIGNED_INT;
+    RemoveBlock(VBM_BLOCK_INDEX_RANGES);
+}
+
+// As above for 16-bit indices. Any index ranges are the caller's to set.
+void VBObject::SetConvertedIndexData(unsigned short * data, unsigned int count)
+{
+    delete [] m_converted_short_index_data;
+    m_converted_short_index_data = data;
+    delete [] m_converted_index_data;
+    m_converted_index_data = NULL;
+    m_index_data = (const unsigned char *)data;
+    m_index_data_size = count * sizeof(GLushort);
+    m_header.num_indices = count;
+    m_header.index_type = GL_UNSIGNED_SHORT;
+    RemoveBlock(VBM_BLOCK_INDEX_RANGES);
+}
+
+// Vertex used by an element of the index buffer, or the element itself for
+// non-indexed objects
+unsigned int VBObject::GetIndex(unsigned int element) const
+{
+    if (m_header.num_indices == 0)
+        return element;
+
+    if (m_header.index_type == GL_UNSIGNED_SHORT)
+    {
+        unsigned int count = 0;
+        const VBM_INDEX_RANGE * ranges = GetIndexRanges(&count);
+        unsigned int base_vertex = ranges ? ranges[FindIndexRange(ranges, count, element)].base_vertex : 0;
+
+        return ((const GLushort *)m_index_data)[element] + base_vertex;
+    }
+
+    return ((const GLuint *)m_index_data)[element];
+}
+
+size_t VBObject::GetAttributeOffset(unsigned int index) const
+{
+    size_t offset = 0;
+
+    for (unsigned int i = 0; i < index; i++)
+        offset += vbmAttribSize(m_attrib[i]);
+
+    return m_vertex_stride ? offset : offset * m_header.num_vertices;
+}
+
+// Copies one planar float attribute into every vertex of an interleaved
+// buffer. When spill is set, up to 16 bytes may be written at each vertex even
+// if the attribute is smaller, which is what lets the SSE path use whole
+// register stores. The caller writes attributes in increasing offset order, so
+// the spill is always overwritten by the next attribute or lands in padding.
+static void vbmInterleaveAttribute(unsigned char * dst, size_t stride, const float * src,
+                                   unsigned int components, unsigned int count, bool spill)
+{
+    unsigned int v = 0;
+
+#ifdef VBM_USE_SSE2
+    if (spill)
+    {
+        // Four vertices per iteration: load their planar floats as whole
+        // registers, then shuffle them apart into one register per vertex
+        for (; v + 4 <= count; v += 4, src += 4 * components)
+        {
+            __m128 v0, v1, v2, v3;
+
+            switch (components)
+            {
+                case 1:
+                {
+                    __m128 a = _mm_loadu_ps(src);
+                    v0 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0));
+                    v1 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+                    v2 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2));
+                    v3 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3));
+                    break;
+                }
+                case 2:
+                {
+                    __m128 a = _mm_loadu_ps(src);           // x0 y0 x1 y1
+                    __m128 b = _mm_loadu_ps(src + 4);       // x2 y2 x3 y3
+                    v0 = a;
+                    v1 = _mm_movehl_ps(a, a);
+                    v2 = b;
+                    v3 = _mm_movehl_ps(b, b);
+                    break;
+                }
+                case 3:
+                {
+                    __m128 a = _mm_loadu_ps(src);           // x0 y0 z0 x1
+                    __m128 b = _mm_loadu_ps(src + 4);       // y1 z1 x2 y2
+                    __m128 c = _mm_loadu_ps(src + 8);       // z2 x3 y3 z3
+                    __m128 t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 3, 3));
+                    v0 = a;
+                    v1 = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 3, 2, 1));
+                    v2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 0, 3, 2));
+                    v3 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 2, 1));
+                    break;
+                }
+                default:
+                    v0 = _mm_loadu_ps(src);
+                    v1 = _mm_loadu_ps(src + 4);
+                    v2 = _mm_loadu_ps(src + 8);
+                    v3 = _mm_loadu_ps(src + 12);
+                    break;
+            }
+
+            _mm_storeu_ps((float *)(dst + (v + 0) * stride), v0);
+            _mm_storeu_ps((float *)(dst + (v + 1) * stride), v1);
+            _mm_storeu_ps((float *)(dst + (v + 2) * stride), v2);
+            _mm_storeu_ps((float *)(dst + (v + 3) * stride), v3);
+        }
+    }
+#else
+    (void)spill;
+#endif
+
+    for (; v < count; v++, src += components)
+        memcpy(dst + v * stride, src, components * sizeof(float));
+}
+
+// Re-packs the planar attribute blocks into interleaved vertices with a
+// 16-byte aligned stride. Float attributes are shuffled with SSE, anything
+// else (quantized data) is copied vertex by vertex.
+bool VBObject::Interleave(void)
+{
+    GLsizei stride;
+    size_t size;
+    unsigned char * data = InterleavedCopy(&stride, &size);
+
+    if (data == NULL)
+        return false;
+
+    SetConvertedVertexData(data, size);
+    m_vertex_stride = stride;
+    m_header.flags |= VBM_FLAG_INTERLEAVED;
+
+    return true;
+}
+
+unsigned char * VBObject::InterleavedCopy(GLsizei * vertex_stride, size_t * data_size) const
+{
+    unsigned int i;
+    size_t vertex_size = 0;
+
+    for (i = 0; i < m_header.num_attribs; i++)
+    {
+        if (m_attrib[i].components == 0 || m_attrib[i].components > 4)
+            return NULL;
+        vertex_size += vbmAttribSize(m_attrib[i]);
+    }
+
+    size_t stride = (vertex_size + 15) & ~(size_t)15;
+    size_t size = stride * m_header.num_vertices;
+
+    // Zero-initialized so that padding is deterministic in saved files
+    unsigned char * data = new unsigned char [size]();
+    size_t offset = 0;
+
+    for (i = 0; i < m_header.num_attribs; i++)
+    {
+        const unsigned char * src = m_vertex_data + GetAttributeOffset(i);
+        unsigned int attrib_size = vbmAttribSize(m_attrib[i]);
+
+        if (m_attrib[i].type == GL_FLOAT)
+        {
+            vbmInterleaveAttribute(data + offset, stride, (const float *)src, m_attrib[i].components, m_header.num_vertices, offset + 16 <= stride);
+        }
+        else
+        {
+            for (unsigned int v = 0; v < m_header.num_vertices; v++)
+                memcpy(data + offset + v * stride, src + v * attrib_size, attrib_size);
+        }
+
+        offset += attrib_size;
+    }
+
+    // The last attribute's spill lands in the padding; clear it again
+    if (stride != vertex_size)
+    {
+        for (unsigned int v = 0; v < m_header.num_vertices; v++)
+            memset(data + v * stride + vertex_size, 0, stride - vertex_size);
+    }
+
+    *vertex_stride = (GLsizei)stride;
+    *data_size = size;
+
+    return data;
+}
+
+bool VBObject::SaveToVBM(const char * filename) const
+{
+    if (m_attrib == NULL)
+        return false;
+
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    VBM_HEADER header = m_header;
+    unsigned int i;
+
+    header.magic = VBM_MAGIC;
+    for (i = 0; i < header.num_attribs; i++)
+    {
+        if (m_attrib[i].type != GL_FLOAT)
+            header.magic = VBM_MAGIC_V2;
+    }
+
+    header.size = sizeof(VBM_HEADER);
+    header.flags &= ~(VBM_FLAG_HAS_VERTICES | VBM_FLAG_HAS_INDICES | VBM_FLAG_HAS_FRAMES | VBM_FLAG_HAS_MATERIALS | VBM_FLAG_HAS_BLOCKS);
+    if (header.num_vertices)
+        header.flags |= VBM_FLAG_HAS_VERTICES;
+    if (header.num_indices)
+        header.flags |= VBM_FLAG_HAS_INDICES;
+    if (header.num_frames)
+        header.flags |= VBM_FLAG_HAS_FRAMES;
+    if (header.num_materials)
+        header.flags |= VBM_FLAG_HAS_MATERIALS;
+    if (m_num_blocks)
+        header.flags |= VBM_FLAG_HAS_BLOCKS;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    ok = ok && fwrite(m_attrib, sizeof(VBM_ATTRIB_HEADER), header.num_attribs, f) == header.num_attribs;
+    ok = ok && fwrite(m_frame, sizeof(VBM_FRAME_HEADER), header.num_frames, f) == header.num_frames;
+    ok = ok && fwrite(m_vertex_data, 1, m_vertex_data_size, f) == m_vertex_data_size;
+    ok = ok && fwrite(m_index_data, 1, m_index_data_size, f) == m_index_data_size;
+    ok = ok && fwrite(m_material, sizeof(VBM_MATERIAL), header.num_materials, f) == header.num_materials;
+    ok = ok && fwrite(m_chunks, sizeof(VBM_RENDER_CHUNK), header.num_chunks, f) == header.num_chunks;
+
+    static const unsigned char padding[4] = { 0, 0, 0, 0 };
+
+    if (m_num_blocks && ok)
+    {
+        size_t pad = (4 - (ftell(f) & 3)) & 3;
+        ok = fwrite(padding, 1, pad, f) == pad;
+    }
+
+    for (i = 0; i < m_num_blocks && ok; i++)
+    {
+        VBM_BLOCK_HEADER block = { m_blocks[i].type, m_blocks[i].size };
+        size_t pad = (4 - (m_blocks[i].size & 3)) & 3;
+
+        ok = fwrite(&block, sizeof(block), 1, f) == 1;
+        ok = ok && fwrite(m_blocks[i].data, 1, m_blocks[i].size, f) == m_blocks[i].size;
+        ok = ok && fwrite(padding, 1, pad, f) == pad;
+    }
+
+    return fclose(f) == 0 && ok;
+}
+
+// Orders the chunks by material so that Render switches textures as rarely
+// as possible. Within a material chunks stay in vertex order, so those that
+// follow each other become a single draw.
+void VBObject::BuildChunkDraws(void)
+{
+    delete [] m_chunk_draws;
+    m_chunk_draws = NULL;
+    delete [] m_chunk_materials;
+    m_chunk_materials = NULL;
+    m_chunk_draw_count = 0;
+
+    unsigned int num_chunks = m_header.num_chunks;
+    unsigned int i;
+
+    if (num_chunks == 0)
         return;
 
-    glBindVertexArray(m_vao);
+    std::vector<unsigned int> order(num_chunks);
+    for (i = 0; i < num_chunks; i++)
+        order[i] = i;
 
-    if (m_header.num_chunks)
+    const VBM_RENDER_CHUNK * chunks = m_chunks;
+
+    std::stable_sort(order.begin(), order.end(), [chunks](unsigned int a, unsigned int b)
+    {
+        if (chunks[a].material_index != chunks[b].material_index)
+            return chunks[a].material_index < chunks[b].material_index;
+        return chunks[a].first < chunks[b].first;
+    });
+
+    m_chunk_draws = new VBM_DRAW_COMMAND [num_chunks];
+    m_chunk_materials = new unsigned int [num_chunks];
+
+    for (i = 0; i < num_chunks; i++)
     {
-        unsigned int chunk = 6; // (t >> 1) % m_header.num_chunks;
+        const VBM_RENDER_CHUNK & chunk = chunks[order[i]];
 
-        for (chunk = 0; chunk < m_header.num_chunks; chunk++)
+        if (m_chunk_draw_count != 0)
         {
-            unsigned int material_index = m_chunks[chunk].material_index;
-            // if (m_material_textures[material_index].normal != 0)
+            VBM_DRAW_COMMAND & last = m_chunk_draws[m_chunk_draw_count - 1];
+
+            if (m_chunk_materials[m_chunk_draw_count - 1] == chunk.material_index && last.first + last.count == chunk.first)
             {
-                glActiveTexture(GL_TEXTURE2);
-                glBindTexture(GL_TEXTURE_2D, m_material_textures[material_index].normal);
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, m_material_textures[material_index].specular);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, m_material_textures[material_index].diffuse);
-                VBM_MATERIAL * material = &m_material[m_chunks[chunk].material_index];
-                glDrawArrays(GL_TRIANGLES, m_chunks[chunk].first, m_chunks[chunk].count);
+                last.count += chunk.count;
+                continue;
             }
         }
+
+        VBM_DRAW_COMMAND & draw = m_chunk_draws[m_chunk_draw_count];
+        draw.count = chunk.count;
+        draw.instance_count = 1;
+        draw.first = chunk.first;
+        draw.base_instance = 0;
+        m_chunk_materials[m_chunk_draw_count] = chunk.material_index;
+        m_chunk_draw_count++;
     }
-    else
+}
+
+// Binds texture to unit unless it's already there, tracking the active unit
+static void vbmBindTexture(unsigned int unit, GLuint texture, GLuint * bound, unsigned int & active, unsigned int & calls)
+{
+    if (bound[unit] == texture)
+        return;
+
+    if (active != unit)
     {
-        if (instances) {
-            if (m_header.num_indices)
-                glDrawElementsInstanced(GL_TRIANGLES, m_frame[frame_index].count, GL_UNSIGNED_INT, (GLvoid *)(m_frame[frame_index].first * sizeof(GLuint)), instances);
-            else
-                glDrawArraysInstanced(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count, instances);
-        } else {
-            if (m_header.num_indices)
-                glDrawElements(GL_TRIANGLES, m_frame[frame_index].count, GL_UNSIGNED_INT, (GLvoid *)(m_frame[frame_index].first * sizeof(GLuint)));
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active = unit;
+        calls++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    bound[unit] = texture;
+    calls++;
+}
+
+void VBObject::Render(unsigned int frame_index, unsigned int instances, unsigned int base_instance)
+{
+    m_render_calls = 0;
+
+    if (frame_index >= m_header.num_frames)
+        return;
+
+    glBindVertexArray(m_vao);
+    m_render_calls++;
+
+    if (m_header.num_chunks)
+    {
+        // Nothing is known about the bindings on entry (the application may
+        // have changed them since the last call), so the cache only spans
+        // this call. ~0 is never a texture name.
+        GLuint bound[3] = { ~0u, ~0u, ~0u };
+        unsigned int active = ~0u;
+
+        for (unsigned int i = 0; i < m_chunk_draw_count; i++)
+        {
+            const material_texture & textures = m_material_textures[m_chunk_materials[i]];
+            GLint first = m_chunk_draws[i].first;
+            GLsizei count = m_chunk_draws[i].count;
+
+            vbmBindTexture(2, textures.normal, bound, active, m_render_calls);
+            vbmBindTexture(1, textures.specular, bound, active, m_render_calls);
+            vbmBindTexture(0, textures.diffuse, bound, active, m_render_calls);
+
+            first += GetBaseVertex();
+
+            if (base_instance)
+                glDrawArraysInstancedBaseInstance(GL_TRIANGLES, first, count, instances ? instances : 1, base_instance);
+            else if (instances)
+                glDrawArraysInstanced(GL_TRIANGLES, first, count, instances);
             else
-                glDrawArrays(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count);
+                glDrawArrays(GL_TRIANGLES, first, count);
+            m_render_calls++;
+        }
+
+        // Leave unit 0 active, as drawing chunks always did
+        if (active != 0)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            m_render_calls++;
         }
     }
+    else if (m_meshlet_culling && frame_index == 0 && instances == 0 && base_instance == 0)
+    {
+        if (GetBlock(VBM_BLOCK_INDEX_RANGES) || m_pool)
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, m_draw_counts, m_header.index_type, (GLvoid **)m_draw_offsets, m_draw_count, m_draw_base_vertices);
+        else
+            glMultiDrawElements(GL_TRIANGLES, m_draw_counts, m_header.index_type, m_draw_offsets, m_draw_count);
+        m_render_calls++;
+    }
+    else if (m_header.num_indices)
+    {
+        m_render_calls += DrawIndices(m_frame[frame_index].first, m_frame[frame_index].count, instances, base_instance);
+    }
+    else
+    {
+        if (base_instance)
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count,
+                                              instances ? instances : 1, base_instance);
+        else if (instances)
+            glDrawArraysInstanced(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count, instances);
+        else
+            glDrawArrays(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count);
+        m_render_calls++;
+    }
+    glBindVertexArray(0);
+    m_render_calls++;
+}
+
+void VBObject::RenderIndirect(unsigned int instances, GLuint material_binding)
+{
+    if (m_indirect_buffer == 0)
+    {
+        Render(0, instances);
+        return;
+    }
+
+    m_render_calls = 0;
+
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirect_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, material_binding, m_material_index_buffer);
+    m_render_calls += 3;
+
+    // The instance count lives in the commands; only rewrite them when it
+    // changes
+    unsigned int instance_count = instances ? instances : 1;
+
+    if (instance_count != m_indirect_instances)
+    {
+        for (unsigned int i = 0; i < m_chunk_draw_count; i++)
+            m_chunk_draws[i].instance_count = instance_count;
+
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, m_chunk_draw_count * sizeof(VBM_DRAW_COMMAND), m_chunk_draws);
+        m_indirect_instances = instance_count;
+        m_render_calls++;
+    }
+
+    glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, m_chunk_draw_count, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
     glBindVertexArray(0);
+    m_render_calls += 3;
 }
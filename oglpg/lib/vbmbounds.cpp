@@ -0,0 +1,358 @@
+// Bounding volumes for VBObject: an axis aligned box and a sphere for every
+// frame and render chunk, so that whole objects and single chunks can be
+// culled. They are computed from the position stream in place, four floats
+// at a time, and kept in a VBM_BLOCK_BOUNDS block that saved files carry.
+
+#include "vbm.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBM_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Float positions of every vertex, step bytes apart. Whole four-float loads
+// may be used below end; past it only the three components are read.
+struct vbmPositions
+{
+    const unsigned char * data;
+    size_t step;
+    const unsigned char * end;
+    unsigned int count;
+};
+
+#ifdef VBM_USE_SSE2
+static inline __m128 vbmLoadPosition(const vbmPositions & positions, unsigned int v)
+{
+    const float * p = (const float *)(positions.data + v * positions.step);
+
+    if ((const unsigned char *)(p + 4) <= positions.end)
+        return _mm_loadu_ps(p);
+
+    return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+}
+#endif
+
+// Bounds of count vertices, vertices[i] if vertices is set, first + i if
+// not. Vertices outside the object are skipped.
+static void vbmRangeBounds(VBM_BOUNDS & bounds, const vbmPositions & positions,
+                           const unsigned int * vertices, unsigned int first, unsigned int count)
+{
+    unsigned int i, v, k;
+    unsigned int used = 0;
+
+    memset(&bounds, 0, sizeof(bounds));
+
+#ifdef VBM_USE_SSE2
+    __m128 lo = _mm_set1_ps(1e30f);
+    __m128 hi = _mm_set1_ps(-1e30f);
+
+    for (i = 0; i < count; i++)
+    {
+        v = vertices ? vertices[i] : first + i;
+        if (v >= positions.count)
+            continue;
+
+        __m128 p = vbmLoadPosition(positions, v);
+        lo = _mm_min_ps(lo, p);
+        hi = _mm_max_ps(hi, p);
+        used++;
+    }
+
+    if (used == 0)
+        return;
+
+    float l[4], h[4];
+    _mm_storeu_ps(l, lo);
+    _mm_storeu_ps(h, hi);
+
+    for (k = 0; k < 3; k++)
+    {
+        bounds.min[k] = l[k];
+        bounds.max[k] = h[k];
+        bounds.center[k] = (l[k] + h[k]) * 0.5f;
+    }
+
+    // The sphere is centered on the box, which is close enough to minimal
+    // for culling. The fourth lane is masked off before the dot product.
+    const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    __m128 center = _mm_setr_ps(bounds.center[0], bounds.center[1], bounds.center[2], 0.0f);
+    __m128 radius = _mm_setzero_ps();
+
+    for (i = 0; i < count; i++)
+    {
+        v = vertices ? vertices[i] : first + i;
+        if (v >= positions.count)
+            continue;
+
+        __m128 d = _mm_and_ps(_mm_sub_ps(vbmLoadPosition(positions, v), center), xyz);
+        d = _mm_mul_ps(d, d);
+        d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+        d = _mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1)));
+        radius = _mm_max_ss(radius, d);
+    }
+
+    bounds.radius = sqrtf(_mm_cvtss_f32(radius));
+#else
+    float lo[3] = { 1e30f, 1e30f, 1e30f };
+    float hi[3] = { -1e30f, -1e30f, -1e30f };
+
+    for (i = 0; i < count; i++)
+    {
+        v = vertices ? vertices[i] : first + i;
+        if (v >= positions.count)
+            continue;
+
+        const float * p = (const float *)(positions.data + v * positions.step);
+        for (k = 0; k < 3; k++)
+        {
+            if (p[k] < lo[k]) lo[k] = p[k];
+            if (p[k] > hi[k]) hi[k] = p[k];
+        }
+        used++;
+    }
+
+    if (used == 0)
+        return;
+
+    for (k = 0; k < 3; k++)
+    {
+        bounds.min[k] = lo[k];
+        bounds.max[k] = hi[k];
+        bounds.center[k] = (lo[k] + hi[k]) * 0.5f;
+    }
+
+    float radius = 0.0f;
+
+    for (i = 0; i < count; i++)
+    {
+        v = vertices ? vertices[i] : first + i;
+        if (v >= positions.count)
+            continue;
+
+        const float * p = (const float *)(positions.data + v * positions.step);
+        float dx = p[0] - bounds.center[0];
+        float dy = p[1] - bounds.center[1];
+        float dz = p[2] - bounds.center[2];
+        float d = dx * dx + dy * dy + dz * dz;
+        if (d > radius)
+            radius = d;
+    }
+
+    bounds.radius = sqrtf(radius);
+#endif
+}
+
+// Position (attribute 0) of vertex 0, with the following ones step bytes
+// apart. Float positions are read where they are; anything else is decoded
+// into *decoded, which the caller deletes.
+const unsigned char * VBObject::GetPositions(size_t * step, float ** decoded) const
+{
+    const VBM_ATTRIB_HEADER & attrib = m_attrib[0];
+
+    *decoded = NULL;
+
+    if (attrib.type == GL_FLOAT && attrib.components >= 3)
+    {
+        *step = m_vertex_stride ? m_vertex_stride : attrib.components * sizeof(float);
+        return m_vertex_data + GetAttributeOffset(0);
+    }
+
+    *decoded = new float [m_header.num_vertices * 4];
+    *step = 4 * sizeof(float);
+
+    if (!DecodeAttribute(0, *decoded))
+    {
+        delete [] *decoded;
+        *decoded = NULL;
+        return NULL;
+    }
+
+    return (const unsigned char *)*decoded;
+}
+
+bool VBObject::ComputeBounds(void)
+{
+    if (m_attrib == NULL || m_header.num_attribs == 0 || m_header.num_vertices == 0)
+    {
+        RemoveBlock(VBM_BLOCK_BOUNDS);
+        return false;
+    }
+
+    unsigned int num_vertices = m_header.num_vertices;
+    float * decoded;
+    vbmPositions positions;
+    unsigned int i;
+
+    positions.data = GetPositions(&positions.step, &decoded);
+    if (positions.data == NULL)
+        return false;
+
+    positions.end = decoded ? (const unsigned char *)(decoded + num_vertices * 4) : m_vertex_data + m_vertex_data_size;
+    positions.count = num_vertices;
+
+    unsigned int num_frames = m_header.num_frames;
+    unsigned int num_chunks = m_header.num_chunks;
+    std::vector<VBM_BOUNDS> bounds(num_frames + num_chunks);
+    std::vector<unsigned int> vertices;
+
+    for (i = 0; i < num_frames; i++)
+    {
+        unsigned int first = m_frame[i].first;
+        unsigned int count = m_frame[i].count;
+
+        if (m_header.num_indices == 0)
+        {
+            vbmRangeBounds(bounds[i], positions, NULL, first, count);
+            continue;
+        }
+
+        if (first > m_header.num_indices)
+            first = m_header.num_indices;
+        if (count > m_header.num_indices - first)
+            count = m_header.num_indices - first;
+
+        if (m_header.index_type == GL_UNSIGNED_INT)
+        {
+            vbmRangeBounds(bounds[i], positions, (const GLuint *)m_index_data + first, 0, count);
+            continue;
+        }
+
+        vertices.resize(count);
+        for (unsigned int e = 0; e < count; e++)
+            vertices[e] = GetIndex(first + e);
+
+        vbmRangeBounds(bounds[i], positions, count ? &vertices[0] : NULL, 0, count);
+    }
+
+    // Chunks are vertex ranges
+    for (i = 0; i < num_chunks; i++)
+        vbmRangeBounds(bounds[num_frames + i], positions, NULL, m_chunks[i].first, m_chunks[i].count);
+
+    delete [] decoded;
+
+    if (bounds.empty())
+    {
+        RemoveBlock(VBM_BLOCK_BOUNDS);
+        return true;
+    }
+
+    return SetBlock(VBM_BLOCK_BOUNDS, &bounds[0], (unsigned int)(bounds.size() * sizeof(VBM_BOUNDS)));
+}
+
+const VBM_BOUNDS * VBObject::GetFrameBounds(unsigned int frame) const
+{
+    unsigned int size = 0;
+    const VBM_BOUNDS * bounds = (const VBM_BOUNDS *)GetBlock(VBM_BLOCK_BOUNDS, &size);
+
+    if (bounds == NULL || frame >= m_header.num_frames)
+        return NULL;
+
+    return bounds + frame;
+}
+
+const VBM_BOUNDS * VBObject::GetChunkBounds(unsigned int chunk) const
+{
+    unsigned int size = 0;
+    const VBM_BOUNDS * bounds = (const VBM_BOUNDS *)GetBlock(VBM_BLOCK_BOUNDS, &size);
+
+    if (bounds == NULL || chunk >= m_header.num_chunks)
+        return NULL;
+
+    return bounds + m_header.num_frames + chunk;
+}
+
+bool VBObject::IntersectRay(const vmath::vec3 & origin, const vmath::vec3 & direction, float * distance, unsigned int frame) const
+{
+    const VBM_BOUNDS * bounds = GetFrameBounds(frame);
+    float dd = vmath::dot(direction, direction);
+    unsigned int i, k;
+
+    if (bounds == NULL || dd == 0.0f || m_frame[frame].count < 3)
+        return false;
+
+    // Miss the sphere between origin and *distance, miss everything
+    vmath::vec3 center(bounds->center[0], bounds->center[1], bounds->center[2]);
+    float t = vmath::dot(center - origin, direction) / dd;
+    t = t < 0.0f ? 0.0f : (t > *distance ? *distance : t);
+    vmath::vec3 closest = origin + direction * t - center;
+
+    if (vmath::dot(closest, closest) > bounds->radius * bounds->radius)
+        return false;
+
+    size_t step;
+    float * decoded;
+    const unsigned char * positions = GetPositions(&step, &decoded);
+
+    if (positions == NULL)
+        return false;
+
+    unsigned int first = m_frame[frame].first;
+    unsigned int count = m_frame[frame].count - m_frame[frame].count % 3;
+    unsigned int limit = m_header.num_indices ? m_header.num_indices : m_header.num_vertices;
+    float nearest = *distance;
+    bool hit = false;
+
+    if (first > limit)
+        first = limit;
+    if (count > limit - first)
+        count = (limit - first) - (limit - first) % 3;
+
+    // Moller-Trumbore, both faces
+    for (i = 0; i < count; i += 3)
+    {
+        const float * p[3];
+
+        for (k = 0; k < 3; k++)
+        {
+            unsigned int v = m_header.num_indices ? GetIndex(first + i + k) : first + i + k;
+            if (v >= m_header.num_vertices)
+                break;
+            p[k] = (const float *)(positions + v * step);
+        }
+
+        if (k != 3)
+            continue;
+
+        vmath::vec3 a(p[0][0], p[0][1], p[0][2]);
+        vmath::vec3 e1 = vmath::vec3(p[1][0], p[1][1], p[1][2]) - a;
+        vmath::vec3 e2 = vmath::vec3(p[2][0], p[2][1], p[2][2]) - a;
+        vmath::vec3 q = vmath::cross(direction, e2);
+        float det = vmath::dot(e1, q);
+
+        if (det == 0.0f)
+            continue;
+
+        float inv_det = 1.0f / det;
+        vmath::vec3 s = origin - a;
+        float u = vmath::dot(s, q) * inv_det;
+
+        if (u < 0.0f || u > 1.0f)
+            continue;
+
+        vmath::vec3 r = vmath::cross(s, e1);
+        float v = vmath::dot(direction, r) * inv_det;
+
+        if (v < 0.0f || u + v > 1.0f)
+            continue;
+
+        float d = vmath::dot(e2, r) * inv_det;
+
+        if (d >= 0.0f && d < nearest)
+        {
+            nearest = d;
+            hit = true;
+        }
+    }
+
+    delete [] decoded;
+
+    if (hit)
+        *distance = nearest;
+
+    return hit;
+}
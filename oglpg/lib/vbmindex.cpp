@@ -0,0 +1,301 @@
+// 16-bit indices for VBObject. Objects with up to 65536 vertices simply store
+// their indices in half the space; larger ones split the index buffer into
+// ranges that each reach no more than 65536 vertices from a base vertex and
+// are drawn with glDrawElementsBaseVertex.
+
+#include "vbm.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+bool VBObject::CompactIndices(void)
+{
+    if (m_header.num_indices == 0 || m_header.index_type == GL_UNSIGNED_SHORT)
+        return true;
+
+    if (m_header.index_type != GL_UNSIGNED_INT)
+        return false;
+
+    unsigned int num_indices = m_header.num_indices;
+    unsigned int num_vertices = m_header.num_vertices;
+    std::vector<unsigned int> indices((const GLuint *)m_index_data, (const GLuint *)m_index_data + num_indices);
+    std::vector<unsigned int> sources;      // Old vertex of each new one, empty while unchanged
+    unsigned int i, v;
+
+    // Ranges may only be split between triangles. Frames, LOD levels and
+    // meshlets all start on one, so triangles are counted from their starts.
+    std::vector<unsigned int> starts;
+
+    for (i = 0; i < m_header.num_frames; i++)
+        starts.push_back(m_frame[i].first);
+
+    unsigned int size = 0;
+    const VBM_LOD * lod = (const VBM_LOD *)GetBlock(VBM_BLOCK_LOD, &size);
+    for (i = 0; lod && i < size / sizeof(VBM_LOD); i++)
+        starts.push_back(lod[i].first);
+
+    const VBM_MESHLET * meshlet = (const VBM_MESHLET *)GetBlock(VBM_BLOCK_MESHLETS, &size);
+    for (i = 0; meshlet && i < size / sizeof(VBM_MESHLET); i++)
+        starts.push_back(meshlet[i].first);
+
+    starts.push_back(0);
+    starts.push_back(num_indices);
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+    // Too many vertices for one range: number them in order of first use
+    // (chunks address vertices directly, so not when there are any). Each
+    // range then only reaches back as far as its triangles do.
+    if (num_vertices > 0x10000 && m_header.num_chunks == 0)
+    {
+        const unsigned int unused = ~0u;
+        std::vector<unsigned int> remap(num_vertices, unused);
+
+        for (i = 0; i < num_indices; i++)
+        {
+            if (indices[i] < num_vertices && remap[indices[i]] == unused)
+            {
+                remap[indices[i]] = (unsigned int)sources.size();
+                sources.push_back(indices[i]);
+            }
+        }
+
+        for (v = 0; v < num_vertices; v++)
+        {
+            if (remap[v] == unused)
+            {
+                remap[v] = (unsigned int)sources.size();
+                sources.push_back(v);
+            }
+        }
+
+        for (i = 0; i < num_indices; i++)
+        {
+            if (indices[i] < num_vertices)
+                indices[i] = remap[indices[i]];
+        }
+    }
+
+    // The odd triangle that spans more than a range on its own moves to the
+    // end of its run, with copies of its vertices appended next to each
+    // other. That way they all share one range.
+    std::vector<unsigned int> far;
+
+    for (unsigned int s = 0; s + 1 < starts.size(); s++)
+    {
+        unsigned int begin = starts[s];
+        unsigned int end = starts[s + 1];
+        unsigned int out = begin;
+
+        far.clear();
+
+        for (unsigned int p = begin; p < end; p += 3)
+        {
+            unsigned int n = std::min(3u, end - p);
+            unsigned int lo = *std::min_element(&indices[p], &indices[p] + n);
+            unsigned int hi = *std::max_element(&indices[p], &indices[p] + n);
+
+            if (hi - lo > 0xFFFF)
+            {
+                far.insert(far.end(), &indices[p], &indices[p] + n);
+                continue;
+            }
+
+            for (i = 0; i < n; i++)
+                indices[out++] = indices[p + i];
+        }
+
+        if (far.empty())
+            continue;
+
+        if (sources.empty())
+        {
+            for (v = 0; v < num_vertices; v++)
+                sources.push_back(v);
+        }
+
+        for (i = 0; i < far.size(); i++)
+        {
+            indices[out++] = (unsigned int)sources.size();
+            sources.push_back(sources[far[i]]);
+        }
+    }
+
+    // Greedily extend each range for as long as its span fits in 16 bits
+    std::vector<VBM_INDEX_RANGE> ranges;
+    VBM_INDEX_RANGE range = { 0, 0, 0 };
+    unsigned int lo = ~0u;
+    unsigned int hi = 0;
+    unsigned int next_start = 0;
+    unsigned int p = 0;
+
+    while (p < num_indices)
+    {
+        while (starts[next_start] <= p)
+            next_start++;
+
+        unsigned int end = std::min(p + 3, starts[next_start]);
+        unsigned int triangle_lo = *std::min_element(&indices[p], &indices[0] + end);
+        unsigned int triangle_hi = *std::max_element(&indices[p], &indices[0] + end);
+
+        if (range.count != 0 && std::max(hi, triangle_hi) - std::min(lo, triangle_lo) > 0xFFFF)
+        {
+            range.base_vertex = hi <= 0xFFFF ? 0 : lo;
+            ranges.push_back(range);
+
+            range.first = p;
+            range.count = 0;
+            lo = ~0u;
+            hi = 0;
+        }
+
+        lo = std::min(lo, triangle_lo);
+        hi = std::max(hi, triangle_hi);
+        range.count += end - p;
+        p = end;
+    }
+
+    range.base_vertex = hi <= 0xFFFF ? 0 : lo;
+    ranges.push_back(range);
+
+    if (!sources.empty())
+    {
+        // Rebuild the vertex data in the object's current layout
+        unsigned int new_count = (unsigned int)sources.size();
+        size_t vertex_size = 0;
+
+        for (i = 0; i < m_header.num_attribs; i++)
+            vertex_size += vbmAttribSize(m_attrib[i]);
+
+        size_t new_size = m_vertex_stride ? (size_t)m_vertex_stride * new_count : vertex_size * new_count;
+        unsigned char * data = new unsigned char [new_size]();
+        size_t dst_offset = 0;
+
+        for (i = 0; i < m_header.num_attribs; i++)
+        {
+            size_t size = vbmAttribSize(m_attrib[i]);
+            size_t step = m_vertex_stride ? m_vertex_stride : size;
+            const unsigned char * src = m_vertex_data + GetAttributeOffset(i);
+            unsigned char * dst = data + (m_vertex_stride ? dst_offset : dst_offset * new_count);
+
+            for (v = 0; v < new_count; v++)
+                memcpy(dst + v * step, src + sources[v] * step, size);
+
+            dst_offset += size;
+        }
+
+        SetConvertedVertexData(data, new_size);
+        m_header.num_vertices = new_count;
+    }
+
+    unsigned short * compact = new unsigned short [num_indices];
+
+    for (unsigned int r = 0; r < ranges.size(); r++)
+    {
+        for (i = ranges[r].first; i < ranges[r].first + ranges[r].count; i++)
+            compact[i] = (unsigned short)(indices[i] - ranges[r].base_vertex);
+    }
+
+    SetConvertedIndexData(compact, num_indices);
+    DisableMeshletCulling();
+
+    // A single range from vertex 0 needs no table
+    if (ranges.size() == 1 && ranges[0].base_vertex == 0)
+        return true;
+
+    return SetBlock(VBM_BLOCK_INDEX_RANGES, &ranges[0], (unsigned int)(ranges.size() * sizeof(VBM_INDEX_RANGE)));
+}
+
+// Index ranges of a 16-bit index buffer, or NULL when every index is
+// relative to vertex 0
+const VBM_INDEX_RANGE * VBObject::GetIndexRanges(unsigned int * count) const
+{
+    unsigned int size = 0;
+    const VBM_INDEX_RANGE * ranges = (const VBM_INDEX_RANGE *)GetBlock(VBM_BLOCK_INDEX_RANGES, &size);
+
+    *count = size / sizeof(VBM_INDEX_RANGE);
+
+    return ranges;
+}
+
+// The range containing element
+unsigned int VBObject::FindIndexRange(const VBM_INDEX_RANGE * ranges, unsigned int count, unsigned int element) const
+{
+    unsigned int lo = 0;
+    unsigned int hi = count;
+
+    // Last range starting at or before element
+    while (hi - lo > 1)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (ranges[mid].first <= element)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Draws count indices from first with the VAO already bound, one draw per
+// index range they touch. Returns the number of draws.
+unsigned int VBObject::DrawIndices(unsigned int first, unsigned int count, unsigned int instances, unsigned int base_instance)
+{
+    GLenum type = m_header.index_type == GL_UNSIGNED_SHORT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    size_t element_size = type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    VBM_INDEX_RANGE whole = { 0, m_header.num_indices, 0 };
+    unsigned int pool_first = GetFirstIndex();
+    unsigned int pool_base = GetBaseVertex();
+    unsigned int num_ranges = 0;
+    const VBM_INDEX_RANGE * ranges = GetIndexRanges(&num_ranges);
+    unsigned int draws = 0;
+
+    if (ranges == NULL)
+    {
+        ranges = &whole;
+        num_ranges = 1;
+    }
+
+    for (unsigned int r = FindIndexRange(ranges, num_ranges, first); r < num_ranges; r++)
+    {
+        unsigned int begin = std::max(first, ranges[r].first);
+        unsigned int end = std::min(first + count, ranges[r].first + ranges[r].count);
+
+        if (begin >= end)
+            break;
+
+        GLsizei n = end - begin;
+        const GLvoid * offset = BUFFER_OFFSET((begin + pool_first) * element_size);
+        GLint base_vertex = ranges[r].base_vertex + pool_base;
+
+        // Only ask for base vertex support when it is needed
+        if (base_instance)
+        {
+            if (base_vertex)
+                glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, n, type, offset, instances ? instances : 1, base_vertex, base_instance);
+            else
+                glDrawElementsInstancedBaseInstance(GL_TRIANGLES, n, type, offset, instances ? instances : 1, base_instance);
+        }
+        else if (instances)
+        {
+            if (base_vertex)
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, n, type, offset, instances, base_vertex);
+            else
+                glDrawElementsInstanced(GL_TRIANGLES, n, type, offset, instances);
+        }
+        else
+        {
+            if (base_vertex)
+                glDrawElementsBaseVertex(GL_TRIANGLES, n, type, (GLvoid *)offset, base_vertex);
+            else
+                glDrawElements(GL_TRIANGLES, n, type, offset);
+        }
+
+        draws++;
+    }
+
+    return draws;
+}
@@ -0,0 +1,131 @@
+#include "vbmloader.h"
+
+#include <stdio.h>
+#include <chrono>
+
+static double vbmLoaderNow(void)
+{
+    using namespace std::chrono;
+
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+VBMAsyncLoader::VBMAsyncLoader(VThreadPool * pool)
+    : m_pool(pool ? pool : &VThreadPool::GetDefault()),
+      m_start(vbmLoaderNow()),
+      m_in_flight(0),
+      m_pending(0)
+{
+
+}
+
+VBMAsyncLoader::~VBMAsyncLoader(void)
+{
+    // Workers hold pointers to this object; let them finish
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_in_flight != 0)
+        m_worker_done.wait(lock);
+
+    while (!m_ready.empty())
+    {
+        delete m_ready.front();
+        m_ready.pop_front();
+    }
+}
+
+double VBMAsyncLoader::GetTime(void) const
+{
+    return vbmLoaderNow() - m_start;
+}
+
+void VBMAsyncLoader::Load(VBObject * object, const char * filename,
+                          int vertexIndex, int normalIndex, int texCoord0Index,
+                          unsigned int flags,
+                          const Callback & callback)
+{
+    Request * request = new Request;
+
+    request->object = object;
+    request->vertexIndex = vertexIndex;
+    request->normalIndex = normalIndex;
+    request->texCoord0Index = texCoord0Index;
+    request->flags = flags;
+    request->callback = callback;
+    request->stats.filename = filename;
+    request->stats.success = false;
+    request->stats.queued = GetTime();
+    request->stats.mapped = 0.0;
+    request->stats.uploaded = 0.0;
+
+    m_pending++;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_in_flight++;
+    }
+
+    m_pool->Submit([this, request]()
+    {
+        request->stats.success = request->object->MapVBM(request->stats.filename.c_str(), request->flags);
+        request->stats.mapped = GetTime();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.push_back(request);
+        m_in_flight--;
+        m_worker_done.notify_all();
+    });
+}
+
+unsigned int VBMAsyncLoader::Update(double budget_ms)
+{
+    double start = vbmLoaderNow();
+    unsigned int uploaded = 0;
+
+    for (;;)
+    {
+        if (uploaded != 0 && vbmLoaderNow() - start >= budget_ms)
+            break;
+
+        Request * request;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (m_ready.empty())
+                break;
+
+            request = m_ready.front();
+            m_ready.pop_front();
+        }
+
+        if (request->stats.success)
+            request->stats.success = request->object->UploadVBM(request->vertexIndex, request->normalIndex, request->texCoord0Index);
+        request->stats.uploaded = GetTime();
+
+        m_pending--;
+        m_stats.push_back(request->stats);
+
+        if (request->callback)
+            request->callback(request->object, request->stats);
+
+        delete request;
+        uploaded++;
+    }
+
+    return uploaded;
+}
+
+void VBMAsyncLoader::PrintStats(FILE * f) const
+{
+    fprintf(f, "%-32s %10s %10s %10s %10s\n", "file", "queued", "mapped", "uploaded", "latency");
+
+    for (size_t i = 0; i < m_stats.size(); i++)
+    {
+        const VBMLoadStats & s = m_stats[i];
+
+        fprintf(f, "%-32s %10.2f %10.2f %10.2f %10.2f%s\n",
+                s.filename.c_str(), s.queued, s.mapped, s.uploaded, s.GetLatency(),
+                s.success ? "" : " FAILED");
+    }
+}
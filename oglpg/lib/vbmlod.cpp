@@ -0,0 +1,479 @@
+// Level of detail generation and selection for VBObject. Levels come from a
+// quadric error metric edge collapse simplifier (Garland and Heckbert,
+// "Surface Simplification Using Quadric Error Metrics"). Vertices are only
+// ever collapsed onto other existing vertices, so every level indexes the
+// same vertex data and switching levels is just a different index range.
+
+#include "vbm.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Symmetric 4x4 matrix of the summed squared distances to a set of planes
+struct vbmQuadric
+{
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+};
+
+static void vbmQuadricAddPlane(vbmQuadric & q, double a, double b, double c, double d, double weight)
+{
+    q.a00 += weight * a * a; q.a01 += weight * a * b; q.a02 += weight * a * c; q.a03 += weight * a * d;
+    q.a11 += weight * b * b; q.a12 += weight * b * c; q.a13 += weight * b * d;
+    q.a22 += weight * c * c; q.a23 += weight * c * d;
+    q.a33 += weight * d * d;
+}
+
+static void vbmQuadricAdd(vbmQuadric & q, const vbmQuadric & r)
+{
+    q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+    q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+    q.a22 += r.a22; q.a23 += r.a23;
+    q.a33 += r.a33;
+}
+
+static double vbmQuadricError(const vbmQuadric & q, const float * p)
+{
+    double x = p[0], y = p[1], z = p[2];
+
+    double error = q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x +
+                   q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y +
+                   q.a22 * z * z + 2.0 * q.a23 * z +
+                   q.a33;
+
+    return error > 0.0 ? error : 0.0;
+}
+
+static void vbmTriangleNormal(const float * a, const float * b, const float * c, double * n)
+{
+    double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+struct vbmCollapse
+{
+    double cost;
+    unsigned int source;
+    unsigned int target;
+
+    bool operator<(const vbmCollapse & other) const
+    {
+        return cost < other.cost;
+    }
+};
+
+// Simplifies indices in place until at most target_count triangles are left
+// or nothing more can be collapsed. Quadrics and weights accumulate across
+// calls, so consecutive levels measure their error against the original.
+// Returns the largest error of any collapse, in model units.
+static double vbmSimplify(std::vector<unsigned int> & indices, const float * positions, unsigned int vertex_count,
+                          const std::vector<bool> & locked, std::vector<vbmQuadric> & quadrics,
+                          std::vector<double> & weights, unsigned int target_count)
+{
+    double max_error = 0.0;
+    std::vector<unsigned int> offsets(vertex_count + 1);
+    std::vector<unsigned int> adjacency;
+    std::vector<unsigned int> remap(vertex_count);
+    std::vector<bool> touched(vertex_count);
+    std::vector<vbmCollapse> collapses;
+    std::vector<unsigned int> neighbours;
+
+    while (indices.size() / 3 > target_count)
+    {
+        unsigned int index_count = (unsigned int)indices.size();
+        unsigned int triangle_count = index_count / 3;
+        unsigned int i, j, v;
+
+        // Triangles around each vertex
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (i = 0; i < index_count; i++)
+            offsets[indices[i] + 1]++;
+        for (v = 0; v < vertex_count; v++)
+            offsets[v + 1] += offsets[v];
+
+        adjacency.resize(index_count);
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (i = 0; i < index_count; i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+
+        // Every directed edge whose source may move
+        collapses.clear();
+
+        for (i = 0; i < index_count; i++)
+        {
+            unsigned int a = indices[i];
+            unsigned int b = indices[i - i % 3 + (i + 1) % 3];
+
+            for (unsigned int k = 0; k < 2; k++, std::swap(a, b))
+            {
+                if (locked[a])
+                    continue;
+
+                vbmQuadric q = quadrics[a];
+                vbmQuadricAdd(q, quadrics[b]);
+
+                double weight = weights[a] + weights[b];
+                vbmCollapse collapse = { weight > 0.0 ? vbmQuadricError(q, positions + b * 4) / weight : 0.0, a, b };
+                collapses.push_back(collapse);
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end());
+
+        for (v = 0; v < vertex_count; v++)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), false);
+
+        unsigned int needed = triangle_count - target_count;
+        unsigned int removed = 0;
+        unsigned int performed = 0;
+
+        // Collapses block their neighbours for the rest of the pass, so a pass
+        // that ran down the whole list would end up taking expensive ones
+        // while cheap ones wait for the next pass. Cap the cost at what the
+        // cheapest collapses needed would cost, unless nothing fits under it.
+        double limit = collapses.empty() ? 0.0 : collapses[std::min((size_t)needed, collapses.size() - 1)].cost;
+
+        for (i = 0; i < collapses.size() && removed < needed; i++)
+        {
+            unsigned int s = collapses[i].source;
+            unsigned int t = collapses[i].target;
+
+            if (touched[s] || touched[t])
+                continue;
+
+            if (collapses[i].cost > limit && performed > 0)
+                break;
+
+            // Triangles around s must not flip or degenerate once s moves
+            // to t; count the ones on the edge, which disappear
+            unsigned int edge_triangles = 0;
+            bool valid = true;
+
+            for (j = offsets[s]; j < offsets[s + 1] && valid; j++)
+            {
+                const unsigned int * tri = &indices[adjacency[j] * 3];
+
+                if (tri[0] == t || tri[1] == t || tri[2] == t)
+                {
+                    edge_triangles++;
+                    continue;
+                }
+
+                double before[3], after[3];
+                const float * p[3];
+                for (unsigned int k = 0; k < 3; k++)
+                    p[k] = positions + tri[k] * 4;
+
+                vbmTriangleNormal(p[0], p[1], p[2], before);
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    if (tri[k] == s)
+                        p[k] = positions + t * 4;
+                }
+                vbmTriangleNormal(p[0], p[1], p[2], after);
+
+                double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+                double length = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                                sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+
+                valid = dot > 0.25 * length;
+            }
+
+            if (!valid || edge_triangles == 0)
+                continue;
+
+            // Link condition: the only vertices both ends may share are the
+            // apexes of the triangles on the edge, or the collapse would pinch
+            // the surface into a non-manifold shape
+            neighbours.clear();
+            for (j = offsets[s]; j < offsets[s + 1]; j++)
+                neighbours.insert(neighbours.end(), &indices[adjacency[j] * 3], &indices[adjacency[j] * 3] + 3);
+
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+            size_t s_count = neighbours.size();
+
+            for (j = offsets[t]; j < offsets[t + 1]; j++)
+                neighbours.insert(neighbours.end(), &indices[adjacency[j] * 3], &indices[adjacency[j] * 3] + 3);
+
+            std::sort(neighbours.begin() + s_count, neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin() + s_count, neighbours.end()), neighbours.end());
+
+            // Both lists contain s and t themselves
+            unsigned int shared = 0;
+            for (size_t n = s_count; n < neighbours.size(); n++)
+            {
+                if (std::binary_search(neighbours.begin(), neighbours.begin() + s_count, neighbours[n]))
+                    shared++;
+            }
+
+            if (shared - 2 > edge_triangles)
+                continue;
+
+            remap[s] = t;
+            vbmQuadricAdd(quadrics[t], quadrics[s]);
+            weights[t] += weights[s];
+
+            if (collapses[i].cost > max_error)
+                max_error = collapses[i].cost;
+
+            // Keep later collapses in this pass away from the triangles this
+            // one changed, so that their checks stay valid
+            for (j = offsets[s]; j < offsets[s + 1]; j++)
+            {
+                const unsigned int * tri = &indices[adjacency[j] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+
+            removed += edge_triangles;
+            performed++;
+        }
+
+        if (performed == 0)
+            break;
+
+        // Apply the collapses and drop the triangles that became degenerate
+        unsigned int write = 0;
+
+        for (i = 0; i < index_count; i += 3)
+        {
+            unsigned int a = remap[indices[i + 0]];
+            unsigned int b = remap[indices[i + 1]];
+            unsigned int c = remap[indices[i + 2]];
+
+            if (a == b || b == c || c == a)
+                continue;
+
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+
+        indices.resize(write);
+    }
+
+    return sqrt(max_error);
+}
+
+bool VBObject::GenerateLODs(unsigned int levels, float ratio)
+{
+    if (m_attrib == NULL || levels == 0 || m_header.num_frames == 0 || ratio <= 0.0f || ratio >= 1.0f)
+        return false;
+
+    if (m_header.num_indices == 0 && !Optimize())
+        return false;
+
+    unsigned int num_vertices = m_header.num_vertices;
+    unsigned int i, v;
+
+    // Regenerating replaces the levels appended last time
+    unsigned int lod_size = 0;
+    const VBM_LOD * old_lod = (const VBM_LOD *)GetBlock(VBM_BLOCK_LOD, &lod_size);
+    unsigned int base_count = m_header.num_indices;
+
+    if (old_lod && lod_size >= 2 * sizeof(VBM_LOD))
+        base_count = old_lod[1].first;
+
+    std::vector<float> positions(num_vertices * 4);
+    if (!DecodeAttribute(0, &positions[0]))
+        return false;
+
+    std::vector<unsigned int> current(m_frame[0].count);
+    for (i = 0; i < m_frame[0].count; i++)
+    {
+        current[i] = GetIndex(m_frame[0].first + i);
+        if (current[i] >= num_vertices)
+            return false;
+    }
+
+    // Vertices that share a position are split by their other attributes
+    // (UV or normal seams), and those on open borders outline the mesh.
+    // Moving either would tear the surface, so both stay put.
+    std::vector<unsigned int> by_position(num_vertices);
+    for (v = 0; v < num_vertices; v++)
+        by_position[v] = v;
+
+    std::sort(by_position.begin(), by_position.end(), [&positions](unsigned int a, unsigned int b)
+    {
+        return memcmp(&positions[a * 4], &positions[b * 4], 3 * sizeof(float)) < 0;
+    });
+
+    std::vector<unsigned int> position_id(num_vertices);
+    std::vector<unsigned int> position_count;
+
+    for (i = 0; i < num_vertices; i++)
+    {
+        if (i == 0 || memcmp(&positions[by_position[i] * 4], &positions[by_position[i - 1] * 4], 3 * sizeof(float)) != 0)
+            position_count.push_back(0);
+
+        position_id[by_position[i]] = (unsigned int)position_count.size() - 1;
+        position_count.back()++;
+    }
+
+    std::vector<bool> locked(num_vertices, false);
+    std::vector<unsigned long long> edges;
+
+    for (i = 0; i < current.size(); i++)
+    {
+        unsigned int a = position_id[current[i]];
+        unsigned int b = position_id[current[i - i % 3 + (i + 1) % 3]];
+        edges.push_back(a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a);
+    }
+
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> border_position(position_count.size(), false);
+
+    for (i = 0; i < edges.size(); i++)
+    {
+        bool single = (i == 0 || edges[i - 1] != edges[i]) && (i + 1 == edges.size() || edges[i + 1] != edges[i]);
+
+        if (single)
+        {
+            border_position[(unsigned int)(edges[i] >> 32)] = true;
+            border_position[(unsigned int)(edges[i] & 0xFFFFFFFF)] = true;
+        }
+    }
+
+    for (v = 0; v < num_vertices; v++)
+        locked[v] = position_count[position_id[v]] > 1 || border_position[position_id[v]];
+
+    // Plane quadrics, area weighted so that the error is a mean squared
+    // distance rather than depending on the tessellation
+    vbmQuadric zero;
+    memset(&zero, 0, sizeof(zero));
+
+    std::vector<vbmQuadric> quadrics(num_vertices, zero);
+    std::vector<double> weights(num_vertices, 0.0);
+
+    for (i = 0; i + 2 < current.size(); i += 3)
+    {
+        const float * a = &positions[current[i + 0] * 4];
+        const float * b = &positions[current[i + 1] * 4];
+        const float * c = &positions[current[i + 2] * 4];
+        double n[3];
+
+        vbmTriangleNormal(a, b, c, n);
+
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0)
+            continue;
+
+        double area = length * 0.5;
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+
+        double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            vbmQuadricAddPlane(quadrics[current[i + k]], n[0], n[1], n[2], d, area);
+            weights[current[i + k]] += area;
+        }
+    }
+
+    // Level 0 is frame 0 as it is
+    std::vector<VBM_LOD> lods;
+    VBM_LOD base = { m_frame[0].first, m_frame[0].count, 0.0f };
+    lods.push_back(base);
+
+    std::vector<unsigned int> appended;
+    double error = 0.0;
+
+    for (unsigned int level = 1; level < levels; level++)
+    {
+        unsigned int target = (unsigned int)(current.size() / 3 * ratio);
+        size_t before = current.size();
+
+        error = std::max(error, vbmSimplify(current, &positions[0], num_vertices, locked, quadrics, weights, target));
+
+        // Stop when the simplifier gets stuck (everything left is locked)
+        // well short of the target; such a level saves too little to be
+        // worth its indices
+        if (current.empty() || current.size() > before * (1.0f + ratio) / 2)
+            break;
+
+        VBM_LOD lod = { base_count + (unsigned int)appended.size(), (unsigned int)current.size(), (float)error };
+        lods.push_back(lod);
+        appended.insert(appended.end(), current.begin(), current.end());
+    }
+
+    unsigned int total = base_count + (unsigned int)appended.size();
+    unsigned int * indices = new unsigned int [total];
+
+    for (i = 0; i < base_count; i++)
+        indices[i] = GetIndex(i);
+    if (!appended.empty())
+        memcpy(indices + base_count, &appended[0], appended.size() * sizeof(unsigned int));
+
+    SetConvertedIndexData(indices, total);
+
+    return SetBlock(VBM_BLOCK_LOD, &lods[0], (unsigned int)(lods.size() * sizeof(VBM_LOD)));
+}
+
+unsigned int VBObject::GetLODCount(void) const
+{
+    unsigned int size = 0;
+
+    if (GetBlock(VBM_BLOCK_LOD, &size) == NULL || size < sizeof(VBM_LOD))
+        return 1;
+
+    return size / sizeof(VBM_LOD);
+}
+
+float VBObject::GetLODError(unsigned int lod) const
+{
+    const VBM_LOD * table = (const VBM_LOD *)GetBlock(VBM_BLOCK_LOD);
+
+    if (table == NULL || lod >= GetLODCount())
+        return 0.0f;
+
+    return table[lod].error;
+}
+
+unsigned int VBObject::SelectLOD(float distance, float projection_scale, float pixel_error) const
+{
+    unsigned int count = GetLODCount();
+
+    if (distance <= 0.0f)
+        return 0;
+
+    for (unsigned int lod = count - 1; lod > 0; lod--)
+    {
+        if (GetLODError(lod) * projection_scale / distance <= pixel_error)
+            return lod;
+    }
+
+    return 0;
+}
+
+void VBObject::RenderLOD(unsigned int lod, unsigned int instances, unsigned int base_instance)
+{
+    const VBM_LOD * table = (const VBM_LOD *)GetBlock(VBM_BLOCK_LOD);
+
+    // The object itself is its only level
+    if (table == NULL || m_header.num_indices == 0)
+    {
+        Render(0, instances, base_instance);
+        return;
+    }
+
+    if (lod >= GetLODCount())
+        lod = GetLODCount() - 1;
+
+    glBindVertexArray(m_vao);
+    DrawIndices(table[lod].first, table[lod].count, instances, base_instance);
+    glBindVertexArray(0);
+}
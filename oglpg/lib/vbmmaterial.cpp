@@ -0,0 +1,596 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "vbmmaterial.h"
+#include "vbcn.h"
+#include "vmipgen.h"
+#include "vmmap.h"
+#include "vthread.h"
+#include "vermilion.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <map>
+
+// A map as loaded, before scaling, and where it goes
+struct vbmSourceMap
+{
+    std::string path;
+    unsigned int kind;
+    int layer;
+    unsigned int width;
+    unsigned int height;
+    std::vector<unsigned char> rgba;
+};
+
+// Uncompressed and RLE TGA, grayscale or true color, to RGBA8 with the
+// bottom row first as GL expects
+static bool vbmLoadTGA(const char * filename, std::vector<unsigned char> & rgba, unsigned int & width, unsigned int & height)
+{
+    VMappedFile file;
+
+    if (!file.Open(filename) || file.GetSize() < 18)
+        return false;
+
+    const unsigned char * data = file.GetData();
+    const unsigned char * end = data + file.GetSize();
+    unsigned int type = data[2] & 7;
+    unsigned int bytes = data[16] / 8;
+    bool rle = (data[2] & 8) != 0;
+    bool top_down = (data[17] & 0x20) != 0;
+
+    width = data[12] | (data[13] << 8);
+    height = data[14] | (data[15] << 8);
+
+    // No color mapped images
+    if (data[1] != 0 || width == 0 || height == 0 ||
+        !((type == 3 && bytes == 1) || (type == 2 && (bytes == 3 || bytes == 4))))
+        return false;
+
+    const unsigned char * p = data + 18 + data[0];
+    size_t pixels = (size_t)width * height;
+    size_t n = 0;
+
+    rgba.resize(pixels * 4);
+
+    while (n < pixels)
+    {
+        size_t count = pixels - n;
+        bool repeat = false;
+
+        if (rle)
+        {
+            if (p >= end)
+                return false;
+            repeat = (*p & 0x80) != 0;
+            count = (*p++ & 0x7F) + 1;
+            if (count > pixels - n)
+                return false;
+        }
+
+        if ((size_t)(end - p) < (repeat ? 1 : count) * bytes)
+            return false;
+
+        for (size_t i = 0; i < count; i++, n++)
+        {
+            const unsigned char * texel = repeat ? p : p + i * bytes;
+            unsigned char * out = &rgba[n * 4];
+
+            if (bytes == 1)
+            {
+                out[0] = out[1] = out[2] = texel[0];
+                out[3] = 255;
+            }
+            else
+            {
+                out[0] = texel[2];
+                out[1] = texel[1];
+                out[2] = texel[0];
+                out[3] = bytes == 4 ? texel[3] : 255;
+            }
+        }
+
+        p += (repeat ? 1 : count) * bytes;
+    }
+
+    if (top_down)
+    {
+        size_t pitch = (size_t)width * 4;
+        std::vector<unsigned char> row(pitch);
+
+        for (unsigned int y = 0; y < height / 2; y++)
+        {
+            unsigned char * a = &rgba[y * pitch];
+            unsigned char * b = &rgba[(height - 1 - y) * pitch];
+
+            memcpy(&row[0], a, pitch);
+            memcpy(a, b, pitch);
+            memcpy(b, &row[0], pitch);
+        }
+    }
+
+    return true;
+}
+
+// Top mip of an uncompressed 8-bit or a block-compressed DDS file, in the
+// row order vglLoadTexture would upload it in
+static bool vbmLoadDDS(const char * filename, std::vector<unsigned char> & rgba, unsigned int & width, unsigned int & height)
+{
+    vglImageData image;
+    vglLoadImage(filename, &image);
+
+    VBCnCodec::Format format;
+    bool srgb;
+
+    if (image.mip[0].data != NULL && image.target == GL_TEXTURE_2D && VBCnCodec::GetFormat(image.internalFormat, format, srgb))
+    {
+        width = image.mip[0].width;
+        height = image.mip[0].height;
+        rgba.resize((size_t)width * height * 4);
+
+        // Maps are already loaded in parallel, so this one's blocks aren't
+        VBCnCodec::Decode(format, (const unsigned char *)image.mip[0].data, width, height, &rgba[0]);
+        vglUnloadImage(&image);
+
+        return true;
+    }
+
+    unsigned int components = image.format == GL_RED ? 1 : (image.format == GL_RGBA || image.format == GL_BGRA ? 4 : 0);
+    bool ok = image.mip[0].data != NULL && image.target == GL_TEXTURE_2D && image.type == GL_UNSIGNED_BYTE &&
+              components != 0 && image.mip[0].width > 0 && image.mip[0].height > 0 &&
+              image.totalDataSize >= (GLsizeiptr)image.mip[0].width * image.mip[0].height * components;
+
+    if (ok)
+    {
+        const unsigned char * texels = (const unsigned char *)image.mip[0].data;
+        size_t pixels;
+
+        width = image.mip[0].width;
+        height = image.mip[0].height;
+        pixels = (size_t)width * height;
+        rgba.resize(pixels * 4);
+
+        for (size_t i = 0; i < pixels; i++)
+        {
+            const unsigned char * texel = texels + i * components;
+            unsigned char * out = &rgba[i * 4];
+
+            if (components == 1)
+            {
+                out[0] = out[1] = out[2] = texel[0];
+                out[3] = 255;
+            }
+            else
+            {
+                bool bgra = image.format == GL_BGRA;
+                out[0] = texel[bgra ? 2 : 0];
+                out[1] = texel[1];
+                out[2] = texel[bgra ? 0 : 2];
+                out[3] = texel[3];
+            }
+        }
+    }
+
+    if (image.mip[0].data != NULL)
+        vglUnloadImage(&image);
+
+    return ok;
+}
+
+static bool vbmHasExtension(const std::string & path, const char * extension)
+{
+    size_t length = strlen(extension);
+
+    if (path.size() < length)
+        return false;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = path[path.size() - length + i];
+        if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != extension[i])
+            return false;
+    }
+
+    return true;
+}
+
+// Source texels and weights for each destination texel along one axis:
+// the destination texel's footprint as a box when shrinking, the two
+// nearest source texels interpolated linearly when growing. Both come out
+// as taps texels per destination texel, indices clamped to the edge.
+static unsigned int vbmFilterWeights(unsigned int source, unsigned int destination,
+                                     std::vector<unsigned int> & indices, std::vector<float> & weights)
+{
+    double scale = (double)source / destination;
+    unsigned int taps = scale > 1.0 ? (unsigned int)ceil(scale) + 1 : 2;
+
+    indices.assign((size_t)destination * taps, 0);
+    weights.assign((size_t)destination * taps, 0.0f);
+
+    for (unsigned int x = 0; x < destination; x++)
+    {
+        unsigned int * index = &indices[(size_t)x * taps];
+        float * weight = &weights[(size_t)x * taps];
+
+        if (scale > 1.0)
+        {
+            double begin = x * scale;
+            double end = begin + scale;
+            unsigned int first = (unsigned int)begin;
+
+            for (unsigned int t = 0; t < taps; t++)
+            {
+                unsigned int i = first + t;
+                double covered = (end < i + 1.0 ? end : i + 1.0) - (begin > i ? begin : (double)i);
+
+                index[t] = i < source ? i : source - 1;
+                weight[t] = covered > 0.0 ? (float)(covered / scale) : 0.0f;
+            }
+        }
+        else
+        {
+            double center = (x + 0.5) * scale - 0.5;
+            double below = floor(center);
+            int i = (int)below;
+
+            index[0] = i < 0 ? 0 : (unsigned int)i;
+            index[1] = i + 1 >= (int)source ? source - 1 : (unsigned int)(i + 1);
+            weight[1] = (float)(center - below);
+            weight[0] = 1.0f - weight[1];
+        }
+    }
+
+    return taps;
+}
+
+// Separable resampling of an RGBA8 image, rows first
+static void vbmResize(const unsigned char * source, unsigned int width, unsigned int height,
+                      unsigned char * destination, unsigned int new_width, unsigned int new_height)
+{
+    if (width == new_width && height == new_height)
+    {
+        memcpy(destination, source, (size_t)width * height * 4);
+        return;
+    }
+
+    std::vector<unsigned int> indices;
+    std::vector<float> weights;
+    std::vector<float> rows((size_t)new_width * height * 4);
+    unsigned int taps = vbmFilterWeights(width, new_width, indices, weights);
+    unsigned int x, y, t, c;
+
+    for (y = 0; y < height; y++)
+    {
+        const unsigned char * in = source + (size_t)y * width * 4;
+        float * out = &rows[(size_t)y * new_width * 4];
+
+        for (x = 0; x < new_width; x++)
+        {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            for (t = 0; t < taps; t++)
+            {
+                const unsigned char * texel = in + indices[x * taps + t] * 4;
+                float weight = weights[x * taps + t];
+
+                for (c = 0; c < 4; c++)
+                    sum[c] += texel[c] * weight;
+            }
+
+            for (c = 0; c < 4; c++)
+                out[x * 4 + c] = sum[c];
+        }
+    }
+
+    taps = vbmFilterWeights(height, new_height, indices, weights);
+
+    for (y = 0; y < new_height; y++)
+    {
+        unsigned char * out = destination + (size_t)y * new_width * 4;
+
+        for (x = 0; x < new_width * 4; x++)
+        {
+            float sum = 0.0f;
+
+            for (t = 0; t < taps; t++)
+                sum += rows[(size_t)indices[y * taps + t] * new_width * 4 + x] * weights[y * taps + t];
+
+            out[x] = (unsigned char)(sum < 0.0f ? 0 : (sum > 255.0f ? 255 : (int)(sum + 0.5f)));
+        }
+    }
+}
+
+VBMaterialArrays::VBMaterialArrays(void)
+    : m_layer_buffer(0)
+{
+    for (unsigned int k = 0; k < KIND_COUNT; k++)
+    {
+        m_arrays[k].width = 0;
+        m_arrays[k].height = 0;
+        m_arrays[k].layers = 0;
+        memset(&m_arrays[k].mips, 0, sizeof(m_arrays[k].mips));
+        m_textures[k] = 0;
+    }
+}
+
+VBMaterialArrays::~VBMaterialArrays(void)
+{
+    Free();
+}
+
+bool VBMaterialArrays::Load(const VBObject & object, const char * directory, unsigned int max_size, VThreadPool * pool)
+{
+    unsigned int num_materials = object.GetMaterialCount();
+    unsigned int m, k;
+
+    Free();
+
+    if (num_materials == 0 || max_size == 0)
+        return false;
+
+    if (pool == NULL)
+        pool = &VThreadPool::GetDefault();
+
+    // Every distinct map, and which of them each material uses
+    std::vector<vbmSourceMap> maps;
+    std::map<std::string, unsigned int> found[KIND_COUNT];
+    std::vector<int> uses(num_materials * KIND_COUNT, -1);
+
+    for (m = 0; m < num_materials; m++)
+    {
+        const char * names[KIND_COUNT] =
+        {
+            object.GetMaterialDiffuseMapName(m),
+            object.GetMaterialSpecularMapName(m),
+            object.GetMaterialNormalMapName(m)
+        };
+
+        for (k = 0; k < KIND_COUNT; k++)
+        {
+            // The names are fixed size fields that need not be terminated
+            size_t length = strnlen(names[k], sizeof(VBM_MATERIAL::diffuse_map));
+
+            if (length == 0)
+                continue;
+
+            std::string path = directory && directory[0] ? std::string(directory) + "/" : std::string();
+            path.append(names[k], length);
+
+            for (size_t i = 0; i < path.size(); i++)
+            {
+                if (path[i] == '\\')
+                    path[i] = '/';
+            }
+
+            std::map<std::string, unsigned int>::iterator it = found[k].find(path);
+
+            if (it == found[k].end())
+            {
+                it = found[k].insert(std::make_pair(path, (unsigned int)maps.size())).first;
+                maps.push_back(vbmSourceMap());
+                maps.back().path = path;
+                maps.back().kind = k;
+                maps.back().layer = -1;
+                maps.back().width = 0;
+                maps.back().height = 0;
+            }
+
+            uses[m * KIND_COUNT + k] = (int)it->second;
+        }
+    }
+
+    pool->ParallelFor((unsigned int)maps.size(), 1, [&maps](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            vbmSourceMap & map = maps[i];
+            bool ok = vbmHasExtension(map.path, ".dds") ? vbmLoadDDS(map.path.c_str(), map.rgba, map.width, map.height)
+                                                        : vbmLoadTGA(map.path.c_str(), map.rgba, map.width, map.height);
+
+            if (!ok)
+                std::vector<unsigned char>().swap(map.rgba);
+        }
+    });
+
+    // Layers in order of first use, and each array as big as its biggest map
+    for (size_t i = 0; i < maps.size(); i++)
+    {
+        vbmSourceMap & map = maps[i];
+        array & a = m_arrays[map.kind];
+
+        if (map.rgba.empty())
+        {
+            m_missing.push_back(map.path);
+            continue;
+        }
+
+        map.layer = (int)a.layers++;
+        a.width = map.width > a.width ? map.width : a.width;
+        a.height = map.height > a.height ? map.height : a.height;
+    }
+
+    std::vector<unsigned char> texels[KIND_COUNT];
+
+    for (k = 0; k < KIND_COUNT; k++)
+    {
+        array & a = m_arrays[k];
+
+        a.width = a.width < max_size ? a.width : max_size;
+        a.height = a.height < max_size ? a.height : max_size;
+        texels[k].resize((size_t)a.width * a.height * 4 * a.layers);
+    }
+
+    array * arrays = m_arrays;
+
+    pool->ParallelFor((unsigned int)maps.size(), 1, [&maps, &texels, arrays](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            vbmSourceMap & map = maps[i];
+            array & a = arrays[map.kind];
+
+            if (map.layer < 0)
+                continue;
+
+            vbmResize(&map.rgba[0], map.width, map.height,
+                      &texels[map.kind][(size_t)a.width * a.height * 4 * map.layer], a.width, a.height);
+            std::vector<unsigned char>().swap(map.rgba);
+        }
+    });
+
+    // Mipmaps, the layers' tiles spread over the pool, so that Upload
+    // doesn't have to wait for glGenerateMipmap
+    for (k = 0; k < KIND_COUNT; k++)
+    {
+        array & a = m_arrays[k];
+        vglImageData top;
+
+        if (a.layers == 0)
+            continue;
+
+        memset(&top, 0, sizeof(top));
+        top.target = GL_TEXTURE_2D_ARRAY;
+        top.internalFormat = GL_RGBA8;
+        top.format = GL_RGBA;
+        top.type = GL_UNSIGNED_BYTE;
+        top.mipLevels = 1;
+        top.slices = (GLsizei)a.layers;
+        top.mip[0].width = (GLsizei)a.width;
+        top.mip[0].height = (GLsizei)a.height;
+        top.mip[0].depth = 1;
+        top.mip[0].mipStride = (GLsizeiptr)a.width * a.height * 4;
+        top.mip[0].data = &texels[k][0];
+        top.sliceStride = top.mip[0].mipStride;
+        top.totalDataSize = (GLsizeiptr)texels[k].size();
+
+        VMipGenerator::Generate(top, a.mips, VMipGenerator::KAISER, -1.0f, pool);
+        std::vector<unsigned char>().swap(texels[k]);
+    }
+
+    m_layers.resize(num_materials);
+
+    for (m = 0; m < num_materials; m++)
+    {
+        int layers[KIND_COUNT];
+
+        for (k = 0; k < KIND_COUNT; k++)
+            layers[k] = uses[m * KIND_COUNT + k] >= 0 ? maps[uses[m * KIND_COUNT + k]].layer : -1;
+
+        m_layers[m].diffuse = layers[DIFFUSE];
+        m_layers[m].specular = layers[SPECULAR];
+        m_layers[m].normal = layers[NORMAL];
+        m_layers[m].reserved = 0;
+    }
+
+    return true;
+}
+
+bool VBMaterialArrays::Upload(void)
+{
+    if (m_layers.empty())
+        return false;
+
+    for (unsigned int k = 0; k < KIND_COUNT; k++)
+    {
+        array & a = m_arrays[k];
+
+        if (a.mips.mip[0].data == NULL || m_textures[k] != 0)
+            continue;
+
+        glGenTextures(1, &m_textures[k]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_textures[k]);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, a.mips.mipLevels, GL_RGBA8, a.width, a.height, a.layers);
+
+        // Layers keep their mipmaps together, so each level of each layer
+        // goes in on its own
+        for (GLint level = 0; level < a.mips.mipLevels; level++)
+        {
+            const vglImageMipData & mip = a.mips.mip[level];
+
+            for (unsigned int layer = 0; layer < a.layers; layer++)
+            {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mip.width, mip.height, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                                (const unsigned char *)mip.data + (size_t)a.mips.sliceStride * layer);
+            }
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+        // GL has its own copy now
+        vglUnloadImage(&a.mips);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (m_layer_buffer == 0)
+    {
+        glGenBuffers(1, &m_layer_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_layer_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_layers.size() * sizeof(VBM_MATERIAL_LAYERS), &m_layers[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    return true;
+}
+
+void VBMaterialArrays::Bind(GLuint first_unit, GLuint binding) const
+{
+    for (unsigned int k = KIND_COUNT; k-- > 0; )
+    {
+        glActiveTexture(GL_TEXTURE0 + first_unit + k);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_textures[k]);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_layer_buffer);
+}
+
+void VBMaterialArrays::Free(void)
+{
+    for (unsigned int k = 0; k < KIND_COUNT; k++)
+    {
+        if (m_textures[k] != 0)
+            glDeleteTextures(1, &m_textures[k]);
+        m_textures[k] = 0;
+
+        m_arrays[k].width = 0;
+        m_arrays[k].height = 0;
+        m_arrays[k].layers = 0;
+        if (m_arrays[k].mips.mip[0].data != NULL)
+            vglUnloadImage(&m_arrays[k].mips);
+    }
+
+    if (m_layer_buffer != 0)
+        glDeleteBuffers(1, &m_layer_buffer);
+    m_layer_buffer = 0;
+
+    m_layers.clear();
+    m_missing.clear();
+}
+
+size_t VBMaterialArrays::GetDataSize(void) const
+{
+    size_t size = 0;
+
+    for (unsigned int k = 0; k < KIND_COUNT; k++)
+    {
+        const array & a = m_arrays[k];
+        unsigned int width = a.width, height = a.height;
+
+        // The levels VMipGenerator makes
+        for (int level = 0; level < MAX_TEXTURE_MIPS && a.layers != 0; level++)
+        {
+            size += (size_t)width * height * 4 * a.layers;
+
+            if (width == 1 && height == 1)
+                break;
+
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+    }
+
+    return size;
+}
@@ -0,0 +1,385 @@
+// Meshlets for VBObject: frame 0 split into small clusters of triangles that
+// share vertices, each with a bounding sphere and a cone of its normals so
+// that it can be frustum and backface culled as a whole on the CPU.
+
+#include "vbm.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+// Bounds of one meshlet. The sphere is centered on the middle of the
+// bounding box, which is close enough to minimal for culling.
+static void vbmMeshletBounds(VBM_MESHLET & meshlet, const unsigned int * indices, const float * positions)
+{
+    float lo[3] = { 1e30f, 1e30f, 1e30f };
+    float hi[3] = { -1e30f, -1e30f, -1e30f };
+    unsigned int i, k;
+
+    for (i = 0; i < meshlet.count; i++)
+    {
+        const float * p = positions + indices[i] * 4;
+        for (k = 0; k < 3; k++)
+        {
+            if (p[k] < lo[k]) lo[k] = p[k];
+            if (p[k] > hi[k]) hi[k] = p[k];
+        }
+    }
+
+    float radius = 0.0f;
+
+    for (k = 0; k < 3; k++)
+        meshlet.center[k] = (lo[k] + hi[k]) * 0.5f;
+
+    for (i = 0; i < meshlet.count; i++)
+    {
+        const float * p = positions + indices[i] * 4;
+        float dx = p[0] - meshlet.center[0];
+        float dy = p[1] - meshlet.center[1];
+        float dz = p[2] - meshlet.center[2];
+        float d = dx * dx + dy * dy + dz * dz;
+        if (d > radius)
+            radius = d;
+    }
+
+    meshlet.radius = sqrtf(radius);
+
+    // Cone: the average of the unit triangle normals, and the widest angle
+    // any of them makes with it
+    std::vector<float> normals;
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+
+    for (i = 0; i < meshlet.count; i += 3)
+    {
+        const float * a = positions + indices[i + 0] * 4;
+        const float * b = positions + indices[i + 1] * 4;
+        const float * c = positions + indices[i + 2] * 4;
+        float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        // Degenerate triangles are never rasterized, so don't constrain the cone
+        if (length == 0.0f)
+            continue;
+
+        for (k = 0; k < 3; k++)
+        {
+            n[k] /= length;
+            axis[k] += n[k];
+            normals.push_back(n[k]);
+        }
+    }
+
+    float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float min_dot = 1.0f;
+
+    if (length > 0.0f)
+    {
+        for (k = 0; k < 3; k++)
+            axis[k] /= length;
+
+        for (i = 0; i < normals.size(); i += 3)
+        {
+            float d = normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2];
+            if (d < min_dot)
+                min_dot = d;
+        }
+    }
+
+    for (k = 0; k < 3; k++)
+        meshlet.cone_axis[k] = axis[k];
+
+    // Seen from anywhere within 90 degrees minus the cone's half angle of
+    // the axis, every triangle faces away. Cones wider than about 84 degrees
+    // leave too little room for that to be worth testing.
+    meshlet.cone_cutoff = length > 0.0f && min_dot > 0.1f ? sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+}
+
+bool VBObject::BuildMeshlets(unsigned int max_vertices, unsigned int max_triangles)
+{
+    if (m_attrib == NULL || m_header.num_frames == 0 || max_vertices < 3 || max_triangles == 0)
+        return false;
+
+    if (m_header.num_indices == 0 && !Optimize())
+        return false;
+
+    unsigned int num_vertices = m_header.num_vertices;
+    unsigned int first = m_frame[0].first;
+    unsigned int index_count = m_frame[0].count - m_frame[0].count % 3;
+    unsigned int triangle_count = index_count / 3;
+    unsigned int i, v;
+
+    std::vector<float> positions(num_vertices * 4);
+    if (!DecodeAttribute(0, &positions[0]))
+        return false;
+
+    std::vector<unsigned int> indices(index_count);
+    for (i = 0; i < index_count; i++)
+    {
+        indices[i] = GetIndex(first + i);
+        if (indices[i] >= num_vertices)
+            return false;
+    }
+
+    // Triangles around each vertex
+    std::vector<unsigned int> offsets(num_vertices + 1, 0);
+    for (i = 0; i < index_count; i++)
+        offsets[indices[i] + 1]++;
+    for (v = 0; v < num_vertices; v++)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<unsigned int> adjacency(index_count);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (i = 0; i < index_count; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<unsigned int> in_meshlet(num_vertices, 0);     // Stamp of the meshlet using the vertex
+    std::vector<unsigned int> meshlet_vertices;
+    std::vector<unsigned int> sorted;
+    std::vector<VBM_MESHLET> meshlets;
+
+    sorted.reserve(index_count);
+
+    unsigned int stamp = 0;
+    unsigned int seed = 0;
+
+    while (sorted.size() < index_count)
+    {
+        VBM_MESHLET meshlet;
+        memset(&meshlet, 0, sizeof(meshlet));
+        meshlet.first = first + (unsigned int)sorted.size();
+
+        stamp++;
+        meshlet_vertices.clear();
+
+        // Start from the first triangle left in the (cache optimized) order
+        while (emitted[seed])
+            seed++;
+
+        unsigned int next = seed;
+
+        while (true)
+        {
+            const unsigned int * tri = &indices[next * 3];
+
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                if (in_meshlet[tri[k]] != stamp)
+                {
+                    in_meshlet[tri[k]] = stamp;
+                    meshlet_vertices.push_back(tri[k]);
+                }
+            }
+
+            sorted.insert(sorted.end(), tri, tri + 3);
+            emitted[next] = true;
+            meshlet.count += 3;
+
+            if (meshlet.count / 3 >= max_triangles)
+                break;
+
+            // Grow across the meshlet's vertices, preferring the triangle
+            // that adds the fewest new ones
+            int best = -1;
+            unsigned int best_new = 3;
+
+            for (i = 0; i < meshlet_vertices.size() && best_new > 0; i++)
+            {
+                v = meshlet_vertices[i];
+
+                for (unsigned int j = offsets[v]; j < offsets[v + 1]; j++)
+                {
+                    unsigned int t = adjacency[j];
+
+                    if (emitted[t])
+                        continue;
+
+                    unsigned int added = (in_meshlet[indices[t * 3 + 0]] != stamp) +
+                                         (in_meshlet[indices[t * 3 + 1]] != stamp) +
+                                         (in_meshlet[indices[t * 3 + 2]] != stamp);
+
+                    if (added < best_new || best < 0)
+                    {
+                        best = (int)t;
+                        best_new = added;
+                        if (added == 0)
+                            break;
+                    }
+                }
+            }
+
+            if (best < 0 || meshlet_vertices.size() + best_new > max_vertices)
+                break;
+
+            next = (unsigned int)best;
+        }
+
+        meshlet.vertex_count = (unsigned int)meshlet_vertices.size();
+        meshlets.push_back(meshlet);
+    }
+
+    // Bounds, from the reordered triangles
+    for (i = 0; i < meshlets.size(); i++)
+        vbmMeshletBounds(meshlets[i], &sorted[meshlets[i].first - first], &positions[0]);
+
+    unsigned int total = m_header.num_indices;
+    unsigned int * all = new unsigned int [total];
+
+    for (i = 0; i < total; i++)
+        all[i] = GetIndex(i);
+    if (index_count)
+        memcpy(all + first, &sorted[0], index_count * sizeof(unsigned int));
+
+    SetConvertedIndexData(all, total);
+    DisableMeshletCulling();
+
+    if (meshlets.empty())
+    {
+        RemoveBlock(VBM_BLOCK_MESHLETS);
+        return true;
+    }
+
+    return SetBlock(VBM_BLOCK_MESHLETS, &meshlets[0], (unsigned int)(meshlets.size() * sizeof(VBM_MESHLET)));
+}
+
+unsigned int VBObject::GetMeshletCount(void) const
+{
+    unsigned int size = 0;
+
+    if (GetBlock(VBM_BLOCK_MESHLETS, &size) == NULL)
+        return 0;
+
+    return size / sizeof(VBM_MESHLET);
+}
+
+unsigned int VBObject::CullMeshlets(const vmath::mat4 & model_view_projection, const vmath::vec3 & eye)
+{
+    const VBM_MESHLET * meshlets = (const VBM_MESHLET *)GetBlock(VBM_BLOCK_MESHLETS);
+    unsigned int count = GetMeshletCount();
+    unsigned int i, k;
+
+    if (meshlets == NULL || m_header.num_indices == 0)
+        return 0;
+
+    // Meshlets crossing into another index range take one more draw each
+    unsigned int num_ranges = 0;
+    const VBM_INDEX_RANGE * ranges = GetIndexRanges(&num_ranges);
+    size_t element_size = m_header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    unsigned int pool_first = GetFirstIndex();
+    GLint pool_base = GetBaseVertex();
+
+    if (m_draw_counts == NULL)
+    {
+        m_draw_counts = new GLsizei [count + num_ranges];
+        m_draw_offsets = new const GLvoid * [count + num_ranges];
+        m_draw_base_vertices = new GLint [count + num_ranges];
+    }
+
+    // Frustum planes from the rows of the matrix (Gribb and Hartmann); the
+    // matrix is column major, m[column][row]
+    const vmath::mat4 & m = model_view_projection;
+    float planes[6][4];
+
+    for (k = 0; k < 4; k++)
+    {
+        planes[0][k] = m[k][3] + m[k][0];
+        planes[1][k] = m[k][3] - m[k][0];
+        planes[2][k] = m[k][3] + m[k][1];
+        planes[3][k] = m[k][3] - m[k][1];
+        planes[4][k] = m[k][3] + m[k][2];
+        planes[5][k] = m[k][3] - m[k][2];
+    }
+
+    for (i = 0; i < 6; i++)
+    {
+        float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        if (length > 0.0f)
+        {
+            for (k = 0; k < 4; k++)
+                planes[i][k] /= length;
+        }
+    }
+
+    unsigned int visible = 0;
+    unsigned int run_end = ~0u;
+
+    m_draw_count = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        const VBM_MESHLET & meshlet = meshlets[i];
+        const float * c = meshlet.center;
+        bool culled = false;
+
+        for (k = 0; k < 6 && !culled; k++)
+            culled = planes[k][0] * c[0] + planes[k][1] * c[1] + planes[k][2] * c[2] + planes[k][3] < -meshlet.radius;
+
+        if (!culled && meshlet.cone_cutoff < 1.0f)
+        {
+            float d[3] = { c[0] - eye[0], c[1] - eye[1], c[2] - eye[2] };
+            float distance = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+            culled = d[0] * meshlet.cone_axis[0] + d[1] * meshlet.cone_axis[1] + d[2] * meshlet.cone_axis[2] >=
+                     meshlet.cone_cutoff * distance + meshlet.radius;
+        }
+
+        if (culled)
+            continue;
+
+        visible++;
+
+        unsigned int first = meshlet.first;
+        unsigned int end = meshlet.first + meshlet.count;
+
+        while (first < end)
+        {
+            unsigned int stop = end;
+            GLint base_vertex = pool_base;
+
+            if (ranges)
+            {
+                const VBM_INDEX_RANGE & range = ranges[FindIndexRange(ranges, num_ranges, first)];
+
+                if (range.first + range.count < stop)
+                    stop = range.first + range.count;
+                base_vertex += range.base_vertex;
+            }
+
+            // Extend the previous draw when this one follows it directly
+            if (first == run_end && m_draw_base_vertices[m_draw_count - 1] == base_vertex)
+            {
+                m_draw_counts[m_draw_count - 1] += stop - first;
+            }
+            else
+            {
+                m_draw_counts[m_draw_count] = stop - first;
+                m_draw_offsets[m_draw_count] = BUFFER_OFFSET((first + pool_first) * element_size);
+                m_draw_base_vertices[m_draw_count] = base_vertex;
+                m_draw_count++;
+            }
+
+            run_end = first = stop;
+        }
+    }
+
+    m_meshlet_culling = true;
+
+    return visible;
+}
+
+void VBObject::DisableMeshletCulling(void)
+{
+    m_meshlet_culling = false;
+    m_draw_count = 0;
+
+    // The draw list is sized for the meshlets it was built for
+    delete [] m_draw_counts;
+    m_draw_counts = NULL;
+    delete [] m_draw_offsets;
+    m_draw_offsets = NULL;
+    delete [] m_draw_base_vertices;
+    m_draw_base_vertices = NULL;
+}
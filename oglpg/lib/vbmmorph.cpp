@@ -0,0 +1,306 @@
+#include "vbmmorph.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBM_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Adds up to four weighted sources into out, or overwrites out when not
+// accumulating. floats is a multiple of 8.
+static void vbmMorphBlendPass(const float * const * src, const float * weights, unsigned int count,
+                              bool accumulate, float * out, size_t floats)
+{
+#ifdef VBM_USE_SSE2
+    __m128 w[4];
+    unsigned int k;
+
+    for (k = 0; k < count; k++)
+        w[k] = _mm_set1_ps(weights[k]);
+
+    for (size_t j = 0; j < floats; j += 4)
+    {
+        __m128 acc = accumulate ? _mm_loadu_ps(out + j) : _mm_setzero_ps();
+
+        for (k = 0; k < count; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src[k] + j), w[k]));
+
+        _mm_storeu_ps(out + j, acc);
+    }
+#else
+    for (size_t j = 0; j < floats; j++)
+    {
+        float acc = accumulate ? out[j] : 0.0f;
+
+        for (unsigned int k = 0; k < count; k++)
+            acc += src[k][j] * weights[k];
+
+        out[j] = acc;
+    }
+#endif
+}
+
+VBMorphTargets::VBMorphTargets(void)
+    : m_targets(0),
+      m_vertices(0),
+      m_first_vertex(0),
+      m_buffer(0),
+      m_texture(0),
+      m_blend_buffer(0)
+{
+}
+
+VBMorphTargets::~VBMorphTargets(void)
+{
+    Free();
+}
+
+bool VBMorphTargets::Load(const VBObject & object)
+{
+    Free();
+
+    unsigned int num_frames = object.m_header.num_frames;
+    unsigned int num_vertices = object.m_header.num_vertices;
+    unsigned int num_indices = object.m_header.num_indices;
+    unsigned int f, e, v;
+
+    if (object.m_attrib == NULL || num_frames == 0 || num_vertices == 0)
+        return false;
+
+    unsigned int element_count = num_indices ? num_indices : num_vertices;
+    unsigned int count = object.m_frame[0].count;
+    std::vector<unsigned int> first(num_frames);
+    unsigned int span = count;
+
+    // Where each target's vertices start, and that each frame has as many
+    for (f = 0; f < num_frames; f++)
+    {
+        const VBM_FRAME_HEADER & frame = object.m_frame[f];
+
+        if (count == 0 || frame.count != count || frame.first > element_count || count > element_count - frame.first)
+            return false;
+
+        if (num_indices == 0)
+        {
+            first[f] = frame.first;
+            continue;
+        }
+
+        unsigned int lo = ~0u;
+        unsigned int hi = 0;
+
+        for (e = 0; e < count; e++)
+        {
+            v = object.GetIndex(frame.first + e);
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+
+        if (hi >= num_vertices || (f > 0 && hi - lo + 1 != span))
+            return false;
+
+        first[f] = lo;
+        span = hi - lo + 1;
+    }
+
+    // and that they are the same triangles
+    for (f = 1; f < num_frames && num_indices; f++)
+    {
+        for (e = 0; e < count; e++)
+        {
+            if (object.GetIndex(object.m_frame[f].first + e) - first[f] !=
+                object.GetIndex(object.m_frame[0].first + e) - first[0])
+                return false;
+        }
+    }
+
+    int normal_index = -1;
+
+    for (unsigned int i = 1; i < object.m_header.num_attribs; i++)
+    {
+        if (strcmp(object.m_attrib[i].name, "normal") == 0)
+        {
+            normal_index = (int)i;
+            break;
+        }
+    }
+
+    std::vector<float> positions((size_t)num_vertices * 4);
+    std::vector<float> normals;
+
+    if (!object.DecodeAttribute(0, &positions[0]))
+        return false;
+
+    if (normal_index >= 0)
+    {
+        normals.resize((size_t)num_vertices * 4);
+        if (!object.DecodeAttribute(normal_index, &normals[0]))
+            return false;
+    }
+
+    m_data.resize((size_t)num_frames * span * 8);
+
+    for (f = 0; f < num_frames; f++)
+    {
+        float * dst = &m_data[(size_t)f * span * 8];
+
+        for (v = 0; v < span; v++, dst += 8)
+        {
+            const float * p = &positions[((size_t)first[f] + v) * 4];
+
+            dst[0] = p[0];
+            dst[1] = p[1];
+            dst[2] = p[2];
+            dst[3] = 1.0f;
+
+            if (normal_index >= 0)
+            {
+                const float * n = &normals[((size_t)first[f] + v) * 4];
+
+                dst[4] = n[0];
+                dst[5] = n[1];
+                dst[6] = n[2];
+            }
+            else
+            {
+                dst[4] = 0.0f;
+                dst[5] = 0.0f;
+                dst[6] = 1.0f;
+            }
+
+            dst[7] = 0.0f;
+        }
+    }
+
+    m_targets = num_frames;
+    m_vertices = span;
+    m_first_vertex = first[0];
+
+    return true;
+}
+
+bool VBMorphTargets::Upload(void)
+{
+    if (m_data.empty())
+        return false;
+
+    if (m_texture != 0)
+        return true;
+
+    // Objects too large for a texture buffer are left to UploadBlend
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+
+    if ((size_t)max_texels < m_data.size() / 4)
+        return false;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_data.size() * sizeof(float), &m_data[0], GL_STATIC_DRAW);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_buffer);
+
+    return true;
+}
+
+void VBMorphTargets::Bind(GLuint unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+}
+
+void VBMorphTargets::SetUniforms(GLuint program, unsigned int base_vertex) const
+{
+    glProgramUniform1i(program, glGetUniformLocation(program, "vbm_morph_vertex_count"), (GLint)m_vertices);
+    glProgramUniform1i(program, glGetUniformLocation(program, "vbm_morph_first_vertex"), (GLint)(base_vertex + m_first_vertex));
+}
+
+void VBMorphTargets::Blend(const unsigned int * targets, const float * weights, unsigned int count, float * out) const
+{
+    size_t floats = (size_t)m_vertices * 8;
+    const float * src[4];
+    float w[4];
+    unsigned int n = 0;
+    bool accumulate = false;
+
+    // Four targets per pass over the vertices; the first pass overwrites
+    // out, so that no weights at all give zeros
+    for (unsigned int i = 0; i <= count; i++)
+    {
+        if (i < count && targets[i] < m_targets && weights[i] != 0.0f)
+        {
+            src[n] = &m_data[(size_t)targets[i] * floats];
+            w[n] = weights[i];
+            n++;
+        }
+
+        if (n == 4 || (i == count && (n > 0 || !accumulate)))
+        {
+            vbmMorphBlendPass(src, w, n, accumulate, out, floats);
+            accumulate = true;
+            n = 0;
+        }
+    }
+}
+
+bool VBMorphTargets::UploadBlend(VBObject & object, const unsigned int * targets, const float * weights, unsigned int count,
+                                 GLuint position_location, GLuint normal_location)
+{
+    if (m_data.empty() || object.m_vao == 0 || object.m_pool != NULL)
+        return false;
+
+    // Vertex numbers start at m_first_vertex, so the buffer does too
+    GLsizeiptr stride = 8 * sizeof(float);
+    GLintptr offset = (GLintptr)m_first_vertex * stride;
+    GLsizeiptr size = (GLsizeiptr)m_vertices * stride;
+
+    if (m_blend_buffer == 0)
+        glGenBuffers(1, &m_blend_buffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_blend_buffer);
+
+    // Orphan last frame's storage rather than wait for the GPU to finish
+    // reading it
+    glBufferData(GL_ARRAY_BUFFER, offset + size, NULL, GL_STREAM_DRAW);
+
+    float * out = (float *)glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (out == NULL)
+        return false;
+
+    Blend(targets, weights, count, out);
+
+    if (!glUnmapBuffer(GL_ARRAY_BUFFER))
+        return false;
+
+    glBindVertexArray(object.m_vao);
+    glVertexAttribPointer(position_location, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, BUFFER_OFFSET(0));
+    glEnableVertexAttribArray(position_location);
+    glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, (GLsizei)stride, BUFFER_OFFSET(4 * sizeof(float)));
+    glEnableVertexAttribArray(normal_location);
+    glBindVertexArray(0);
+
+    return true;
+}
+
+void VBMorphTargets::Free(void)
+{
+    if (m_texture != 0)
+        glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+
+    if (m_blend_buffer != 0)
+        glDeleteBuffers(1, &m_blend_buffer);
+    m_blend_buffer = 0;
+
+    std::vector<float>().swap(m_data);
+    m_targets = 0;
+    m_vertices = 0;
+    m_first_vertex = 0;
+}
@@ -0,0 +1,531 @@
+// Mesh optimization for VBObject: welding into an index buffer, triangle
+// reordering for the post-transform vertex cache (Tipsify, from Sander et al.
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"),
+// cluster reordering against overdraw from the same paper, and vertex
+// renumbering for fetch locality.
+
+#include "vbm.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Maps each vertex to the first vertex with identical attribute data
+static void vbmWeldVertices(const unsigned char * packed, size_t vertex_size, unsigned int count, std::vector<unsigned int> & remap)
+{
+    size_t table_size = 1;
+    while (table_size < (size_t)count * 2)
+        table_size <<= 1;
+
+    const unsigned int empty = ~0u;
+    std::vector<unsigned int> table(table_size, empty);
+
+    remap.resize(count);
+
+    for (unsigned int v = 0; v < count; v++)
+    {
+        const unsigned char * key = packed + v * vertex_size;
+
+        // FNV-1a
+        unsigned int hash = 2166136261u;
+        for (size_t i = 0; i < vertex_size; i++)
+            hash = (hash ^ key[i]) * 16777619u;
+
+        size_t slot = hash & (table_size - 1);
+
+        // Linear probing; the table is never more than half full
+        while (table[slot] != empty && memcmp(packed + table[slot] * vertex_size, key, vertex_size) != 0)
+            slot = (slot + 1) & (table_size - 1);
+
+        if (table[slot] == empty)
+            table[slot] = v;
+
+        remap[v] = table[slot];
+    }
+}
+
+// FIFO cache simulation; vertex_count bounds the indices
+static unsigned int vbmCountCacheMisses(const unsigned int * indices, unsigned int index_count,
+                                        unsigned int vertex_count, unsigned int cache_size)
+{
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    unsigned int timestamp = cache_size + 1;
+    unsigned int misses = 0;
+
+    for (unsigned int i = 0; i < index_count; i++)
+    {
+        if (timestamp - cache_time[indices[i]] > cache_size)
+        {
+            cache_time[indices[i]] = timestamp++;
+            misses++;
+        }
+    }
+
+    return misses;
+}
+
+// Tipsify. Reorders the triangles of indices (which may only reference
+// vertices below vertex_count) into out. The triangle index of every point
+// where the walk had to restart from a dead end is appended to clusters;
+// those are the boundaries the overdraw pass may reorder at.
+static void vbmTipsify(const unsigned int * indices, unsigned int index_count, unsigned int vertex_count,
+                       unsigned int cache_size, unsigned int * out, std::vector<unsigned int> & clusters)
+{
+    unsigned int triangle_count = index_count / 3;
+    unsigned int i, v;
+
+    // Triangles using each vertex
+    std::vector<unsigned int> offsets(vertex_count + 1, 0);
+    std::vector<unsigned int> live(vertex_count, 0);
+
+    for (i = 0; i < index_count; i++)
+        live[indices[i]]++;
+
+    for (v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+
+    std::vector<unsigned int> adjacency(index_count);
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+
+    for (i = 0; i < index_count; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<unsigned int> dead_end;
+    std::vector<unsigned int> candidates;
+
+    unsigned int timestamp = cache_size + 1;
+    unsigned int cursor = 1;
+    unsigned int output = 0;
+    int fanning = index_count ? (int)indices[0] : -1;
+
+    clusters.push_back(0);
+
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        // Emit every remaining triangle around the fanning vertex
+        for (i = offsets[fanning]; i < offsets[fanning + 1]; i++)
+        {
+            unsigned int t = adjacency[i];
+
+            if (emitted[t])
+                continue;
+
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                v = indices[t * 3 + k];
+
+                out[output++] = v;
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+
+                if (timestamp - cache_time[v] > cache_size)
+                    cache_time[v] = timestamp++;
+            }
+
+            emitted[t] = true;
+        }
+
+        // The candidate still in the cache with the most time left, as long
+        // as fanning around it won't evict it before it's done
+        int next = -1;
+        int best = -1;
+
+        for (i = 0; i < candidates.size(); i++)
+        {
+            v = candidates[i];
+
+            if (live[v] == 0)
+                continue;
+
+            int priority = 0;
+            if (timestamp - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = timestamp - cache_time[v];
+
+            if (priority > best)
+            {
+                best = priority;
+                next = v;
+            }
+        }
+
+        if (next < 0)
+        {
+            // Dead end: back up through recently used vertices, then fall
+            // back to scanning for any vertex with triangles left
+            while (!dead_end.empty() && next < 0)
+            {
+                v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v] > 0)
+                    next = v;
+            }
+
+            while (next < 0 && cursor < vertex_count)
+            {
+                if (live[cursor] > 0)
+                    next = cursor;
+                cursor++;
+            }
+
+            if (next >= 0 && output / 3 != clusters.back())
+                clusters.push_back(output / 3);
+        }
+
+        fanning = next;
+    }
+}
+
+// Sorts the clusters of a cache-optimized triangle list so that clusters
+// facing away from the mesh center come first. Those tend to occlude the
+// rest, so fewer fragments get shaded twice. Clusters are first split where
+// doing so keeps the cache efficiency within threshold of the whole list.
+static void vbmOptimizeOverdraw(unsigned int * indices, unsigned int index_count, unsigned int vertex_count,
+                                const float * positions, unsigned int cache_size, const std::vector<unsigned int> & hard_clusters, float threshold)
+{
+    unsigned int triangle_count = index_count / 3;
+    unsigned int t;
+
+    if (triangle_count < 2)
+        return;
+
+    // Whole-list cache miss rate to measure the clusters against
+    float acmr = (float)vbmCountCacheMisses(indices, index_count, vertex_count, cache_size) / triangle_count;
+
+    // Soft boundaries inside each hard cluster
+    std::vector<unsigned int> clusters;
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    unsigned int timestamp = cache_size + 1;
+
+    for (size_t c = 0; c < hard_clusters.size(); c++)
+    {
+        unsigned int start = hard_clusters[c];
+        unsigned int end = c + 1 < hard_clusters.size() ? hard_clusters[c + 1] : triangle_count;
+        unsigned int cluster_misses = 0;
+        unsigned int cluster_start = start;
+
+        clusters.push_back(start);
+
+        for (t = start; t < end; t++)
+        {
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                if (timestamp - cache_time[v] > cache_size)
+                {
+                    cache_time[v] = timestamp++;
+                    cluster_misses++;
+                }
+            }
+
+            if (t + 1 < end && (float)cluster_misses / (t + 1 - cluster_start) <= acmr * threshold)
+            {
+                clusters.push_back(t + 1);
+                cluster_start = t + 1;
+                cluster_misses = 0;
+
+                // Each cluster must stand on its own once moved
+                timestamp += cache_size + 1;
+            }
+        }
+    }
+
+    // Mesh center, area weighted
+    double center[3] = { 0.0, 0.0, 0.0 };
+    double total_area = 0.0;
+
+    std::vector<float> normals(triangle_count * 3);
+    std::vector<float> centroids(triangle_count * 3);
+    std::vector<float> areas(triangle_count);
+
+    for (t = 0; t < triangle_count; t++)
+    {
+        const float * a = positions + indices[t * 3 + 0] * 4;
+        const float * b = positions + indices[t * 3 + 1] * 4;
+        const float * c = positions + indices[t * 3 + 2] * 4;
+
+        float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5f;
+
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            // The length of n is twice the area, so these are area weighted
+            normals[t * 3 + k] = n[k];
+            centroids[t * 3 + k] = (a[k] + b[k] + c[k]) / 3.0f;
+            center[k] += centroids[t * 3 + k] * area;
+        }
+
+        areas[t] = area;
+        total_area += area;
+    }
+
+    if (total_area > 0.0)
+    {
+        for (unsigned int k = 0; k < 3; k++)
+            center[k] /= total_area;
+    }
+
+    // Sort key per cluster: how far the cluster's centroid lies along its
+    // own average normal, seen from the mesh center
+    size_t cluster_count = clusters.size();
+    std::vector<float> sort_key(cluster_count);
+    std::vector<unsigned int> order(cluster_count);
+
+    for (size_t c = 0; c < cluster_count; c++)
+    {
+        unsigned int start = clusters[c];
+        unsigned int end = c + 1 < cluster_count ? clusters[c + 1] : triangle_count;
+        float n[3] = { 0.0f, 0.0f, 0.0f };
+        float p[3] = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+
+        for (t = start; t < end; t++)
+        {
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                n[k] += normals[t * 3 + k];
+                p[k] += centroids[t * 3 + k] * areas[t];
+            }
+            area += areas[t];
+        }
+
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0.0f;
+
+        if (area > 0.0f && length > 0.0f)
+        {
+            for (unsigned int k = 0; k < 3; k++)
+                key += (p[k] / area - (float)center[k]) * n[k] / length;
+        }
+
+        sort_key[c] = key;
+        order[c] = (unsigned int)c;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&sort_key](unsigned int a, unsigned int b)
+    {
+        return sort_key[a] > sort_key[b];
+    });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(index_count);
+
+    for (size_t c = 0; c < cluster_count; c++)
+    {
+        unsigned int start = clusters[order[c]];
+        unsigned int end = order[c] + 1 < cluster_count ? clusters[order[c] + 1] : triangle_count;
+
+        sorted.insert(sorted.end(), indices + start * 3, indices + end * 3);
+    }
+
+    memcpy(indices, &sorted[0], index_count * sizeof(unsigned int));
+}
+
+bool VBObject::Optimize(unsigned int steps, unsigned int cache_size)
+{
+    if (m_attrib == NULL || m_header.num_chunks != 0 || m_header.num_vertices == 0)
+        return false;
+
+    unsigned int num_vertices = m_header.num_vertices;
+    unsigned int num_elements = m_header.num_indices ? m_header.num_indices : num_vertices;
+    unsigned int i, v;
+
+    // Every frame must be a whole number of triangles
+    for (i = 0; i < m_header.num_frames; i++)
+    {
+        if (m_frame[i].count % 3 != 0)
+            return false;
+    }
+
+    size_t vertex_size = 0;
+    for (i = 0; i < m_header.num_attribs; i++)
+        vertex_size += vbmAttribSize(m_attrib[i]);
+
+    // Gather each vertex's attributes (without interleaving padding) to
+    // compare them as one key
+    std::vector<unsigned char> packed(vertex_size * num_vertices);
+    size_t attrib_offset = 0;
+
+    for (i = 0; i < m_header.num_attribs; i++)
+    {
+        size_t size = vbmAttribSize(m_attrib[i]);
+        size_t step = m_vertex_stride ? m_vertex_stride : size;
+        const unsigned char * src = m_vertex_data + GetAttributeOffset(i);
+
+        for (v = 0; v < num_vertices; v++)
+            memcpy(&packed[v * vertex_size + attrib_offset], src + v * step, size);
+
+        attrib_offset += size;
+    }
+
+    std::vector<unsigned int> weld;
+    vbmWeldVertices(&packed[0], vertex_size, num_vertices, weld);
+
+    unsigned int * indices = new unsigned int [num_elements];
+
+    for (i = 0; i < num_elements; i++)
+    {
+        unsigned int index = GetIndex(i);
+
+        if (index >= num_vertices)
+        {
+            delete [] indices;
+            return false;
+        }
+
+        indices[i] = weld[index];
+    }
+
+    std::vector<float> positions;
+
+    if (steps & VBM_OPTIMIZE_OVERDRAW)
+    {
+        positions.resize(num_vertices * 4);
+        if (!DecodeAttribute(0, &positions[0]))
+            steps &= ~VBM_OPTIMIZE_OVERDRAW;
+    }
+
+    if (steps & (VBM_OPTIMIZE_VERTEX_CACHE | VBM_OPTIMIZE_OVERDRAW))
+    {
+        std::vector<unsigned int> reordered;
+        std::vector<unsigned int> clusters;
+
+        // Meshlets are ranges of frame 0 in its current order
+        RemoveBlock(VBM_BLOCK_MESHLETS);
+        DisableMeshletCulling();
+
+        for (i = 0; i < m_header.num_frames; i++)
+        {
+            unsigned int * frame_indices = indices + m_frame[i].first;
+            unsigned int count = m_frame[i].count;
+
+            if (count == 0)
+                continue;
+
+            reordered.resize(count);
+            clusters.clear();
+
+            vbmTipsify(frame_indices, count, num_vertices, cache_size, &reordered[0], clusters);
+
+            if (steps & VBM_OPTIMIZE_OVERDRAW)
+                vbmOptimizeOverdraw(&reordered[0], count, num_vertices, &positions[0], cache_size, clusters, 1.05f);
+
+            // Small meshes that were authored in strips can already beat
+            // the reordering; leave those alone
+            if (vbmCountCacheMisses(&reordered[0], count, num_vertices, cache_size) <
+                vbmCountCacheMisses(frame_indices, count, num_vertices, cache_size))
+                memcpy(frame_indices, &reordered[0], count * sizeof(unsigned int));
+        }
+    }
+
+    // Drop the vertices welding made unused, numbering the rest either in
+    // order of first use or in their original order
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(num_vertices, unused);
+    unsigned int new_count = 0;
+
+    if (steps & VBM_OPTIMIZE_VERTEX_FETCH)
+    {
+        for (i = 0; i < num_elements; i++)
+        {
+            if (remap[indices[i]] == unused)
+                remap[indices[i]] = new_count++;
+        }
+    }
+    else
+    {
+        std::vector<bool> used(num_vertices, false);
+
+        for (i = 0; i < num_elements; i++)
+            used[indices[i]] = true;
+
+        for (v = 0; v < num_vertices; v++)
+        {
+            if (used[v])
+                remap[v] = new_count++;
+        }
+    }
+
+    for (i = 0; i < num_elements; i++)
+        indices[i] = remap[indices[i]];
+
+    // Rebuild the vertex data in the object's current layout
+    size_t new_size = m_vertex_stride ? (size_t)m_vertex_stride * new_count : vertex_size * new_count;
+    unsigned char * data = new unsigned char [new_size]();
+    size_t dst_offset = 0;
+
+    for (i = 0; i < m_header.num_attribs; i++)
+    {
+        size_t size = vbmAttribSize(m_attrib[i]);
+        size_t step = m_vertex_stride ? m_vertex_stride : size;
+        const unsigned char * src = m_vertex_data + GetAttributeOffset(i);
+        unsigned char * dst = data + (m_vertex_stride ? dst_offset : dst_offset * new_count);
+
+        for (v = 0; v < num_vertices; v++)
+        {
+            if (remap[v] != unused)
+                memcpy(dst + remap[v] * step, src + v * step, size);
+        }
+
+        dst_offset += size;
+    }
+
+    SetConvertedVertexData(data, new_size);
+    SetConvertedIndexData(indices, num_elements);
+    m_header.num_vertices = new_count;
+
+    return true;
+}
+
+VBM_CACHE_STATS VBObject::AnalyzeVertexCache(unsigned int cache_size) const
+{
+    VBM_CACHE_STATS stats;
+    memset(&stats, 0, sizeof(stats));
+
+    std::vector<unsigned int> cache_time(m_header.num_vertices, 0);
+    std::vector<unsigned int> last_frame(m_header.num_vertices, 0);
+    unsigned int timestamp = cache_size + 1;
+
+    for (unsigned int f = 0; f < m_header.num_frames; f++)
+    {
+        // Frames are drawn separately, so each starts with a cold cache
+        timestamp += cache_size + 1;
+
+        for (unsigned int i = m_frame[f].first; i < m_frame[f].first + m_frame[f].count; i++)
+        {
+            unsigned int v = GetIndex(i);
+
+            if (v >= m_header.num_vertices)
+                continue;
+
+            if (last_frame[v] != f + 1)
+            {
+                last_frame[v] = f + 1;
+                stats.vertices++;
+            }
+
+            if (timestamp - cache_time[v] > cache_size)
+            {
+                cache_time[v] = timestamp++;
+                stats.transformed++;
+            }
+        }
+
+        stats.triangles += m_frame[f].count / 3;
+    }
+
+    if (stats.triangles)
+        stats.acmr = (float)stats.transformed / stats.triangles;
+    if (stats.vertices)
+        stats.atvr = (float)stats.transformed / stats.vertices;
+
+    return stats;
+}
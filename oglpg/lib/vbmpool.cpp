@@ -0,0 +1,565 @@
+// Shared geometry buffers for VBObjects, see vbmpool.h
+
+#include "vbmpool.h"
+
+#include <string.h>
+
+static size_t vbmIndexSize(GLenum type)
+{
+    return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+void VBGeometryPool::RangeAllocator::Reset(unsigned int capacity, unsigned int used)
+{
+    m_free.clear();
+    m_capacity = capacity;
+    m_used = used;
+
+    if (used < capacity)
+    {
+        block rest = { used, capacity - used };
+        m_free.push_back(rest);
+    }
+}
+
+unsigned int VBGeometryPool::RangeAllocator::Allocate(unsigned int count)
+{
+    size_t best = m_free.size();
+
+    if (count == 0)
+        return 0;
+
+    for (size_t i = 0; i < m_free.size(); i++)
+    {
+        if (m_free[i].count >= count && (best == m_free.size() || m_free[i].count < m_free[best].count))
+        {
+            best = i;
+            if (m_free[i].count == count)
+                break;
+        }
+    }
+
+    if (best == m_free.size())
+        return ~0u;
+
+    unsigned int offset = m_free[best].offset;
+
+    if (m_free[best].count == count)
+    {
+        m_free.erase(m_free.begin() + best);
+    }
+    else
+    {
+        m_free[best].offset += count;
+        m_free[best].count -= count;
+    }
+
+    m_used += count;
+
+    return offset;
+}
+
+void VBGeometryPool::RangeAllocator::Release(unsigned int offset, unsigned int count)
+{
+    if (count == 0)
+        return;
+
+    size_t i = 0;
+    while (i < m_free.size() && m_free[i].offset < offset)
+        i++;
+
+    block freed = { offset, count };
+    m_free.insert(m_free.begin() + i, freed);
+    m_used -= count;
+
+    // Merge with the following block, then the preceding one
+    if (i + 1 < m_free.size() && m_free[i].offset + m_free[i].count == m_free[i + 1].offset)
+    {
+        m_free[i].count += m_free[i + 1].count;
+        m_free.erase(m_free.begin() + i + 1);
+    }
+
+    if (i > 0 && m_free[i - 1].offset + m_free[i - 1].count == m_free[i].offset)
+    {
+        m_free[i - 1].count += m_free[i].count;
+        m_free.erase(m_free.begin() + i);
+    }
+}
+
+VBGeometryPool::VBGeometryPool(size_t vertex_bytes, size_t index_bytes)
+    : m_vertex_bytes(vertex_bytes),
+      m_index_bytes(index_bytes)
+{
+}
+
+VBGeometryPool::~VBGeometryPool(void)
+{
+    Free();
+}
+
+void VBGeometryPool::Free(void)
+{
+    for (size_t i = 0; i < m_formats.size(); i++)
+    {
+        format & f = m_formats[i];
+
+        glDeleteVertexArrays(1, &f.vao);
+        glDeleteBuffers(1, &f.vertex_buffer);
+        glDeleteBuffers(1, &f.index_buffer);
+        glDeleteBuffers(1, &f.indirect_buffer);
+    }
+
+    m_formats.clear();
+    m_allocations.clear();
+    m_free_handles.clear();
+}
+
+// Index of the format matching layout, created with empty buffers if there
+// is none yet
+unsigned int VBGeometryPool::FindFormat(const format & layout)
+{
+    unsigned int i;
+
+    for (i = 0; i < m_formats.size(); i++)
+    {
+        const format & f = m_formats[i];
+
+        if (f.stride != layout.stride || f.index_type != layout.index_type || f.attributes.size() != layout.attributes.size())
+            continue;
+
+        size_t a = 0;
+        for (; a < f.attributes.size(); a++)
+        {
+            const attribute & x = f.attributes[a];
+            const attribute & y = layout.attributes[a];
+
+            if (x.type != y.type || x.components != y.components || x.normalized != y.normalized ||
+                x.location != y.location || x.offset != y.offset)
+                break;
+        }
+
+        if (a == f.attributes.size())
+            return i;
+    }
+
+    m_formats.push_back(format());
+
+    format & f = m_formats.back();
+    f.attributes = layout.attributes;
+    f.stride = layout.stride;
+    f.index_type = layout.index_type;
+    f.vao = 0;
+    f.vertex_buffer = 0;
+    f.index_buffer = 0;
+    f.indirect_buffer = 0;
+    f.vertices.Reset(0);
+    f.indices.Reset(0);
+
+    glGenVertexArrays(1, &f.vao);
+
+    unsigned int vertex_capacity = (unsigned int)(m_vertex_bytes / f.stride);
+    unsigned int index_capacity = (unsigned int)(m_index_bytes / vbmIndexSize(f.index_type));
+
+    Repack(i, vertex_capacity ? vertex_capacity : 1, index_capacity ? index_capacity : 1);
+
+    return i;
+}
+
+void VBGeometryPool::SetupVertexArray(format & f)
+{
+    glBindVertexArray(f.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f.vertex_buffer);
+
+    for (size_t i = 0; i < f.attributes.size(); i++)
+    {
+        const attribute & a = f.attributes[i];
+
+        glVertexAttribPointer(a.location, a.components, a.type, a.normalized, f.stride, BUFFER_OFFSET(a.offset));
+        glEnableVertexAttribArray(a.location);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, f.index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void VBGeometryPool::Repack(unsigned int index, unsigned int vertex_capacity, unsigned int index_capacity)
+{
+    format & f = m_formats[index];
+    size_t index_size = vbmIndexSize(f.index_type);
+    GLuint buffers[2];
+    size_t i;
+
+    // Copies go through the copy targets so that no vertex array's element
+    // buffer binding is disturbed
+    glGenBuffers(2, buffers);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)vertex_capacity * f.stride, NULL, GL_STATIC_DRAW);
+
+    unsigned int vertex_end = 0;
+
+    if (f.vertex_buffer)
+        glBindBuffer(GL_COPY_READ_BUFFER, f.vertex_buffer);
+
+    for (i = 0; i < m_allocations.size(); i++)
+    {
+        allocation & a = m_allocations[i];
+
+        if (!a.live || a.format != index)
+            continue;
+
+        if (a.vertex_count)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)a.first_vertex * f.stride,
+                                (GLintptr)vertex_end * f.stride, (GLsizeiptr)a.vertex_count * f.stride);
+        a.first_vertex = vertex_end;
+        vertex_end += a.vertex_count;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(index_capacity * index_size), NULL, GL_STATIC_DRAW);
+
+    unsigned int index_end = 0;
+
+    if (f.index_buffer)
+        glBindBuffer(GL_COPY_READ_BUFFER, f.index_buffer);
+
+    for (i = 0; i < m_allocations.size(); i++)
+    {
+        allocation & a = m_allocations[i];
+
+        if (!a.live || a.format != index)
+            continue;
+
+        if (a.index_count)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)(a.first_index * index_size),
+                                (GLintptr)(index_end * index_size), (GLsizeiptr)(a.index_count * index_size));
+        a.first_index = index_end;
+        index_end += a.index_count;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &f.vertex_buffer);
+    glDeleteBuffers(1, &f.index_buffer);
+    f.vertex_buffer = buffers[0];
+    f.index_buffer = buffers[1];
+    f.vertices.Reset(vertex_capacity, vertex_end);
+    f.indices.Reset(index_capacity, index_end);
+
+    SetupVertexArray(f);
+}
+
+unsigned int VBGeometryPool::Add(const format & layout, const void * vertices, unsigned int vertex_count,
+                                 const void * indices, unsigned int index_count)
+{
+    if (layout.stride == 0)
+        return ~0u;
+
+    unsigned int index = FindFormat(layout);
+    format & f = m_formats[index];
+    size_t index_size = vbmIndexSize(f.index_type);
+
+    unsigned int first_vertex = f.vertices.Allocate(vertex_count);
+    unsigned int first_index = f.indices.Allocate(index_count);
+
+    if (first_vertex == ~0u || first_index == ~0u)
+    {
+        if (first_vertex != ~0u)
+            f.vertices.Release(first_vertex, vertex_count);
+        if (first_index != ~0u)
+            f.indices.Release(first_index, index_count);
+
+        // Offsets are 32-bit; refuse to grow a format past 2^31 vertices
+        // or indices rather than wrap them
+        if (f.vertices.GetUsed() + (size_t)vertex_count > 0x80000000u ||
+            f.indices.GetUsed() + (size_t)index_count > 0x80000000u)
+            return ~0u;
+
+        // Grow until everything fits packed, which also squeezes out any
+        // holes
+        unsigned int vertex_capacity = f.vertices.GetCapacity();
+        unsigned int index_capacity = f.indices.GetCapacity();
+
+        while (vertex_capacity < f.vertices.GetUsed() + vertex_count)
+            vertex_capacity *= 2;
+        while (index_capacity < f.indices.GetUsed() + index_count)
+            index_capacity *= 2;
+
+        Repack(index, vertex_capacity, index_capacity);
+
+        first_vertex = f.vertices.Allocate(vertex_count);
+        first_index = f.indices.Allocate(index_count);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, f.vertex_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)first_vertex * f.stride, (GLsizeiptr)vertex_count * f.stride, vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, f.index_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)(first_index * index_size), (GLsizeiptr)(index_count * index_size), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    allocation a;
+    a.format = index;
+    a.first_vertex = first_vertex;
+    a.vertex_count = vertex_count;
+    a.first_index = first_index;
+    a.index_count = index_count;
+    a.live = true;
+
+    if (!m_free_handles.empty())
+    {
+        unsigned int handle = m_free_handles.back();
+        m_free_handles.pop_back();
+        m_allocations[handle] = a;
+        return handle;
+    }
+
+    m_allocations.push_back(a);
+
+    return (unsigned int)m_allocations.size() - 1;
+}
+
+void VBGeometryPool::Release(unsigned int handle)
+{
+    // Free() may have dropped the allocation already
+    if (handle >= m_allocations.size() || !m_allocations[handle].live)
+        return;
+
+    allocation & a = m_allocations[handle];
+    format & f = m_formats[a.format];
+
+    f.vertices.Release(a.first_vertex, a.vertex_count);
+    f.indices.Release(a.first_index, a.index_count);
+    a.live = false;
+    m_free_handles.push_back(handle);
+}
+
+void VBGeometryPool::Defragment(void)
+{
+    for (unsigned int i = 0; i < m_formats.size(); i++)
+        Repack(i, m_formats[i].vertices.GetCapacity(), m_formats[i].indices.GetCapacity());
+}
+
+void VBGeometryPool::Queue(const VBObject & object, unsigned int frame, unsigned int instances)
+{
+    if (object.m_pool != this || frame >= object.m_header.num_frames || instances == 0)
+        return;
+
+    const allocation & a = m_allocations[object.m_pool_handle];
+    format & f = m_formats[a.format];
+    unsigned int first = object.m_frame[frame].first;
+    unsigned int count = object.m_frame[frame].count;
+
+    // One command per index range the frame touches, as in DrawIndices
+    VBM_INDEX_RANGE whole = { 0, object.m_header.num_indices, 0 };
+    unsigned int num_ranges = 0;
+    const VBM_INDEX_RANGE * ranges = object.GetIndexRanges(&num_ranges);
+
+    if (ranges == NULL)
+    {
+        ranges = &whole;
+        num_ranges = 1;
+    }
+
+    for (unsigned int r = object.FindIndexRange(ranges, num_ranges, first); r < num_ranges; r++)
+    {
+        unsigned int begin = first > ranges[r].first ? first : ranges[r].first;
+        unsigned int end = first + count < ranges[r].first + ranges[r].count ? first + count : ranges[r].first + ranges[r].count;
+
+        if (begin >= end)
+            break;
+
+        VBM_DRAW_ELEMENTS_COMMAND command;
+        command.count = end - begin;
+        command.instance_count = instances;
+        command.first_index = a.first_index + begin;
+        command.base_vertex = (int)(a.first_vertex + ranges[r].base_vertex);
+        command.base_instance = 0;
+        f.batch.push_back(command);
+    }
+}
+
+unsigned int VBGeometryPool::Flush(void)
+{
+    unsigned int calls = 0;
+
+    for (size_t i = 0; i < m_formats.size(); i++)
+    {
+        format & f = m_formats[i];
+
+        if (f.batch.empty())
+            continue;
+
+        glBindVertexArray(f.vao);
+
+        if (glMultiDrawElementsIndirect != NULL)
+        {
+            if (f.indirect_buffer == 0)
+                glGenBuffers(1, &f.indirect_buffer);
+
+            // Respecified every flush so the driver can orphan the old store
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, f.indirect_buffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, f.batch.size() * sizeof(VBM_DRAW_ELEMENTS_COMMAND), &f.batch[0], GL_STREAM_DRAW);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, f.index_type, NULL, (GLsizei)f.batch.size(), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            calls++;
+        }
+        else
+        {
+            size_t index_size = vbmIndexSize(f.index_type);
+
+            for (size_t c = 0; c < f.batch.size(); c++)
+            {
+                const VBM_DRAW_ELEMENTS_COMMAND & command = f.batch[c];
+
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, f.index_type,
+                                                  BUFFER_OFFSET(command.first_index * index_size),
+                                                  command.instance_count, command.base_vertex);
+                calls++;
+            }
+        }
+
+        f.batch.clear();
+    }
+
+    glBindVertexArray(0);
+
+    return calls;
+}
+
+size_t VBGeometryPool::GetUsedBytes(void) const
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < m_formats.size(); i++)
+    {
+        const format & f = m_formats[i];
+        bytes += (size_t)f.vertices.GetUsed() * f.stride + f.indices.GetUsed() * vbmIndexSize(f.index_type);
+    }
+
+    return bytes;
+}
+
+size_t VBGeometryPool::GetCapacityBytes(void) const
+{
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < m_formats.size(); i++)
+    {
+        const format & f = m_formats[i];
+        bytes += (size_t)f.vertices.GetCapacity() * f.stride + f.indices.GetCapacity() * vbmIndexSize(f.index_type);
+    }
+
+    return bytes;
+}
+
+bool VBObject::UploadToPool(VBGeometryPool * pool, int vertexIndex, int normalIndex, int texCoord0Index)
+{
+    if (!IsMapped() || pool == NULL || m_header.num_vertices == 0)
+        return false;
+
+    // Interleaving and indexing go into copies that the object only takes
+    // on once the pool has room, so a failed upload leaves it as it was
+    const unsigned char * vertices = m_vertex_data;
+    unsigned char * interleaved = NULL;
+    GLsizei stride = m_vertex_stride;
+    size_t interleaved_size = 0;
+
+    if (stride == 0)
+    {
+        interleaved = InterleavedCopy(&stride, &interleaved_size);
+        if (interleaved == NULL)
+            return false;
+        vertices = interleaved;
+    }
+
+    // Frames then address the new indices exactly as they did the vertices
+    const unsigned char * indices = m_index_data;
+    unsigned int * sequential = NULL;
+    unsigned int index_count = m_header.num_indices;
+    GLenum index_type = m_header.index_type;
+
+    if (index_count == 0)
+    {
+        sequential = new unsigned int [m_header.num_vertices];
+
+        for (unsigned int i = 0; i < m_header.num_vertices; i++)
+            sequential[i] = i;
+
+        indices = (const unsigned char *)sequential;
+        index_count = m_header.num_vertices;
+        index_type = GL_UNSIGNED_INT;
+    }
+
+    VBGeometryPool::format layout;
+    layout.stride = stride;
+    layout.index_type = index_type == GL_UNSIGNED_SHORT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    size_t offset = 0;
+
+    for (unsigned int i = 0; i < m_header.num_attribs; i++)
+    {
+        VBGeometryPool::attribute a;
+
+        // Same locations as UploadVBM
+        a.location = i;
+        if (i == 0)
+            a.location = vertexIndex;
+        else if (i == 1)
+            a.location = normalIndex;
+        else if (i == 2)
+            a.location = texCoord0Index;
+
+        a.type = m_attrib[i].type;
+        a.components = m_attrib[i].components;
+        a.normalized = (m_attrib[i].flags & VBM_ATTRIB_FLAG_NORMALIZED) ? GL_TRUE : GL_FALSE;
+        a.offset = offset;
+        layout.attributes.push_back(a);
+
+        offset += vbmAttribSize(m_attrib[i]);
+    }
+
+    unsigned int handle = pool->Add(layout, vertices, m_header.num_vertices, indices, index_count);
+
+    if (handle == ~0u)
+    {
+        delete [] interleaved;
+        delete [] sequential;
+        return false;
+    }
+
+    if (interleaved != NULL)
+    {
+        SetConvertedVertexData(interleaved, interleaved_size);
+        m_vertex_stride = stride;
+        m_header.flags |= VBM_FLAG_INTERLEAVED;
+    }
+
+    if (sequential != NULL)
+        SetConvertedIndexData(sequential, index_count);
+
+    // A reload replaces whatever the last upload made
+    ReleaseGL();
+
+    m_pool = pool;
+    m_pool_handle = handle;
+    m_vao = pool->GetVertexArray(handle);
+
+    if (m_header.num_materials != 0)
+    {
+        m_material_textures = new VBObject::material_texture[m_header.num_materials];
+        memset(m_material_textures, 0, m_header.num_materials * sizeof(*m_material_textures));
+    }
+
+    return true;
+}
+
+unsigned int VBObject::GetBaseVertex(void) const
+{
+    return m_pool ? m_pool->GetAllocation(m_pool_handle).first_vertex : 0;
+}
+
+unsigned int VBObject::GetFirstIndex(void) const
+{
+    return m_pool ? m_pool->GetAllocation(m_pool_handle).first_index : 0;
+}
@@ -0,0 +1,512 @@
+#include "vbm.h"
+
+#include <math.h>
+#include <string.h>
+
+// Attribute classes Quantize() picks an encoding for, by attribute name
+enum
+{
+    VBM_CLASS_OTHER,
+    VBM_CLASS_POSITION,
+    VBM_CLASS_UNIT_VECTOR,
+    VBM_CLASS_TEXCOORD
+};
+
+static int vbmClassifyAttribute(const char * name)
+{
+    if (strcmp(name, "position") == 0)
+        return VBM_CLASS_POSITION;
+    if (strcmp(name, "normal") == 0 || strcmp(name, "tangent") == 0 || strcmp(name, "bitangent") == 0)
+        return VBM_CLASS_UNIT_VECTOR;
+    if (strncmp(name, "map", 3) == 0 || strncmp(name, "texcoord", 8) == 0)
+        return VBM_CLASS_TEXCOORD;
+    return VBM_CLASS_OTHER;
+}
+
+static unsigned short vbmFloatToHalf(float value)
+{
+    unsigned int f;
+    memcpy(&f, &value, sizeof(f));
+
+    unsigned int sign = (f >> 16) & 0x8000;
+    int exponent = (int)((f >> 23) & 0xFF) - 127 + 15;
+    unsigned int mantissa = f & 0x007FFFFF;
+
+    // NaN and infinity
+    if (((f >> 23) & 0xFF) == 0xFF)
+        return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+
+    // Too large - saturate rather than produce infinities
+    if (exponent >= 31)
+        return (unsigned short)(sign | 0x7BFF);
+
+    // Denormal or zero
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (unsigned short)sign;
+
+        mantissa |= 0x00800000;
+        unsigned int shift = 14 - exponent;
+        unsigned int half = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+
+        return (unsigned short)(sign | half);
+    }
+
+    unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1FFF;
+
+    // Round to nearest even; a carry into the exponent is still correct
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+
+    if ((half & 0x7C00) == 0x7C00)
+        half = sign | 0x7BFF;
+
+    return (unsigned short)half;
+}
+
+static float vbmHalfToFloat(unsigned short half)
+{
+    unsigned int sign = (half & 0x8000) << 16;
+    unsigned int exponent = (half >> 10) & 0x1F;
+    unsigned int mantissa = half & 0x3FF;
+    unsigned int f;
+
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            f = sign;
+        }
+        else
+        {
+            // Denormal - renormalize
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            f = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+        }
+    }
+    else if (exponent == 31)
+    {
+        f = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else
+    {
+        f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+static inline short vbmFloatToSnorm16(float value)
+{
+    if (value > 1.0f) value = 1.0f;
+    if (value < -1.0f) value = -1.0f;
+    return (short)floorf(value * 32767.0f + 0.5f);
+}
+
+static inline unsigned int vbmFloatToSnorm10(float value)
+{
+    if (value > 1.0f) value = 1.0f;
+    if (value < -1.0f) value = -1.0f;
+    return (unsigned int)((int)floorf(value * 511.0f + 0.5f)) & 0x3FF;
+}
+
+static inline float vbmSnorm10ToFloat(unsigned int bits)
+{
+    // Sign-extend the 10-bit field
+    int value = (int)(bits << 22) >> 22;
+    float f = value / 511.0f;
+    return f < -1.0f ? -1.0f : f;
+}
+
+// Maps a unit vector onto the octahedron and unfolds it into [-1,1]^2
+static void vbmOctEncode(const float * n, float * e)
+{
+    float l = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+
+    if (l == 0.0f)
+    {
+        e[0] = e[1] = 0.0f;
+        return;
+    }
+
+    float x = n[0] / l;
+    float y = n[1] / l;
+
+    if (n[2] < 0.0f)
+    {
+        float ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+
+    e[0] = x;
+    e[1] = y;
+}
+
+// CPU version of VBM_GLSL_OCT_DECODE
+static void vbmOctDecode(float ex, float ey, float * n)
+{
+    float x = ex;
+    float y = ey;
+    float z = 1.0f - fabsf(ex) - fabsf(ey);
+    float t = z < 0.0f ? -z : 0.0f;
+
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+
+    float l = sqrtf(x * x + y * y + z * z);
+    if (l > 0.0f)
+    {
+        x /= l;
+        y /= l;
+        z /= l;
+    }
+
+    n[0] = x;
+    n[1] = y;
+    n[2] = z;
+}
+
+bool VBObject::DecodeAttribute(unsigned int index, float * out) const
+{
+    if (m_attrib == NULL || index >= m_header.num_attribs)
+        return false;
+
+    const VBM_ATTRIB_HEADER & attrib = m_attrib[index];
+    const unsigned char * base = m_vertex_data + GetAttributeOffset(index);
+    size_t step = m_vertex_stride;
+    bool normalized = (attrib.flags & VBM_ATTRIB_FLAG_NORMALIZED) != 0;
+    unsigned int components = attrib.components < 4 ? attrib.components : 4;
+    unsigned int quant_size = 0;
+    const VBM_ATTRIB_QUANT * quant = (const VBM_ATTRIB_QUANT *)GetBlock(VBM_BLOCK_ATTRIB_QUANT, &quant_size);
+
+    if (quant)
+        quant += index;
+
+    if (step == 0)
+        step = vbmAttribSize(attrib);
+
+    for (unsigned int v = 0; v < m_header.num_vertices; v++, out += 4)
+    {
+        const unsigned char * p = base + v * step;
+        unsigned int c;
+
+        out[0] = out[1] = out[2] = 0.0f;
+        out[3] = 1.0f;
+
+        switch (attrib.type)
+        {
+            case GL_FLOAT:
+                memcpy(out, p, components * sizeof(float));
+                break;
+            case GL_HALF_FLOAT:
+                for (c = 0; c < components; c++)
+                {
+                    unsigned short h;
+                    memcpy(&h, p + c * 2, 2);
+                    out[c] = vbmHalfToFloat(h);
+                }
+                break;
+            case GL_SHORT:
+                for (c = 0; c < components; c++)
+                {
+                    short i;
+                    memcpy(&i, p + c * 2, 2);
+                    out[c] = normalized ? (i < -32767 ? -1.0f : i / 32767.0f) : (float)i;
+                }
+                break;
+            case GL_UNSIGNED_SHORT:
+                for (c = 0; c < components; c++)
+                {
+                    unsigned short i;
+                    memcpy(&i, p + c * 2, 2);
+                    out[c] = normalized ? i / 65535.0f : (float)i;
+                }
+                break;
+            case GL_BYTE:
+                for (c = 0; c < components; c++)
+                {
+                    signed char i = (signed char)p[c];
+                    out[c] = normalized ? (i < -127 ? -1.0f : i / 127.0f) : (float)i;
+                }
+                break;
+            case GL_UNSIGNED_BYTE:
+                for (c = 0; c < components; c++)
+                    out[c] = normalized ? p[c] / 255.0f : (float)p[c];
+                break;
+            case GL_INT_2_10_10_10_REV:
+            {
+                unsigned int packed;
+                memcpy(&packed, p, 4);
+                out[0] = vbmSnorm10ToFloat(packed & 0x3FF);
+                out[1] = vbmSnorm10ToFloat((packed >> 10) & 0x3FF);
+                out[2] = vbmSnorm10ToFloat((packed >> 20) & 0x3FF);
+                int w = (int)packed >> 30;
+                out[3] = w < -1 ? -1.0f : (float)w;
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (attrib.flags & VBM_ATTRIB_FLAG_OCTAHEDRAL)
+        {
+            vbmOctDecode(out[0], out[1], out);
+            out[3] = 1.0f;
+        }
+        else if (quant)
+        {
+            for (c = 0; c < components; c++)
+                out[c] = out[c] * quant->scale[c] + quant->bias[c];
+        }
+    }
+
+    return true;
+}
+
+vmath::vec4 VBObject::GetAttributeScale(unsigned int index) const
+{
+    const VBM_ATTRIB_QUANT * quant = (const VBM_ATTRIB_QUANT *)GetBlock(VBM_BLOCK_ATTRIB_QUANT);
+
+    if (quant == NULL || index >= m_header.num_attribs)
+        return vmath::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+
+    return vmath::vec4(quant[index].scale[0], quant[index].scale[1], quant[index].scale[2], quant[index].scale[3]);
+}
+
+vmath::vec4 VBObject::GetAttributeBias(unsigned int index) const
+{
+    const VBM_ATTRIB_QUANT * quant = (const VBM_ATTRIB_QUANT *)GetBlock(VBM_BLOCK_ATTRIB_QUANT);
+
+    if (quant == NULL || index >= m_header.num_attribs)
+        return vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    return vmath::vec4(quant[index].bias[0], quant[index].bias[1], quant[index].bias[2], quant[index].bias[3]);
+}
+
+bool VBObject::Quantize(unsigned int position_encoding, unsigned int normal_encoding, unsigned int texcoord_encoding)
+{
+    if (m_attrib == NULL || m_vertex_stride != 0)
+        return false;
+
+    // Nothing to fit encodings to, so the object is left as it is
+    if (m_header.num_vertices == 0)
+        return true;
+
+    unsigned int num_attribs = m_header.num_attribs;
+    unsigned int num_vertices = m_header.num_vertices;
+    unsigned int i, v, c;
+
+    VBM_ATTRIB_HEADER * attrib = new VBM_ATTRIB_HEADER[num_attribs];
+    VBM_ATTRIB_QUANT * quant = new VBM_ATTRIB_QUANT[num_attribs];
+    unsigned int * encoding = new unsigned int[num_attribs];
+    bool * keep_sign = new bool[num_attribs];
+    size_t total_size = 0;
+
+    memcpy(attrib, m_attrib, num_attribs * sizeof(VBM_ATTRIB_HEADER));
+
+    const VBM_ATTRIB_QUANT * old_quant = (const VBM_ATTRIB_QUANT *)GetBlock(VBM_BLOCK_ATTRIB_QUANT);
+
+    // Pick the new layout of every attribute first
+    for (i = 0; i < num_attribs; i++)
+    {
+        int attrib_class = vbmClassifyAttribute(attrib[i].name);
+
+        switch (attrib_class)
+        {
+            case VBM_CLASS_POSITION:    encoding[i] = position_encoding; break;
+            case VBM_CLASS_UNIT_VECTOR: encoding[i] = normal_encoding; break;
+            case VBM_CLASS_TEXCOORD:    encoding[i] = texcoord_encoding; break;
+            default:                    encoding[i] = VBM_ENCODING_FLOAT; break;
+        }
+
+        // Packed unit vector encodings make no sense for anything else
+        if (attrib_class != VBM_CLASS_UNIT_VECTOR &&
+            (encoding[i] == VBM_ENCODING_INT_2_10_10_10 || encoding[i] == VBM_ENCODING_OCTAHEDRAL))
+            encoding[i] = VBM_ENCODING_FLOAT;
+
+        // Four component unit vectors are tangents with the bitangent sign
+        // in w, which the octahedral encoding has no room for
+        if (encoding[i] == VBM_ENCODING_OCTAHEDRAL && attrib[i].components == 4)
+            encoding[i] = VBM_ENCODING_INT_2_10_10_10;
+
+        keep_sign[i] = attrib[i].components == 4;
+
+        if (old_quant)
+        {
+            quant[i] = old_quant[i];
+        }
+        else
+        {
+            for (c = 0; c < 4; c++)
+            {
+                quant[i].scale[c] = 1.0f;
+                quant[i].bias[c] = 0.0f;
+            }
+        }
+
+        // Keep the components a multiple of four bytes so that vertex
+        // fetches stay aligned
+        switch (encoding[i])
+        {
+            case VBM_ENCODING_HALF:
+            case VBM_ENCODING_NORM16:
+                attrib[i].type = encoding[i] == VBM_ENCODING_HALF ? GL_HALF_FLOAT : GL_SHORT;
+                attrib[i].flags = encoding[i] == VBM_ENCODING_HALF ? 0 : VBM_ATTRIB_FLAG_NORMALIZED;
+                if (attrib[i].components & 1)
+                    attrib[i].components++;
+                break;
+            case VBM_ENCODING_INT_2_10_10_10:
+                attrib[i].type = GL_INT_2_10_10_10_REV;
+                attrib[i].components = 4;
+                attrib[i].flags = VBM_ATTRIB_FLAG_NORMALIZED;
+                break;
+            case VBM_ENCODING_OCTAHEDRAL:
+                attrib[i].type = GL_SHORT;
+                attrib[i].components = 2;
+                attrib[i].flags = VBM_ATTRIB_FLAG_NORMALIZED | VBM_ATTRIB_FLAG_OCTAHEDRAL;
+                break;
+            default:
+                break;
+        }
+
+        if (encoding[i] != VBM_ENCODING_FLOAT)
+        {
+            for (c = 0; c < 4; c++)
+            {
+                quant[i].scale[c] = 1.0f;
+                quant[i].bias[c] = 0.0f;
+            }
+        }
+
+        total_size += vbmAttribSize(attrib[i]);
+    }
+
+    total_size *= num_vertices;
+
+    unsigned char * data = new unsigned char [total_size];
+    unsigned char * dst = data;
+    float * decoded = new float [num_vertices * 4];
+    bool quantized = false;
+
+    for (i = 0; i < num_attribs; i++)
+    {
+        size_t src_size = (i + 1 < num_attribs ? GetAttributeOffset(i + 1) : m_vertex_data_size) - GetAttributeOffset(i);
+
+        if (encoding[i] == VBM_ENCODING_FLOAT)
+        {
+            memcpy(dst, m_vertex_data + GetAttributeOffset(i), src_size);
+            dst += src_size;
+            continue;
+        }
+
+        DecodeAttribute(i, decoded);
+        quantized = true;
+
+        switch (encoding[i])
+        {
+            case VBM_ENCODING_HALF:
+                for (v = 0; v < num_vertices; v++)
+                {
+                    for (c = 0; c < attrib[i].components; c++)
+                    {
+                        unsigned short h = vbmFloatToHalf(decoded[v * 4 + c]);
+                        memcpy(dst, &h, 2);
+                        dst += 2;
+                    }
+                }
+                break;
+            case VBM_ENCODING_NORM16:
+            {
+                // Fit the bounds of each component into [-1,1]
+                for (c = 0; c < attrib[i].components; c++)
+                {
+                    float lo = decoded[c];
+                    float hi = decoded[c];
+
+                    for (v = 1; v < num_vertices; v++)
+                    {
+                        float x = decoded[v * 4 + c];
+                        if (x < lo) lo = x;
+                        if (x > hi) hi = x;
+                    }
+
+                    quant[i].scale[c] = (hi - lo) * 0.5f;
+                    quant[i].bias[c] = (hi + lo) * 0.5f;
+                }
+
+                for (v = 0; v < num_vertices; v++)
+                {
+                    for (c = 0; c < attrib[i].components; c++)
+                    {
+                        float scale = quant[i].scale[c];
+                        short s = vbmFloatToSnorm16(scale != 0.0f ? (decoded[v * 4 + c] - quant[i].bias[c]) / scale : 0.0f);
+                        memcpy(dst, &s, 2);
+                        dst += 2;
+                    }
+                }
+                break;
+            }
+            case VBM_ENCODING_INT_2_10_10_10:
+                for (v = 0; v < num_vertices; v++)
+                {
+                    const float * n = decoded + v * 4;
+                    unsigned int packed = vbmFloatToSnorm10(n[0]) |
+                                          (vbmFloatToSnorm10(n[1]) << 10) |
+                                          (vbmFloatToSnorm10(n[2]) << 20);
+
+                    // w as a 2-bit signed -1 or 1
+                    if (keep_sign[i])
+                        packed |= (n[3] < 0.0f ? 3u : 1u) << 30;
+                    memcpy(dst, &packed, 4);
+                    dst += 4;
+                }
+                break;
+            case VBM_ENCODING_OCTAHEDRAL:
+                for (v = 0; v < num_vertices; v++)
+                {
+                    float e[2];
+                    vbmOctEncode(decoded + v * 4, e);
+                    short s[2] = { vbmFloatToSnorm16(e[0]), vbmFloatToSnorm16(e[1]) };
+                    memcpy(dst, s, 4);
+                    dst += 4;
+                }
+                break;
+        }
+    }
+
+    delete [] decoded;
+
+    // The attribute table lives in the private mapping, so it can be patched
+    // in place
+    memcpy(m_attrib, attrib, num_attribs * sizeof(VBM_ATTRIB_HEADER));
+    SetConvertedVertexData(data, total_size);
+
+    if (quantized || old_quant)
+        SetBlock(VBM_BLOCK_ATTRIB_QUANT, quant, num_attribs * sizeof(VBM_ATTRIB_QUANT));
+
+    delete [] attrib;
+    delete [] quant;
+    delete [] encoding;
+    delete [] keep_sign;
+
+    // Bound what the shader will decode, not the original positions
+    ComputeBounds();
+
+    return true;
+}
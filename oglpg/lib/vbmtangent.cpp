@@ -0,0 +1,461 @@
+// Tangent space generation for VBObject, for normal mapping. The result
+// follows MikkTSpace (Mikkelsen, "Simulation of Wrinkled Surfaces
+// Revisited"): each triangle's tangent comes from its texture coordinate
+// derivatives, is projected into the tangent plane of every corner's normal
+// and weighted by the corner's angle, and vertices that agree on position,
+// normal and texture coordinate share one tangent however they are indexed.
+// The bitangent is not stored; w holds its sign, so that the shader
+// rebuilds it as w * cross(normal, tangent.xyz).
+//
+// Where MikkTSpace differs is at vertices shared by mirrored and unmirrored
+// triangles. It splits those, which would change the vertex count under
+// the frames, LODs and meshlets; here the orientation with the most weight
+// wins instead.
+
+#include "vbm.h"
+#include "vthread.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBM_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+static int vbmFindTangentInput(const VBM_ATTRIB_HEADER * attrib, unsigned int count, bool texcoord)
+{
+    for (unsigned int i = 1; i < count; i++)
+    {
+        const char * name = attrib[i].name;
+
+        if (texcoord ? strncmp(name, "map", 3) == 0 || strncmp(name, "texcoord", 8) == 0
+                     : strcmp(name, "normal") == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static inline float vbmDot3(const float * a, const float * b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// a minus its component along the unit vector n, normalized. false if
+// nothing is left.
+static inline bool vbmProjectNormalize(const float * a, const float * n, float * out)
+{
+    float d = vbmDot3(a, n);
+
+    out[0] = a[0] - n[0] * d;
+    out[1] = a[1] - n[1] * d;
+    out[2] = a[2] - n[2] * d;
+
+    float l = vbmDot3(out, out);
+    if (!(l > 1e-20f))
+        return false;
+
+    l = 1.0f / sqrtf(l);
+    out[0] *= l;
+    out[1] *= l;
+    out[2] *= l;
+
+    return true;
+}
+
+// Assigns each vertex the first vertex with the same position, normal and
+// texture coordinate. -0 and 0 compare equal, as they do in MikkTSpace.
+// The keys and their hashes are built in parallel; only the table inserts
+// are serial.
+static void vbmGroupVertices(const float * positions, const float * normals, const float * texcoords,
+                             unsigned int count, VThreadPool * pool, std::vector<unsigned int> & group)
+{
+    size_t table_size = 1;
+    while (table_size < (size_t)count * 2)
+        table_size <<= 1;
+
+    std::vector<float> keys((size_t)count * 8);
+    std::vector<unsigned int> hashes(count);
+
+    pool->ParallelFor(count, 16384, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            float * key = &keys[(size_t)v * 8];
+
+            key[0] = positions[v * 4 + 0] + 0.0f;
+            key[1] = positions[v * 4 + 1] + 0.0f;
+            key[2] = positions[v * 4 + 2] + 0.0f;
+            key[3] = normals[v * 4 + 0] + 0.0f;
+            key[4] = normals[v * 4 + 1] + 0.0f;
+            key[5] = normals[v * 4 + 2] + 0.0f;
+            key[6] = texcoords[v * 4 + 0] + 0.0f;
+            key[7] = texcoords[v * 4 + 1] + 0.0f;
+
+            unsigned int bits[8];
+            memcpy(bits, key, sizeof(bits));
+
+            // FNV-1a over whole words, then a final mix as neighbouring
+            // vertices differ only in the low mantissa bits
+            unsigned int hash = 2166136261u;
+            for (unsigned int i = 0; i < 8; i++)
+                hash = (hash ^ bits[i]) * 16777619u;
+
+            hash ^= hash >> 16;
+            hash *= 0x85EBCA6Bu;
+            hash ^= hash >> 13;
+
+            hashes[v] = hash;
+        }
+    });
+
+    const unsigned int empty = ~0u;
+    std::vector<unsigned int> table(table_size, empty);
+
+    group.resize(count);
+
+    for (unsigned int v = 0; v < count; v++)
+    {
+        const float * key = &keys[(size_t)v * 8];
+        unsigned int hash = hashes[v];
+        size_t slot = hash & (table_size - 1);
+
+        // Linear probing; the table is never more than half full
+        while (table[slot] != empty &&
+               (hashes[table[slot]] != hash || memcmp(&keys[(size_t)table[slot] * 8], key, 8 * sizeof(float)) != 0))
+            slot = (slot + 1) & (table_size - 1);
+
+        if (table[slot] == empty)
+            table[slot] = v;
+
+        group[v] = table[slot];
+    }
+}
+
+bool VBObject::GenerateTangents(VThreadPool * pool)
+{
+    if (m_attrib == NULL || m_vertex_stride != 0 || m_header.num_vertices == 0)
+        return false;
+
+    int normal_index = vbmFindTangentInput(m_attrib, m_header.num_attribs, false);
+    int texcoord_index = vbmFindTangentInput(m_attrib, m_header.num_attribs, true);
+
+    if (normal_index < 0 || texcoord_index < 0)
+        return false;
+
+    if (pool == NULL)
+        pool = &VThreadPool::GetDefault();
+
+    unsigned int num_vertices = m_header.num_vertices;
+    std::vector<float> positions((size_t)num_vertices * 4);
+    std::vector<float> normals((size_t)num_vertices * 4);
+    std::vector<float> texcoords((size_t)num_vertices * 4);
+
+    const unsigned int inputs[3] = { 0, (unsigned int)normal_index, (unsigned int)texcoord_index };
+    float * const decoded[3] = { &positions[0], &normals[0], &texcoords[0] };
+    bool ok[3] = { false, false, false };
+
+    pool->ParallelFor(3, 1, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            ok[i] = DecodeAttribute(inputs[i], decoded[i]);
+    });
+
+    if (!ok[0] || !ok[1] || !ok[2])
+        return false;
+
+    // Unit normals, as quantized ones are only close
+    pool->ParallelFor(num_vertices, 16384, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            float * n = &normals[(size_t)v * 4];
+            float l = vbmDot3(n, n);
+
+            if (l > 0.0f)
+            {
+                l = 1.0f / sqrtf(l);
+                n[0] *= l;
+                n[1] *= l;
+                n[2] *= l;
+            }
+        }
+    });
+
+    // The triangles of every frame, as vertex numbers. 16-bit indices are
+    // rebased range by range rather than through GetIndex, which would
+    // search the ranges for every index.
+    std::vector<unsigned int> corners;
+    unsigned int element_count = m_header.num_indices ? m_header.num_indices : num_vertices;
+    VBM_INDEX_RANGE whole = { 0, element_count, 0 };
+    unsigned int num_ranges = 0;
+    const VBM_INDEX_RANGE * ranges = GetIndexRanges(&num_ranges);
+    unsigned int f, i;
+
+    if (ranges == NULL)
+    {
+        ranges = &whole;
+        num_ranges = 1;
+    }
+
+    for (f = 0; f < m_header.num_frames; f++)
+    {
+        unsigned int first = m_frame[f].first;
+        unsigned int count = m_frame[f].count;
+        size_t base = corners.size();
+
+        if (first > element_count || count > element_count - first)
+            continue;
+
+        count -= count % 3;
+        corners.resize(base + count);
+
+        pool->ParallelFor(count, 16384, [&, first, base](unsigned int begin, unsigned int end)
+        {
+            unsigned int r = FindIndexRange(ranges, num_ranges, first + begin);
+
+            for (unsigned int e = first + begin; e < first + end; e++)
+            {
+                unsigned int vertex;
+
+                while (r + 1 < num_ranges && ranges[r + 1].first <= e)
+                    r++;
+
+                if (m_header.num_indices == 0)
+                    vertex = e;
+                else if (m_header.index_type == GL_UNSIGNED_SHORT)
+                    vertex = ((const GLushort *)m_index_data)[e] + ranges[r].base_vertex;
+                else
+                    vertex = ((const GLuint *)m_index_data)[e];
+
+                corners[base + e - first] = vertex < num_vertices ? vertex : 0;
+            }
+        });
+    }
+
+    unsigned int num_corners = (unsigned int)corners.size();
+
+    // Each corner's share: the triangle's tangent in the tangent plane of
+    // the corner's normal, times the corner's angle, and in w the angle
+    // signed by the triangle's texture space orientation.
+    std::vector<float> shares((size_t)num_corners * 4);
+
+    pool->ParallelFor(num_corners / 3, 4096, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int t = begin; t < end; t++)
+        {
+            const unsigned int * tri = &corners[t * 3];
+            const float * p0 = &positions[tri[0] * 4];
+            const float * p1 = &positions[tri[1] * 4];
+            const float * p2 = &positions[tri[2] * 4];
+            const float * uv0 = &texcoords[tri[0] * 4];
+            const float * uv1 = &texcoords[tri[1] * 4];
+            const float * uv2 = &texcoords[tri[2] * 4];
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float du1 = uv1[0] - uv0[0], dv1 = uv1[1] - uv0[1];
+            float du2 = uv2[0] - uv0[0], dv2 = uv2[1] - uv0[1];
+            float area = du1 * dv2 - du2 * dv1;
+            float orientation = area > 0.0f ? 1.0f : -1.0f;
+
+            // Unnormalized; its length doesn't matter as each corner
+            // normalizes its projection
+            float tangent[3] =
+            {
+                (e1[0] * dv2 - e2[0] * dv1) * orientation,
+                (e1[1] * dv2 - e2[1] * dv1) * orientation,
+                (e1[2] * dv2 - e2[2] * dv1) * orientation
+            };
+
+            bool degenerate = area == 0.0f || !(vbmDot3(tangent, tangent) > 0.0f);
+
+            for (unsigned int c = 0; c < 3; c++)
+            {
+                float * share = &shares[((size_t)t * 3 + c) * 4];
+                const float * n = &normals[tri[c] * 4];
+                const float * p = &positions[tri[c] * 4];
+                const float * next = &positions[tri[(c + 1) % 3] * 4];
+                const float * prev = &positions[tri[(c + 2) % 3] * 4];
+                float a[3] = { next[0] - p[0], next[1] - p[1], next[2] - p[2] };
+                float b[3] = { prev[0] - p[0], prev[1] - p[1], prev[2] - p[2] };
+                float t_n[3], a_n[3], b_n[3];
+
+                share[0] = share[1] = share[2] = share[3] = 0.0f;
+
+                // The angle is measured in the tangent plane too
+                if (degenerate || !vbmProjectNormalize(tangent, n, t_n) ||
+                    !vbmProjectNormalize(a, n, a_n) || !vbmProjectNormalize(b, n, b_n))
+                    continue;
+
+                float cosine = vbmDot3(a_n, b_n);
+                float angle = acosf(cosine > 1.0f ? 1.0f : cosine < -1.0f ? -1.0f : cosine);
+
+                share[0] = t_n[0] * angle;
+                share[1] = t_n[1] * angle;
+                share[2] = t_n[2] * angle;
+                share[3] = orientation * angle;
+            }
+        }
+    });
+
+    // Sort the corners by vertex group, counting sort style, so that each
+    // group's shares can be summed by one thread without atomics
+    std::vector<unsigned int> group;
+    vbmGroupVertices(&positions[0], &normals[0], &texcoords[0], num_vertices, pool, group);
+
+    std::vector<unsigned int> group_start((size_t)num_vertices + 1, 0);
+    std::vector<unsigned int> group_corners(num_corners);
+
+    for (i = 0; i < num_corners; i++)
+        group_start[group[corners[i]] + 1]++;
+
+    for (i = 0; i < num_vertices; i++)
+        group_start[i + 1] += group_start[i];
+
+    {
+        std::vector<unsigned int> cursor(group_start.begin(), group_start.end() - 1);
+
+        for (i = 0; i < num_corners; i++)
+            group_corners[cursor[group[corners[i]]]++] = i;
+    }
+
+    // Groups are numbered by their first vertex, so the result is written
+    // there and copied to the other members afterwards
+    float * tangents = new float [(size_t)num_vertices * 4];
+
+    pool->ParallelFor(num_vertices, 4096, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            if (group[v] != v)
+                continue;
+
+            const unsigned int * member = &group_corners[group_start[v]];
+            unsigned int count = group_start[v + 1] - group_start[v];
+            float sum[4];
+
+#ifdef VBM_USE_SSE2
+            __m128 acc = _mm_setzero_ps();
+
+            for (unsigned int c = 0; c < count; c++)
+                acc = _mm_add_ps(acc, _mm_loadu_ps(&shares[(size_t)member[c] * 4]));
+
+            _mm_storeu_ps(sum, acc);
+#else
+            sum[0] = sum[1] = sum[2] = sum[3] = 0.0f;
+
+            for (unsigned int c = 0; c < count; c++)
+            {
+                const float * share = &shares[(size_t)member[c] * 4];
+
+                sum[0] += share[0];
+                sum[1] += share[1];
+                sum[2] += share[2];
+                sum[3] += share[3];
+            }
+#endif
+
+            const float * n = &normals[(size_t)v * 4];
+            float * out = tangents + (size_t)v * 4;
+
+            // Vertices no usable triangle touches get any tangent
+            // perpendicular to their normal
+            if (!vbmProjectNormalize(sum, n, out))
+            {
+                static const float x_axis[3] = { 1.0f, 0.0f, 0.0f };
+                static const float y_axis[3] = { 0.0f, 1.0f, 0.0f };
+
+                if (!vbmProjectNormalize(fabsf(n[0]) < 0.9f ? x_axis : y_axis, n, out))
+                {
+                    out[0] = 1.0f;
+                    out[1] = out[2] = 0.0f;
+                }
+            }
+
+            out[3] = sum[3] < 0.0f ? -1.0f : 1.0f;
+        }
+    });
+
+    pool->ParallelFor(num_vertices, 16384, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            if (group[v] != v)
+                memcpy(tangents + (size_t)v * 4, tangents + (size_t)group[v] * 4, 4 * sizeof(float));
+        }
+    });
+
+    // Replace an existing tangent attribute where it is, so that it keeps
+    // its binding, or append one
+    unsigned int num_attribs = m_header.num_attribs;
+    unsigned int target = num_attribs;
+
+    for (i = 0; i < num_attribs; i++)
+    {
+        if (strcmp(m_attrib[i].name, "tangent") == 0)
+            target = i;
+    }
+
+    unsigned int new_num_attribs = target == num_attribs ? num_attribs + 1 : num_attribs;
+    VBM_ATTRIB_HEADER * attrib = new VBM_ATTRIB_HEADER[new_num_attribs];
+
+    memcpy(attrib, m_attrib, num_attribs * sizeof(VBM_ATTRIB_HEADER));
+    memset(&attrib[target], 0, sizeof(VBM_ATTRIB_HEADER));
+    strcpy(attrib[target].name, "tangent");
+    attrib[target].type = GL_FLOAT;
+    attrib[target].components = 4;
+    attrib[target].flags = 0;
+
+    size_t tangent_size = (size_t)num_vertices * 4 * sizeof(float);
+    size_t old_size = target < num_attribs ? (target + 1 < num_attribs ? GetAttributeOffset(target + 1) : m_vertex_data_size) - GetAttributeOffset(target) : 0;
+    size_t total_size = m_vertex_data_size - old_size + tangent_size;
+    unsigned char * data = new unsigned char [total_size];
+    unsigned char * dst = data;
+
+    for (i = 0; i < new_num_attribs; i++)
+    {
+        if (i == target)
+        {
+            memcpy(dst, tangents, tangent_size);
+            dst += tangent_size;
+            continue;
+        }
+
+        size_t src_size = (i + 1 < num_attribs ? GetAttributeOffset(i + 1) : m_vertex_data_size) - GetAttributeOffset(i);
+
+        memcpy(dst, m_vertex_data + GetAttributeOffset(i), src_size);
+        dst += src_size;
+    }
+
+    delete [] tangents;
+
+    // The new attribute is plain floats: identity dequantization
+    const VBM_ATTRIB_QUANT * old_quant = (const VBM_ATTRIB_QUANT *)GetBlock(VBM_BLOCK_ATTRIB_QUANT);
+
+    if (old_quant)
+    {
+        std::vector<VBM_ATTRIB_QUANT> quant(old_quant, old_quant + num_attribs);
+
+        quant.resize(new_num_attribs);
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            quant[target].scale[c] = 1.0f;
+            quant[target].bias[c] = 0.0f;
+        }
+
+        SetBlock(VBM_BLOCK_ATTRIB_QUANT, &quant[0], new_num_attribs * sizeof(VBM_ATTRIB_QUANT));
+    }
+
+    // The table in the mapping can't grow, so the object owns it from now on
+    delete [] m_converted_attrib;
+    m_converted_attrib = attrib;
+    m_attrib = attrib;
+    m_header.num_attribs = new_num_attribs;
+    SetConvertedVertexData(data, total_size);
+
+    return true;
+}
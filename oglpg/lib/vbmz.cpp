@@ -0,0 +1,437 @@
+#include "vbm.h"
+#include "vbmz.h"
+#include "vthread.h"
+
+#include <string.h>
+
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VBMZ_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// The codec: a block is a series of sequences, each a token byte holding a
+// literal count (high nibble) and a match length minus VBMZ_MIN_MATCH (low
+// nibble), then any count that didn't fit in its nibble as a run of bytes
+// added up until one below 255, the literals, a 16-bit little endian offset
+// back into the output and the rest of the match length. The last sequence
+// has literals only and ends where the block's data does.
+#define VBMZ_MIN_MATCH      4
+#define VBMZ_MAX_OFFSET     65535
+#define VBMZ_HASH_BITS      14
+
+static inline unsigned int vbmzRead32(const unsigned char * p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline unsigned int vbmzHash(unsigned int word)
+{
+    return (word * 2654435761u) >> (32 - VBMZ_HASH_BITS);
+}
+
+static void vbmzWriteCount(std::vector<unsigned char> & out, size_t count)
+{
+    for (count -= 15; count >= 255; count -= 255)
+        out.push_back(255);
+    out.push_back((unsigned char)count);
+}
+
+// match_length 0 writes the final, literals only sequence
+static void vbmzWriteSequence(std::vector<unsigned char> & out, const unsigned char * literals, size_t literal_count,
+                              size_t offset, size_t match_length)
+{
+    size_t match_code = match_length ? match_length - VBMZ_MIN_MATCH : 0;
+
+    out.push_back((unsigned char)(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15)));
+    if (literal_count >= 15)
+        vbmzWriteCount(out, literal_count);
+    out.insert(out.end(), literals, literals + literal_count);
+
+    if (match_length)
+    {
+        out.push_back((unsigned char)offset);
+        out.push_back((unsigned char)(offset >> 8));
+        if (match_code >= 15)
+            vbmzWriteCount(out, match_code);
+    }
+}
+
+// Greedy: the most recent position with the same four bytes, found through
+// a hash table, is the only candidate tried. Runs without matches are
+// skipped through faster and faster, so incompressible data costs little.
+static void vbmzCompress(const unsigned char * src, size_t size, std::vector<unsigned char> & out)
+{
+    std::vector<unsigned int> table(1 << VBMZ_HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t misses = 0;
+
+    out.clear();
+
+    while (i + VBMZ_MIN_MATCH <= size)
+    {
+        unsigned int word = vbmzRead32(src + i);
+        unsigned int & slot = table[vbmzHash(word)];
+        size_t candidate = slot;
+
+        slot = (unsigned int)i;
+
+        if (candidate >= i || i - candidate > VBMZ_MAX_OFFSET || vbmzRead32(src + candidate) != word)
+        {
+            i += 1 + (misses++ >> 6);
+            continue;
+        }
+
+        while (i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1])
+        {
+            i--;
+            candidate--;
+        }
+
+        size_t length = VBMZ_MIN_MATCH;
+        while (i + length < size && src[i + length] == src[candidate + length])
+            length++;
+
+        vbmzWriteSequence(out, src + anchor, i - anchor, i - candidate, length);
+
+        i += length;
+        anchor = i;
+        misses = 0;
+
+        // Gives the next search a candidate from inside the match
+        if (i + 2 <= size)
+            table[vbmzHash(vbmzRead32(src + i - 2))] = (unsigned int)(i - 2);
+    }
+
+    vbmzWriteSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+static inline bool vbmzReadCount(const unsigned char *& p, const unsigned char * end, size_t & count)
+{
+    unsigned int byte;
+
+    do
+    {
+        if (p == end || count > ((size_t)-1 >> 1))
+            return false;
+        byte = *p++;
+        count += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+// Checks every count and offset against both buffers, so corrupt data fails
+// rather than reading or writing outside them
+static bool vbmzDecompress(const unsigned char * src, size_t size, unsigned char * dst, size_t dst_size)
+{
+    const unsigned char * p = src;
+    const unsigned char * end = src + size;
+    unsigned char * out = dst;
+    unsigned char * out_end = dst + dst_size;
+
+    while (p < end)
+    {
+        unsigned int token = *p++;
+        size_t literal_count = token >> 4;
+
+        if (literal_count == 15 && !vbmzReadCount(p, end, literal_count))
+            return false;
+        if ((size_t)(end - p) < literal_count || (size_t)(out_end - out) < literal_count)
+            return false;
+
+        memcpy(out, p, literal_count);
+        p += literal_count;
+        out += literal_count;
+
+        if (p == end)
+            break;
+        if (end - p < 2)
+            return false;
+
+        size_t offset = p[0] | (p[1] << 8);
+        size_t length = token & 15;
+        p += 2;
+
+        if (length == 15 && !vbmzReadCount(p, end, length))
+            return false;
+        length += VBMZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(out - dst) || (size_t)(out_end - out) < length)
+            return false;
+
+        const unsigned char * match = out - offset;
+
+        if (offset >= 8 && (size_t)(out_end - out) >= length + 8)
+        {
+            // Eight bytes at a time, overshooting into space the output
+            // still has; every copy reads only bytes already written
+            unsigned char * stop = out + length;
+            for (; out < stop; out += 8, match += 8)
+                memcpy(out, match, 8);
+            out = stop;
+        }
+        else
+        {
+            for (size_t n = 0; n < length; n++)
+                *out++ = *match++;
+        }
+    }
+
+    return out == out_end;
+}
+
+// The filters. Bytes past the last whole word are left where they are.
+
+static void vbmzShuffle(const unsigned char * in, size_t size, unsigned char * out, bool delta)
+{
+    size_t words = size / 4;
+
+    for (size_t k = 0; k < 4; k++)
+    {
+        unsigned char * lane = out + k * words;
+        unsigned char previous = 0;
+
+        for (size_t i = 0; i < words; i++)
+        {
+            unsigned char byte = in[i * 4 + k];
+            lane[i] = delta ? (unsigned char)(byte - previous) : byte;
+            previous = byte;
+        }
+    }
+
+    memcpy(out + words * 4, in + words * 4, size - words * 4);
+}
+
+// One pass over the output, word by word, with a running sum per lane
+static void vbmzUnshuffle(const unsigned char * in, size_t size, unsigned char * out, bool delta)
+{
+    size_t words = size / 4;
+    const unsigned char * lanes[4] = { in, in + words, in + words * 2, in + words * 3 };
+    unsigned char sums[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+#ifdef VBMZ_USE_SSE2
+    // Sixteen words at a time: a prefix sum within each lane's 16 bytes in
+    // four shifted adds, then the lanes interleaved back into words
+    for (; i + 16 <= words; i += 16)
+    {
+        __m128i lane[4];
+
+        for (size_t k = 0; k < 4; k++)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *)(lanes[k] + i));
+
+            if (delta)
+            {
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+                x = _mm_add_epi8(x, _mm_set1_epi8((char)sums[k]));
+                sums[k] = (unsigned char)(_mm_extract_epi16(x, 7) >> 8);
+            }
+
+            lane[k] = x;
+        }
+
+        __m128i low01 = _mm_unpacklo_epi8(lane[0], lane[1]);
+        __m128i high01 = _mm_unpackhi_epi8(lane[0], lane[1]);
+        __m128i low23 = _mm_unpacklo_epi8(lane[2], lane[3]);
+        __m128i high23 = _mm_unpackhi_epi8(lane[2], lane[3]);
+
+        _mm_storeu_si128((__m128i *)(out + i * 4), _mm_unpacklo_epi16(low01, low23));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 16), _mm_unpackhi_epi16(low01, low23));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 32), _mm_unpacklo_epi16(high01, high23));
+        _mm_storeu_si128((__m128i *)(out + i * 4 + 48), _mm_unpackhi_epi16(high01, high23));
+    }
+#endif
+
+    for (; i < words; i++)
+    {
+        for (size_t k = 0; k < 4; k++)
+        {
+            sums[k] = delta ? (unsigned char)(sums[k] + lanes[k][i]) : lanes[k][i];
+            out[i * 4 + k] = sums[k];
+        }
+    }
+
+    memcpy(out + words * 4, in + words * 4, size - words * 4);
+}
+
+static unsigned int vbmzCompressBlock(const unsigned char * src, size_t size, std::vector<unsigned char> & out)
+{
+    std::vector<unsigned char> filtered(size);
+    std::vector<unsigned char> candidate;
+    unsigned int filter = VBM_FILTER_NONE;
+
+    vbmzCompress(src, size, out);
+
+    for (unsigned int f = VBM_FILTER_SHUFFLE; f <= VBM_FILTER_SHUFFLE_DELTA; f++)
+    {
+        vbmzShuffle(src, size, &filtered[0], f == VBM_FILTER_SHUFFLE_DELTA);
+        vbmzCompress(&filtered[0], size, candidate);
+
+        if (candidate.size() < out.size())
+        {
+            out.swap(candidate);
+            filter = f;
+        }
+    }
+
+    if (out.size() >= size)
+    {
+        out.assign(src, src + size);
+        filter = VBM_FILTER_STORED;
+    }
+
+    return filter;
+}
+
+static bool vbmzDecodeBlock(const unsigned char * src, const VBM_COMPRESSED_BLOCK & block, size_t size,
+                            unsigned char * out, std::vector<unsigned char> & scratch)
+{
+    switch (block.filter)
+    {
+        case VBM_FILTER_STORED:
+            if (block.size != size)
+                return false;
+            memcpy(out, src, size);
+            return true;
+        case VBM_FILTER_NONE:
+            return vbmzDecompress(src, block.size, out, size);
+        case VBM_FILTER_SHUFFLE:
+        case VBM_FILTER_SHUFFLE_DELTA:
+            scratch.resize(size);
+            if (!vbmzDecompress(src, block.size, &scratch[0], size))
+                return false;
+            vbmzUnshuffle(&scratch[0], size, out, block.filter == VBM_FILTER_SHUFFLE_DELTA);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool vbmCompress(const unsigned char * data, size_t size, std::vector<unsigned char> & out,
+                 unsigned int block_size, VThreadPool * pool)
+{
+    if (size == 0 || (unsigned long long)size > 0xFFFFFFFFull)
+        return false;
+
+    if (block_size == 0)
+        block_size = VBM_COMPRESSED_BLOCK_SIZE;
+    block_size = (block_size + 3) & ~3u;
+
+    unsigned int num_blocks = (unsigned int)((size + block_size - 1) / block_size);
+    std::vector<std::vector<unsigned char> > packed(num_blocks);
+    std::vector<unsigned int> filters(num_blocks);
+
+    auto compress = [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int b = begin; b < end; b++)
+        {
+            size_t first = (size_t)b * block_size;
+            size_t count = size - first < block_size ? size - first : block_size;
+
+            filters[b] = vbmzCompressBlock(data + first, count, packed[b]);
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor(num_blocks, 1, compress);
+    else
+        compress(0, num_blocks);
+
+    VBM_COMPRESSED_HEADER header;
+    header.magic = VBM_MAGIC_COMPRESSED;
+    header.size = sizeof(header);
+    header.raw_size = (unsigned int)size;
+    header.block_size = block_size;
+    header.num_blocks = num_blocks;
+    header.flags = 0;
+
+    std::vector<VBM_COMPRESSED_BLOCK> table(num_blocks);
+    unsigned long long offset = sizeof(header) + num_blocks * sizeof(VBM_COMPRESSED_BLOCK);
+
+    for (unsigned int b = 0; b < num_blocks; b++)
+    {
+        table[b].offset = (unsigned int)offset;
+        table[b].size = (unsigned int)packed[b].size();
+        table[b].filter = filters[b];
+        offset += packed[b].size();
+    }
+
+    if (offset > 0xFFFFFFFFull)
+        return false;
+
+    out.resize((size_t)offset);
+    memcpy(&out[0], &header, sizeof(header));
+    memcpy(&out[sizeof(header)], &table[0], num_blocks * sizeof(VBM_COMPRESSED_BLOCK));
+
+    for (unsigned int b = 0; b < num_blocks; b++)
+    {
+        if (!packed[b].empty())
+            memcpy(&out[table[b].offset], &packed[b][0], packed[b].size());
+    }
+
+    return true;
+}
+
+size_t vbmGetDecompressedSize(const unsigned char * data, size_t size)
+{
+    const VBM_COMPRESSED_HEADER * header = (const VBM_COMPRESSED_HEADER *)data;
+
+    if (size < sizeof(VBM_COMPRESSED_HEADER) || header->magic != VBM_MAGIC_COMPRESSED ||
+        header->size < sizeof(VBM_COMPRESSED_HEADER) || header->size > size ||
+        header->raw_size == 0 || header->block_size == 0 || (header->block_size & 3) != 0 ||
+        header->num_blocks != (header->raw_size - 1) / header->block_size + 1 ||
+        header->num_blocks > (size - header->size) / sizeof(VBM_COMPRESSED_BLOCK))
+        return 0;
+
+    const VBM_COMPRESSED_BLOCK * blocks = (const VBM_COMPRESSED_BLOCK *)(data + header->size);
+
+    for (unsigned int b = 0; b < header->num_blocks; b++)
+    {
+        if (blocks[b].offset > size || blocks[b].size > size - blocks[b].offset)
+            return 0;
+    }
+
+    return header->raw_size;
+}
+
+bool vbmDecompress(const unsigned char * data, size_t size, unsigned char * out, VThreadPool * pool)
+{
+    size_t raw_size = vbmGetDecompressedSize(data, size);
+
+    if (raw_size == 0)
+        return false;
+
+    const VBM_COMPRESSED_HEADER * header = (const VBM_COMPRESSED_HEADER *)data;
+    const VBM_COMPRESSED_BLOCK * blocks = (const VBM_COMPRESSED_BLOCK *)(data + header->size);
+    std::atomic<bool> ok(true);
+
+    auto decode = [&](unsigned int begin, unsigned int end)
+    {
+        std::vector<unsigned char> scratch;
+
+        for (unsigned int b = begin; b < end && ok; b++)
+        {
+            size_t first = (size_t)b * header->block_size;
+            size_t count = raw_size - first < header->block_size ? raw_size - first : header->block_size;
+
+            if (!vbmzDecodeBlock(data + blocks[b].offset, blocks[b], count, out + first, scratch))
+                ok = false;
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor(header->num_blocks, 1, decode);
+    else
+        decode(0, header->num_blocks);
+
+    return ok;
+}
@@ -0,0 +1,616 @@
+#include "vbvh.h"
+#include "vcull.h"
+#include "vthread.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+// Instances per leaf below which the heuristic may stop splitting, and the
+// number of bins candidate splits are taken from along each axis
+#define VBVH_MAX_LEAF       4
+#define VBVH_BINS           16
+
+// Half the surface area of a box, which is all the heuristic needs
+static inline float vbvhArea(const float min[3], const float max[3])
+{
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static inline void vbvhEmpty(float min[3], float max[3])
+{
+    min[0] = min[1] = min[2] = 1e30f;
+    max[0] = max[1] = max[2] = -1e30f;
+}
+
+static inline void vbvhGrow(float min[3], float max[3], const float other_min[3], const float other_max[3])
+{
+    for (int k = 0; k < 3; k++)
+    {
+        min[k] = std::min(min[k], other_min[k]);
+        max[k] = std::max(max[k], other_max[k]);
+    }
+}
+
+// Box against the planes in mask: -1 if it is outside one of them, else the
+// mask of the planes it still straddles
+static inline int vbvhClassify(const float planes[6][4], const float min[3], const float max[3], int mask)
+{
+    for (int j = 0; j < 6; j++)
+    {
+        if ((mask & (1 << j)) == 0)
+            continue;
+
+        const float * p = planes[j];
+
+        // Corner furthest along the plane's normal, then the nearest one
+        float outer = p[0] * (p[0] >= 0.0f ? max[0] : min[0]) +
+                    p[1] * (p[1] >= 0.0f ? max[1] : min[1]) +
+                    p[2] * (p[2] >= 0.0f ? max[2] : min[2]) + p[3];
+
+        if (outer < 0.0f)
+            return -1;
+
+        float inner = p[0] * (p[0] >= 0.0f ? min[0] : max[0]) +
+                     p[1] * (p[1] >= 0.0f ? min[1] : max[1]) +
+                     p[2] * (p[2] >= 0.0f ? min[2] : max[2]) + p[3];
+
+        if (inner >= 0.0f)
+            mask &= ~(1 << j);
+    }
+
+    return mask;
+}
+
+// Distance along the ray at which it enters the box, or -1 if it misses the
+// box before limit
+static inline float vbvhSlab(const float min[3], const float max[3], const float origin[3], const float inverse[3], float limit)
+{
+    float enter = 0.0f;
+    float leave = limit;
+
+    for (int k = 0; k < 3; k++)
+    {
+        float t0 = (min[k] - origin[k]) * inverse[k];
+        float t1 = (max[k] - origin[k]) * inverse[k];
+
+        enter = std::max(enter, std::min(t0, t1));
+        leave = std::min(leave, std::max(t0, t1));
+    }
+
+    return enter <= leave ? enter : -1.0f;
+}
+
+VInstanceBVH::VInstanceBVH(VThreadPool * pool)
+    : m_pool(pool),
+      m_node_count(0),
+      m_built_count(0),
+      m_built_cost(0.0f)
+{
+}
+
+void VInstanceBVH::SetInstances(const vmath::vec3 & box_min, const vmath::vec3 & box_max,
+                                const vmath::mat4 * matrices, unsigned int count)
+{
+    vmath::vec3 center = (box_min + box_max) * 0.5f;
+    vmath::vec3 extent = (box_max - box_min) * 0.5f;
+
+    m_boxes.resize(count);
+
+    // The transformed box's center, and its extent along each axis from the
+    // absolute values of the matrix (Arvo)
+    std::function<void (unsigned int, unsigned int)> transform = [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const vmath::mat4 & m = matrices[i];
+            box & b = m_boxes[i];
+
+            for (int k = 0; k < 3; k++)
+            {
+                float c = m[0][k] * center[0] + m[1][k] * center[1] + m[2][k] * center[2] + m[3][k];
+                float e = fabsf(m[0][k]) * extent[0] + fabsf(m[1][k]) * extent[1] + fabsf(m[2][k]) * extent[2];
+
+                b.min[k] = c - e;
+                b.max[k] = c + e;
+            }
+        }
+    };
+
+    if (m_pool)
+        m_pool->ParallelFor(count, 16384, transform);
+    else
+        transform(0, count);
+}
+
+void VInstanceBVH::SetBoxes(const vmath::vec3 * box_min, const vmath::vec3 * box_max, unsigned int count)
+{
+    m_boxes.resize(count);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            m_boxes[i].min[k] = box_min[i][k];
+            m_boxes[i].max[k] = box_max[i][k];
+        }
+    }
+}
+
+void VInstanceBVH::Build(void)
+{
+    unsigned int count = (unsigned int)m_boxes.size();
+    unsigned int i;
+
+    m_order.resize(count);
+    m_nodes.clear();
+    m_built_count = count;
+    m_built_cost = 0.0f;
+
+    if (count == 0)
+        return;
+
+    // A binary tree with at least one instance per leaf has no more nodes
+    // than this, so the array never moves while threads fill it in
+    m_nodes.resize(2 * count - 1);
+    m_node_count = 1;
+
+    // Splitting reorders copies of the boxes rather than indices into
+    // m_boxes, so that every pass over a node reads memory in order
+    task root;
+
+    root.node = 0;
+    root.first = 0;
+    root.count = count;
+    vbvhEmpty(root.bounds.min, root.bounds.max);
+    vbvhEmpty(root.centroids.min, root.centroids.max);
+
+    m_references.resize(count);
+    for (i = 0; i < count; i++)
+    {
+        m_references[i].bounds = m_boxes[i];
+        m_references[i].instance = i;
+        Grow(root, m_boxes[i]);
+    }
+
+    unsigned int threads = m_pool ? m_pool->GetThreadCount() + 1 : 1;
+
+    if (threads > 1 && count >= 4096)
+    {
+        // Split the top of the tree here until there are plenty of subtrees
+        // to balance over the threads, then build those in parallel
+        std::vector<task> deferred;
+        unsigned int defer_count = std::max(count / (threads * 8), 1024u);
+
+        BuildSubtree(root, defer_count, &deferred);
+
+        m_pool->ParallelFor((unsigned int)deferred.size(), 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int t = begin; t < end; t++)
+                BuildSubtree(deferred[t], 0, NULL);
+        });
+    }
+    else
+    {
+        BuildSubtree(root, 0, NULL);
+    }
+
+    for (i = 0; i < count; i++)
+        m_order[i] = m_references[i].instance;
+
+    std::vector<reference>().swap(m_references);
+
+    m_nodes.resize(m_node_count);
+    m_built_cost = GetCost();
+}
+
+void VInstanceBVH::BuildSubtree(const task & root, unsigned int defer_count, std::vector<task> * deferred)
+{
+    std::vector<task> stack(1, root);
+
+    while (!stack.empty())
+    {
+        task t = stack.back();
+        stack.pop_back();
+
+        if (deferred && t.count <= defer_count)
+        {
+            deferred->push_back(t);
+            continue;
+        }
+
+        node & n = m_nodes[t.node];
+        task left, right;
+
+        n.bounds = t.bounds;
+        n.first = t.first;
+        n.count = t.count;
+        n.left = 0;
+
+        if (!Split(t, left, right))
+            continue;
+
+        n.left = AllocateNodes();
+        left.node = n.left;
+        right.node = n.left + 1;
+
+        stack.push_back(right);
+        stack.push_back(left);
+    }
+}
+
+// Adds a box, and its centroid, to the bounds of a task. Centroids are kept
+// doubled, which the bins do not mind.
+void VInstanceBVH::Grow(task & t, const box & b)
+{
+    float c[3] = { b.min[0] + b.max[0], b.min[1] + b.max[1], b.min[2] + b.max[2] };
+
+    vbvhGrow(t.bounds.min, t.bounds.max, b.min, b.max);
+    vbvhGrow(t.centroids.min, t.centroids.max, c, c);
+}
+
+// Divides the instances of t between left and right, reordering them so
+// that left's come first. False if t is better off as a leaf.
+bool VInstanceBVH::Split(const task & t, task & left, task & right)
+{
+    reference * references = &m_references[t.first];
+    unsigned int i;
+    int k, b;
+
+    if (t.count <= 2)
+        return false;
+
+    // All three axes are binned in the same pass
+    box bins[3][VBVH_BINS];
+    unsigned int counts[3][VBVH_BINS];
+    float scale[3];
+
+    for (k = 0; k < 3; k++)
+    {
+        float extent = t.centroids.max[k] - t.centroids.min[k];
+
+        scale[k] = extent > 0.0f ? VBVH_BINS * 0.9999f / extent : 0.0f;
+        for (b = 0; b < VBVH_BINS; b++)
+        {
+            vbvhEmpty(bins[k][b].min, bins[k][b].max);
+            counts[k][b] = 0;
+        }
+    }
+
+    for (i = 0; i < t.count; i++)
+    {
+        const box & r = references[i].bounds;
+
+        for (k = 0; k < 3; k++)
+        {
+            b = (int)((r.min[k] + r.max[k] - t.centroids.min[k]) * scale[k]);
+            counts[k][b]++;
+            vbvhGrow(bins[k][b].min, bins[k][b].max, r.min, r.max);
+        }
+    }
+
+    // Cost of a split counts instances weighted by the area of their side;
+    // visiting the node itself costs as much as one instance
+    float best_cost = 1e30f;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (k = 0; k < 3; k++)
+    {
+        if (scale[k] == 0.0f)
+            continue;
+
+        // Right hand sides swept from the top, then left hand sides from the
+        // bottom
+        float right_area[VBVH_BINS];
+        unsigned int right_count[VBVH_BINS];
+        box sweep;
+        unsigned int n = 0;
+
+        vbvhEmpty(sweep.min, sweep.max);
+
+        for (b = VBVH_BINS - 1; b > 0; b--)
+        {
+            vbvhGrow(sweep.min, sweep.max, bins[k][b].min, bins[k][b].max);
+            n += counts[k][b];
+            right_area[b] = n ? vbvhArea(sweep.min, sweep.max) : 0.0f;
+            right_count[b] = n;
+        }
+
+        vbvhEmpty(sweep.min, sweep.max);
+        n = 0;
+
+        for (b = 0; b < VBVH_BINS - 1; b++)
+        {
+            vbvhGrow(sweep.min, sweep.max, bins[k][b].min, bins[k][b].max);
+            n += counts[k][b];
+
+            if (n == 0 || right_count[b + 1] == 0)
+                continue;
+
+            float cost = vbvhArea(sweep.min, sweep.max) * n + right_area[b + 1] * right_count[b + 1];
+
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = k;
+                best_bin = b;
+            }
+        }
+    }
+
+    float area = vbvhArea(t.bounds.min, t.bounds.max);
+
+    if (t.count <= VBVH_MAX_LEAF && (best_axis < 0 || area + best_cost >= area * t.count))
+        return false;
+
+    vbvhEmpty(left.bounds.min, left.bounds.max);
+    vbvhEmpty(left.centroids.min, left.centroids.max);
+    right.bounds = left.bounds;
+    right.centroids = left.centroids;
+
+    unsigned int split = 0;
+
+    if (best_axis >= 0)
+    {
+        // Partition and gather the bounds of both sides in the same pass
+        float axis_scale = scale[best_axis];
+        float low = t.centroids.min[best_axis];
+        unsigned int end = t.count;
+
+        while (split < end)
+        {
+            const box & r = references[split].bounds;
+
+            if ((int)((r.min[best_axis] + r.max[best_axis] - low) * axis_scale) <= best_bin)
+            {
+                Grow(left, r);
+                split++;
+            }
+            else
+            {
+                Grow(right, r);
+                std::swap(references[split], references[--end]);
+            }
+        }
+    }
+    else
+    {
+        // Every centroid in the same place: any half will do
+        split = t.count / 2;
+
+        for (i = 0; i < t.count; i++)
+            Grow(i < split ? left : right, references[i].bounds);
+    }
+
+    left.first = t.first;
+    left.count = split;
+    right.first = t.first + split;
+    right.count = t.count - split;
+
+    return true;
+}
+
+unsigned int VInstanceBVH::AllocateNodes(void)
+{
+    return m_node_count.fetch_add(2);
+}
+
+bool VInstanceBVH::Refit(void)
+{
+    if (m_boxes.size() != m_built_count)
+        return false;
+
+    // Children always follow their parent
+    for (unsigned int i = (unsigned int)m_nodes.size(); i-- > 0; )
+        RefitNode(i);
+
+    return true;
+}
+
+void VInstanceBVH::RefitNode(unsigned int index)
+{
+    node & n = m_nodes[index];
+
+    vbvhEmpty(n.bounds.min, n.bounds.max);
+
+    if (n.left)
+    {
+        vbvhGrow(n.bounds.min, n.bounds.max, m_nodes[n.left].bounds.min, m_nodes[n.left].bounds.max);
+        vbvhGrow(n.bounds.min, n.bounds.max, m_nodes[n.left + 1].bounds.min, m_nodes[n.left + 1].bounds.max);
+        return;
+    }
+
+    for (unsigned int i = n.first; i < n.first + n.count; i++)
+        vbvhGrow(n.bounds.min, n.bounds.max, m_boxes[m_order[i]].min, m_boxes[m_order[i]].max);
+}
+
+float VInstanceBVH::GetCost(void) const
+{
+    if (m_nodes.empty())
+        return 0.0f;
+
+    float root_area = vbvhArea(m_nodes[0].bounds.min, m_nodes[0].bounds.max);
+    double cost = 0.0;
+
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        const node & n = m_nodes[i];
+        cost += vbvhArea(n.bounds.min, n.bounds.max) * (n.left ? 1.0 : (double)n.count);
+    }
+
+    return root_area > 0.0f ? (float)(cost / root_area) : (float)m_nodes.size();
+}
+
+bool VInstanceBVH::NeedsRebuild(float max_growth) const
+{
+    return GetCost() > m_built_cost * max_growth;
+}
+
+unsigned int VInstanceBVH::QueryFrustum(const vmath::mat4 & view_projection, std::vector<unsigned int> & visible) const
+{
+    size_t start = visible.size();
+
+    if (m_nodes.empty())
+        return 0;
+
+    float planes[6][4];
+    VFrustumCuller::ExtractPlanes(view_projection, planes);
+
+    // Nodes to visit, with the planes their parent still straddled
+    std::vector<std::pair<unsigned int, int> > stack;
+    stack.reserve(64);
+    stack.push_back(std::make_pair(0u, 0x3F));
+
+    while (!stack.empty())
+    {
+        const node & n = m_nodes[stack.back().first];
+        int mask = vbvhClassify(planes, n.bounds.min, n.bounds.max, stack.back().second);
+        unsigned int i;
+
+        stack.pop_back();
+
+        if (mask < 0)
+            continue;
+
+        // Entirely inside: everything below is visible without more tests
+        if (mask == 0)
+        {
+            visible.insert(visible.end(), m_order.begin() + n.first, m_order.begin() + n.first + n.count);
+            continue;
+        }
+
+        if (n.left)
+        {
+            stack.push_back(std::make_pair(n.left + 1, mask));
+            stack.push_back(std::make_pair(n.left, mask));
+            continue;
+        }
+
+        for (i = n.first; i < n.first + n.count; i++)
+        {
+            const box & b = m_boxes[m_order[i]];
+
+            if (vbvhClassify(planes, b.min, b.max, mask) >= 0)
+                visible.push_back(m_order[i]);
+        }
+    }
+
+    return (unsigned int)(visible.size() - start);
+}
+
+bool VInstanceBVH::Raycast(const vmath::vec3 & origin, const vmath::vec3 & direction, RayHit & hit,
+                           float max_distance, const RayTest & test) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    float o[3] = { origin[0], origin[1], origin[2] };
+    float inverse[3];
+    int k;
+
+    for (k = 0; k < 3; k++)
+        inverse[k] = direction[k] != 0.0f ? 1.0f / direction[k] : (direction[k] >= 0.0f ? 1e30f : -1e30f);
+
+    float best = max_distance;
+    bool found = false;
+    float enter = vbvhSlab(m_nodes[0].bounds.min, m_nodes[0].bounds.max, o, inverse, best);
+
+    if (enter < 0.0f)
+        return false;
+
+    // Nodes to visit with the distance the ray enters them at, nearest on top
+    std::vector<std::pair<unsigned int, float> > stack;
+    stack.reserve(64);
+    stack.push_back(std::make_pair(0u, enter));
+
+    while (!stack.empty())
+    {
+        const node & n = m_nodes[stack.back().first];
+        float node_enter = stack.back().second;
+
+        stack.pop_back();
+
+        // Something nearer was hit since this node was pushed
+        if (node_enter > best)
+            continue;
+
+        if (n.left)
+        {
+            float left = vbvhSlab(m_nodes[n.left].bounds.min, m_nodes[n.left].bounds.max, o, inverse, best);
+            float right = vbvhSlab(m_nodes[n.left + 1].bounds.min, m_nodes[n.left + 1].bounds.max, o, inverse, best);
+
+            if (left >= 0.0f && right >= 0.0f)
+            {
+                bool left_first = left <= right;
+
+                stack.push_back(left_first ? std::make_pair(n.left + 1, right) : std::make_pair(n.left, left));
+                stack.push_back(left_first ? std::make_pair(n.left, left) : std::make_pair(n.left + 1, right));
+            }
+            else if (left >= 0.0f)
+            {
+                stack.push_back(std::make_pair(n.left, left));
+            }
+            else if (right >= 0.0f)
+            {
+                stack.push_back(std::make_pair(n.left + 1, right));
+            }
+
+            continue;
+        }
+
+        for (unsigned int i = n.first; i < n.first + n.count; i++)
+        {
+            unsigned int instance = m_order[i];
+            const box & b = m_boxes[instance];
+            float t = vbvhSlab(b.min, b.max, o, inverse, best);
+
+            if (t < 0.0f)
+                continue;
+
+            if (test)
+            {
+                float distance = best;
+
+                if (!test(instance, origin, direction, distance) || distance > best)
+                    continue;
+
+                t = distance;
+            }
+
+            best = t;
+            hit.instance = instance;
+            found = true;
+        }
+    }
+
+    if (found)
+        hit.distance = best;
+
+    return found;
+}
+
+void VInstanceBVH::GetPickRay(const vmath::mat4 & view, const vmath::mat4 & projection, float x, float y,
+                              vmath::vec3 & origin, vmath::vec3 & direction)
+{
+    // Through (x, y) at z = -1 in eye space, inverting the x and y rows of a
+    // perspective projection, where w = -z
+    vmath::vec3 eye((x + projection[2][0]) / projection[0][0], (y + projection[2][1]) / projection[1][1], -1.0f);
+
+    // The inverse of a rotation and translation is the transposed rotation
+    // and the translation rotated back and negated
+    for (int k = 0; k < 3; k++)
+    {
+        vmath::vec3 axis(view[k][0], view[k][1], view[k][2]);
+        vmath::vec3 translation(view[3][0], view[3][1], view[3][2]);
+
+        origin[k] = -vmath::dot(axis, translation);
+        direction[k] = vmath::dot(axis, eye);
+    }
+
+    direction = vmath::normalize(direction);
+}
@@ -0,0 +1,304 @@
+#include "vcache.h"
+#include "vmmap.h"
+#include "vermilion.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ctype.h>
+#endif
+
+VResourceCache::VResourceCache(size_t unused_budget)
+    : m_unused_budget(unused_budget),
+      m_clock(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+VResourceCache::~VResourceCache(void)
+{
+    // Whatever is still referenced goes too - the cache owns it
+    while (!m_by_content.empty())
+        Evict(m_by_content.begin()->second);
+}
+
+std::string VResourceCache::GetCanonicalPath(const char * filename)
+{
+#ifdef _WIN32
+    char buffer[_MAX_PATH];
+
+    if (_fullpath(buffer, filename, sizeof(buffer)) == NULL)
+        return filename;
+
+    // Paths are case insensitive and take either slash
+    for (char * c = buffer; *c; c++)
+        *c = *c == '/' ? '\\' : (char)tolower((unsigned char)*c);
+
+    return buffer;
+#else
+    char * resolved = realpath(filename, NULL);
+
+    if (resolved == NULL)
+        return filename;
+
+    std::string path(resolved);
+    free(resolved);
+
+    return path;
+#endif
+}
+
+bool VResourceCache::HashFile(const char * filename, unsigned long long * hash)
+{
+    VMappedFile file;
+
+    if (!file.Open(filename))
+        return false;
+
+    const unsigned char * data = file.GetData();
+    size_t size = file.GetSize();
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+
+    *hash = h;
+
+    return true;
+}
+
+VBObject * VResourceCache::AcquireMesh(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags)
+{
+    char prefix[64];
+    std::string content_key;
+
+    sprintf(prefix, "mesh %d %d %d %x ", vertexIndex, normalIndex, texCoord0Index, flags);
+
+    std::string path = GetCanonicalPath(filename);
+    std::string path_key = prefix + path;
+    entry * e = Find(path_key, prefix, filename, &content_key);
+
+    if (e != NULL)
+        return e->resource.object;
+
+    VBObject * object = new VBObject;
+
+    if (!object->LoadFromVBM(filename, vertexIndex, normalIndex, texCoord0Index, flags))
+    {
+        object->Free();
+        delete object;
+        return NULL;
+    }
+
+    e = Insert(MESH, path, path_key, content_key);
+    e->resource.object = object;
+    e->resource.bytes = object->GetDataSize();
+    m_by_object[object] = e;
+    m_stats.resident_bytes += e->resource.bytes;
+
+    return object;
+}
+
+GLuint VResourceCache::AcquireTexture(const char * filename)
+{
+    const char * prefix = "texture ";
+    std::string content_key;
+    std::string path = GetCanonicalPath(filename);
+    std::string path_key = prefix + path;
+    entry * e = Find(path_key, prefix, filename, &content_key);
+
+    if (e != NULL)
+        return e->resource.texture;
+
+    vglImageData image;
+    GLuint texture = vglLoadTexture(filename, 0, &image);
+
+    if (texture == 0)
+        return 0;
+
+    e = Insert(TEXTURE, path, path_key, content_key);
+    e->resource.texture = texture;
+    e->resource.bytes = (size_t)image.totalDataSize;
+    m_by_texture[texture] = e;
+    m_stats.resident_bytes += e->resource.bytes;
+
+    vglUnloadImage(&image);
+
+    return texture;
+}
+
+void VResourceCache::Release(VBObject * object)
+{
+    std::map<VBObject *, entry *>::iterator it = m_by_object.find(object);
+
+    if (it != m_by_object.end())
+        ReleaseEntry(it->second);
+}
+
+void VResourceCache::ReleaseTexture(GLuint texture)
+{
+    std::map<GLuint, entry *>::iterator it = m_by_texture.find(texture);
+
+    if (it != m_by_texture.end())
+        ReleaseEntry(it->second);
+}
+
+void VResourceCache::EvictUnused(void)
+{
+    std::vector<entry *> unused;
+    std::map<std::string, entry *>::iterator it;
+
+    for (it = m_by_content.begin(); it != m_by_content.end(); ++it)
+    {
+        if (it->second->refs == 0)
+            unused.push_back(it->second);
+    }
+
+    for (size_t i = 0; i < unused.size(); i++)
+        Evict(unused[i]);
+}
+
+// Looks the resource up by path, then by contents. A content hit learns the
+// new path so the next lookup through it needs no I/O. On a miss the
+// content key for the file is returned for Insert.
+VResourceCache::entry * VResourceCache::Find(const std::string & path_key, const std::string & content_key_prefix,
+                                             const char * filename, std::string * content_key)
+{
+    std::map<std::string, entry *>::iterator it = m_by_path.find(path_key);
+
+    if (it != m_by_path.end())
+    {
+        m_stats.path_hits++;
+        AddRef(it->second);
+        return it->second;
+    }
+
+    unsigned long long hash;
+
+    // Unreadable - loading will fail too, but keep the key unique
+    if (!HashFile(filename, &hash))
+    {
+        *content_key = path_key;
+        return NULL;
+    }
+
+    char hex[20];
+    sprintf(hex, "%016llx", hash);
+    *content_key = content_key_prefix + hex;
+
+    it = m_by_content.find(*content_key);
+
+    if (it == m_by_content.end())
+        return NULL;
+
+    entry * e = it->second;
+
+    e->path_keys.push_back(path_key);
+    m_by_path[path_key] = e;
+    m_stats.content_hits++;
+    AddRef(e);
+
+    return e;
+}
+
+VResourceCache::entry * VResourceCache::Insert(Type type, const std::string & path, const std::string & path_key, const std::string & content_key)
+{
+    entry * e = new entry;
+
+    e->path = path;
+    e->content_key = content_key;
+    e->path_keys.push_back(path_key);
+    e->refs = 1;
+    e->last_used = ++m_clock;
+
+    memset(&e->resource, 0, sizeof(e->resource));
+    e->resource.type = type;
+    e->resource.path = e->path.c_str();
+
+    m_by_path[path_key] = e;
+    m_by_content[content_key] = e;
+
+    m_stats.loads++;
+    m_stats.resident++;
+
+    return e;
+}
+
+void VResourceCache::AddRef(entry * e)
+{
+    if (e->refs++ == 0)
+        m_stats.unused_bytes -= e->resource.bytes;
+
+    e->last_used = ++m_clock;
+}
+
+void VResourceCache::ReleaseEntry(entry * e)
+{
+    if (e->refs == 0 || --e->refs != 0)
+        return;
+
+    m_stats.unused_bytes += e->resource.bytes;
+    e->last_used = ++m_clock;
+
+    Trim();
+}
+
+void VResourceCache::Evict(entry * e)
+{
+    if (m_evict_callback)
+        m_evict_callback(e->resource);
+
+    if (e->resource.type == MESH)
+    {
+        m_by_object.erase(e->resource.object);
+        e->resource.object->Free();
+        delete e->resource.object;
+    }
+    else
+    {
+        m_by_texture.erase(e->resource.texture);
+        glDeleteTextures(1, &e->resource.texture);
+    }
+
+    for (size_t i = 0; i < e->path_keys.size(); i++)
+        m_by_path.erase(e->path_keys[i]);
+
+    m_by_content.erase(e->content_key);
+
+    m_stats.resident--;
+    m_stats.resident_bytes -= e->resource.bytes;
+
+    if (e->refs == 0)
+        m_stats.unused_bytes -= e->resource.bytes;
+
+    delete e;
+}
+
+// Frees the least recently used unreferenced resources until the rest fit
+// in the budget
+void VResourceCache::Trim(void)
+{
+    while (m_stats.unused_bytes > m_unused_budget)
+    {
+        entry * oldest = NULL;
+        std::map<std::string, entry *>::iterator it;
+
+        for (it = m_by_content.begin(); it != m_by_content.end(); ++it)
+        {
+            entry * e = it->second;
+
+            if (e->refs == 0 && (oldest == NULL || e->last_used < oldest->last_used))
+                oldest = e;
+        }
+
+        if (oldest == NULL)
+            break;
+
+        Evict(oldest);
+    }
+}
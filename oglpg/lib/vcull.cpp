@@ -0,0 +1,166 @@
+#include "vcull.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#define VCULL_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VCULL_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+VFrustumCuller::VFrustumCuller(void)
+{
+    memset(m_planes, 0, sizeof(m_planes));
+}
+
+const char * VFrustumCuller::GetPath(void)
+{
+#if defined(VCULL_USE_AVX)
+    return "avx";
+#elif defined(VCULL_USE_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void VFrustumCuller::ExtractPlanes(const vmath::mat4 & view_projection, float planes[6][4])
+{
+    // Planes from the rows of the matrix (Gribb and Hartmann); the matrix is
+    // column major, m[column][row]
+    const vmath::mat4 & m = view_projection;
+    int i, k;
+
+    for (k = 0; k < 4; k++)
+    {
+        planes[0][k] = m[k][3] + m[k][0];
+        planes[1][k] = m[k][3] - m[k][0];
+        planes[2][k] = m[k][3] + m[k][1];
+        planes[3][k] = m[k][3] - m[k][1];
+        planes[4][k] = m[k][3] + m[k][2];
+        planes[5][k] = m[k][3] - m[k][2];
+    }
+
+    // Normalized, so that distances compare with radii
+    for (i = 0; i < 6; i++)
+    {
+        float length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        if (length > 0.0f)
+        {
+            for (k = 0; k < 4; k++)
+                planes[i][k] /= length;
+        }
+    }
+}
+
+void VFrustumCuller::SetFrustum(const vmath::mat4 & view_projection)
+{
+    ExtractPlanes(view_projection, m_planes);
+}
+
+unsigned int VFrustumCuller::Cull(const vmath::vec4 & sphere, const vmath::mat4 * matrices, const vmath::vec4 * colors,
+                                  unsigned int count, vmath::mat4 * out_matrices, vmath::vec4 * out_colors)
+{
+    unsigned int visible = 0;
+    unsigned int i, j;
+
+    // Eight instances at a time: their spheres go into small arrays on the
+    // stack, are tested together, and the survivors are copied while their
+    // matrices are still in the cache
+    for (i = 0; i < count; i += 8)
+    {
+        unsigned int n = count - i < 8 ? count - i : 8;
+        float x[8] = { 0.0f, };
+        float y[8] = { 0.0f, };
+        float z[8] = { 0.0f, };
+        float scale[8] = { 0.0f, };
+
+        // Move the sphere into world space. The radius is scaled by the
+        // longest basis vector, which covers any scale or shear; its squared
+        // length is kept and the square root taken a register at a time.
+        for (j = 0; j < n; j++)
+        {
+            const vmath::mat4 & m = matrices[i + j];
+            float sx = m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2];
+            float sy = m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2];
+            float sz = m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2];
+
+            scale[j] = sx > sy ? (sx > sz ? sx : sz) : (sy > sz ? sy : sz);
+            x[j] = m[0][0] * sphere[0] + m[1][0] * sphere[1] + m[2][0] * sphere[2] + m[3][0];
+            y[j] = m[0][1] * sphere[0] + m[1][1] * sphere[1] + m[2][1] * sphere[2] + m[3][1];
+            z[j] = m[0][2] * sphere[0] + m[1][2] * sphere[1] + m[2][2] * sphere[2] + m[3][2];
+        }
+
+        // Bit j set when sphere i + j is at least partly inside every plane
+        unsigned int mask = 0;
+
+#if defined(VCULL_USE_AVX)
+        __m256 vx = _mm256_loadu_ps(x);
+        __m256 vy = _mm256_loadu_ps(y);
+        __m256 vz = _mm256_loadu_ps(z);
+        __m256 r = _mm256_mul_ps(_mm256_set1_ps(-sphere[3]), _mm256_sqrt_ps(_mm256_loadu_ps(scale)));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (j = 0; j < 6; j++)
+        {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(vx, _mm256_set1_ps(m_planes[j][0])), _mm256_set1_ps(m_planes[j][3]));
+            d = _mm256_add_ps(d, _mm256_mul_ps(vy, _mm256_set1_ps(m_planes[j][1])));
+            d = _mm256_add_ps(d, _mm256_mul_ps(vz, _mm256_set1_ps(m_planes[j][2])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, r, _CMP_GE_OQ));
+        }
+
+        mask = (unsigned int)_mm256_movemask_ps(inside);
+#elif defined(VCULL_USE_SSE2)
+        for (unsigned int half = 0; half < 8; half += 4)
+        {
+            __m128 vx = _mm_loadu_ps(x + half);
+            __m128 vy = _mm_loadu_ps(y + half);
+            __m128 vz = _mm_loadu_ps(z + half);
+            __m128 r = _mm_mul_ps(_mm_set1_ps(-sphere[3]), _mm_sqrt_ps(_mm_loadu_ps(scale + half)));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+            for (j = 0; j < 6; j++)
+            {
+                __m128 d = _mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(m_planes[j][0])), _mm_set1_ps(m_planes[j][3]));
+                d = _mm_add_ps(d, _mm_mul_ps(vy, _mm_set1_ps(m_planes[j][1])));
+                d = _mm_add_ps(d, _mm_mul_ps(vz, _mm_set1_ps(m_planes[j][2])));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, r));
+            }
+
+            mask |= (unsigned int)_mm_movemask_ps(inside) << half;
+        }
+#else
+        for (unsigned int lane = 0; lane < n; lane++)
+        {
+            float r = -sphere[3] * sqrtf(scale[lane]);
+            bool inside = true;
+
+            for (j = 0; j < 6 && inside; j++)
+                inside = m_planes[j][0] * x[lane] + m_planes[j][1] * y[lane] + m_planes[j][2] * z[lane] + m_planes[j][3] >= r;
+
+            if (inside)
+                mask |= 1u << lane;
+        }
+#endif
+
+        // Lanes past the last instance
+        mask &= (1u << n) - 1;
+
+        // Compact the survivors
+        for (j = 0; mask != 0; j++, mask >>= 1)
+        {
+            if ((mask & 1) == 0)
+                continue;
+
+            out_matrices[visible] = matrices[i + j];
+            if (colors && out_colors)
+                out_colors[visible] = colors[i + j];
+            visible++;
+        }
+    }
+
+    return visible;
+}
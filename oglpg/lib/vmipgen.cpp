@@ -0,0 +1,617 @@
+#include "vmipgen.h"
+#include "vthread.h"
+#include "vermilion.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#if defined(__AVX2__)
+#define VMIP_USE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VMIP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define VMIP_PI             3.14159265358979323846
+#define VMIP_TILE_SIZE      64
+
+// Kaiser window shape, and the sinc lobes both windowed filters keep
+#define VMIP_KAISER_ALPHA   4.0
+#define VMIP_FILTER_WIDTH   3.0
+
+// How to turn a format's bytes into floats and back. Texels are always
+// four floats while being filtered, whatever the format, with the channels
+// it lacks left 0.
+struct vmipFormat
+{
+    unsigned int channels;
+    int coverage;                   // Channel the alpha test reads, -1 if not preserving coverage
+    unsigned int pass;              // Smallest byte in that channel that passes the test
+    bool srgb[4];
+    float linear[256];              // Byte to float, for linear channels
+    float srgb_linear[256];         // sRGB byte to linear float
+    float srgb_thresholds[255];     // Linear floats halfway between sRGB codes
+};
+
+// Weights for filtering source texels down to destination ones along one
+// axis: each destination texel d takes taps source texels from first[d] on,
+// which may run past either edge. Each weight is repeated repeat times, so
+// that the row pass can multiply whole texels at once.
+struct vmipAxis
+{
+    unsigned int taps;
+    unsigned int repeat;
+    std::vector<int> first;
+    std::vector<float> weights;
+};
+
+// One level of every layer, filtered from the level above
+struct vmipLevel
+{
+    const unsigned char * source;   // Layer 0 of the level above
+    unsigned char * destination;    // Layer 0 of this level
+    size_t stride;                  // Between layers
+    unsigned int source_width;
+    unsigned int source_height;
+    unsigned int width;
+    unsigned int height;
+    vmipAxis x;
+    vmipAxis y;
+    float * alpha;                  // Unquantized coverage channel, width x height per layer, or NULL
+};
+
+static double vmipSinc(double x)
+{
+    if (x == 0.0)
+        return 1.0;
+
+    x *= VMIP_PI;
+
+    return sin(x) / x;
+}
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window
+static double vmipBesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 64 && term > sum * 1e-12; k++)
+    {
+        double f = x * 0.5 / k;
+
+        term *= f * f;
+        sum += term;
+    }
+
+    return sum;
+}
+
+// The filter t destination texels from a destination texel's center
+static double vmipKernel(VMipGenerator::Filter filter, double t)
+{
+    t = fabs(t);
+
+    switch (filter)
+    {
+        case VMipGenerator::BOX:
+            return t < 0.5 ? 1.0 : (t == 0.5 ? 0.5 : 0.0);
+        case VMipGenerator::KAISER:
+        {
+            if (t >= VMIP_FILTER_WIDTH)
+                return 0.0;
+
+            double r = t / VMIP_FILTER_WIDTH;
+
+            return vmipSinc(t) * vmipBesselI0(VMIP_KAISER_ALPHA * sqrt(1.0 - r * r)) / vmipBesselI0(VMIP_KAISER_ALPHA);
+        }
+        case VMipGenerator::LANCZOS:
+            return t < VMIP_FILTER_WIDTH ? vmipSinc(t) * vmipSinc(t / VMIP_FILTER_WIDTH) : 0.0;
+    }
+
+    return 0.0;
+}
+
+// Like vbmFilterWeights, but with the filter stretched over the source
+// texels each destination texel covers, and taps that start where its
+// weights do rather than clamped to the edges, so that they are always
+// adjacent. Taps are padded with zero weights to a multiple of multiple.
+static void vmipFilterAxis(VMipGenerator::Filter filter, unsigned int source, unsigned int destination,
+                           unsigned int repeat, unsigned int multiple, vmipAxis & axis)
+{
+    double scale = (double)source / destination;
+    double support = (filter == VMipGenerator::BOX ? 0.5 : VMIP_FILTER_WIDTH) * scale;
+    unsigned int span = source == destination ? 1 : (unsigned int)ceil(support * 2.0) + 1;
+    std::vector<double> weights((size_t)destination * span);
+    std::vector<unsigned int> counts(destination);
+    unsigned int d, t;
+
+    axis.taps = 1;
+    axis.repeat = repeat;
+    axis.first.resize(destination);
+
+    for (d = 0; d < destination; d++)
+    {
+        double * w = &weights[(size_t)d * span];
+
+        if (source == destination)
+        {
+            axis.first[d] = (int)d;
+            counts[d] = 1;
+            w[0] = 1.0;
+            continue;
+        }
+
+        double center = (d + 0.5) * scale;
+        int start = (int)ceil(center - support - 0.5);
+        unsigned int lo = span, hi = 0;
+
+        for (t = 0; t < span; t++)
+        {
+            w[t] = vmipKernel(filter, (start + (int)t + 0.5 - center) / scale);
+
+            if (w[t] != 0.0)
+            {
+                lo = std::min(lo, t);
+                hi = t;
+            }
+        }
+
+        if (lo > hi)
+        {
+            lo = hi = 0;
+            w[0] = 1.0;
+        }
+
+        axis.first[d] = start + (int)lo;
+        counts[d] = hi - lo + 1;
+        memmove(w, w + lo, counts[d] * sizeof(double));
+        axis.taps = std::max(axis.taps, counts[d]);
+    }
+
+    axis.taps = (axis.taps + multiple - 1) / multiple * multiple;
+    axis.weights.assign((size_t)destination * axis.taps * repeat, 0.0f);
+
+    for (d = 0; d < destination; d++)
+    {
+        const double * w = &weights[(size_t)d * span];
+        double sum = 0.0;
+
+        for (t = 0; t < counts[d]; t++)
+            sum += w[t];
+
+        for (t = 0; t < counts[d]; t++)
+        {
+            float weight = (float)(w[t] / sum);
+
+            for (unsigned int r = 0; r < repeat; r++)
+                axis.weights[((size_t)d * axis.taps + t) * repeat + r] = weight;
+        }
+    }
+}
+
+static void vmipInitFormat(vmipFormat & format, unsigned int channels, bool srgb, float alpha_cutoff)
+{
+    unsigned int i;
+
+    format.channels = channels;
+    format.coverage = -1;
+    format.pass = 256;
+
+    if (alpha_cutoff > 0.0f && alpha_cutoff <= 1.0f && (channels == 1 || channels == 4))
+    {
+        format.coverage = (int)channels - 1;
+
+        for (format.pass = 0; format.pass / 255.0f < alpha_cutoff; format.pass++)
+            ;
+    }
+
+    for (i = 0; i < 4; i++)
+        format.srgb[i] = srgb && i < 3 && (int)i != format.coverage;
+
+    for (i = 0; i < 256; i++)
+    {
+        double c = i / 255.0;
+
+        format.linear[i] = (float)c;
+        format.srgb_linear[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+
+    for (i = 0; i < 255; i++)
+    {
+        double c = (i + 0.5) / 255.0;
+
+        format.srgb_thresholds[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+}
+
+// Loads count texels of a row from source texel first on, clamped to the
+// row, as four floats each
+static void vmipLoadRow(const vmipFormat & format, const unsigned char * row, unsigned int width,
+                        int first, unsigned int count, float * out)
+{
+    const float * tables[4];
+    unsigned int c;
+
+    for (c = 0; c < 4; c++)
+        tables[c] = format.srgb[c] ? format.srgb_linear : format.linear;
+
+    for (unsigned int i = 0; i < count; i++, out += 4)
+    {
+        int x = std::min(std::max(first + (int)i, 0), (int)width - 1);
+        const unsigned char * texel = row + (size_t)x * format.channels;
+
+        for (c = 0; c < format.channels; c++)
+            out[c] = tables[c][texel[c]];
+        for (; c < 4; c++)
+            out[c] = 0.0f;
+    }
+}
+
+// Filters count destination texels from d on out of a row loaded from
+// source texel first on. Each one's taps are adjacent texels, so this is a
+// dot product of taps x 4 floats with its weights, four channels at once.
+static void vmipFilterRow(const vmipAxis & axis, const float * row, int first, unsigned int d,
+                          unsigned int count, float * out)
+{
+    unsigned int n = axis.taps * 4;
+
+    for (unsigned int i = 0; i < count; i++, d++, out += 4)
+    {
+        const float * in = row + (axis.first[d] - first) * 4;
+        const float * w = &axis.weights[(size_t)d * n];
+        unsigned int j;
+
+#if defined(VMIP_USE_AVX2)
+        // Taps come in pairs, so n is a multiple of 8
+        __m256 sum = _mm256_setzero_ps();
+
+        for (j = 0; j < n; j += 8)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(in + j), _mm256_loadu_ps(w + j)));
+
+        _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+#elif defined(VMIP_USE_SSE2)
+        __m128 sum = _mm_setzero_ps();
+
+        for (j = 0; j < n; j += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(in + j), _mm_loadu_ps(w + j)));
+
+        _mm_storeu_ps(out, sum);
+#else
+        out[0] = out[1] = out[2] = out[3] = 0.0f;
+
+        for (j = 0; j < n; j += 4)
+        {
+            out[0] += in[j + 0] * w[j + 0];
+            out[1] += in[j + 1] * w[j + 1];
+            out[2] += in[j + 2] * w[j + 2];
+            out[3] += in[j + 3] * w[j + 3];
+        }
+#endif
+    }
+}
+
+// out is the weighted sum of taps rows of count floats
+static void vmipFilterColumns(const float * const * rows, const float * weights, unsigned int taps,
+                              unsigned int count, float * out)
+{
+    unsigned int i = 0, t;
+
+#if defined(VMIP_USE_AVX2)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for (t = 0; t < taps; t++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[t] + i), _mm256_set1_ps(weights[t])));
+
+        _mm256_storeu_ps(out + i, sum);
+    }
+#endif
+#if defined(VMIP_USE_AVX2) || defined(VMIP_USE_SSE2)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+
+        for (t = 0; t < taps; t++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[t] + i), _mm_set1_ps(weights[t])));
+
+        _mm_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float sum = 0.0f;
+
+        for (t = 0; t < taps; t++)
+            sum += rows[t][i] * weights[t];
+
+        out[i] = sum;
+    }
+}
+
+static unsigned char vmipQuantize(float v)
+{
+    v = v * 255.0f + 0.5f;
+
+    return (unsigned char)(v <= 0.0f ? 0 : (v >= 255.0f ? 255 : (int)v));
+}
+
+// Rounds a row of filtered texels to bytes, sRGB channels to the nearest
+// code. The coverage channel goes to alpha instead, if there is one, to be
+// scaled and rounded once the whole level is known.
+static void vmipStoreRow(const vmipFormat & format, const float * row, unsigned int count,
+                         unsigned char * out, float * alpha)
+{
+    for (unsigned int i = 0; i < count; i++, row += 4, out += format.channels)
+    {
+        for (unsigned int c = 0; c < format.channels; c++)
+        {
+            if ((int)c == format.coverage && alpha != NULL)
+                alpha[i] = row[c];
+            else if (format.srgb[c])
+                out[c] = (unsigned char)(std::upper_bound(format.srgb_thresholds, format.srgb_thresholds + 255, row[c]) -
+                                         format.srgb_thresholds);
+            else
+                out[c] = vmipQuantize(row[c]);
+        }
+    }
+}
+
+// Filters destination texels [x0, x1) x [y0, y1) of one layer: the source
+// rows they reach are filtered across first, then down
+static void vmipFilterTile(const vmipFormat & format, const vmipLevel & level, unsigned int layer,
+                           unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    int col0 = level.x.first[x0];
+    int row0 = level.y.first[y0];
+    unsigned int cols = (unsigned int)(level.x.first[x1 - 1] - col0) + level.x.taps;
+    unsigned int rows = (unsigned int)(level.y.first[y1 - 1] - row0) + level.y.taps;
+    unsigned int width = x1 - x0;
+    std::vector<float> scratch(((size_t)cols + (size_t)rows * width + width) * 4);
+    std::vector<const float *> taps(level.y.taps);
+    float * loaded = &scratch[0];
+    float * filtered = loaded + (size_t)cols * 4;
+    float * out = filtered + (size_t)rows * width * 4;
+    const unsigned char * source = level.source + level.stride * layer;
+    unsigned char * destination = level.destination + level.stride * layer;
+    size_t source_pitch = (size_t)level.source_width * format.channels;
+    unsigned int r, y, t;
+
+    for (r = 0; r < rows; r++)
+    {
+        int sy = std::min(std::max(row0 + (int)r, 0), (int)level.source_height - 1);
+
+        vmipLoadRow(format, source + source_pitch * sy, level.source_width, col0, cols, loaded);
+        vmipFilterRow(level.x, loaded, col0, x0, width, filtered + (size_t)r * width * 4);
+    }
+
+    for (y = y0; y < y1; y++)
+    {
+        size_t offset = (size_t)y * level.width + x0;
+
+        for (t = 0; t < level.y.taps; t++)
+            taps[t] = filtered + (size_t)(level.y.first[y] - row0 + t) * width * 4;
+
+        vmipFilterColumns(&taps[0], &level.y.weights[(size_t)y * level.y.taps], level.y.taps, width * 4, out);
+        vmipStoreRow(format, out, width, destination + offset * format.channels,
+                     level.alpha != NULL ? level.alpha + (size_t)level.width * level.height * layer + offset : NULL);
+    }
+}
+
+// Scale for a level's coverage channel that brings the fraction coverage
+// of its texels to the alpha test's threshold: halfway between the values
+// that should just pass and just fail, as Castano does it. Reorders alpha.
+static float vmipCoverageScale(const vmipFormat & format, std::vector<float> & alpha, double coverage)
+{
+    float threshold = (format.pass - 0.5f) / 255.0f;
+    size_t n = alpha.size();
+    size_t k = (size_t)(coverage * n + 0.5);
+    float value;
+
+    if (k == 0)
+        return 1.0f;
+
+    if (k >= n)
+    {
+        // Everything passed at the top; only ever scale up to keep it so
+        value = *std::min_element(alpha.begin(), alpha.end());
+
+        return value > 0.0f && value < threshold ? threshold / value : 1.0f;
+    }
+
+    std::nth_element(alpha.begin(), alpha.begin() + (k - 1), alpha.end(), std::greater<float>());
+
+    value = (alpha[k - 1] + *std::max_element(alpha.begin() + k, alpha.end())) * 0.5f;
+
+    return value > 0.0f ? threshold / value : 1.0f;
+}
+
+static void vmipRun(VThreadPool * pool, unsigned int count, const std::function<void (unsigned int, unsigned int)> & func)
+{
+    if (pool != NULL)
+        pool->ParallelFor(count, 1, func);
+    else
+        func(0, count);
+}
+
+const char * VMipGenerator::GetPath(void)
+{
+#if defined(VMIP_USE_AVX2)
+    return "avx2";
+#elif defined(VMIP_USE_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+bool VMipGenerator::Generate(const vglImageData & image, vglImageData & mips, Filter filter, float alpha_cutoff, VThreadPool * pool)
+{
+    unsigned int channels;
+
+    switch (image.format)
+    {
+        case GL_RED:
+            channels = 1;
+            break;
+        case GL_RG:
+            channels = 2;
+            break;
+        case GL_RGB:
+        case GL_BGR:
+            channels = 3;
+            break;
+        case GL_RGBA:
+        case GL_BGRA:
+            channels = 4;
+            break;
+        default:
+            return false;
+    }
+
+    if (image.mip[0].data == NULL || image.type != GL_UNSIGNED_BYTE || image.target == GL_TEXTURE_3D ||
+        image.mip[0].width < 1 || image.mip[0].height < 1 || image.mip[0].depth > 1)
+        return false;
+
+    bool srgb = image.internalFormat == GL_SRGB8 || image.internalFormat == GL_SRGB8_ALPHA8 ||
+                image.internalFormat == GL_SRGB || image.internalFormat == GL_SRGB_ALPHA;
+    vmipFormat format;
+
+    vmipInitFormat(format, channels, srgb, alpha_cutoff);
+
+    unsigned int faces = (image.target == GL_TEXTURE_CUBE_MAP || image.target == GL_TEXTURE_CUBE_MAP_ARRAY) ? 6 : 1;
+    unsigned int layers = (unsigned int)image.slices * faces;
+    unsigned int width = (unsigned int)image.mip[0].width;
+    unsigned int height = (unsigned int)image.mip[0].height;
+    vglImageData out = image;
+    GLsizeiptr offset = 0;
+    int level;
+
+    out.mapping = NULL;
+    out.mappingSize = 0;
+
+    for (level = 0; level < MAX_TEXTURE_MIPS; level++)
+    {
+        out.mip[level].width = width;
+        out.mip[level].height = height;
+        out.mip[level].depth = 1;
+        out.mip[level].mipStride = (GLsizeiptr)width * height * channels;
+        out.mip[level].data = NULL;
+        offset += out.mip[level].mipStride;
+
+        if (width == 1 && height == 1)
+        {
+            level++;
+            break;
+        }
+
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    out.mipLevels = level;
+    out.sliceStride = offset;
+    out.totalDataSize = out.sliceStride * layers;
+
+    unsigned char * data = new unsigned char [out.totalDataSize];
+    std::vector<double> coverage(layers);
+    unsigned int layer;
+
+    for (layer = 0; layer < layers; layer++)
+    {
+        const unsigned char * top = (const unsigned char *)image.mip[0].data + (size_t)image.sliceStride * layer;
+
+        memcpy(data + (size_t)out.sliceStride * layer, top, out.mip[0].mipStride);
+
+        if (format.coverage >= 0)
+        {
+            size_t n = (size_t)out.mip[0].width * out.mip[0].height;
+            size_t passed = 0;
+
+            for (size_t i = 0; i < n; i++)
+                passed += top[i * channels + format.coverage] >= format.pass;
+
+            coverage[layer] = (double)passed / n;
+        }
+    }
+
+    for (level = 1, offset = 0; level < out.mipLevels; level++)
+    {
+        const vglImageMipData & above = out.mip[level - 1];
+        const vglImageMipData & mip = out.mip[level];
+        std::vector<float> alpha;
+        vmipLevel pass;
+
+        pass.source = data + offset;
+        offset += above.mipStride;
+        pass.destination = data + offset;
+        pass.stride = (size_t)out.sliceStride;
+        pass.source_width = above.width;
+        pass.source_height = above.height;
+        pass.width = mip.width;
+        pass.height = mip.height;
+        pass.alpha = NULL;
+
+        // Row taps in pairs fill AVX2 registers two texels at a time
+        vmipFilterAxis(filter, pass.source_width, pass.width, 4, 2, pass.x);
+        vmipFilterAxis(filter, pass.source_height, pass.height, 1, 1, pass.y);
+
+        if (format.coverage >= 0)
+        {
+            alpha.resize((size_t)pass.width * pass.height * layers);
+            pass.alpha = &alpha[0];
+        }
+
+        unsigned int tiles_x = (pass.width + VMIP_TILE_SIZE - 1) / VMIP_TILE_SIZE;
+        unsigned int tiles_y = (pass.height + VMIP_TILE_SIZE - 1) / VMIP_TILE_SIZE;
+        unsigned int tiles = tiles_x * tiles_y;
+
+        vmipRun(pool, tiles * layers, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int task = begin; task < end; task++)
+            {
+                unsigned int tile = task % tiles;
+                unsigned int x0 = (tile % tiles_x) * VMIP_TILE_SIZE;
+                unsigned int y0 = (tile / tiles_x) * VMIP_TILE_SIZE;
+
+                vmipFilterTile(format, pass, task / tiles, x0, y0,
+                               std::min(x0 + VMIP_TILE_SIZE, pass.width), std::min(y0 + VMIP_TILE_SIZE, pass.height));
+            }
+        });
+
+        if (format.coverage < 0)
+            continue;
+
+        vmipRun(pool, layers, [&](unsigned int begin, unsigned int end)
+        {
+            size_t n = (size_t)pass.width * pass.height;
+
+            for (unsigned int l = begin; l < end; l++)
+            {
+                const float * values = pass.alpha + n * l;
+                std::vector<float> sorted(values, values + n);
+                float scale = vmipCoverageScale(format, sorted, coverage[l]);
+                unsigned char * texels = pass.destination + pass.stride * l + format.coverage;
+
+                for (size_t i = 0; i < n; i++)
+                    texels[i * channels] = vmipQuantize(values[i] * scale);
+            }
+        });
+    }
+
+    for (level = 0, offset = 0; level < out.mipLevels; level++)
+    {
+        out.mip[level].data = data + offset;
+        offset += out.mip[level].mipStride;
+    }
+
+    mips = out;
+
+    return true;
+}
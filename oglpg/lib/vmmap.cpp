@@ -0,0 +1,143 @@
+#include "vmmap.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+VMappedFile::VMappedFile(void)
+    : m_data(0),
+      m_size(0),
+#ifdef _WIN32
+      m_file(INVALID_HANDLE_VALUE),
+      m_mapping(NULL)
+#else
+      m_fd(-1)
+#endif
+{
+
+}
+
+VMappedFile::~VMappedFile(void)
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool VMappedFile::Open(const char * filename)
+{
+    Close();
+
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+
+    // PAGE_WRITECOPY + FILE_MAP_COPY gives us a private copy-on-write view
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (m_mapping == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    m_data = (unsigned char *)MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (m_data == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    m_size = (size_t)size.QuadPart;
+
+    return true;
+}
+
+void VMappedFile::Close(void)
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    m_data = 0;
+    m_size = 0;
+
+    if (m_mapping != NULL)
+        CloseHandle(m_mapping);
+    m_mapping = NULL;
+
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool VMappedFile::Open(const char * filename)
+{
+    Close();
+
+    m_fd = open(filename, O_RDONLY);
+    if (m_fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+
+    void * data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+
+    // Files are consumed front to back, once
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    m_data = (unsigned char *)data;
+    m_size = (size_t)st.st_size;
+
+    return true;
+}
+
+void VMappedFile::Close(void)
+{
+    if (m_data)
+        munmap(m_data, m_size);
+    m_data = 0;
+    m_size = 0;
+
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+}
+
+#endif
+
+void VMappedFile::Prefault(void) const
+{
+    // Touching one byte per page is enough to pull the whole file in
+    const size_t page_size = 4096;
+    volatile unsigned char sink = 0;
+
+    for (size_t offset = 0; offset < m_size; offset += page_size)
+        sink += m_data[offset];
+    if (m_size)
+        sink += m_data[m_size - 1];
+
+    (void)sink;
+}
@@ -0,0 +1,154 @@
+#include "vthread.h"
+
+#include <atomic>
+#include <memory>
+
+VThreadPool::VThreadPool(unsigned int num_threads)
+    : m_busy(0),
+      m_quit(false)
+{
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+
+    for (unsigned int i = 0; i < num_threads; i++)
+        m_threads.push_back(std::thread(&VThreadPool::WorkerMain, this));
+}
+
+VThreadPool::~VThreadPool(void)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_task_ready.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+        m_threads[i].join();
+}
+
+void VThreadPool::Submit(const std::function<void (void)> & task)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_tasks.push_back(task);
+    }
+    m_task_ready.notify_one();
+}
+
+void VThreadPool::Wait(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_tasks.empty() || m_busy != 0)
+        m_all_done.wait(lock);
+}
+
+void VThreadPool::ParallelFor(unsigned int count, unsigned int grain, const std::function<void (unsigned int, unsigned int)> & func)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+
+    unsigned int num_ranges = (count + grain - 1) / grain;
+
+    if (num_ranges == 1)
+    {
+        func(0, count);
+        return;
+    }
+
+    // Workers and the caller pull ranges from a shared counter, so uneven
+    // ranges balance out by themselves. A helper may only get scheduled after
+    // all ranges are done and this function has returned, so the state it
+    // touches is reference counted rather than living on this stack.
+    struct ParallelForState
+    {
+        std::function<void (unsigned int, unsigned int)> func;
+        unsigned int count;
+        unsigned int grain;
+        unsigned int num_ranges;
+        std::atomic<unsigned int> next_range;
+        std::atomic<unsigned int> ranges_left;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->func = func;
+    state->count = count;
+    state->grain = grain;
+    state->num_ranges = num_ranges;
+    state->next_range = 0;
+    state->ranges_left = num_ranges;
+
+    std::function<void (void)> worker = [state]()
+    {
+        unsigned int range;
+
+        while ((range = state->next_range.fetch_add(1)) < state->num_ranges)
+        {
+            unsigned int begin = range * state->grain;
+            unsigned int end = begin + state->grain < state->count ? begin + state->grain : state->count;
+
+            state->func(begin, end);
+
+            if (state->ranges_left.fetch_sub(1) == 1)
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    unsigned int helpers = num_ranges - 1 < GetThreadCount() ? num_ranges - 1 : GetThreadCount();
+
+    for (unsigned int i = 0; i < helpers; i++)
+        Submit(worker);
+
+    worker();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->ranges_left.load() != 0)
+        state->done.wait(lock);
+}
+
+VThreadPool & VThreadPool::GetDefault(void)
+{
+    static VThreadPool pool;
+
+    return pool;
+}
+
+void VThreadPool::WorkerMain(void)
+{
+    for (;;)
+    {
+        std::function<void (void)> task;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (m_tasks.empty() && !m_quit)
+                m_task_ready.wait(lock);
+
+            if (m_tasks.empty())
+                return;
+
+            task = m_tasks.front();
+            m_tasks.pop_front();
+            m_busy++;
+        }
+
+        task();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_busy--;
+            if (m_tasks.empty() && m_busy == 0)
+                m_all_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#include "bench.h"
+#include "vgl.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+double BenchNow(void)
+{
+    using namespace std::chrono;
+
+    return duration<double, std::milli>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+size_t BenchPeakMemory(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+
+    return pmc.PeakWorkingSetSize;
+#else
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+
+    // Kilobytes on Linux
+    return (size_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+bool BenchEvictFile(const char * filename)
+{
+#ifdef _WIN32
+    // Opening a file unbuffered makes the cache manager flush and purge
+    // what it holds of it
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    CloseHandle(file);
+    return true;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    // Dirty pages can't be dropped, so write them out first
+    bool ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+
+    close(fd);
+    return ok;
+#endif
+}
+
+bool BenchCreateContext(int * argc, char ** argv)
+{
+    glewExperimental = GL_TRUE;
+
+    glutInit(argc, argv);
+    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
+    glutInitWindowSize(64, 64);
+    glutInitContextVersion(4, 3);
+    glutInitContextProfile(GLUT_CORE_PROFILE);
+    glutCreateWindow(argv[0]);
+    glutHideWindow();
+
+    if (glewInit())
+        return false;
+
+    // glewExperimental can leave a benign GL_INVALID_ENUM behind
+    glGetError();
+
+    return true;
+}
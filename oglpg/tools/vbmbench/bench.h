@@ -0,0 +1,41 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stddef.h>
+
+#include "vgl.h"
+
+// Helpers shared by the vbmbench benchmarks
+
+// Wall clock in milliseconds, high resolution
+double BenchNow(void);
+
+// Peak resident set of the process so far, in bytes. This is a high water
+// mark, so compare separate runs rather than two phases of one run.
+size_t BenchPeakMemory(void);
+
+// Drops the file's pages from the OS page cache, so that the next read goes
+// to the disk. Pages another process has mapped may stay.
+bool BenchEvictFile(const char * filename);
+
+// Creates a hidden window with a 4.3 core context and initializes GLEW
+bool BenchCreateContext(int * argc, char ** argv);
+
+// From vutils.h, which defines it in the header, so only bench_layout.cpp
+// may include it
+void vglAttachShaderSource(GLuint prog, GLenum type, const char * source);
+
+// Benchmarks, one per command line verb
+int BenchLoad(int argc, char ** argv);
+int BenchAsync(int argc, char ** argv);
+int BenchLayout(int argc, char ** argv);
+int BenchPool(int argc, char ** argv);
+int BenchCache(int argc, char ** argv);
+int BenchCull(int argc, char ** argv);
+int BenchBvh(int argc, char ** argv);
+int BenchRead(int argc, char ** argv);
+int BenchMaterials(int argc, char ** argv);
+int BenchMorph(int argc, char ** argv);
+int BenchBcn(int argc, char ** argv);
+
+#endif /* __BENCH_H__ */
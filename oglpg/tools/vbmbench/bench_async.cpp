@@ -0,0 +1,82 @@
+// Loads a set of VBM files through VBMAsyncLoader while running a fake frame
+// loop, and prints when each asset became drawable. The same files are then
+// loaded serially, the way init() in the samples does it, for comparison.
+//
+//     vbmbench async [-b budget_ms] file.vbm ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbmloader.h"
+#include "bench.h"
+
+int BenchAsync(int argc, char ** argv)
+{
+    double budget = 2.0;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-b") == 0)
+    {
+        budget = atof(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc)
+    {
+        fprintf(stderr, "async: expected at least one file\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "async: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    int num_files = argc - first_file;
+    VBObject * objects = new VBObject[num_files];
+    int frames = 0;
+    double worst_frame = 0.0;
+
+    {
+        VBMAsyncLoader loader;
+
+        for (int i = 0; i < num_files; i++)
+            loader.Load(&objects[i], argv[first_file + i], 0, 1, 2);
+
+        while (loader.GetPendingCount() != 0)
+        {
+            double frame_start = BenchNow();
+
+            loader.Update(budget);
+            glFinish();
+
+            double frame_time = BenchNow() - frame_start;
+            if (frame_time > worst_frame)
+                worst_frame = frame_time;
+            frames++;
+        }
+
+        loader.PrintStats(stdout);
+
+        const std::vector<VBMLoadStats> & stats = loader.GetStats();
+        printf("async: first asset after %.2f ms, all %d after %.2f ms, %d frames, worst frame %.2f ms (budget %.2f ms)\n",
+               stats.front().uploaded, num_files, stats.back().uploaded, frames, worst_frame, budget);
+    }
+
+    for (int i = 0; i < num_files; i++)
+        objects[i].Free();
+
+    double start = BenchNow();
+
+    for (int i = 0; i < num_files; i++)
+        objects[i].LoadFromVBM(argv[first_file + i], 0, 1, 2);
+    glFinish();
+
+    printf("serial: all %d after %.2f ms, blocking the GL thread throughout\n", num_files, BenchNow() - start);
+
+    delete [] objects;
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+// CPU decompression of block-compressed DDS files against the same texels
+// stored uncompressed, for machines without a GPU. Each file is decoded to
+// RGBA8 into a copy next to it (file.dds.rgba.dds, removed afterwards);
+// every iteration then drops both from the page cache and either loads the
+// BCn file and decodes every mip of every slice on the default pool, or
+// loads the RGBA8 copy and reads it through. The last two columns are
+// decoding alone, from memory, on one thread and on the pool. No OpenGL
+// context is needed.
+//
+//     vbmbench bcn [-n iterations] file.dds ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "vermilion.h"
+#include "vbcn.h"
+#include "vthread.h"
+#include "bench.h"
+
+#define DXGI_FORMAT_R8G8B8A8_UNORM          28
+#define DXGI_FORMAT_R8G8B8A8_UNORM_SRGB     29
+
+static const char * format_names[] = { "bc1", "bc2", "bc3", "bc4", "bc5", "bc7" };
+
+static void Put32(std::vector<unsigned char> & out, size_t offset, unsigned int value)
+{
+    out[offset + 0] = (unsigned char)(value & 0xFF);
+    out[offset + 1] = (unsigned char)((value >> 8) & 0xFF);
+    out[offset + 2] = (unsigned char)((value >> 16) & 0xFF);
+    out[offset + 3] = (unsigned char)(value >> 24);
+}
+
+// An RGBA8 image as a DDS file with a DX10 header, so that vglLoadImage
+// gives back the same target, slices and mips
+static bool WriteDDS(const char * filename, const vglImageData & image)
+{
+    bool cube = image.target == GL_TEXTURE_CUBE_MAP || image.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+    unsigned int dimension = image.target == GL_TEXTURE_3D ? 4 :
+                             (image.target == GL_TEXTURE_1D || image.target == GL_TEXTURE_1D_ARRAY ? 2 : 3);
+    std::vector<unsigned char> header(4 + 124 + 20, 0);
+
+    Put32(header, 0, 0x20534444);                       // "DDS "
+    Put32(header, 4, 124);
+    Put32(header, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | (dimension == 4 ? 0x800000 : 0));
+    Put32(header, 12, image.mip[0].height);
+    Put32(header, 16, image.mip[0].width);
+    Put32(header, 24, dimension == 4 ? image.mip[0].depth : 0);
+    Put32(header, 28, image.mipLevels);
+    Put32(header, 76, 32);                              // pixel format size
+    Put32(header, 80, 0x4);                             // DDPF_FOURCC
+    Put32(header, 84, 0x30315844);                      // "DX10"
+    Put32(header, 108, 0x1000 | (image.mipLevels > 1 ? 0x400008 : 0));
+    Put32(header, 128, image.internalFormat == GL_SRGB8_ALPHA8 ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM);
+    Put32(header, 132, dimension);
+    Put32(header, 136, cube ? 0x4 : 0);                 // DDS_RESOURCE_MISC_TEXTURECUBE
+    Put32(header, 140, image.slices);
+
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    bool ok = fwrite(&header[0], 1, header.size(), f) == header.size() &&
+              fwrite(image.mip[0].data, 1, image.totalDataSize, f) == (size_t)image.totalDataSize;
+
+    return fclose(f) == 0 && ok;
+}
+
+// Texels in every mip of every slice of an image
+static double CountTexels(const vglImageData & image)
+{
+    bool cube = image.target == GL_TEXTURE_CUBE_MAP || image.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+    double texels = 0.0;
+
+    for (int level = 0; level < image.mipLevels; level++)
+        texels += (double)image.mip[level].width * image.mip[level].height * image.mip[level].depth;
+
+    return texels * image.slices * (cube ? 6 : 1);
+}
+
+// Best time to load the BCn file and decode it, with the file evicted
+// before each try
+static double ColdDecode(const char * filename, int iterations, VThreadPool & pool)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!BenchEvictFile(filename))
+            return -1.0;
+
+        vglImageData image, rgba;
+        double start = BenchNow();
+
+        vglLoadImage(filename, &image);
+
+        if (!VBCnCodec::DecodeImage(image, rgba, &pool))
+        {
+            if (image.mip[0].data != NULL)
+                vglUnloadImage(&image);
+            return -1.0;
+        }
+
+        double elapsed = BenchNow() - start;
+
+        vglUnloadImage(&image);
+        vglUnloadImage(&rgba);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+// Keeps the reads in ColdLoad from being optimized away
+static volatile unsigned int bench_sink;
+
+// Best time to load the RGBA8 copy and touch every cache line of it. It is
+// mapped, so the touching is what pulls it off the disk.
+static double ColdLoad(const char * filename, int iterations)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!BenchEvictFile(filename))
+            return -1.0;
+
+        vglImageData image;
+        double start = BenchNow();
+
+        vglLoadImage(filename, &image);
+
+        if (image.mip[0].data == NULL)
+            return -1.0;
+
+        const unsigned char * data = (const unsigned char *)image.mip[0].data;
+        unsigned int sum = 0;
+
+        for (GLsizeiptr b = 0; b < image.totalDataSize; b += 64)
+            sum += data[b];
+        bench_sink = sum;
+
+        double elapsed = BenchNow() - start;
+
+        vglUnloadImage(&image);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+// Best time to decode an image already in memory
+static double WarmDecode(const vglImageData & image, int iterations, VThreadPool * pool)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        vglImageData rgba;
+        double start = BenchNow();
+
+        VBCnCodec::DecodeImage(image, rgba, pool);
+
+        double elapsed = BenchNow() - start;
+
+        vglUnloadImage(&rgba);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+int BenchBcn(int argc, char ** argv)
+{
+    int iterations = 5;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+        iterations = atoi(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc || iterations < 1)
+    {
+        fprintf(stderr, "bcn: expected [-n iterations] and at least one file\n");
+        return 1;
+    }
+
+    VThreadPool & pool = VThreadPool::GetDefault();
+
+    printf("%u worker threads, %s\n", pool.GetThreadCount(), VBCnCodec::GetPath());
+    printf("%-24s %6s %9s %10s %10s %9s %9s %9s %9s %9s %9s\n", "file", "format", "Mtexels", "bcn bytes", "rgba bytes",
+           "bcn ms", "bcn Mt/s", "rgba ms", "rgba Mt/s", "dec1 Mt/s", "decN Mt/s");
+
+    for (int n = first_file; n < argc; n++)
+    {
+        vglImageData image, rgba;
+        VBCnCodec::Format format;
+        bool srgb;
+
+        vglLoadImage(argv[n], &image);
+
+        if (image.mip[0].data == NULL || !VBCnCodec::GetFormat(image.internalFormat, format, srgb))
+        {
+            fprintf(stderr, "bcn: %s isn't a block-compressed DDS file this can decode\n", argv[n]);
+            if (image.mip[0].data != NULL)
+                vglUnloadImage(&image);
+            continue;
+        }
+
+        double mtexels = CountTexels(image) / 1e6;
+        double single = WarmDecode(image, iterations, NULL);
+        double parallel = WarmDecode(image, iterations, &pool);
+        std::string copy = std::string(argv[n]) + ".rgba.dds";
+        GLsizeiptr bcn_bytes = image.totalDataSize;
+
+        VBCnCodec::DecodeImage(image, rgba, &pool);
+        vglUnloadImage(&image);
+
+        bool written = WriteDDS(copy.c_str(), rgba);
+        GLsizeiptr rgba_bytes = rgba.totalDataSize;
+
+        vglUnloadImage(&rgba);
+
+        if (!written)
+        {
+            fprintf(stderr, "bcn: unable to write %s\n", copy.c_str());
+            continue;
+        }
+
+        double compressed = ColdDecode(argv[n], iterations, pool);
+        double raw = ColdLoad(copy.c_str(), iterations);
+
+        remove(copy.c_str());
+
+        if (compressed < 0.0 || raw < 0.0)
+        {
+            fprintf(stderr, "bcn: unable to load %s\n", argv[n]);
+            continue;
+        }
+
+        printf("%-24s %6s %9.2f %10lu %10lu %9.3f %9.1f %9.3f %9.1f %9.1f %9.1f\n", argv[n], format_names[format], mtexels,
+               (unsigned long)bcn_bytes, (unsigned long)rgba_bytes, compressed, mtexels * 1000.0 / compressed,
+               raw, mtexels * 1000.0 / raw, mtexels * 1000.0 / single, mtexels * 1000.0 / parallel);
+    }
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+// Cost of VInstanceBVH against testing every instance, from 1000 up to
+// max_instances in steps of ten: building on one thread and on the default
+// pool, refitting after every instance has moved, a frustum query against
+// VFrustumCuller over all instances, and picking rays against a loop over
+// every box. Query and ray results are checked against brute force. Instances are scattered over a large area, of which the camera
+// sees a small part, as in an open world. No OpenGL context is needed.
+//
+//     vbmbench bvh [-n max_instances]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vbvh.h"
+#include "vcull.h"
+#include "vthread.h"
+#include "bench.h"
+
+// Boxes of the instances the way the tree computes them, for the brute
+// force ray casts
+static void InstanceBoxes(const vmath::vec3 & box_min, const vmath::vec3 & box_max, const vmath::mat4 * matrices,
+                          unsigned int count, std::vector<vmath::vec3> & mins, std::vector<vmath::vec3> & maxs)
+{
+    vmath::vec3 center = (box_min + box_max) * 0.5f;
+    vmath::vec3 extent = (box_max - box_min) * 0.5f;
+
+    mins.resize(count);
+    maxs.resize(count);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const vmath::mat4 & m = matrices[i];
+
+        for (int k = 0; k < 3; k++)
+        {
+            float c = m[0][k] * center[0] + m[1][k] * center[1] + m[2][k] * center[2] + m[3][k];
+            float e = fabsf(m[0][k]) * extent[0] + fabsf(m[1][k]) * extent[1] + fabsf(m[2][k]) * extent[2];
+
+            mins[i][k] = c - e;
+            maxs[i][k] = c + e;
+        }
+    }
+}
+
+// Boxes at least partly inside every plane
+static unsigned int QueryReference(const float planes[6][4], const std::vector<vmath::vec3> & mins,
+                                   const std::vector<vmath::vec3> & maxs, unsigned int count)
+{
+    unsigned int visible = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        bool inside = true;
+
+        for (int j = 0; j < 6 && inside; j++)
+        {
+            const float * p = planes[j];
+            inside = p[0] * (p[0] >= 0.0f ? maxs[i][0] : mins[i][0]) +
+                     p[1] * (p[1] >= 0.0f ? maxs[i][1] : mins[i][1]) +
+                     p[2] * (p[2] >= 0.0f ? maxs[i][2] : mins[i][2]) + p[3] >= 0.0f;
+        }
+
+        if (inside)
+            visible++;
+    }
+
+    return visible;
+}
+
+// Distance to the nearest box the ray enters, 1e30 for none
+static float RaycastReference(const std::vector<vmath::vec3> & mins, const std::vector<vmath::vec3> & maxs, unsigned int count,
+                              const vmath::vec3 & origin, const vmath::vec3 & direction)
+{
+    float best = 1e30f;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float enter = 0.0f;
+        float leave = best;
+
+        for (int k = 0; k < 3 && enter <= leave; k++)
+        {
+            float inverse = direction[k] != 0.0f ? 1.0f / direction[k] : 1e30f;
+            float t0 = (mins[i][k] - origin[k]) * inverse;
+            float t1 = (maxs[i][k] - origin[k]) * inverse;
+
+            enter = std::max(enter, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+
+        if (enter <= leave)
+            best = enter;
+    }
+
+    return best;
+}
+
+int BenchBvh(int argc, char ** argv)
+{
+    unsigned int max_instances = 1000000;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+        max_instances = atoi(argv[2]);
+
+    if (max_instances < 1000)
+    {
+        fprintf(stderr, "bvh: expected [-n max_instances] of at least 1000\n");
+        return 1;
+    }
+
+    const vmath::mat4 view = vmath::translate(0.0f, 0.0f, -1500.0f);
+    const vmath::mat4 projection = vmath::frustum(-1.0f, 1.0f, -0.75f, 0.75f, 1.0f, 5000.0f);
+    const vmath::mat4 view_projection = projection * view;
+    const vmath::vec3 box_min(-90.0f, -70.0f, -90.0f);
+    const vmath::vec3 box_max(90.0f, 110.0f, 90.0f);
+    const vmath::vec4 sphere(0.0f, 20.0f, 0.0f, 130.0f);
+    const int rays = 1000;
+
+    std::vector<vmath::mat4> matrices(max_instances);
+    std::vector<vmath::mat4> moved(max_instances);
+    std::vector<vmath::mat4> out_matrices(max_instances);
+    std::vector<unsigned int> visible;
+    std::vector<vmath::vec3> mins, maxs;
+
+    srand(1);
+
+    for (unsigned int n = 0; n < max_instances; n++)
+    {
+        float x = (float)rand() / RAND_MAX * 60000.0f - 30000.0f;
+        float y = (float)rand() / RAND_MAX * 2000.0f - 1000.0f;
+        float z = (float)rand() / RAND_MAX * 60000.0f - 30000.0f;
+
+        matrices[n] = vmath::translate(x, y, z) * vmath::rotate(x, 0.0f, 1.0f, 0.0f);
+        moved[n] = vmath::translate(0.0f, 5.0f, 0.0f) * matrices[n];
+    }
+
+    float planes[6][4];
+    VFrustumCuller::ExtractPlanes(view_projection, planes);
+
+    VFrustumCuller culler;
+    culler.SetFrustum(view_projection);
+
+    VThreadPool & pool = VThreadPool::GetDefault();
+    VInstanceBVH serial;
+    VInstanceBVH parallel(&pool);
+
+    printf("%u worker threads\n", pool.GetThreadCount());
+    printf("%10s %8s %10s %10s %9s %9s %10s %10s %10s %10s\n", "instances", "visible", "build ms", "pool ms",
+           "refit ms", "cost", "query ms", "cull ms", "ray us", "loop us");
+
+    for (unsigned int count = 1000; count <= max_instances; count *= 10)
+    {
+        double start = BenchNow();
+        serial.SetInstances(box_min, box_max, &matrices[0], count);
+        serial.Build();
+        double built = BenchNow() - start;
+
+        start = BenchNow();
+        parallel.SetInstances(box_min, box_max, &matrices[0], count);
+        parallel.Build();
+        double pooled = BenchNow() - start;
+
+        // Every instance moves, the tree keeps its shape
+        start = BenchNow();
+        parallel.SetInstances(box_min, box_max, &moved[0], count);
+        parallel.Refit();
+        double refitted = BenchNow() - start;
+        float cost = parallel.GetCost();
+
+        parallel.SetInstances(box_min, box_max, &matrices[0], count);
+        parallel.Refit();
+
+        // Enough repetitions for about ten million instances culled
+        int repeat = std::max((int)(10000000 / count), 1);
+        unsigned int found = 0;
+        int r;
+
+        start = BenchNow();
+        for (r = 0; r < repeat; r++)
+        {
+            visible.clear();
+            found = serial.QueryFrustum(view_projection, visible);
+        }
+        double queried = (BenchNow() - start) / repeat;
+
+        start = BenchNow();
+        for (r = 0; r < repeat; r++)
+            culler.Cull(sphere, &matrices[0], NULL, count, &out_matrices[0], NULL);
+        double flat = (BenchNow() - start) / repeat;
+
+        InstanceBoxes(box_min, box_max, &matrices[0], count, mins, maxs);
+
+        unsigned int expected = QueryReference(planes, mins, maxs, count);
+        if (found != expected)
+            printf("mismatch: %u visible, %u expected\n", found, expected);
+
+        // Picking rays spread over the screen
+
+        std::vector<vmath::vec3> origins(rays), directions(rays);
+        for (r = 0; r < rays; r++)
+        {
+            float x = (float)(r % 40) / 20.0f - 0.975f;
+            float y = (float)(r / 40) / 12.5f - 0.96f;
+            VInstanceBVH::GetPickRay(view, projection, x, y, origins[r], directions[r]);
+        }
+
+        std::vector<float> distances(rays);
+        unsigned int mismatches = 0;
+        VInstanceBVH::RayHit hit;
+
+        start = BenchNow();
+        for (r = 0; r < rays; r++)
+            distances[r] = serial.Raycast(origins[r], directions[r], hit) ? hit.distance : 1e30f;
+        double cast = (BenchNow() - start) * 1000.0 / rays;
+
+        start = BenchNow();
+        for (r = 0; r < rays; r++)
+        {
+            // Instances may overlap, so compare how far the hits are
+            if (RaycastReference(mins, maxs, count, origins[r], directions[r]) != distances[r])
+                mismatches++;
+        }
+        double looped = (BenchNow() - start) * 1000.0 / rays;
+
+        if (mismatches)
+            printf("mismatch: %u of %d rays hit at a different distance\n", mismatches, rays);
+
+        printf("%10u %8u %10.3f %10.3f %9.3f %9.1f %10.4f %10.4f %10.3f %10.3f\n", count, found,
+               built, pooled, refitted, cost, queried, flat, cast, looped);
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+// A scene of many nodes referencing a few assets: every node loading its own
+// copy against every node acquiring it from a VResourceCache. Reports the
+// time to build the scene and the vertex, index and texel data left
+// resident. Files are .vbm meshes or .dds textures; name the same asset under
+// two paths, or a copy of it, to see it found by contents.
+//
+//     vbmbench cache [-r references] file.vbm|file.dds ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vcache.h"
+#include "vermilion.h"
+#include "bench.h"
+
+static bool IsTexture(const char * filename)
+{
+    const char * dot = strrchr(filename, '.');
+
+    return dot != NULL && (strcmp(dot, ".dds") == 0 || strcmp(dot, ".DDS") == 0);
+}
+
+// Every node loads its own copy, as the demos do
+static double BuildUncached(char ** files, int num_files, int references, size_t * bytes)
+{
+    std::vector<VBObject *> objects;
+    std::vector<GLuint> textures;
+    double start = BenchNow();
+
+    *bytes = 0;
+
+    for (int r = 0; r < references; r++)
+    {
+        for (int n = 0; n < num_files; n++)
+        {
+            if (IsTexture(files[n]))
+            {
+                vglImageData image;
+                GLuint texture = vglLoadTexture(files[n], 0, &image);
+
+                if (image.mip[0].data != NULL)
+                {
+                    *bytes += (size_t)image.totalDataSize;
+                    vglUnloadImage(&image);
+                }
+                textures.push_back(texture);
+            }
+            else
+            {
+                VBObject * object = new VBObject;
+
+                if (object->LoadFromVBM(files[n], 0, 1, 2))
+                    *bytes += object->GetDataSize();
+                objects.push_back(object);
+            }
+        }
+    }
+
+    glFinish();
+
+    double elapsed = BenchNow() - start;
+
+    for (size_t i = 0; i < objects.size(); i++)
+        delete objects[i];
+    if (!textures.empty())
+        glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+
+    return elapsed;
+}
+
+// Every node acquires its assets from the cache, then releases them
+static double BuildCached(char ** files, int num_files, int references, VResourceCache & cache)
+{
+    std::vector<VBObject *> objects;
+    std::vector<GLuint> textures;
+    double start = BenchNow();
+
+    for (int r = 0; r < references; r++)
+    {
+        for (int n = 0; n < num_files; n++)
+        {
+            if (IsTexture(files[n]))
+                textures.push_back(cache.AcquireTexture(files[n]));
+            else
+                objects.push_back(cache.AcquireMesh(files[n], 0, 1, 2));
+        }
+    }
+
+    glFinish();
+
+    double elapsed = BenchNow() - start;
+
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        if (objects[i] != NULL)
+            cache.Release(objects[i]);
+    }
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+        if (textures[i] != 0)
+            cache.ReleaseTexture(textures[i]);
+    }
+
+    return elapsed;
+}
+
+int BenchCache(int argc, char ** argv)
+{
+    int references = 100;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0)
+    {
+        references = atoi(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc || references < 1)
+    {
+        fprintf(stderr, "cache: expected [-r references] and at least one file\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "cache: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    char ** files = argv + first_file;
+    int num_files = argc - first_file;
+    size_t uncached_bytes;
+    double uncached = BuildUncached(files, num_files, references, &uncached_bytes);
+
+    // Unused resources are kept up to everything the scene needs, so the
+    // second build finds them all
+    VResourceCache cache(uncached_bytes);
+    unsigned int evictions = 0;
+
+    cache.SetEvictCallback([&evictions](const VResourceCache::Resource &)
+    {
+        evictions++;
+    });
+
+    double cold = BuildCached(files, num_files, references, cache);
+    VResourceCache::Stats stats = cache.GetStats();
+    double warm = BuildCached(files, num_files, references, cache);
+    unsigned int warm_loads = cache.GetStats().loads - stats.loads;
+
+    cache.EvictUnused();
+
+    printf("%d files, %d references each\n", num_files, references);
+    printf("%-10s %10s %12s %7s %10s %12s\n", "mode", "ms", "resident MB", "loads", "path hits", "content hits");
+    printf("%-10s %10.3f %12.2f %7d %10s %12s\n", "uncached", uncached, uncached_bytes / 1048576.0,
+           num_files * references, "-", "-");
+    printf("%-10s %10.3f %12.2f %7u %10u %12u\n", "cached", cold, stats.resident_bytes / 1048576.0,
+           stats.loads, stats.path_hits, stats.content_hits);
+    printf("%-10s %10.3f %12s %7u %10s %12s\n", "reacquire", warm, "-", warm_loads, "-", "-");
+    printf("%u resources evicted once unused\n", evictions);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+// CPU cost of frustum culling instances with VFrustumCuller, from 100 up to
+// max_instances in steps of ten, against a plain one-sphere-at-a-time loop.
+// Instances are scattered around the camera so that about a third of them
+// are in view. No OpenGL context is needed.
+//
+//     vbmbench cull [-n max_instances]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vcull.h"
+#include "bench.h"
+
+// The loop VFrustumCuller replaces, to check its results and compare speed
+static unsigned int CullReference(const float planes[6][4], const vmath::vec4 & sphere, const vmath::mat4 * matrices,
+                                  const vmath::vec4 * colors, unsigned int count, vmath::mat4 * out_matrices, vmath::vec4 * out_colors)
+{
+    unsigned int visible = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const vmath::mat4 & m = matrices[i];
+        float c[3];
+        bool inside = true;
+
+        for (int k = 0; k < 3; k++)
+            c[k] = m[0][k] * sphere[0] + m[1][k] * sphere[1] + m[2][k] * sphere[2] + m[3][k];
+
+        for (int j = 0; j < 6 && inside; j++)
+            inside = planes[j][0] * c[0] + planes[j][1] * c[1] + planes[j][2] * c[2] + planes[j][3] >= -sphere[3];
+
+        if (inside)
+        {
+            out_matrices[visible] = m;
+            out_colors[visible] = colors[i];
+            visible++;
+        }
+    }
+
+    return visible;
+}
+
+int BenchCull(int argc, char ** argv)
+{
+    unsigned int max_instances = 1000000;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+        max_instances = atoi(argv[2]);
+
+    if (max_instances < 100)
+    {
+        fprintf(stderr, "cull: expected [-n max_instances] of at least 100\n");
+        return 1;
+    }
+
+    vmath::mat4 view_projection = vmath::frustum(-1.0f, 1.0f, -0.75f, 0.75f, 1.0f, 5000.0f) *
+                                  vmath::translate(0.0f, 0.0f, -1500.0f);
+    float planes[6][4];
+
+    VFrustumCuller::ExtractPlanes(view_projection, planes);
+
+    VFrustumCuller culler;
+    culler.SetFrustum(view_projection);
+
+    const vmath::vec4 sphere(0.0f, 20.0f, 0.0f, 90.0f);
+    std::vector<vmath::mat4> matrices(max_instances);
+    std::vector<vmath::vec4> colors(max_instances);
+    std::vector<vmath::mat4> out_matrices(max_instances);
+    std::vector<vmath::vec4> out_colors(max_instances);
+
+    srand(1);
+
+    for (unsigned int n = 0; n < max_instances; n++)
+    {
+        float x = (float)rand() / RAND_MAX * 6000.0f - 3000.0f;
+        float y = (float)rand() / RAND_MAX * 6000.0f - 3000.0f;
+        float z = (float)rand() / RAND_MAX * 6000.0f - 3000.0f;
+
+        matrices[n] = vmath::translate(x, y, z) * vmath::rotate(x, 0.0f, 1.0f, 0.0f);
+        colors[n] = vmath::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    printf("%s path\n", VFrustumCuller::GetPath());
+    printf("%10s %10s %12s %12s %8s %12s\n", "instances", "visible", "culler ms", "loop ms", "speedup", "upload saved");
+
+    for (unsigned int count = 100; count <= max_instances; count *= 10)
+    {
+        // Enough repetitions for about ten million sphere tests
+        int repeat = (int)(10000000 / count);
+        unsigned int visible = 0;
+        unsigned int reference = 0;
+        int r;
+
+        double start = BenchNow();
+        for (r = 0; r < repeat; r++)
+            visible = culler.Cull(sphere, &matrices[0], &colors[0], count, &out_matrices[0], &out_colors[0]);
+        double culled = (BenchNow() - start) / repeat;
+
+        start = BenchNow();
+        for (r = 0; r < repeat; r++)
+            reference = CullReference(planes, sphere, &matrices[0], &colors[0], count, &out_matrices[0], &out_colors[0]);
+        double looped = (BenchNow() - start) / repeat;
+
+        if (visible != reference)
+            printf("mismatch: %u visible, %u expected\n", visible, reference);
+
+        // Matrix and color of every culled instance no longer uploaded
+        double saved = (double)(count - visible) * (sizeof(vmath::mat4) + sizeof(vmath::vec4)) / 1024.0;
+
+        printf("%10u %10u %12.4f %12.4f %7.2fx %9.0f KB\n", count, visible, culled, looped, looped / culled, saved);
+    }
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Instanced vertex throughput of planar against interleaved attribute layout.
+// Rendering goes to a tiny framebuffer so that the vertex stage dominates.
+//
+//     vbmbench layout [-i instances] file.vbm ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "vutils.h"
+#include "bench.h"
+
+static const char layout_vs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (location = 0) in vec4 position;\n"
+    "layout (location = 1) in vec3 normal;\n"
+    "layout (location = 2) in vec2 tc;\n"
+    "\n"
+    "uniform float scale;\n"
+    "\n"
+    "out vec4 color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    vec3 offset = vec3(gl_InstanceID % 32, (gl_InstanceID / 32) % 32, gl_InstanceID / 1024);\n"
+    "    gl_Position = vec4(position.xyz * scale + offset * 0.01, 1.0);\n"
+    "    color = vec4(normal * 0.5 + 0.5, tc.x + tc.y);\n"
+    "}\n";
+
+static const char layout_fs[] =
+    "#version 430 core\n"
+    "\n"
+    "in vec4 color;\n"
+    "layout (location = 0) out vec4 output_color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    output_color = color;\n"
+    "}\n";
+
+// Returns vertices per second
+static double MeasureThroughput(VBObject & object, unsigned int instances)
+{
+    const int frames = 50;
+    GLuint query;
+    GLuint64 elapsed = 0;
+
+    glGenQueries(1, &query);
+
+    // Warm up so that the first-use costs don't count
+    object.Render(0, instances);
+    glFinish();
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < frames; i++)
+        object.Render(0, instances);
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+    glDeleteQueries(1, &query);
+
+    double vertices = (double)object.GetVertexCount() * instances * frames;
+
+    return elapsed ? vertices / (elapsed * 1e-9) : 0.0;
+}
+
+int BenchLayout(int argc, char ** argv)
+{
+    unsigned int instances = 1000;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-i") == 0)
+    {
+        instances = atoi(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc)
+    {
+        fprintf(stderr, "layout: expected at least one file\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "layout: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    GLuint fbo, rbo[2];
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(2, rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 64, 64);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 64, 64);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo[1]);
+    glViewport(0, 0, 64, 64);
+    glEnable(GL_DEPTH_TEST);
+
+    GLuint program = glCreateProgram();
+    vglAttachShaderSource(program, GL_VERTEX_SHADER, layout_vs);
+    vglAttachShaderSource(program, GL_FRAGMENT_SHADER, layout_fs);
+    glLinkProgram(program);
+    glUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "scale"), 0.001f);
+
+    printf("%-24s %10s %16s %16s %8s\n", "file", "instances", "planar Mvert/s", "interl. Mvert/s", "gain");
+
+    for (int n = first_file; n < argc; n++)
+    {
+        VBObject planar;
+        VBObject interleaved;
+
+        if (!planar.LoadFromVBM(argv[n], 0, 1, 2) ||
+            !interleaved.LoadFromVBM(argv[n], 0, 1, 2, VBM_LOAD_INTERLEAVE))
+        {
+            fprintf(stderr, "layout: failed to load %s\n", argv[n]);
+            continue;
+        }
+
+        double p = MeasureThroughput(planar, instances);
+        double i = MeasureThroughput(interleaved, instances);
+
+        printf("%-24s %10u %16.1f %16.1f %7.2fx\n", argv[n], instances, p * 1e-6, i * 1e-6, p > 0.0 ? i / p : 0.0);
+    }
+
+    glDeleteProgram(program);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, rbo);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+// Compares VBObject::LoadFromVBM (mapped, no intermediate copies) against
+// the original read-everything-then-memcpy loader, which is reproduced here.
+// Peak memory is a process-wide high water mark, so run each mode in its own
+// process:
+//
+//     vbmbench load copy ../../media/*.vbm
+//     vbmbench load mmap ../../media/*.vbm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "bench.h"
+
+// The previous loader: one heap buffer the size of the file, everything
+// memcpy'd out of it into more heap arrays, then uploaded from the heap.
+static bool LoadCopy(const char * filename, GLuint & vao, GLuint buffers[2])
+{
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL)
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    size_t filesize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    unsigned char * data = new unsigned char [filesize];
+    fread(data, filesize, 1, f);
+    fclose(f);
+
+    VBM_HEADER header;
+    memset(&header, 0, sizeof(header));
+
+    if (((VBM_HEADER *)data)->magic == VBM_MAGIC_SBM)
+    {
+        const VBM_HEADER_SBM * sbm = (const VBM_HEADER_SBM *)data;
+        header.size = sbm->size;
+        header.num_attribs = sbm->num_attribs;
+        header.num_frames = sbm->num_frames;
+        header.num_vertices = sbm->num_vertices;
+        header.num_indices = sbm->num_indices;
+        header.index_type = sbm->index_type;
+    }
+    else
+    {
+        memcpy(&header, data, sizeof(VBM_HEADER));
+    }
+
+    unsigned char * raw_data = data + header.size + header.num_attribs * sizeof(VBM_ATTRIB_HEADER) + header.num_frames * sizeof(VBM_FRAME_HEADER);
+
+    VBM_ATTRIB_HEADER * attrib = new VBM_ATTRIB_HEADER[header.num_attribs];
+    memcpy(attrib, data + header.size, header.num_attribs * sizeof(VBM_ATTRIB_HEADER));
+    VBM_FRAME_HEADER * frame = new VBM_FRAME_HEADER[header.num_frames];
+    memcpy(frame, data + header.size + header.num_attribs * sizeof(VBM_ATTRIB_HEADER), header.num_frames * sizeof(VBM_FRAME_HEADER));
+
+    size_t total_data_size = 0;
+    unsigned int i;
+
+    for (i = 0; i < header.num_attribs; i++)
+        total_data_size += attrib[i].components * sizeof(GLfloat) * header.num_vertices;
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(2, buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, total_data_size, raw_data, GL_STATIC_DRAW);
+
+    size_t element_size = header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
+    if (header.num_indices)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, header.num_indices * element_size, raw_data + total_data_size, GL_STATIC_DRAW);
+    }
+
+    total_data_size += header.num_indices * element_size;
+
+    glBindVertexArray(0);
+
+    VBM_MATERIAL * material = new VBM_MATERIAL[header.num_materials];
+    memcpy(material, raw_data + total_data_size, header.num_materials * sizeof(VBM_MATERIAL));
+    total_data_size += header.num_materials * sizeof(VBM_MATERIAL);
+
+    VBM_RENDER_CHUNK * chunks = new VBM_RENDER_CHUNK[header.num_chunks];
+    memcpy(chunks, raw_data + total_data_size, header.num_chunks * sizeof(VBM_RENDER_CHUNK));
+
+    delete [] data;
+    delete [] attrib;
+    delete [] frame;
+    delete [] material;
+    delete [] chunks;
+
+    return true;
+}
+
+int BenchLoad(int argc, char ** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "load: expected copy|mmap and at least one file\n");
+        return 1;
+    }
+
+    bool use_mmap = strcmp(argv[1], "mmap") == 0;
+    int iterations = 20;
+    int first_file = 2;
+
+    if (strcmp(argv[2], "-n") == 0 && argc > 3)
+    {
+        iterations = atoi(argv[3]);
+        first_file = 4;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "load: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    size_t start_peak = BenchPeakMemory();
+
+    printf("%-24s %10s %10s %10s\n", "file", "bytes", "min ms", "avg ms");
+
+    for (int n = first_file; n < argc; n++)
+    {
+        double total = 0.0;
+        double best = 1e30;
+        long size = 0;
+
+        FILE * f = fopen(argv[n], "rb");
+        if (f != NULL)
+        {
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+            fclose(f);
+        }
+
+        for (int i = 0; i < iterations; i++)
+        {
+            double start = BenchNow();
+            bool ok;
+
+            if (use_mmap)
+            {
+                VBObject object;
+                ok = object.LoadFromVBM(argv[n], 0, 1, 2);
+                glFinish();
+            }
+            else
+            {
+                GLuint vao = 0;
+                GLuint buffers[2] = { 0, 0 };
+                ok = LoadCopy(argv[n], vao, buffers);
+                glFinish();
+                glDeleteBuffers(2, buffers);
+                glDeleteVertexArrays(1, &vao);
+            }
+
+            double elapsed = BenchNow() - start;
+
+            if (!ok)
+            {
+                fprintf(stderr, "load: failed to load %s\n", argv[n]);
+                break;
+            }
+
+            total += elapsed;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%-24s %10ld %10.3f %10.3f\n", argv[n], size, best, total / iterations);
+    }
+
+    size_t end_peak = BenchPeakMemory();
+
+    printf("mode: %s, peak memory %.2f MB (%.2f MB above start)\n",
+           use_mmap ? "mmap" : "copy",
+           end_peak / (1024.0 * 1024.0),
+           (end_peak - start_peak) / (1024.0 * 1024.0));
+
+    return 0;
+}
@@ -0,0 +1,287 @@
+// Drawing a model with many materials: chunk by chunk with Render, binding
+// each material's maps in between, against one RenderIndirect with every map
+// in the texture arrays VBMaterialArrays builds. Reports the time to load and
+// upload the arrays and what they hold, then the CPU time and GL calls per
+// frame of both ways of drawing. Maps are looked up next to the file unless
+// a directory is given.
+//
+//     vbmbench materials [-s max_size] file.vbm [directory]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "vbmmaterial.h"
+#include "bench.h"
+
+static const char chunk_vs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (location = 0) in vec4 position;\n"
+    "layout (location = 2) in vec2 tc;\n"
+    "\n"
+    "out vec2 uv;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    gl_Position = vec4(position.xyz * 0.001, 1.0);\n"
+    "    uv = tc;\n"
+    "}\n";
+
+static const char chunk_fs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (binding = 0) uniform sampler2D diffuse_map;\n"
+    "layout (binding = 1) uniform sampler2D specular_map;\n"
+    "\n"
+    "in vec2 uv;\n"
+    "\n"
+    "layout (location = 0) out vec4 output_color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    output_color = texture(diffuse_map, uv) + texture(specular_map, uv);\n"
+    "}\n";
+
+static const char indirect_vs[] =
+    "#version 430 core\n"
+    "#extension GL_ARB_shader_draw_parameters : require\n"
+    "\n"
+    "layout (location = 0) in vec4 position;\n"
+    "layout (location = 2) in vec2 tc;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer material_index_buffer\n"
+    "{\n"
+    "    uint materials[];\n"
+    "};\n"
+    "\n"
+    "out vec2 uv;\n"
+    "flat out int material;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    gl_Position = vec4(position.xyz * 0.001, 1.0);\n"
+    "    uv = tc;\n"
+    "    material = int(materials[gl_DrawIDARB]);\n"
+    "}\n";
+
+static const char indirect_fs[] =
+    "#version 430 core\n"
+    "\n"
+    VBM_GLSL_MATERIAL_ARRAYS
+    "\n"
+    "in vec2 uv;\n"
+    "flat in int material;\n"
+    "\n"
+    "layout (location = 0) out vec4 output_color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    output_color = vbm_sample_map(vbm_diffuse_maps, vbm_layers[material].diffuse, uv, vec4(0.0)) +\n"
+    "                   vbm_sample_map(vbm_specular_maps, vbm_layers[material].specular, uv, vec4(0.0));\n"
+    "}\n";
+
+static const char * const kind_names[VBMaterialArrays::KIND_COUNT] = { "diffuse", "specular", "normal" };
+
+static GLuint BuildProgram(const char * vs, const char * fs)
+{
+    GLuint program = glCreateProgram();
+    GLint linked = GL_FALSE;
+
+    vglAttachShaderSource(program, GL_VERTEX_SHADER, vs);
+    vglAttachShaderSource(program, GL_FRAGMENT_SHADER, fs);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+// A 2D texture seeing one layer of a kind's array, as the demos would load
+// that map on its own, made once per layer however many materials use it
+static GLuint GetLayerView(const VBMaterialArrays & arrays, VBMaterialArrays::Kind kind, int layer,
+                           std::vector<GLuint> & views)
+{
+    if (layer < 0)
+        return 0;
+
+    if (views.empty())
+        views.resize(arrays.GetLayerCount(kind), 0);
+
+    if (views[layer] == 0)
+    {
+        GLint levels = 0;
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrays.GetTexture(kind));
+        glGetTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenTextures(1, &views[layer]);
+        glTextureView(views[layer], GL_TEXTURE_2D, arrays.GetTexture(kind), GL_RGBA8, 0, levels, layer, 1);
+        glBindTexture(GL_TEXTURE_2D, views[layer]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    return views[layer];
+}
+
+int BenchMaterials(int argc, char ** argv)
+{
+    const int frames = 100;
+    unsigned int max_size = 1024;
+    int first_arg = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-s") == 0)
+    {
+        max_size = atoi(argv[2]);
+        first_arg = 3;
+    }
+
+    if (first_arg >= argc || argc > first_arg + 2 || max_size == 0)
+    {
+        fprintf(stderr, "materials: expected [-s max_size], a file and optionally a directory\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "materials: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    const char * filename = argv[first_arg];
+    std::string directory;
+
+    if (first_arg + 1 < argc)
+    {
+        directory = argv[first_arg + 1];
+    }
+    else
+    {
+        const char * slash = strrchr(filename, '/');
+        const char * backslash = strrchr(filename, '\\');
+
+        if (backslash > slash)
+            slash = backslash;
+        if (slash != NULL)
+            directory.assign(filename, slash - filename);
+    }
+
+    VBObject object;
+
+    if (!object.LoadFromVBM(filename, 0, 1, 2))
+    {
+        fprintf(stderr, "materials: failed to load %s\n", filename);
+        return 1;
+    }
+
+    VBMaterialArrays arrays;
+    double start = BenchNow();
+    bool built = arrays.Load(object, directory.empty() ? NULL : directory.c_str(), max_size);
+    double load_ms = BenchNow() - start;
+
+    start = BenchNow();
+    built = built && arrays.Upload();
+    glFinish();
+
+    double upload_ms = BenchNow() - start;
+
+    if (!built)
+    {
+        fprintf(stderr, "materials: %s has no materials\n", filename);
+        return 1;
+    }
+
+    GLuint chunk_program = BuildProgram(chunk_vs, chunk_fs);
+    GLuint indirect_program = BuildProgram(indirect_vs, indirect_fs);
+
+    if (chunk_program == 0 || indirect_program == 0)
+    {
+        fprintf(stderr, "materials: unable to build the shaders (GL_ARB_shader_draw_parameters is needed)\n");
+        glDeleteProgram(chunk_program);
+        glDeleteProgram(indirect_program);
+        return 1;
+    }
+
+    // Both paths sample the same texels
+    std::vector<GLuint> views[VBMaterialArrays::KIND_COUNT];
+
+    for (unsigned int m = 0; m < object.GetMaterialCount(); m++)
+    {
+        const VBM_MATERIAL_LAYERS * layers = arrays.GetLayers(m);
+
+        object.SetMaterialDiffuseTexture(m, GetLayerView(arrays, VBMaterialArrays::DIFFUSE, layers->diffuse,
+                                                         views[VBMaterialArrays::DIFFUSE]));
+        object.SetMaterialSpecularTexture(m, GetLayerView(arrays, VBMaterialArrays::SPECULAR, layers->specular,
+                                                          views[VBMaterialArrays::SPECULAR]));
+        object.SetMaterialNormalTexture(m, GetLayerView(arrays, VBMaterialArrays::NORMAL, layers->normal,
+                                                        views[VBMaterialArrays::NORMAL]));
+    }
+
+    glUseProgram(chunk_program);
+
+    unsigned int calls = 0;
+    start = BenchNow();
+
+    for (int f = 0; f < frames; f++)
+    {
+        object.Render();
+        calls += object.GetRenderCallCount();
+        glFinish();
+    }
+
+    double chunk_ms = (BenchNow() - start) / frames;
+    unsigned int chunk_calls = calls / frames;
+
+    // Nothing else draws in between, so the arrays stay bound
+    glUseProgram(indirect_program);
+    arrays.Bind();
+
+    calls = 0;
+    start = BenchNow();
+
+    for (int f = 0; f < frames; f++)
+    {
+        object.RenderIndirect();
+        calls += object.GetRenderCallCount();
+        glFinish();
+    }
+
+    double indirect_ms = (BenchNow() - start) / frames;
+    unsigned int indirect_calls = calls / frames;
+
+    printf("%s: %u materials, arrays loaded in %.3f ms and uploaded in %.3f ms, %.2f MB\n", filename,
+           object.GetMaterialCount(), load_ms, upload_ms, arrays.GetDataSize() / 1048576.0);
+    for (int k = 0; k < VBMaterialArrays::KIND_COUNT; k++)
+        printf("    %-10s %u layers\n", kind_names[k], arrays.GetLayerCount((VBMaterialArrays::Kind)k));
+    for (size_t i = 0; i < arrays.GetMissingMaps().size(); i++)
+        printf("    missing    %s\n", arrays.GetMissingMaps()[i].c_str());
+    printf("%-10s %12s %12s\n", "", "ms/frame", "GL calls");
+    printf("%-10s %12.3f %12u\n", "chunks", chunk_ms, chunk_calls);
+    printf("%-10s %12.3f %12u\n", "indirect", indirect_ms, indirect_calls);
+
+    glUseProgram(0);
+    for (int k = 0; k < VBMaterialArrays::KIND_COUNT; k++)
+    {
+        if (!views[k].empty())
+            glDeleteTextures((GLsizei)views[k].size(), &views[k][0]);
+    }
+    glDeleteProgram(chunk_program);
+    glDeleteProgram(indirect_program);
+    object.Free();
+    arrays.Free();
+
+    return 0;
+}
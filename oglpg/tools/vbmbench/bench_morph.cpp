@@ -0,0 +1,467 @@
+// Cost of a crowd of keyframe animated instances, each at its own point of
+// the animation. Three ways of drawing it:
+//
+//     upload  blend on the CPU with a plain loop and upload every instance's
+//             vertices, one draw per instance - what animating meant before
+//     cpu     the same through VBMorphTargets::UploadBlend (SSE2)
+//     gpu     one instanced draw blending in the vertex shader from
+//             VBMorphTargets' texture buffer; only a phase per instance is
+//             uploaded
+//
+// Files with a single frame get keyframes made up for them: copies of the
+// mesh with a wave running through it, written next to the file as
+// file.vbm.morph and removed afterwards. Rendering goes to a tiny
+// framebuffer so that vertex work dominates.
+//
+//     vbmbench morph [-i instances] [-k keyframes] file.vbm ...
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "vbmmorph.h"
+#include "bench.h"
+
+static const char morph_cpu_vs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (location = 0) in vec4 position;\n"
+    "layout (location = 1) in vec3 normal;\n"
+    "\n"
+    "uniform int instance;\n"
+    "uniform float scale;\n"
+    "\n"
+    "out vec3 color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    vec3 offset = vec3(instance % 32, (instance / 32) % 32, instance / 1024);\n"
+    "    gl_Position = vec4(position.xyz * scale + offset * 0.01, 1.0);\n"
+    "    color = normalize(normal) * 0.5 + 0.5;\n"
+    "}\n";
+
+static const char morph_gpu_vs[] =
+    "#version 430 core\n"
+    "\n"
+    VBM_GLSL_MORPH_TARGETS
+    "\n"
+    "layout (location = 4) in float phase;\n"
+    "\n"
+    "uniform int keyframes;\n"
+    "uniform float scale;\n"
+    "\n"
+    "out vec3 color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    int a = int(phase) % keyframes;\n"
+    "    float t = fract(phase);\n"
+    "    vec3 position;\n"
+    "    vec3 normal;\n"
+    "\n"
+    "    vbm_morph(ivec4(a, (a + 1) % keyframes, 0, 0), vec4(1.0 - t, t, 0.0, 0.0), position, normal);\n"
+    "\n"
+    "    vec3 offset = vec3(gl_InstanceID % 32, (gl_InstanceID / 32) % 32, gl_InstanceID / 1024);\n"
+    "    gl_Position = vec4(position * scale + offset * 0.01, 1.0);\n"
+    "    color = normal * 0.5 + 0.5;\n"
+    "}\n";
+
+static const char morph_fs[] =
+    "#version 430 core\n"
+    "\n"
+    "in vec3 color;\n"
+    "layout (location = 0) out vec4 output_color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    output_color = vec4(color, 1.0);\n"
+    "}\n";
+
+// What the keyframe writer needs beyond the public interface
+class MorphSource : public VBObject
+{
+public:
+    unsigned int GetTotalVertexCount(void) const
+    {
+        return m_header.num_vertices;
+    }
+
+    unsigned int GetTotalIndexCount(void) const
+    {
+        return m_header.num_indices;
+    }
+
+    unsigned int GetFrameFirst(unsigned int frame) const
+    {
+        return m_frame[frame].first;
+    }
+
+    using VBObject::GetIndex;
+};
+
+// Writes keyframes copies of frame 0 as a morph animated VBM file, every
+// attribute decoded to four floats, with a wave along x moved one step
+// further in each copy
+static bool WriteKeyframes(MorphSource & source, unsigned int keyframes, const char * filename)
+{
+    const VBM_BOUNDS * bounds = source.GetFrameBounds(0);
+    unsigned int num_vertices = source.GetTotalVertexCount();
+    unsigned int num_indices = source.GetTotalIndexCount() ? source.GetVertexCount(0) : 0;
+    unsigned int num_attribs = source.GetAttributeCount();
+    unsigned int first = source.GetFrameFirst(0);
+    unsigned int a, f, i;
+
+    if (bounds == NULL || num_vertices == 0)
+        return false;
+
+    FILE * file = fopen(filename, "wb");
+    if (file == NULL)
+        return false;
+
+    VBM_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.magic = VBM_MAGIC;
+    header.size = sizeof(VBM_HEADER);
+    strcpy(header.name, "morph");
+    header.num_attribs = num_attribs;
+    header.num_frames = keyframes;
+    header.num_vertices = num_vertices * keyframes;
+    header.num_indices = num_indices * keyframes;
+    header.index_type = GL_UNSIGNED_INT;
+    header.flags = VBM_FLAG_HAS_VERTICES | VBM_FLAG_HAS_FRAMES | (num_indices ? VBM_FLAG_HAS_INDICES : 0);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (a = 0; a < num_attribs && ok; a++)
+    {
+        VBM_ATTRIB_HEADER attrib;
+        memset(&attrib, 0, sizeof(attrib));
+        snprintf(attrib.name, sizeof(attrib.name), "%s", source.GetAttributeName(a));
+        attrib.type = GL_FLOAT;
+        attrib.components = 4;
+        ok = fwrite(&attrib, sizeof(attrib), 1, file) == 1;
+    }
+
+    for (f = 0; f < keyframes && ok; f++)
+    {
+        VBM_FRAME_HEADER frame;
+
+        if (num_indices)
+        {
+            frame.first = f * num_indices;
+            frame.count = num_indices;
+        }
+        else
+        {
+            frame.first = f * num_vertices + first;
+            frame.count = source.GetVertexCount(0);
+        }
+        frame.flags = 0;
+
+        ok = fwrite(&frame, sizeof(frame), 1, file) == 1;
+    }
+
+    float size = bounds->max[0] - bounds->min[0];
+    float amplitude = bounds->radius * 0.1f;
+    std::vector<float> decoded((size_t)num_vertices * 4);
+    std::vector<float> moved((size_t)num_vertices * 4);
+
+    for (a = 0; a < num_attribs && ok; a++)
+    {
+        ok = source.DecodeAttribute(a, &decoded[0]);
+
+        for (f = 0; f < keyframes && ok; f++)
+        {
+            const float * src = &decoded[0];
+
+            if (a == 0)
+            {
+                float phase = 6.2831853f * f / keyframes;
+
+                for (i = 0; i < num_vertices; i++)
+                {
+                    const float * p = &decoded[i * 4];
+                    float x = size > 0.0f ? (p[0] - bounds->min[0]) / size : 0.0f;
+
+                    moved[i * 4 + 0] = p[0];
+                    moved[i * 4 + 1] = p[1] + amplitude * sinf(x * 6.2831853f + phase);
+                    moved[i * 4 + 2] = p[2];
+                    moved[i * 4 + 3] = p[3];
+                }
+
+                src = &moved[0];
+            }
+
+            ok = fwrite(src, sizeof(float) * 4, num_vertices, file) == num_vertices;
+        }
+    }
+
+    if (num_indices && ok)
+    {
+        std::vector<unsigned int> indices(num_indices);
+
+        for (f = 0; f < keyframes && ok; f++)
+        {
+            for (i = 0; i < num_indices; i++)
+                indices[i] = source.GetIndex(first + i) + f * num_vertices;
+
+            ok = fwrite(&indices[0], sizeof(unsigned int), num_indices, file) == num_indices;
+        }
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+// The loop UploadBlend replaces: two targets, no SIMD
+static void BlendReference(const std::vector<float> & targets, size_t target_floats,
+                           unsigned int a, unsigned int b, float t, float * out)
+{
+    const float * pa = &targets[a * target_floats];
+    const float * pb = &targets[b * target_floats];
+
+    for (size_t j = 0; j < target_floats; j++)
+        out[j] = pa[j] * (1.0f - t) + pb[j] * t;
+}
+
+static float InstancePhase(unsigned int instance, int frame, unsigned int keyframes)
+{
+    float phase = fmodf(instance * 0.37f + frame * 0.05f, 1.0f);
+
+    return phase * keyframes;
+}
+
+int BenchMorph(int argc, char ** argv)
+{
+    const int frames = 50;
+    unsigned int instances = 100;
+    unsigned int keyframes = 8;
+    int n = 1;
+
+    while (n + 1 < argc && argv[n][0] == '-')
+    {
+        if (strcmp(argv[n], "-i") == 0)
+            instances = atoi(argv[n + 1]);
+        else if (strcmp(argv[n], "-k") == 0)
+            keyframes = atoi(argv[n + 1]);
+        else
+            break;
+        n += 2;
+    }
+
+    if (n >= argc || instances == 0 || keyframes < 2)
+    {
+        fprintf(stderr, "morph: expected [-i instances] [-k keyframes] and at least one file\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "morph: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    GLuint fbo, rbo[2];
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(2, rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 64, 64);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 64, 64);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo[1]);
+    glViewport(0, 0, 64, 64);
+    glEnable(GL_DEPTH_TEST);
+
+    GLuint cpu_program = glCreateProgram();
+    vglAttachShaderSource(cpu_program, GL_VERTEX_SHADER, morph_cpu_vs);
+    vglAttachShaderSource(cpu_program, GL_FRAGMENT_SHADER, morph_fs);
+    glLinkProgram(cpu_program);
+
+    GLuint gpu_program = glCreateProgram();
+    vglAttachShaderSource(gpu_program, GL_VERTEX_SHADER, morph_gpu_vs);
+    vglAttachShaderSource(gpu_program, GL_FRAGMENT_SHADER, morph_fs);
+    glLinkProgram(gpu_program);
+
+    GLint instance_location = glGetUniformLocation(cpu_program, "instance");
+
+    GLuint buffers[2];
+    glGenBuffers(2, buffers);
+    GLuint reference_buffer = buffers[0];
+    GLuint phase_buffer = buffers[1];
+
+    printf("%-24s %9s %9s %10s %12s %12s %12s %10s\n", "file", "targets", "vertices", "instances",
+           "upload ms", "cpu ms", "gpu ms", "blended MB");
+
+    for (; n < argc; n++)
+    {
+        std::string filename = argv[n];
+        std::string generated;
+        MorphSource source;
+
+        if (!source.MapVBM(argv[n]))
+        {
+            fprintf(stderr, "morph: unable to load %s\n", argv[n]);
+            continue;
+        }
+
+        if (source.GetFrameCount() == 1)
+        {
+            generated = filename + ".morph";
+
+            if (!WriteKeyframes(source, keyframes, generated.c_str()))
+            {
+                fprintf(stderr, "morph: unable to write %s\n", generated.c_str());
+                continue;
+            }
+
+            filename = generated;
+        }
+
+        VBObject object;
+        VBMorphTargets morph;
+        bool loaded = object.LoadFromVBM(filename.c_str(), 0, 1, 2) && morph.Load(object);
+
+        if (!generated.empty())
+            remove(generated.c_str());
+
+        if (!loaded || !morph.Upload())
+        {
+            fprintf(stderr, "morph: %s has no usable morph targets\n", argv[n]);
+            continue;
+        }
+
+        unsigned int targets = morph.GetTargetCount();
+        unsigned int vertices = morph.GetVertexCount();
+        size_t target_floats = (size_t)vertices * 8;
+        size_t blend_bytes = target_floats * sizeof(float);
+        float radius = source.GetFrameBounds(0)->radius;
+        float scale = 0.5f / radius;
+
+        // The reference blends from a copy of the targets as laid out in the
+        // texture buffer, taken out one at a time with a weight of 1
+        std::vector<float> target_data(target_floats * targets);
+        std::vector<float> blended(target_floats);
+        std::vector<float> check(target_floats);
+
+        for (unsigned int k = 0; k < targets; k++)
+        {
+            unsigned int one = k;
+            float weight = 1.0f;
+            morph.Blend(&one, &weight, 1, &target_data[k * target_floats]);
+        }
+
+        // CPU blending against the plain loop, on one set of weights
+        {
+            unsigned int pair[2] = { 1, 2 % targets };
+            float weights[2] = { 0.25f, 0.75f };
+            float error = 0.0f;
+
+            morph.Blend(pair, weights, 2, &check[0]);
+            BlendReference(target_data, target_floats, pair[0], pair[1], 0.75f, &blended[0]);
+
+            for (size_t j = 0; j < target_floats; j++)
+                error = fmaxf(error, fabsf(check[j] - blended[j]));
+
+            if (error > 1e-5f * radius)
+                printf("mismatch: Blend differs from the reference by %g\n", error);
+        }
+
+        glUseProgram(cpu_program);
+        glUniform1f(glGetUniformLocation(cpu_program, "scale"), scale);
+
+        // upload: a plain loop and glBufferSubData, every instance
+        glBindBuffer(GL_ARRAY_BUFFER, reference_buffer);
+        glBufferData(GL_ARRAY_BUFFER, (morph.GetFirstVertex() + (size_t)vertices) * 8 * sizeof(float), NULL, GL_STREAM_DRAW);
+        object.BindVertexArray();
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(0));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), BUFFER_OFFSET(4 * sizeof(float)));
+
+        double start = BenchNow();
+
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (unsigned int i = 0; i < instances; i++)
+            {
+                float phase = InstancePhase(i, frame, targets);
+                unsigned int a = (unsigned int)phase % targets;
+
+                BlendReference(target_data, target_floats, a, (a + 1) % targets, phase - floorf(phase), &blended[0]);
+                glBindBuffer(GL_ARRAY_BUFFER, reference_buffer);
+                glBufferSubData(GL_ARRAY_BUFFER, morph.GetFirstVertex() * 8 * sizeof(float), blend_bytes, &blended[0]);
+                glUniform1i(instance_location, i);
+                object.Render(0);
+            }
+            glFinish();
+        }
+
+        double upload_ms = (BenchNow() - start) / frames;
+
+        // cpu: UploadBlend, every instance
+        start = BenchNow();
+
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (unsigned int i = 0; i < instances; i++)
+            {
+                float phase = InstancePhase(i, frame, targets);
+                unsigned int pair[2] = { (unsigned int)phase % targets, ((unsigned int)phase + 1) % targets };
+                float weights[2] = { 1.0f - (phase - floorf(phase)), phase - floorf(phase) };
+
+                morph.UploadBlend(object, pair, weights, 2);
+                glUniform1i(instance_location, i);
+                object.Render(0);
+            }
+            glFinish();
+        }
+
+        double cpu_ms = (BenchNow() - start) / frames;
+
+        // gpu: the phases, then one instanced draw
+        std::vector<float> phases(instances);
+
+        glUseProgram(gpu_program);
+        glUniform1f(glGetUniformLocation(gpu_program, "scale"), scale);
+        glUniform1i(glGetUniformLocation(gpu_program, "keyframes"), targets);
+        morph.SetUniforms(gpu_program);
+        morph.Bind();
+
+        glBindBuffer(GL_ARRAY_BUFFER, phase_buffer);
+        glBufferData(GL_ARRAY_BUFFER, instances * sizeof(float), NULL, GL_STREAM_DRAW);
+        object.BindVertexArray();
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+        glVertexAttribDivisor(4, 1);
+        glEnableVertexAttribArray(4);
+
+        start = BenchNow();
+
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (unsigned int i = 0; i < instances; i++)
+                phases[i] = InstancePhase(i, frame, targets);
+
+            glBindBuffer(GL_ARRAY_BUFFER, phase_buffer);
+            glBufferData(GL_ARRAY_BUFFER, instances * sizeof(float), &phases[0], GL_STREAM_DRAW);
+            object.Render(0, instances);
+            glFinish();
+        }
+
+        double gpu_ms = (BenchNow() - start) / frames;
+
+        printf("%-24s %9u %9u %10u %12.3f %12.3f %12.3f %10.1f\n", argv[n], targets, vertices, instances,
+               upload_ms, cpu_ms, gpu_ms, instances * blend_bytes / 1048576.0);
+    }
+
+    glDeleteProgram(cpu_program);
+    glDeleteProgram(gpu_program);
+    glDeleteBuffers(2, buffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, rbo);
+
+    return 0;
+}
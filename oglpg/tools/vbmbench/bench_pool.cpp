@@ -0,0 +1,131 @@
+// CPU cost of drawing a scene of many small meshes: every object with its own
+// vertex array and buffers, one Render each, against the same objects in a
+// VBGeometryPool drawn with one multi-draw per vertex format.
+//
+//     vbmbench pool [-c copies] file.vbm ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbmpool.h"
+#include "bench.h"
+
+static const char pool_vs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (location = 0) in vec4 position;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    gl_Position = vec4(position.xyz * 0.001, 1.0);\n"
+    "}\n";
+
+static const char pool_fs[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (location = 0) out vec4 output_color;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    output_color = vec4(1.0);\n"
+    "}\n";
+
+int BenchPool(int argc, char ** argv)
+{
+    const int frames = 100;
+    unsigned int copies = 100;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+    {
+        copies = atoi(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc || copies == 0)
+    {
+        fprintf(stderr, "pool: expected [-c copies] and at least one file\n");
+        return 1;
+    }
+
+    if (!BenchCreateContext(&argc, argv))
+    {
+        fprintf(stderr, "pool: unable to create an OpenGL context\n");
+        return 1;
+    }
+
+    GLuint program = glCreateProgram();
+    vglAttachShaderSource(program, GL_VERTEX_SHADER, pool_vs);
+    vglAttachShaderSource(program, GL_FRAGMENT_SHADER, pool_fs);
+    glLinkProgram(program);
+    glUseProgram(program);
+
+    // Each file is loaded copies times, as separate objects, in both setups
+    unsigned int num_files = argc - first_file;
+    unsigned int count = num_files * copies;
+    VBObject * separate = new VBObject[count];
+    VBObject * pooled = new VBObject[count];
+    VBGeometryPool pool;
+    unsigned int loaded = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const char * filename = argv[first_file + i % num_files];
+
+        if (!separate[loaded].LoadFromVBM(filename, 0, 1, 2, VBM_LOAD_INTERLEAVE) ||
+            !pooled[loaded].MapVBM(filename, VBM_LOAD_INTERLEAVE) ||
+            !pooled[loaded].UploadToPool(&pool, 0, 1, 2))
+        {
+            fprintf(stderr, "pool: failed to load %s\n", filename);
+            separate[loaded].Free();
+            pooled[loaded].Free();
+            continue;
+        }
+
+        loaded++;
+    }
+
+    unsigned int calls = 0;
+    double start = BenchNow();
+
+    for (int f = 0; f < frames; f++)
+    {
+        for (unsigned int i = 0; i < loaded; i++)
+        {
+            separate[i].Render();
+            calls += separate[i].GetRenderCallCount();
+        }
+        glFinish();
+    }
+
+    double separate_ms = (BenchNow() - start) / frames;
+    unsigned int separate_calls = calls / frames;
+
+    calls = 0;
+    start = BenchNow();
+
+    for (int f = 0; f < frames; f++)
+    {
+        for (unsigned int i = 0; i < loaded; i++)
+            pool.Queue(pooled[i]);
+        calls += pool.Flush();
+        glFinish();
+    }
+
+    double pooled_ms = (BenchNow() - start) / frames;
+    unsigned int pooled_calls = calls / frames;
+
+    printf("%u objects, %u vertex formats, %.1f of %.1f MB pool storage in use\n",
+           loaded, pool.GetFormatCount(), pool.GetUsedBytes() / 1048576.0, pool.GetCapacityBytes() / 1048576.0);
+    printf("%-10s %12s %12s\n", "", "ms/frame", "GL calls");
+    printf("%-10s %12.3f %12u\n", "separate", separate_ms, separate_calls);
+    printf("%-10s %12.3f %12u\n", "pooled", pooled_ms, pooled_calls);
+
+    delete [] separate;
+    delete [] pooled;
+    pool.Free();
+    glDeleteProgram(program);
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Read throughput of raw against compressed VBM files with a cold page
+// cache. Each file is compressed into a copy next to it (file.vbm.z, removed
+// afterwards); every iteration then drops both from the page cache and maps
+// each with VBObject::MapVBM, which reads the whole file and, for the copy,
+// decodes it on the default pool. Throughput is of the original bytes in
+// either case. The last column is decoding alone, from memory. No OpenGL
+// context is needed.
+//
+//     vbmbench read [-n iterations] file.vbm ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "vbm.h"
+#include "vbmz.h"
+#include "vthread.h"
+#include "bench.h"
+
+static bool WriteFile(const char * filename, const std::vector<unsigned char> & data)
+{
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    bool ok = fwrite(&data[0], 1, data.size(), f) == data.size();
+
+    return fclose(f) == 0 && ok;
+}
+
+// Best time of MapVBM with the file evicted before each try
+static double ColdMap(const char * filename, int iterations)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!BenchEvictFile(filename))
+            return -1.0;
+
+        VBObject object;
+        double start = BenchNow();
+
+        if (!object.MapVBM(filename))
+            return -1.0;
+
+        double elapsed = BenchNow() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+int BenchRead(int argc, char ** argv)
+{
+    int iterations = 5;
+    int first_file = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+        iterations = atoi(argv[2]);
+        first_file = 3;
+    }
+
+    if (first_file >= argc || iterations < 1)
+    {
+        fprintf(stderr, "read: expected [-n iterations] and at least one file\n");
+        return 1;
+    }
+
+    VThreadPool & pool = VThreadPool::GetDefault();
+
+    printf("%u worker threads\n", pool.GetThreadCount());
+    printf("%-24s %10s %10s %7s %9s %9s %9s %9s %10s\n", "file", "bytes", "packed", "ratio",
+           "raw ms", "raw MB/s", "vbmz ms", "vbmz MB/s", "dec MB/s");
+
+    for (int n = first_file; n < argc; n++)
+    {
+        VMappedFile file;
+
+        if (!file.Open(argv[n]))
+        {
+            fprintf(stderr, "read: unable to open %s\n", argv[n]);
+            continue;
+        }
+
+        std::vector<unsigned char> packed;
+        std::string copy = std::string(argv[n]) + ".z";
+
+        if (!vbmCompress(file.GetData(), file.GetSize(), packed, VBM_COMPRESSED_BLOCK_SIZE, &pool) ||
+            !WriteFile(copy.c_str(), packed))
+        {
+            fprintf(stderr, "read: unable to write %s\n", copy.c_str());
+            continue;
+        }
+
+        size_t size = file.GetSize();
+        double megabytes = size / (1024.0 * 1024.0);
+
+        // Decoding alone, from memory that is already resident
+        std::vector<unsigned char> decoded(size);
+        double decode = 1e30;
+
+        for (int i = 0; i < iterations; i++)
+        {
+            double start = BenchNow();
+            vbmDecompress(&packed[0], packed.size(), &decoded[0], &pool);
+            double elapsed = BenchNow() - start;
+
+            if (elapsed < decode)
+                decode = elapsed;
+        }
+
+        if (memcmp(&decoded[0], file.GetData(), size) != 0)
+            printf("mismatch: %s doesn't decompress to the original\n", argv[n]);
+
+        file.Close();
+
+        double raw = ColdMap(argv[n], iterations);
+        double compressed = ColdMap(copy.c_str(), iterations);
+
+        remove(copy.c_str());
+
+        if (raw < 0.0 || compressed < 0.0)
+        {
+            fprintf(stderr, "read: unable to load %s\n", argv[n]);
+            continue;
+        }
+
+        printf("%-24s %10lu %10lu %6.1f%% %9.3f %9.1f %9.3f %9.1f %10.1f\n", argv[n],
+               (unsigned long)size, (unsigned long)packed.size(), 100.0 * packed.size() / size,
+               raw, megabytes * 1000.0 / raw, compressed, megabytes * 1000.0 / compressed,
+               megabytes * 1000.0 / decode);
+    }
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+struct BenchCommand
+{
+    const char * name;
+    int (*func)(int argc, char ** argv);
+    const char * usage;
+};
+
+static const BenchCommand commands[] =
+{
+    { "load",       BenchLoad,      "load copy|mmap [-n iterations] file.vbm ..." },
+    { "async",      BenchAsync,     "async [-b budget_ms] file.vbm ..." },
+    { "layout",     BenchLayout,    "layout [-i instances] file.vbm ..." },
+    { "pool",       BenchPool,      "pool [-c copies] file.vbm ..." },
+    { "cache",      BenchCache,     "cache [-r references] file.vbm|file.dds ..." },
+    { "cull",       BenchCull,      "cull [-n max_instances]" },
+    { "bvh",        BenchBvh,       "bvh [-n max_instances]" },
+    { "read",       BenchRead,      "read [-n iterations] file.vbm ..." },
+    { "materials",  BenchMaterials, "materials [-s max_size] file.vbm [directory]" },
+    { "morph",      BenchMorph,     "morph [-i instances] [-k keyframes] file.vbm ..." },
+    { "bcn",        BenchBcn,       "bcn [-n iterations] file.dds ..." },
+};
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage:\n");
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        fprintf(stderr, "    %s %s\n", name, commands[i].usage);
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (strcmp(argv[1], commands[i].name) == 0)
+        {
+            // Hand the verb its own argv so that glutInit sees the program name
+            argv[1] = argv[0];
+            return commands[i].func(argc - 1, argv + 1);
+        }
+    }
+
+    usage(argv[0]);
+    return 1;
+}
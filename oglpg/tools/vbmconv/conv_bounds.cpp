@@ -0,0 +1,47 @@
+// Rewrites a VBM file with a bounding box and sphere for every frame and
+// render chunk, so that loading it doesn't have to compute them. Every other
+// verb writes them too; this one only adds them.
+//
+//     vbmconv bounds in.vbm out.vbm
+
+#include <stdio.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+int ConvBounds(int argc, char ** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "bounds: expected input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[1]))
+    {
+        fprintf(stderr, "bounds: unable to load %s\n", argv[1]);
+        return 1;
+    }
+
+    const VBM_BOUNDS * bounds = object.GetFrameBounds(0);
+
+    if (bounds == NULL)
+    {
+        fprintf(stderr, "bounds: %s has no positions\n", argv[1]);
+        return 1;
+    }
+
+    if (!object.SaveToVBM(argv[2]))
+    {
+        fprintf(stderr, "bounds: unable to write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: frame 0 (%g, %g, %g) - (%g, %g, %g), radius %g\n", argv[2],
+           bounds->min[0], bounds->min[1], bounds->min[2],
+           bounds->max[0], bounds->max[1], bounds->max[2], bounds->radius);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Rewrites a VBM file with 16-bit indices, split into base-vertex ranges
+// where the object has more than 65536 vertices. Run it after optimize, lod
+// and meshlets, which all write 32-bit indices. The same conversion can run
+// at load time with VBM_LOAD_COMPACT_INDICES.
+//
+//     vbmconv compact in.vbm out.vbm
+
+#include <stdio.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+int ConvCompact(int argc, char ** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "compact: expected input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[1]))
+    {
+        fprintf(stderr, "compact: unable to load %s\n", argv[1]);
+        return 1;
+    }
+
+    if (object.GetIndexType() == GL_NONE)
+    {
+        fprintf(stderr, "compact: %s isn't indexed; run optimize first\n", argv[1]);
+        return 1;
+    }
+
+    if (!object.CompactIndices())
+    {
+        fprintf(stderr, "compact: %s has an unsupported index type\n", argv[1]);
+        return 1;
+    }
+
+    if (!object.SaveToVBM(argv[2]))
+    {
+        fprintf(stderr, "compact: unable to write %s\n", argv[2]);
+        return 1;
+    }
+
+    unsigned int size = 0;
+
+    // A single range at base vertex 0 needs no block
+    if (object.GetBlock(VBM_BLOCK_INDEX_RANGES, &size) != NULL)
+        printf("%s: 16-bit indices, %u index range(s)\n", argv[2], (unsigned int)(size / sizeof(VBM_INDEX_RANGE)));
+    else
+        printf("%s: 16-bit indices, no index range block written\n", argv[2]);
+
+    return 0;
+}
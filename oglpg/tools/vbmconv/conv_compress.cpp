@@ -0,0 +1,131 @@
+// Compresses a VBM file into the block compressed container of vbmz.h, or
+// with -d turns one back into the original file. VBObject::MapVBM loads
+// either, decoding the blocks in parallel.
+//
+//     vbmconv compress [-d] [-b block_kb] in.vbm out.vbm
+//
+// Smaller blocks decode on more threads at once but compress a little worse;
+// the default is 256 KB.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vbm.h"
+#include "vbmz.h"
+#include "vmmap.h"
+#include "vthread.h"
+#include "vbmconv.h"
+
+static bool compressWrite(const char * filename, const unsigned char * data, size_t size)
+{
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    bool ok = fwrite(data, 1, size, f) == size;
+
+    return fclose(f) == 0 && ok;
+}
+
+int ConvCompress(int argc, char ** argv)
+{
+    unsigned int block_size = VBM_COMPRESSED_BLOCK_SIZE;
+    bool decompress = false;
+    int n = 1;
+
+    while (n < argc && argv[n][0] == '-')
+    {
+        if (strcmp(argv[n], "-d") == 0)
+        {
+            decompress = true;
+            n++;
+        }
+        else if (strcmp(argv[n], "-b") == 0 && n + 1 < argc)
+        {
+            block_size = (unsigned int)atoi(argv[n + 1]) * 1024;
+            n += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (argc - n != 2 || block_size == 0)
+    {
+        fprintf(stderr, "compress: expected [-d] [-b block_kb] and input and output file names\n");
+        return 1;
+    }
+
+    VMappedFile file;
+
+    if (!file.Open(argv[n]))
+    {
+        fprintf(stderr, "compress: unable to open %s\n", argv[n]);
+        return 1;
+    }
+
+    const unsigned char * data = file.GetData();
+    size_t size = file.GetSize();
+    unsigned int magic = size >= sizeof(magic) ? *(const unsigned int *)data : 0;
+    VThreadPool & pool = VThreadPool::GetDefault();
+    std::vector<unsigned char> out;
+
+    if (decompress)
+    {
+        size_t raw_size = magic == VBM_MAGIC_COMPRESSED ? vbmGetDecompressedSize(data, size) : 0;
+
+        if (raw_size)
+            out.resize(raw_size);
+
+        if (raw_size == 0 || !vbmDecompress(data, size, &out[0], &pool))
+        {
+            fprintf(stderr, "compress: %s isn't a valid compressed VBM file\n", argv[n]);
+            return 1;
+        }
+    }
+    else
+    {
+        if (magic != VBM_MAGIC && magic != VBM_MAGIC_V2 && magic != VBM_MAGIC_SBM)
+        {
+            fprintf(stderr, "compress: %s isn't an uncompressed VBM file\n", argv[n]);
+            return 1;
+        }
+
+        if (!vbmCompress(data, size, out, block_size, &pool))
+        {
+            fprintf(stderr, "compress: %s is too large\n", argv[n]);
+            return 1;
+        }
+    }
+
+    if (!compressWrite(argv[n + 1], &out[0], out.size()))
+    {
+        fprintf(stderr, "compress: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    if (decompress)
+    {
+        printf("%s: %lu bytes\n", argv[n + 1], (unsigned long)out.size());
+        return 0;
+    }
+
+    // How often each filter won
+    const VBM_COMPRESSED_HEADER * header = (const VBM_COMPRESSED_HEADER *)&out[0];
+    const VBM_COMPRESSED_BLOCK * blocks = (const VBM_COMPRESSED_BLOCK *)&out[header->size];
+    unsigned int filters[4] = { 0, 0, 0, 0 };
+
+    for (unsigned int b = 0; b < header->num_blocks; b++)
+        filters[blocks[b].filter]++;
+
+    printf("%s: %lu -> %lu bytes (%.1f%%), %u blocks of %u KB: %u plain, %u shuffled, %u delta, %u stored\n",
+           argv[n + 1], (unsigned long)size, (unsigned long)out.size(), 100.0 * out.size() / size,
+           header->num_blocks, header->block_size / 1024,
+           filters[VBM_FILTER_NONE], filters[VBM_FILTER_SHUFFLE], filters[VBM_FILTER_SHUFFLE_DELTA], filters[VBM_FILTER_STORED]);
+
+    return 0;
+}
@@ -0,0 +1,404 @@
+// Converts an OBJ or PLY mesh into a VBM file with position, normal and,
+// if the mesh has them, texture coordinate attributes (in that order, as
+// VBObject binds them). Files are parsed in parallel on the calling thread
+// and threads workers, by default one per hardware thread. Identical
+// vertices are welded; normals are generated, smooth across texture seams,
+// for meshes that don't have any.
+// OBJ materials (mtllib / usemtl) become VBM materials with a render chunk
+// each. Bounds are written as by every other verb.
+//
+//     vbmconv import [-j threads] in.obj|in.ply out.vbm
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "import.h"
+#include "vbmconv.h"
+#include "vthread.h"
+
+void ImportSplitLines(const char * data, size_t size, size_t piece_size, std::vector<const char *> & starts)
+{
+    const char * end = data + size;
+    const char * p = data;
+
+    starts.clear();
+    starts.push_back(p);
+
+    do
+    {
+        p = (size_t)(end - p) > piece_size ? importNextLine(p + piece_size - 1, end) : end;
+        starts.push_back(p);
+    }
+    while (p < end);
+}
+
+// Welds vertices whose attributes are bit for bit the same and drops those
+// no triangle uses. Vertices are renumbered in the order the triangles
+// first use them.
+static void importWeld(ImportMesh & mesh)
+{
+    unsigned int num_vertices = (unsigned int)mesh.positions.size() / 3;
+    bool normals = !mesh.normals.empty();
+    bool texcoords = !mesh.texcoords.empty();
+
+    // Eight floats per vertex, unused ones zero
+    std::vector<unsigned int> keys(num_vertices * 8, 0);
+    unsigned int i, k;
+
+    for (i = 0; i < num_vertices; i++)
+    {
+        memcpy(&keys[i * 8], &mesh.positions[i * 3], 3 * sizeof(float));
+        if (normals)
+            memcpy(&keys[i * 8 + 3], &mesh.normals[i * 3], 3 * sizeof(float));
+        if (texcoords)
+            memcpy(&keys[i * 8 + 6], &mesh.texcoords[i * 2], 2 * sizeof(float));
+    }
+
+    unsigned int size = 16;
+    while (size < num_vertices * 2)
+        size *= 2;
+
+    std::vector<unsigned int> slots(size, ~0u);
+    std::vector<unsigned int> remap(num_vertices, ~0u);
+    std::vector<unsigned int> kept;
+
+    kept.reserve(num_vertices);
+
+    for (i = 0; i < mesh.indices.size(); i++)
+    {
+        unsigned int v = mesh.indices[i];
+
+        if (remap[v] == ~0u)
+        {
+            const unsigned int * key = &keys[v * 8];
+            unsigned int hash = 0;
+
+            for (k = 0; k < 8; k++)
+                hash = (hash ^ key[k]) * 0x01000193u;
+
+            unsigned int slot = (hash ^ (hash >> 16)) & (size - 1);
+
+            while (slots[slot] != ~0u && memcmp(&keys[kept[slots[slot]] * 8], key, 8 * sizeof(unsigned int)) != 0)
+                slot = (slot + 1) & (size - 1);
+
+            if (slots[slot] == ~0u)
+            {
+                slots[slot] = (unsigned int)kept.size();
+                kept.push_back(v);
+            }
+
+            remap[v] = slots[slot];
+        }
+
+        mesh.indices[i] = remap[v];
+    }
+
+    // Nothing welded or dropped, and already in order of use
+    if (kept.size() == num_vertices)
+    {
+        bool identity = true;
+        for (i = 0; i < num_vertices && identity; i++)
+            identity = kept[i] == i;
+        if (identity)
+            return;
+    }
+
+    unsigned int count = (unsigned int)kept.size();
+    std::vector<float> positions(count * 3), vertex_normals(normals ? count * 3 : 0), vertex_texcoords(texcoords ? count * 2 : 0);
+    std::vector<unsigned int> source(count);
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned int v = kept[i];
+
+        memcpy(&positions[i * 3], &mesh.positions[v * 3], 3 * sizeof(float));
+        if (normals)
+            memcpy(&vertex_normals[i * 3], &mesh.normals[v * 3], 3 * sizeof(float));
+        if (texcoords)
+            memcpy(&vertex_texcoords[i * 2], &mesh.texcoords[v * 2], 2 * sizeof(float));
+        source[i] = mesh.source[v];
+    }
+
+    mesh.positions.swap(positions);
+    mesh.normals.swap(vertex_normals);
+    mesh.texcoords.swap(vertex_texcoords);
+    mesh.source.swap(source);
+}
+
+// Area weighted face normals summed over every vertex of the source file,
+// so that vertices split only by their texture coordinates share a normal
+static void importGenerateNormals(ImportMesh & mesh, VThreadPool & pool)
+{
+    unsigned int num_vertices = (unsigned int)mesh.positions.size() / 3;
+    unsigned int num_triangles = mesh.indices.empty() ? num_vertices / 3 : (unsigned int)mesh.indices.size() / 3;
+    unsigned int num_sources = 0;
+    unsigned int i, k;
+
+    for (i = 0; i < num_vertices; i++)
+        num_sources = mesh.source[i] + 1 > num_sources ? mesh.source[i] + 1 : num_sources;
+
+    std::vector<float> sums(num_sources * 3, 0.0f);
+
+    for (i = 0; i < num_triangles; i++)
+    {
+        unsigned int v[3];
+        float e1[3], e2[3];
+
+        for (k = 0; k < 3; k++)
+            v[k] = mesh.indices.empty() ? i * 3 + k : mesh.indices[i * 3 + k];
+
+        for (k = 0; k < 3; k++)
+        {
+            e1[k] = mesh.positions[v[1] * 3 + k] - mesh.positions[v[0] * 3 + k];
+            e2[k] = mesh.positions[v[2] * 3 + k] - mesh.positions[v[0] * 3 + k];
+        }
+
+        float n[3] =
+        {
+            e1[1] * e2[2] - e1[2] * e2[1],
+            e1[2] * e2[0] - e1[0] * e2[2],
+            e1[0] * e2[1] - e1[1] * e2[0]
+        };
+
+        for (unsigned int c = 0; c < 3; c++)
+        {
+            for (k = 0; k < 3; k++)
+                sums[mesh.source[v[c]] * 3 + k] += n[k];
+        }
+    }
+
+    mesh.normals.resize(num_vertices * 3);
+
+    pool.ParallelFor(num_vertices, 65536, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            const float * n = &sums[mesh.source[v] * 3];
+            float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+            for (unsigned int c = 0; c < 3; c++)
+                mesh.normals[v * 3 + c] = n[c] * scale;
+
+            // Degenerate surroundings point up rather than nowhere
+            if (length == 0.0f)
+                mesh.normals[v * 3 + 2] = 1.0f;
+        }
+    });
+}
+
+static void importBounds(VBM_BOUNDS & bounds, const float * positions, unsigned int first, unsigned int count)
+{
+    unsigned int i, k;
+
+    memset(&bounds, 0, sizeof(bounds));
+
+    if (count == 0)
+        return;
+
+    for (k = 0; k < 3; k++)
+        bounds.min[k] = bounds.max[k] = positions[first * 3 + k];
+
+    for (i = first; i < first + count; i++)
+    {
+        for (k = 0; k < 3; k++)
+        {
+            bounds.min[k] = positions[i * 3 + k] < bounds.min[k] ? positions[i * 3 + k] : bounds.min[k];
+            bounds.max[k] = positions[i * 3 + k] > bounds.max[k] ? positions[i * 3 + k] : bounds.max[k];
+        }
+    }
+
+    float radius = 0.0f;
+
+    for (k = 0; k < 3; k++)
+        bounds.center[k] = (bounds.min[k] + bounds.max[k]) * 0.5f;
+
+    for (i = first; i < first + count; i++)
+    {
+        float dx = positions[i * 3] - bounds.center[0];
+        float dy = positions[i * 3 + 1] - bounds.center[1];
+        float dz = positions[i * 3 + 2] - bounds.center[2];
+        float d = dx * dx + dy * dy + dz * dz;
+
+        radius = d > radius ? d : radius;
+    }
+
+    bounds.radius = sqrtf(radius);
+}
+
+static void importAttrib(VBM_ATTRIB_HEADER & attrib, const char * name, unsigned int components)
+{
+    memset(&attrib, 0, sizeof(attrib));
+    snprintf(attrib.name, sizeof(attrib.name), "%s", name);
+    attrib.type = GL_FLOAT;
+    attrib.components = components;
+}
+
+static bool importWrite(const char * filename, const char * name, const ImportMesh & mesh)
+{
+    unsigned int num_vertices = (unsigned int)mesh.positions.size() / 3;
+    VBM_HEADER header;
+    VBM_ATTRIB_HEADER attribs[3];
+    VBM_FRAME_HEADER frame;
+    unsigned int i;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = VBM_MAGIC;
+    header.size = sizeof(VBM_HEADER);
+    snprintf(header.name, sizeof(header.name), "%s", name);
+    header.num_attribs = mesh.texcoords.empty() ? 2 : 3;
+    header.num_frames = 1;
+    header.num_chunks = (unsigned int)mesh.chunks.size();
+    header.num_vertices = num_vertices;
+    header.num_indices = (unsigned int)mesh.indices.size();
+    header.index_type = mesh.indices.empty() ? GL_NONE : GL_UNSIGNED_INT;
+    header.num_materials = (unsigned int)mesh.materials.size();
+    header.flags = VBM_FLAG_HAS_VERTICES | VBM_FLAG_HAS_FRAMES | VBM_FLAG_HAS_BLOCKS;
+    if (header.num_indices)
+        header.flags |= VBM_FLAG_HAS_INDICES;
+    if (header.num_materials)
+        header.flags |= VBM_FLAG_HAS_MATERIALS;
+
+    importAttrib(attribs[0], "position", 3);
+    importAttrib(attribs[1], "normal", 3);
+    importAttrib(attribs[2], "map1", 2);
+
+    frame.first = 0;
+    frame.count = header.num_indices ? header.num_indices : num_vertices;
+    frame.flags = 0;
+
+    // Welded meshes use every vertex, so frame 0's bounds are those of the
+    // whole vertex array
+    std::vector<VBM_BOUNDS> bounds(1 + mesh.chunks.size());
+
+    importBounds(bounds[0], &mesh.positions[0], 0, num_vertices);
+    for (i = 0; i < mesh.chunks.size(); i++)
+        importBounds(bounds[1 + i], &mesh.positions[0], mesh.chunks[i].first, mesh.chunks[i].count);
+
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    ok = ok && fwrite(attribs, sizeof(VBM_ATTRIB_HEADER), header.num_attribs, f) == header.num_attribs;
+    ok = ok && fwrite(&frame, sizeof(frame), 1, f) == 1;
+    ok = ok && fwrite(&mesh.positions[0], sizeof(float), mesh.positions.size(), f) == mesh.positions.size();
+    ok = ok && fwrite(&mesh.normals[0], sizeof(float), mesh.normals.size(), f) == mesh.normals.size();
+    if (!mesh.texcoords.empty())
+        ok = ok && fwrite(&mesh.texcoords[0], sizeof(float), mesh.texcoords.size(), f) == mesh.texcoords.size();
+    if (!mesh.indices.empty())
+        ok = ok && fwrite(&mesh.indices[0], sizeof(unsigned int), mesh.indices.size(), f) == mesh.indices.size();
+    if (!mesh.materials.empty())
+        ok = ok && fwrite(&mesh.materials[0], sizeof(VBM_MATERIAL), mesh.materials.size(), f) == mesh.materials.size();
+    if (!mesh.chunks.empty())
+        ok = ok && fwrite(&mesh.chunks[0], sizeof(VBM_RENDER_CHUNK), mesh.chunks.size(), f) == mesh.chunks.size();
+
+    // Everything so far is a multiple of four bytes, so the block needs no
+    // padding in front
+    VBM_BLOCK_HEADER block = { VBM_BLOCK_BOUNDS, (unsigned int)(bounds.size() * sizeof(VBM_BOUNDS)) };
+
+    ok = ok && fwrite(&block, sizeof(block), 1, f) == 1;
+    ok = ok && fwrite(&bounds[0], sizeof(VBM_BOUNDS), bounds.size(), f) == bounds.size();
+
+    return fclose(f) == 0 && ok;
+}
+
+static bool importHasExtension(const char * filename, const char * extension)
+{
+    size_t length = strlen(filename);
+    size_t extension_length = strlen(extension);
+
+    if (length < extension_length)
+        return false;
+
+    for (size_t i = 0; i < extension_length; i++)
+    {
+        char c = filename[length - extension_length + i];
+
+        if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != extension[i])
+            return false;
+    }
+
+    return true;
+}
+
+int ConvImport(int argc, char ** argv)
+{
+    unsigned int threads = 0;
+    int arg = 1;
+
+    if (arg + 1 < argc && strcmp(argv[arg], "-j") == 0)
+    {
+        threads = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+
+    if (argc - arg != 2)
+    {
+        fprintf(stderr, "import: expected [-j threads] and input and output file names\n");
+        return 1;
+    }
+
+    const char * input = argv[arg];
+    const char * output = argv[arg + 1];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    VThreadPool pool(threads);
+    ImportMesh mesh;
+    bool ok;
+
+    if (importHasExtension(input, ".obj"))
+        ok = ImportOBJ(input, pool, mesh);
+    else if (importHasExtension(input, ".ply"))
+        ok = ImportPLY(input, pool, mesh);
+    else
+    {
+        fprintf(stderr, "import: %s is neither .obj nor .ply\n", input);
+        return 1;
+    }
+
+    if (!ok)
+        return 1;
+
+    std::chrono::steady_clock::time_point parsed = std::chrono::steady_clock::now();
+
+    if (!mesh.indices.empty())
+        importWeld(mesh);
+
+    if (mesh.normals.empty())
+        importGenerateNormals(mesh, pool);
+
+    // Name after the input, without directory and extension
+    const char * name = input + strlen(input);
+    while (name > input && name[-1] != '/' && name[-1] != '\\')
+        name--;
+
+    char model[64];
+    size_t length = strrchr(name, '.') - name;
+
+    length = length < sizeof(model) - 1 ? length : sizeof(model) - 1;
+    memcpy(model, name, length);
+    model[length] = 0;
+
+    if (!importWrite(output, model, mesh))
+    {
+        fprintf(stderr, "import: unable to write %s\n", output);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+    unsigned int triangles = (unsigned int)(mesh.indices.empty() ? mesh.positions.size() / 9 : mesh.indices.size() / 3);
+
+    printf("%s: %u vertices, %u triangles, %u materials%s; parsed in %.3f s, total %.3f s\n", output,
+           (unsigned int)mesh.positions.size() / 3, triangles, (unsigned int)mesh.materials.size(),
+           mesh.indices.empty() ? " (unindexed, one chunk per material)" : "",
+           std::chrono::duration<double>(parsed - start).count(),
+           std::chrono::duration<double>(done - start).count());
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+// Rewrites a planar VBM file with interleaved, 16-byte aligned vertices.
+// VBObject::LoadFromVBM picks the layout up from the file, so no load flag
+// is needed afterwards.
+
+#include <stdio.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+int ConvInterleave(int argc, char ** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "interleave: expected input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[1], VBM_LOAD_INTERLEAVE))
+    {
+        fprintf(stderr, "interleave: unable to load %s\n", argv[1]);
+        return 1;
+    }
+
+    if (!object.SaveToVBM(argv[2]))
+    {
+        fprintf(stderr, "interleave: unable to write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %u vertices, %u attributes, stride %d bytes\n",
+           argv[2], object.GetVertexCount(), object.GetAttributeCount(), object.GetVertexStride());
+
+    return 0;
+}
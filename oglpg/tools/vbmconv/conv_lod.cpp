@@ -0,0 +1,71 @@
+// Appends a chain of simplified levels of detail to a VBM file. The file is
+// indexed and optimized first if it isn't indexed yet.
+//
+//     vbmconv lod [-l levels] [-r ratio] in.vbm out.vbm
+//
+// Each level keeps about ratio (default 0.5) of the triangles of the one
+// before. At run time VBObject::SelectLOD picks a level from the distance and
+// VBObject::RenderLOD draws it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+int ConvLOD(int argc, char ** argv)
+{
+    unsigned int levels = 4;
+    float ratio = 0.5f;
+    int n = 1;
+
+    while (n + 1 < argc && argv[n][0] == '-')
+    {
+        if (strcmp(argv[n], "-l") == 0)
+            levels = (unsigned int)atoi(argv[n + 1]);
+        else if (strcmp(argv[n], "-r") == 0)
+            ratio = (float)atof(argv[n + 1]);
+        else
+            break;
+
+        n += 2;
+    }
+
+    if (argc - n != 2 || levels == 0 || ratio <= 0.0f || ratio >= 1.0f)
+    {
+        fprintf(stderr, "lod: expected [-l levels] [-r ratio] and input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[n]))
+    {
+        fprintf(stderr, "lod: unable to load %s\n", argv[n]);
+        return 1;
+    }
+
+    if (!object.GenerateLODs(levels, ratio))
+    {
+        fprintf(stderr, "lod: unable to simplify %s\n", argv[n]);
+        return 1;
+    }
+
+    if (!object.SaveToVBM(argv[n + 1]))
+    {
+        fprintf(stderr, "lod: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    const VBM_LOD * lod = (const VBM_LOD *)object.GetBlock(VBM_BLOCK_LOD);
+
+    printf("%s: %u levels\n", argv[n + 1], object.GetLODCount());
+    for (unsigned int i = 0; i < object.GetLODCount(); i++)
+        printf("    %u: %8u triangles, error %g\n", i, lod[i].count / 3, lod[i].error);
+
+    if (object.GetLODCount() < levels)
+        printf("    (the remaining levels would barely be simpler and were dropped)\n");
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Splits frame 0 of a VBM file into meshlets with culling bounds. The file is
+// indexed and optimized first if it isn't indexed yet.
+//
+//     vbmconv meshlets [-v max_vertices] [-t max_triangles] in.vbm out.vbm
+//
+// At run time VBObject::CullMeshlets builds the per-view draw list that
+// VBObject::Render submits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+int ConvMeshlets(int argc, char ** argv)
+{
+    unsigned int max_vertices = 64;
+    unsigned int max_triangles = 124;
+    int n = 1;
+
+    while (n + 1 < argc && argv[n][0] == '-')
+    {
+        if (strcmp(argv[n], "-v") == 0)
+            max_vertices = (unsigned int)atoi(argv[n + 1]);
+        else if (strcmp(argv[n], "-t") == 0)
+            max_triangles = (unsigned int)atoi(argv[n + 1]);
+        else
+            break;
+
+        n += 2;
+    }
+
+    if (argc - n != 2 || max_vertices < 3 || max_triangles == 0)
+    {
+        fprintf(stderr, "meshlets: expected [-v max_vertices] [-t max_triangles] and input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[n]))
+    {
+        fprintf(stderr, "meshlets: unable to load %s\n", argv[n]);
+        return 1;
+    }
+
+    if (!object.BuildMeshlets(max_vertices, max_triangles))
+    {
+        fprintf(stderr, "meshlets: unable to cluster %s\n", argv[n]);
+        return 1;
+    }
+
+    if (!object.SaveToVBM(argv[n + 1]))
+    {
+        fprintf(stderr, "meshlets: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    const VBM_MESHLET * meshlets = (const VBM_MESHLET *)object.GetBlock(VBM_BLOCK_MESHLETS);
+    unsigned int count = object.GetMeshletCount();
+    unsigned int vertices = 0;
+    unsigned int triangles = 0;
+    unsigned int with_cone = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        vertices += meshlets[i].vertex_count;
+        triangles += meshlets[i].count / 3;
+        if (meshlets[i].cone_cutoff < 1.0f)
+            with_cone++;
+    }
+
+    printf("%s: %u meshlets, %.1f vertices and %.1f triangles on average, %u can be backface culled\n",
+           argv[n + 1], count,
+           count ? (float)vertices / count : 0.0f,
+           count ? (float)triangles / count : 0.0f,
+           with_cone);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Indexes a VBM file and reorders it for the post-transform vertex cache,
+// overdraw and vertex fetch, reporting the cache efficiency before and after.
+// The same optimization can run at load time with VBM_LOAD_OPTIMIZE.
+//
+//     vbmconv optimize [-c cache_size] in.vbm out.vbm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+static void PrintStats(const char * label, const VBM_CACHE_STATS & stats)
+{
+    printf("    %-8s %8u triangles %8u vertices  ACMR %.3f  ATVR %.3f\n",
+           label, stats.triangles, stats.vertices, stats.acmr, stats.atvr);
+}
+
+int ConvOptimize(int argc, char ** argv)
+{
+    unsigned int cache_size = 16;
+    int n = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+    {
+        cache_size = (unsigned int)atoi(argv[2]);
+        n = 3;
+    }
+
+    if (argc - n != 2 || cache_size < 3)
+    {
+        fprintf(stderr, "optimize: expected [-c cache_size] and input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[n]))
+    {
+        fprintf(stderr, "optimize: unable to load %s\n", argv[n]);
+        return 1;
+    }
+
+    VBM_CACHE_STATS before = object.AnalyzeVertexCache(cache_size);
+
+    if (!object.Optimize(VBM_OPTIMIZE_ALL, cache_size))
+    {
+        fprintf(stderr, "optimize: %s has render chunks or frames that aren't triangle lists\n", argv[n]);
+        return 1;
+    }
+
+    VBM_CACHE_STATS after = object.AnalyzeVertexCache(cache_size);
+
+    if (!object.SaveToVBM(argv[n + 1]))
+    {
+        fprintf(stderr, "optimize: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    printf("%s (%u entry cache):\n", argv[n + 1], cache_size);
+    PrintStats("before", before);
+    PrintStats("after", after);
+
+    return 0;
+}
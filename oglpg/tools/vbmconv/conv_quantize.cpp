@@ -0,0 +1,110 @@
+// Rewrites a VBM file with compact vertex encodings (a VBM2 file). By
+// default positions and texture coordinates become half floats and normals
+// and tangents GL_INT_2_10_10_10_REV, which takes a position + normal + uv
+// vertex from 36 to 16 bytes.
+//
+//     vbmconv quantize [-p float|half|norm16] [-n float|1010102|oct]
+//                      [-t float|half|norm16] in.vbm out.vbm
+//
+// norm16 attributes must be rescaled by VBObject::GetAttributeScale/Bias and
+// oct normals decoded with VBM_GLSL_OCT_DECODE in the vertex shader.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vbm.h"
+#include "vbmconv.h"
+
+static bool ParseEncoding(const char * name, unsigned int & encoding)
+{
+    static const struct
+    {
+        const char * name;
+        unsigned int encoding;
+    } encodings[] =
+    {
+        { "float",   VBM_ENCODING_FLOAT },
+        { "half",    VBM_ENCODING_HALF },
+        { "norm16",  VBM_ENCODING_NORM16 },
+        { "1010102", VBM_ENCODING_INT_2_10_10_10 },
+        { "oct",     VBM_ENCODING_OCTAHEDRAL },
+    };
+
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++)
+    {
+        if (strcmp(name, encodings[i].name) == 0)
+        {
+            encoding = encodings[i].encoding;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int ConvQuantize(int argc, char ** argv)
+{
+    unsigned int position = VBM_ENCODING_HALF;
+    unsigned int normal = VBM_ENCODING_INT_2_10_10_10;
+    unsigned int texcoord = VBM_ENCODING_HALF;
+    int n = 1;
+
+    while (n + 1 < argc && argv[n][0] == '-')
+    {
+        unsigned int * target = NULL;
+
+        if (strcmp(argv[n], "-p") == 0)
+            target = &position;
+        else if (strcmp(argv[n], "-n") == 0)
+            target = &normal;
+        else if (strcmp(argv[n], "-t") == 0)
+            target = &texcoord;
+
+        if (target == NULL || !ParseEncoding(argv[n + 1], *target))
+        {
+            fprintf(stderr, "quantize: bad option %s %s\n", argv[n], argv[n + 1]);
+            return 1;
+        }
+
+        n += 2;
+    }
+
+    if (argc - n != 2)
+    {
+        fprintf(stderr, "quantize: expected input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[n]))
+    {
+        fprintf(stderr, "quantize: unable to load %s\n", argv[n]);
+        return 1;
+    }
+
+    size_t before = 0;
+    for (unsigned int i = 0; i < object.GetAttributeCount(); i++)
+        before += object.GetAttributeSize(i);
+
+    if (!object.Quantize(position, normal, texcoord))
+    {
+        fprintf(stderr, "quantize: %s must have a planar vertex layout\n", argv[n]);
+        return 1;
+    }
+
+    size_t after = 0;
+    for (unsigned int i = 0; i < object.GetAttributeCount(); i++)
+        after += object.GetAttributeSize(i);
+
+    if (!object.SaveToVBM(argv[n + 1]))
+    {
+        fprintf(stderr, "quantize: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    printf("%s: %u vertices, %u -> %u bytes per vertex\n",
+           argv[n + 1], object.GetVertexCount(), (unsigned int)before, (unsigned int)after);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Adds a tangent attribute to a VBM file, computed by
+// VBObject::GenerateTangents, so that normal mapped models need not build
+// their tangents at every load. An existing tangent attribute is replaced.
+//
+//     vbmconv tangents [-j threads] in.vbm out.vbm
+//
+// Quantize afterwards to store the tangents as GL_INT_2_10_10_10_REV.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "vbm.h"
+#include "vthread.h"
+#include "vbmconv.h"
+
+int ConvTangents(int argc, char ** argv)
+{
+    unsigned int threads = 0;
+    int n = 1;
+
+    if (n + 1 < argc && strcmp(argv[n], "-j") == 0)
+    {
+        threads = (unsigned int)atoi(argv[n + 1]);
+        n += 2;
+    }
+
+    if (argc - n != 2)
+    {
+        fprintf(stderr, "tangents: expected [-j threads] and input and output file names\n");
+        return 1;
+    }
+
+    VBObject object;
+
+    if (!object.MapVBM(argv[n]))
+    {
+        fprintf(stderr, "tangents: unable to load %s\n", argv[n]);
+        return 1;
+    }
+
+    VThreadPool pool(threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (!object.GenerateTangents(&pool))
+    {
+        fprintf(stderr, "tangents: %s must be planar and have normals and texture coordinates\n", argv[n]);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+
+    if (!object.SaveToVBM(argv[n + 1]))
+    {
+        fprintf(stderr, "tangents: unable to write %s\n", argv[n + 1]);
+        return 1;
+    }
+
+    printf("%s: %u vertices, %u attributes, tangents in %.1f ms with %u worker threads\n",
+           argv[n + 1], object.GetVertexCount(), object.GetAttributeCount(),
+           std::chrono::duration<double, std::milli>(done - start).count(), pool.GetThreadCount());
+
+    return 0;
+}
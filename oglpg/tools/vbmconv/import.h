@@ -0,0 +1,191 @@
+#ifndef __IMPORT_H__
+#define __IMPORT_H__
+
+// Mesh importers for vbmconv import. The parsers split the file into one
+// piece per line range and parse the pieces in parallel on a VThreadPool;
+// conv_import.cpp turns the result into a VBM file.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vbm.h"
+
+class VThreadPool;
+
+// A triangle mesh as the importers hand it over. Vertices are welded and
+// indexed, except for meshes with several materials: render chunks are
+// ranges of vertices, so those come out unindexed with their triangles
+// grouped by material and one chunk per material.
+struct ImportMesh
+{
+    std::vector<float> positions;           // Three per vertex
+    std::vector<float> normals;             // Three per vertex, or none
+    std::vector<float> texcoords;           // Two per vertex, or none
+    std::vector<unsigned int> indices;      // Three per triangle, or none
+    std::vector<VBM_MATERIAL> materials;
+    std::vector<VBM_RENDER_CHUNK> chunks;
+
+    // Per vertex, the vertex of the source file it came from, so that
+    // normals generated for a mesh without them are smooth across seams
+    std::vector<unsigned int> source;
+};
+
+// Both print what went wrong to stderr
+bool ImportOBJ(const char * filename, VThreadPool & pool, ImportMesh & mesh);
+bool ImportPLY(const char * filename, VThreadPool & pool, ImportMesh & mesh);
+
+// Ranges of [data, data + size) of about piece_size bytes, each starting at
+// the beginning of a line and ending just after a newline (or at the end)
+void ImportSplitLines(const char * data, size_t size, size_t piece_size, std::vector<const char *> & starts);
+
+static inline bool importIsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char * importSkipSpace(const char * p, const char * end)
+{
+    while (p < end && importIsSpace(*p))
+        p++;
+    return p;
+}
+
+static inline const char * importNextLine(const char * p, const char * end)
+{
+    const char * newline = (const char *)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Parses a decimal integer at p, returning the character after it, or NULL
+// if there is no number there
+static inline const char * importParseInt(const char * p, const char * end, int * value)
+{
+    bool negative = false;
+    int result = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+
+    while (p < end && *p >= '0' && *p <= '9')
+        result = result * 10 + (*p++ - '0');
+
+    *value = negative ? -result : result;
+    return p;
+}
+
+// Parses a floating point number at p like strtod, returning the character
+// after it or NULL. The digits are gathered into a 64-bit integer and scaled
+// by an exact power of ten, which rounds correctly; the rare number that
+// can't be done that way (more than 19 digits, huge exponents, inf, nan)
+// goes to strtod.
+static inline const char * importParseFloat(const char * p, const char * end, float * value)
+{
+    static const double powers[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char * start = p;
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool negative = false;
+    bool any = false;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (!any)
+    {
+        // inf, nan and friends
+        char text[64];
+        size_t length = 0;
+
+        while (start + length < end && length < sizeof(text) - 1 && !importIsSpace(start[length]) && start[length] != '\n')
+        {
+            text[length] = start[length];
+            length++;
+        }
+        text[length] = 0;
+
+        char * stop;
+        double result = strtod(text, &stop);
+
+        if (stop == text)
+            return NULL;
+
+        *value = (float)result;
+        return start + (stop - text);
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        int e;
+        const char * after = importParseInt(p + 1, end, &e);
+
+        if (after)
+        {
+            // Clamped well past where floats overflow or flush to zero
+            exponent += e < -400 ? -400 : (e > 400 ? 400 : e);
+            p = after;
+        }
+    }
+
+    double result;
+
+    if (mantissa == 0)
+    {
+        result = 0.0;
+    }
+    else if (exponent >= -22 && exponent <= 22)
+    {
+        result = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+    }
+    else
+    {
+        char text[512];
+        size_t length = p - start < (ptrdiff_t)sizeof(text) - 1 ? p - start : sizeof(text) - 1;
+
+        memcpy(text, start, length);
+        text[length] = 0;
+        *value = (float)strtod(text, NULL);
+        return p;
+    }
+
+    *value = (float)(negative ? -result : result);
+    return p;
+}
+
+#endif /* __IMPORT_H__ */
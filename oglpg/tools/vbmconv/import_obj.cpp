@@ -0,0 +1,719 @@
+// Wavefront OBJ importer. Every piece of the file gets its own vertex, face
+// and material lists; pieces only depend on each other through how many
+// vertices came before them, which matters for the rare negative (relative)
+// index, and which material was last selected. Both are settled once every
+// piece is parsed. Faces are triangulated as fans.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+
+#include "import.h"
+#include "vmmap.h"
+#include "vthread.h"
+
+// Bytes per piece, small enough to balance well over the threads
+#define OBJ_PIECE_SIZE      (1 << 20)
+
+struct objPiece
+{
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<float> normals;
+
+    // Three per triangle corner: position, texcoord and normal, 0 based,
+    // -1 where the corner has none
+    std::vector<int> corners;
+
+    // Elements of corners holding a relative index resolved within the
+    // piece, which still needs the count of what came before it added
+    std::vector<unsigned int> relative;
+
+    // (first triangle, name) for every usemtl
+    std::vector<std::pair<unsigned int, std::string> > materials;
+    std::vector<std::string> libraries;
+
+    unsigned int lines;
+    unsigned int error_line;        // Line within the piece, 0 for none
+};
+
+static std::string objName(const char * p, const char * end)
+{
+    p = importSkipSpace(p, end);
+
+    const char * last = end;
+    while (last > p && (importIsSpace(last[-1]) || last[-1] == '\n'))
+        last--;
+
+    return std::string(p, last);
+}
+
+static const char * objParseFloats(const char * p, const char * end, float * out, unsigned int count, unsigned int required)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const char * next = importParseFloat(importSkipSpace(p, end), end, &out[i]);
+
+        if (next == NULL)
+        {
+            if (i < required)
+                return NULL;
+            out[i] = 0.0f;
+            continue;
+        }
+
+        p = next;
+    }
+
+    return p;
+}
+
+// One corner of a face, "v", "v/t", "v//n" or "v/t/n"
+static const char * objParseCorner(const char * p, const char * end, const objPiece & piece, int corner[3], bool relative[3])
+{
+    const unsigned int counts[3] =
+    {
+        (unsigned int)piece.positions.size() / 3,
+        (unsigned int)piece.texcoords.size() / 2,
+        (unsigned int)piece.normals.size() / 3
+    };
+
+    for (int k = 0; k < 3; k++)
+    {
+        corner[k] = -1;
+        relative[k] = false;
+
+        if (k > 0)
+        {
+            if (p == end || *p != '/')
+                continue;
+            p++;
+        }
+
+        int index;
+        const char * next = importParseInt(p, end, &index);
+
+        if (next == NULL)
+        {
+            // Only the texcoord may be left out in the middle
+            if (k == 1)
+                continue;
+            return NULL;
+        }
+
+        if (index == 0)
+            return NULL;
+
+        p = next;
+        relative[k] = index < 0;
+        corner[k] = index < 0 ? (int)counts[k] + index : index - 1;
+    }
+
+    return p;
+}
+
+static void objParsePiece(const char * p, const char * end, objPiece & piece)
+{
+    std::vector<int> polygon;
+    std::vector<unsigned char> polygon_relative;
+
+    piece.lines = 0;
+    piece.error_line = 0;
+
+    while (p < end)
+    {
+        const char * line_end = importNextLine(p, end);
+        const char * q = importSkipSpace(p, line_end);
+        bool ok = true;
+
+        piece.lines++;
+
+        if (q + 1 < line_end && q[0] == 'v' && importIsSpace(q[1]))
+        {
+            float v[3];
+
+            ok = objParseFloats(q + 1, line_end, v, 3, 3) != NULL;
+            piece.positions.insert(piece.positions.end(), v, v + 3);
+        }
+        else if (q + 2 < line_end && q[0] == 'v' && q[1] == 't' && importIsSpace(q[2]))
+        {
+            float t[2];
+
+            ok = objParseFloats(q + 2, line_end, t, 2, 1) != NULL;
+            piece.texcoords.insert(piece.texcoords.end(), t, t + 2);
+        }
+        else if (q + 2 < line_end && q[0] == 'v' && q[1] == 'n' && importIsSpace(q[2]))
+        {
+            float n[3];
+
+            ok = objParseFloats(q + 2, line_end, n, 3, 3) != NULL;
+            piece.normals.insert(piece.normals.end(), n, n + 3);
+        }
+        else if (q + 1 < line_end && q[0] == 'f' && importIsSpace(q[1]))
+        {
+            polygon.clear();
+            polygon_relative.clear();
+            q = importSkipSpace(q + 1, line_end);
+
+            while (ok && q < line_end && *q != '\n' && *q != '#')
+            {
+                int corner[3];
+                bool relative[3];
+
+                q = objParseCorner(q, line_end, piece, corner, relative);
+                if (q == NULL)
+                {
+                    ok = false;
+                    break;
+                }
+
+                for (int k = 0; k < 3; k++)
+                {
+                    polygon.push_back(corner[k]);
+                    polygon_relative.push_back(relative[k]);
+                }
+
+                q = importSkipSpace(q, line_end);
+            }
+
+            unsigned int count = (unsigned int)polygon.size() / 3;
+
+            ok = ok && count >= 3;
+
+            for (unsigned int i = 2; ok && i < count; i++)
+            {
+                const unsigned int fan[3] = { 0, i - 1, i };
+
+                for (int c = 0; c < 3; c++)
+                {
+                    for (int k = 0; k < 3; k++)
+                    {
+                        if (polygon_relative[fan[c] * 3 + k])
+                            piece.relative.push_back((unsigned int)piece.corners.size());
+                        piece.corners.push_back(polygon[fan[c] * 3 + k]);
+                    }
+                }
+            }
+        }
+        else if (line_end - q > 7 && strncmp(q, "usemtl", 6) == 0 && importIsSpace(q[6]))
+        {
+            piece.materials.push_back(std::make_pair((unsigned int)piece.corners.size() / 9, objName(q + 6, line_end)));
+        }
+        else if (line_end - q > 7 && strncmp(q, "mtllib", 6) == 0 && importIsSpace(q[6]))
+        {
+            piece.libraries.push_back(objName(q + 6, line_end));
+        }
+
+        // Everything else (comments, groups, smoothing groups, lines and
+        // points) is ignored
+
+        if (!ok && piece.error_line == 0)
+            piece.error_line = piece.lines;
+
+        p = line_end;
+    }
+}
+
+static void objCopyString(char * out, size_t size, const std::string & text)
+{
+    strncpy(out, text.c_str(), size - 1);
+    out[size - 1] = 0;
+}
+
+static void objDefaultMaterial(VBM_MATERIAL & material, const std::string & name)
+{
+    memset(&material, 0, sizeof(material));
+    objCopyString(material.name, sizeof(material.name), name);
+    material.ambient.x = material.ambient.y = material.ambient.z = 0.2f;
+    material.diffuse.x = material.diffuse.y = material.diffuse.z = 0.8f;
+    material.alpha = 1.0f;
+    material.ior = 1.0f;
+}
+
+// Reads the materials of an MTL file into materials, keyed by name. A
+// missing library only loses the materials' colors and maps.
+static void objLoadLibrary(const std::string & filename, std::map<std::string, VBM_MATERIAL> & materials)
+{
+    VMappedFile file;
+
+    if (!file.Open(filename.c_str()))
+    {
+        fprintf(stderr, "import: unable to open material library %s\n", filename.c_str());
+        return;
+    }
+
+    const char * p = (const char *)file.GetData();
+    const char * end = p + file.GetSize();
+    VBM_MATERIAL * material = NULL;
+
+    while (p < end)
+    {
+        const char * line_end = importNextLine(p, end);
+        const char * q = importSkipSpace(p, line_end);
+        const char * word = q;
+
+        while (q < line_end && !importIsSpace(*q) && *q != '\n')
+            q++;
+
+        std::string keyword(word, q);
+        float v[3];
+
+        if (keyword == "newmtl")
+        {
+            std::string name = objName(q, line_end);
+
+            material = &materials[name];
+            objDefaultMaterial(*material, name);
+        }
+        else if (material == NULL)
+        {
+        }
+        else if (keyword == "Ka" && objParseFloats(q, line_end, v, 3, 1))
+        {
+            material->ambient.x = v[0];
+            material->ambient.y = v[1];
+            material->ambient.z = v[2];
+        }
+        else if (keyword == "Kd" && objParseFloats(q, line_end, v, 3, 1))
+        {
+            material->diffuse.x = v[0];
+            material->diffuse.y = v[1];
+            material->diffuse.z = v[2];
+        }
+        else if (keyword == "Ks" && objParseFloats(q, line_end, v, 3, 1))
+        {
+            material->specular.x = v[0];
+            material->specular.y = v[1];
+            material->specular.z = v[2];
+        }
+        else if (keyword == "Tf" && objParseFloats(q, line_end, v, 3, 1))
+        {
+            material->transmission.x = v[0];
+            material->transmission.y = v[1];
+            material->transmission.z = v[2];
+        }
+        else if (keyword == "Ns" && objParseFloats(q, line_end, v, 1, 1))
+        {
+            material->specular_exp.x = material->specular_exp.y = material->specular_exp.z = v[0];
+            material->shininess = v[0];
+        }
+        else if (keyword == "d" && objParseFloats(q, line_end, v, 1, 1))
+        {
+            material->alpha = v[0];
+        }
+        else if (keyword == "Tr" && objParseFloats(q, line_end, v, 1, 1))
+        {
+            material->alpha = 1.0f - v[0];
+        }
+        else if (keyword == "Ni" && objParseFloats(q, line_end, v, 1, 1))
+        {
+            material->ior = v[0];
+        }
+        else if (keyword == "map_Ka")
+        {
+            objCopyString(material->ambient_map, sizeof(material->ambient_map), objName(q, line_end));
+        }
+        else if (keyword == "map_Kd")
+        {
+            objCopyString(material->diffuse_map, sizeof(material->diffuse_map), objName(q, line_end));
+        }
+        else if (keyword == "map_Ks")
+        {
+            objCopyString(material->specular_map, sizeof(material->specular_map), objName(q, line_end));
+        }
+        else if (keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump" || keyword == "norm")
+        {
+            objCopyString(material->normal_map, sizeof(material->normal_map), objName(q, line_end));
+        }
+
+        p = line_end;
+    }
+}
+
+// Open addressing table from (position, texcoord, normal) to the welded
+// vertex made for it. The keys live in the caller's vertex list, three ints
+// per vertex.
+class objWeldTable
+{
+public:
+    explicit objWeldTable(unsigned int expected)
+        : m_count(0)
+    {
+        unsigned int size = 16;
+
+        while (size < expected * 2)
+            size *= 2;
+
+        m_mask = size - 1;
+        m_slots.assign(size, ~0u);
+    }
+
+    // The vertex for corner, or ~0u after recording next for it
+    unsigned int Find(const int * corner, const std::vector<int> & keys, unsigned int next)
+    {
+        for (unsigned int slot = Hash(corner) & m_mask; ; slot = (slot + 1) & m_mask)
+        {
+            unsigned int vertex = m_slots[slot];
+
+            if (vertex == ~0u)
+            {
+                m_slots[slot] = next;
+                if (++m_count * 2 > m_mask)
+                    Grow(keys, corner, next);
+                return ~0u;
+            }
+
+            if (keys[vertex * 3] == corner[0] && keys[vertex * 3 + 1] == corner[1] && keys[vertex * 3 + 2] == corner[2])
+                return vertex;
+        }
+    }
+
+private:
+    static unsigned int Hash(const int * key)
+    {
+        unsigned int hash = (unsigned int)key[0] * 0x9E3779B1u ^ (unsigned int)key[1] * 0x85EBCA77u ^
+                            (unsigned int)key[2] * 0xC2B2AE3Du;
+
+        return hash ^ (hash >> 15);
+    }
+
+    // Doubles the table. The newest vertex's key isn't in keys yet.
+    void Grow(const std::vector<int> & keys, const int * newest, unsigned int newest_vertex)
+    {
+        std::vector<unsigned int> old;
+
+        old.swap(m_slots);
+        m_mask = (m_mask + 1) * 2 - 1;
+        m_slots.assign(m_mask + 1, ~0u);
+
+        for (size_t i = 0; i < old.size(); i++)
+        {
+            if (old[i] == ~0u)
+                continue;
+
+            const int * key = old[i] == newest_vertex ? newest : &keys[old[i] * 3];
+            unsigned int slot = Hash(key) & m_mask;
+
+            while (m_slots[slot] != ~0u)
+                slot = (slot + 1) & m_mask;
+
+            m_slots[slot] = old[i];
+        }
+    }
+
+    std::vector<unsigned int> m_slots;
+    unsigned int m_mask;
+    unsigned int m_count;
+};
+
+bool ImportOBJ(const char * filename, VThreadPool & pool, ImportMesh & mesh)
+{
+    VMappedFile file;
+
+    if (!file.Open(filename))
+    {
+        fprintf(stderr, "import: unable to open %s\n", filename);
+        return false;
+    }
+
+    const char * data = (const char *)file.GetData();
+    std::vector<const char *> starts;
+
+    ImportSplitLines(data, file.GetSize(), OBJ_PIECE_SIZE, starts);
+
+    unsigned int num_pieces = (unsigned int)starts.size() - 1;
+    std::vector<objPiece> pieces(num_pieces);
+
+    pool.ParallelFor(num_pieces, 1, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            objParsePiece(starts[i], starts[i + 1], pieces[i]);
+    });
+
+    // Where each piece's vertices, texcoords, normals and triangles start
+    std::vector<unsigned int> first_position(num_pieces + 1, 0);
+    std::vector<unsigned int> first_texcoord(num_pieces + 1, 0);
+    std::vector<unsigned int> first_normal(num_pieces + 1, 0);
+    std::vector<unsigned int> first_triangle(num_pieces + 1, 0);
+    unsigned int line = 0;
+    unsigned int i;
+
+    for (i = 0; i < num_pieces; i++)
+    {
+        const objPiece & piece = pieces[i];
+
+        if (piece.error_line)
+        {
+            fprintf(stderr, "import: %s(%u): unable to parse line\n", filename, line + piece.error_line);
+            return false;
+        }
+
+        line += piece.lines;
+        first_position[i + 1] = first_position[i] + (unsigned int)piece.positions.size() / 3;
+        first_texcoord[i + 1] = first_texcoord[i] + (unsigned int)piece.texcoords.size() / 2;
+        first_normal[i + 1] = first_normal[i] + (unsigned int)piece.normals.size() / 3;
+        first_triangle[i + 1] = first_triangle[i] + (unsigned int)piece.corners.size() / 9;
+    }
+
+    unsigned int num_positions = first_position[num_pieces];
+    unsigned int num_texcoords = first_texcoord[num_pieces];
+    unsigned int num_normals = first_normal[num_pieces];
+    unsigned int num_triangles = first_triangle[num_pieces];
+
+    if (num_triangles == 0)
+    {
+        fprintf(stderr, "import: %s has no faces\n", filename);
+        return false;
+    }
+
+    // Gather the attribute lists and make every index absolute
+    std::vector<float> positions(num_positions * 3);
+    std::vector<float> texcoords(num_texcoords * 2);
+    std::vector<float> normals(num_normals * 3);
+    std::vector<int> corners(num_triangles * 9);
+
+    pool.ParallelFor(num_pieces, 1, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int p = begin; p < end; p++)
+        {
+            objPiece & piece = pieces[p];
+            const int bases[3] = { (int)first_position[p], (int)first_texcoord[p], (int)first_normal[p] };
+
+            for (size_t r = 0; r < piece.relative.size(); r++)
+                piece.corners[piece.relative[r]] += bases[piece.relative[r] % 3];
+
+            std::copy(piece.positions.begin(), piece.positions.end(), positions.begin() + first_position[p] * 3);
+            std::copy(piece.texcoords.begin(), piece.texcoords.end(), texcoords.begin() + first_texcoord[p] * 2);
+            std::copy(piece.normals.begin(), piece.normals.end(), normals.begin() + first_normal[p] * 3);
+            std::copy(piece.corners.begin(), piece.corners.end(), corners.begin() + first_triangle[p] * 9);
+
+            std::vector<float>().swap(piece.positions);
+            std::vector<float>().swap(piece.texcoords);
+            std::vector<float>().swap(piece.normals);
+            std::vector<int>().swap(piece.corners);
+        }
+    });
+
+    // The material of every triangle. A piece starts with whatever the one
+    // before it selected last.
+    std::map<std::string, VBM_MATERIAL> library;
+    std::map<std::string, unsigned int> material_index;
+    std::vector<std::string> material_names;
+    std::vector<unsigned int> triangle_material(num_triangles, 0);
+    unsigned int current = ~0u;
+
+    for (i = 0; i < num_pieces; i++)
+    {
+        const objPiece & piece = pieces[i];
+        unsigned int triangle = first_triangle[i];
+
+        for (size_t l = 0; l < piece.libraries.size(); l++)
+        {
+            std::string path = filename;
+            size_t slash = path.find_last_of("/\\");
+
+            path = slash == std::string::npos ? piece.libraries[l] : path.substr(0, slash + 1) + piece.libraries[l];
+            objLoadLibrary(path, library);
+        }
+
+        for (size_t m = 0; m <= piece.materials.size(); m++)
+        {
+            unsigned int next = m < piece.materials.size() ? first_triangle[i] + piece.materials[m].first : first_triangle[i + 1];
+
+            std::fill(triangle_material.begin() + triangle, triangle_material.begin() + next, current);
+            triangle = next;
+
+            if (m == piece.materials.size())
+                break;
+
+            const std::string & name = piece.materials[m].second;
+            std::map<std::string, unsigned int>::iterator found = material_index.find(name);
+
+            if (found == material_index.end())
+            {
+                found = material_index.insert(std::make_pair(name, (unsigned int)material_names.size())).first;
+                material_names.push_back(name);
+            }
+
+            current = found->second;
+        }
+    }
+
+    // Triangles that came before the first usemtl get a default material
+    // of their own, unless that is every triangle
+    mesh.materials.clear();
+
+    if (!material_names.empty() && triangle_material[0] == ~0u)
+        material_names.push_back("default");
+
+    for (i = 0; i < num_triangles; i++)
+    {
+        if (triangle_material[i] == ~0u)
+            triangle_material[i] = material_names.empty() ? 0 : (unsigned int)material_names.size() - 1;
+    }
+
+    for (i = 0; i < material_names.size(); i++)
+    {
+        VBM_MATERIAL material;
+        std::map<std::string, VBM_MATERIAL>::const_iterator found = library.find(material_names[i]);
+
+        if (found != library.end())
+            material = found->second;
+        else
+            objDefaultMaterial(material, material_names[i]);
+
+        mesh.materials.push_back(material);
+    }
+
+    // Triangles in material order, stable so that each material's stay as
+    // the file had them
+    std::vector<unsigned int> order(num_triangles);
+    for (i = 0; i < num_triangles; i++)
+        order[i] = i;
+
+    bool multiple = false;
+    for (i = 1; i < num_triangles && !multiple; i++)
+        multiple = triangle_material[i] != triangle_material[0];
+
+    if (multiple)
+    {
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+        {
+            return triangle_material[a] < triangle_material[b];
+        });
+    }
+
+    // Check every index before welding, in parallel
+    std::atomic<bool> bad(false);
+    const int limits[3] = { (int)num_positions, (int)num_texcoords, (int)num_normals };
+
+    pool.ParallelFor(num_triangles * 3, 65536, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int c = begin; c < end; c++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                int index = corners[c * 3 + k];
+
+                if (index >= limits[k] || (index < 0 && (k == 0 || index != -1)))
+                {
+                    bad = true;
+                    return;
+                }
+            }
+        }
+    });
+
+    if (bad)
+    {
+        fprintf(stderr, "import: %s has a face using a vertex that doesn't exist\n", filename);
+        return false;
+    }
+
+    bool has_texcoords = false;
+    bool has_normals = false;
+
+    for (i = 0; i < num_triangles * 3; i++)
+    {
+        has_texcoords |= corners[i * 3 + 1] >= 0;
+        has_normals |= corners[i * 3 + 2] >= 0;
+    }
+
+    // Weld corners with the same position, texcoord and normal into one
+    // vertex, unless the chunks need the vertices in triangle order
+    std::vector<int> keys;
+    std::vector<unsigned int> vertex_of_corner(num_triangles * 3);
+
+    if (multiple)
+    {
+        keys.resize(num_triangles * 9);
+
+        for (i = 0; i < num_triangles; i++)
+        {
+            std::copy(&corners[order[i] * 9], &corners[order[i] * 9] + 9, &keys[i * 9]);
+            vertex_of_corner[i * 3] = i * 3;
+            vertex_of_corner[i * 3 + 1] = i * 3 + 1;
+            vertex_of_corner[i * 3 + 2] = i * 3 + 2;
+        }
+
+        mesh.indices.clear();
+    }
+    else
+    {
+        objWeldTable table(num_positions);
+        unsigned int num_vertices = 0;
+
+        keys.reserve(num_positions * 3);
+
+        for (i = 0; i < num_triangles * 3; i++)
+        {
+            const int * corner = &corners[i * 3];
+            unsigned int vertex = table.Find(corner, keys, num_vertices);
+
+            if (vertex == ~0u)
+            {
+                vertex = num_vertices++;
+                keys.insert(keys.end(), corner, corner + 3);
+            }
+
+            vertex_of_corner[i] = vertex;
+        }
+
+        mesh.indices.swap(vertex_of_corner);
+    }
+
+    // Fill the vertices from the attribute lists
+    unsigned int num_vertices = (unsigned int)keys.size() / 3;
+
+    mesh.positions.resize(num_vertices * 3);
+    mesh.texcoords.resize(has_texcoords ? num_vertices * 2 : 0);
+    mesh.normals.resize(has_normals ? num_vertices * 3 : 0);
+    mesh.source.resize(num_vertices);
+
+    pool.ParallelFor(num_vertices, 65536, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int v = begin; v < end; v++)
+        {
+            const int * key = &keys[v * 3];
+
+            memcpy(&mesh.positions[v * 3], &positions[key[0] * 3], 3 * sizeof(float));
+            mesh.source[v] = key[0];
+
+            if (has_texcoords)
+            {
+                mesh.texcoords[v * 2] = key[1] >= 0 ? texcoords[key[1] * 2] : 0.0f;
+                mesh.texcoords[v * 2 + 1] = key[1] >= 0 ? texcoords[key[1] * 2 + 1] : 0.0f;
+            }
+
+            if (has_normals)
+            {
+                for (int k = 0; k < 3; k++)
+                    mesh.normals[v * 3 + k] = key[2] >= 0 ? normals[key[2] * 3 + k] : 0.0f;
+            }
+        }
+    });
+
+    // One chunk per material, over the vertices of its triangles
+    mesh.chunks.clear();
+
+    if (multiple)
+    {
+        for (i = 0; i < num_triangles; i++)
+        {
+            unsigned int material = triangle_material[order[i]];
+
+            if (mesh.chunks.empty() || mesh.chunks.back().material_index != material)
+            {
+                VBM_RENDER_CHUNK chunk = { material, i * 3, 0 };
+                mesh.chunks.push_back(chunk);
+            }
+
+            mesh.chunks.back().count += 3;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,572 @@
+// Stanford PLY importer, ASCII and binary of either byte order. Positions
+// (x, y, z), normals (nx, ny, nz) and texture coordinates (s, t / u, v /
+// texture_u, texture_v) are read from the vertex element and the
+// vertex_indices list from the face element; other properties and elements
+// are skipped. Binary vertices all have the same size and are decoded in
+// parallel; ASCII files are split into pieces of whole lines, which are
+// parsed in parallel once every piece knows its first line number.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "import.h"
+#include "vmmap.h"
+#include "vthread.h"
+
+#define PLY_PIECE_SIZE      (1 << 20)
+
+enum plyFormat
+{
+    PLY_ASCII,
+    PLY_BINARY_LE,
+    PLY_BINARY_BE
+};
+
+// What a vertex property is used for
+enum plyUse
+{
+    PLY_USE_NONE = -1,
+    PLY_USE_X, PLY_USE_Y, PLY_USE_Z,
+    PLY_USE_NX, PLY_USE_NY, PLY_USE_NZ,
+    PLY_USE_S, PLY_USE_T,
+    PLY_USE_COUNT
+};
+
+struct plyProperty
+{
+    std::string name;
+    int type;                   // Bytes and kind, see plyType
+    int count_type;             // For lists, 0 otherwise
+    int use;
+    unsigned int offset;        // In a binary element without lists
+};
+
+struct plyElement
+{
+    std::string name;
+    unsigned int count;
+    std::vector<plyProperty> properties;
+    bool has_list;
+    unsigned int size;          // Bytes per binary item without lists
+};
+
+// Types are their size in bytes, negated for floating point and plus 0x10
+// for unsigned integers
+static int plyType(const std::string & name)
+{
+    if (name == "char" || name == "int8")
+        return 1;
+    if (name == "uchar" || name == "uint8")
+        return 0x11;
+    if (name == "short" || name == "int16")
+        return 2;
+    if (name == "ushort" || name == "uint16")
+        return 0x12;
+    if (name == "int" || name == "int32")
+        return 4;
+    if (name == "uint" || name == "uint32")
+        return 0x14;
+    if (name == "float" || name == "float32")
+        return -4;
+    if (name == "double" || name == "float64")
+        return -8;
+    return 0;
+}
+
+static inline unsigned int plyTypeSize(int type)
+{
+    return type < 0 ? -type : type & 0xF;
+}
+
+static int plyUseOf(const std::string & name)
+{
+    static const char * const names[][3] =
+    {
+        { "x", 0, 0 }, { "y", 0, 0 }, { "z", 0, 0 },
+        { "nx", 0, 0 }, { "ny", 0, 0 }, { "nz", 0, 0 },
+        { "s", "u", "texture_u" }, { "t", "v", "texture_v" },
+    };
+
+    for (int use = 0; use < PLY_USE_COUNT; use++)
+    {
+        for (int i = 0; i < 3 && names[use][i]; i++)
+        {
+            if (name == names[use][i])
+                return use;
+        }
+    }
+
+    if (name == "texture_s")
+        return PLY_USE_S;
+    if (name == "texture_t")
+        return PLY_USE_T;
+
+    return PLY_USE_NONE;
+}
+
+static inline bool plyHostIsLittleEndian(void)
+{
+    const unsigned int one = 1;
+    return *(const unsigned char *)&one == 1;
+}
+
+// Reads one binary value of type at p as a double
+static inline double plyRead(const unsigned char * p, int type, bool swap)
+{
+    unsigned char bytes[8];
+    unsigned int size = plyTypeSize(type);
+
+    for (unsigned int i = 0; i < size; i++)
+        bytes[i] = swap ? p[size - 1 - i] : p[i];
+
+    switch (type)
+    {
+        case 1:     return *(const signed char *)bytes;
+        case 0x11:  return *(const unsigned char *)bytes;
+        case 2:     { short v; memcpy(&v, bytes, 2); return v; }
+        case 0x12:  { unsigned short v; memcpy(&v, bytes, 2); return v; }
+        case 4:     { int v; memcpy(&v, bytes, 4); return v; }
+        case 0x14:  { unsigned int v; memcpy(&v, bytes, 4); return v; }
+        case -4:    { float v; memcpy(&v, bytes, 4); return v; }
+        default:    { double v; memcpy(&v, bytes, 8); return v; }
+    }
+}
+
+static bool plyParseHeader(const char * data, size_t size, plyFormat & format, std::vector<plyElement> & elements, size_t & body)
+{
+    const char * p = data;
+    const char * end = data + size;
+    bool has_format = false;
+
+    if (size < 4 || strncmp(data, "ply", 3) != 0 || (data[3] != '\n' && data[3] != '\r'))
+        return false;
+
+    for (p = importNextLine(p, end); p < end; )
+    {
+        const char * line_end = importNextLine(p, end);
+        std::vector<std::string> words;
+        const char * q = importSkipSpace(p, line_end);
+
+        while (q < line_end && *q != '\n')
+        {
+            const char * word = q;
+
+            while (q < line_end && !importIsSpace(*q) && *q != '\n')
+                q++;
+            words.push_back(std::string(word, q));
+            q = importSkipSpace(q, line_end);
+        }
+
+        p = line_end;
+
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+
+        if (words[0] == "end_header")
+        {
+            body = p - data;
+            return has_format;
+        }
+
+        if (words[0] == "format" && words.size() >= 2)
+        {
+            if (words[1] == "ascii")
+                format = PLY_ASCII;
+            else if (words[1] == "binary_little_endian")
+                format = PLY_BINARY_LE;
+            else if (words[1] == "binary_big_endian")
+                format = PLY_BINARY_BE;
+            else
+                return false;
+            has_format = true;
+        }
+        else if (words[0] == "element" && words.size() >= 3)
+        {
+            plyElement element;
+
+            element.name = words[1];
+            element.count = (unsigned int)strtoul(words[2].c_str(), NULL, 10);
+            element.has_list = false;
+            element.size = 0;
+            elements.push_back(element);
+        }
+        else if (words[0] == "property" && !elements.empty())
+        {
+            plyElement & element = elements.back();
+            plyProperty property;
+
+            if (words.size() >= 5 && words[1] == "list")
+            {
+                property.count_type = plyType(words[2]);
+                property.type = plyType(words[3]);
+                property.name = words[4];
+                element.has_list = true;
+
+                // Counts have to be integers
+                if (property.count_type <= 0)
+                    return false;
+            }
+            else if (words.size() >= 3)
+            {
+                property.count_type = 0;
+                property.type = plyType(words[1]);
+                property.name = words[2];
+            }
+            else
+            {
+                return false;
+            }
+
+            if (property.type == 0)
+                return false;
+
+            property.use = element.name == "vertex" ? plyUseOf(property.name) : PLY_USE_NONE;
+            property.offset = element.size;
+            element.size += plyTypeSize(property.type);
+            element.properties.push_back(property);
+        }
+    }
+
+    return false;
+}
+
+// Appends the triangles of a polygon, as a fan
+static inline void plyAddPolygon(std::vector<unsigned int> & indices, const unsigned int * polygon, unsigned int count)
+{
+    for (unsigned int i = 2; i < count; i++)
+    {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[i - 1]);
+        indices.push_back(polygon[i]);
+    }
+}
+
+static void plyStoreVertex(ImportMesh & mesh, unsigned int v, const double * values)
+{
+    for (int k = 0; k < 3; k++)
+        mesh.positions[v * 3 + k] = (float)values[PLY_USE_X + k];
+
+    if (!mesh.normals.empty())
+    {
+        for (int k = 0; k < 3; k++)
+            mesh.normals[v * 3 + k] = (float)values[PLY_USE_NX + k];
+    }
+
+    if (!mesh.texcoords.empty())
+    {
+        mesh.texcoords[v * 2] = (float)values[PLY_USE_S];
+        mesh.texcoords[v * 2 + 1] = (float)values[PLY_USE_T];
+    }
+}
+
+static bool plyReadBinary(const unsigned char * p, const unsigned char * end, bool swap,
+                          const std::vector<plyElement> & elements, VThreadPool & pool, ImportMesh & mesh)
+{
+    for (size_t e = 0; e < elements.size(); e++)
+    {
+        const plyElement & element = elements[e];
+        unsigned int i;
+
+        if (element.name == "vertex")
+        {
+            if (element.has_list || (unsigned long long)element.size * element.count > (unsigned long long)(end - p))
+                return false;
+
+            pool.ParallelFor(element.count, 65536, [&](unsigned int begin, unsigned int last)
+            {
+                double values[PLY_USE_COUNT] = { 0.0, };
+
+                for (unsigned int v = begin; v < last; v++)
+                {
+                    const unsigned char * item = p + (size_t)v * element.size;
+
+                    for (size_t k = 0; k < element.properties.size(); k++)
+                    {
+                        const plyProperty & property = element.properties[k];
+
+                        if (property.use != PLY_USE_NONE)
+                            values[property.use] = plyRead(item + property.offset, property.type, swap);
+                    }
+
+                    plyStoreVertex(mesh, v, values);
+                }
+            });
+
+            p += (size_t)element.size * element.count;
+            continue;
+        }
+
+        if (!element.has_list)
+        {
+            if ((unsigned long long)element.size * element.count > (unsigned long long)(end - p))
+                return false;
+            p += (size_t)element.size * element.count;
+            continue;
+        }
+
+        // Items with lists differ in size, so they are walked in order
+        bool faces = element.name == "face";
+        std::vector<unsigned int> polygon;
+
+        for (i = 0; i < element.count; i++)
+        {
+            for (size_t k = 0; k < element.properties.size(); k++)
+            {
+                const plyProperty & property = element.properties[k];
+                unsigned int size = plyTypeSize(property.type);
+
+                if (property.count_type == 0)
+                {
+                    if (size > (size_t)(end - p))
+                        return false;
+                    p += size;
+                    continue;
+                }
+
+                unsigned int count_size = plyTypeSize(property.count_type);
+
+                if (count_size > (size_t)(end - p))
+                    return false;
+
+                unsigned int count = (unsigned int)plyRead(p, property.count_type, swap);
+                p += count_size;
+
+                if ((unsigned long long)count * size > (unsigned long long)(end - p))
+                    return false;
+
+                if (faces && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                {
+                    polygon.resize(count);
+                    for (unsigned int c = 0; c < count; c++)
+                        polygon[c] = (unsigned int)plyRead(p + c * size, property.type, swap);
+
+                    plyAddPolygon(mesh.indices, polygon.empty() ? NULL : &polygon[0], count);
+                }
+
+                p += count * size;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Parses the lines from p to end, the first being line first_line of the
+// body, storing vertices in mesh and triangles in indices
+static bool plyParseLines(const char * p, const char * end, unsigned int first_line, const std::vector<plyElement> & elements,
+                          ImportMesh & mesh, std::vector<unsigned int> & indices)
+{
+    std::vector<double> values;
+    std::vector<unsigned int> polygon;
+    unsigned int line = first_line;
+
+    for (; p < end; line++)
+    {
+        const char * line_end = importNextLine(p, end);
+        unsigned int item = line;
+        size_t e;
+
+        for (e = 0; e < elements.size() && item >= elements[e].count; e++)
+            item -= elements[e].count;
+
+        if (e == elements.size())
+            return importSkipSpace(p, line_end) == line_end || *importSkipSpace(p, line_end) == '\n';
+
+        const plyElement & element = elements[e];
+        bool vertices = element.name == "vertex";
+        bool faces = element.name == "face";
+        double stored[PLY_USE_COUNT] = { 0.0, };
+        const char * q = p;
+
+        for (size_t k = 0; k < element.properties.size() && (vertices || faces); k++)
+        {
+            const plyProperty & property = element.properties[k];
+            float value;
+
+            q = importParseFloat(importSkipSpace(q, line_end), line_end, &value);
+            if (q == NULL)
+                return false;
+
+            if (property.count_type == 0)
+            {
+                if (vertices && property.use != PLY_USE_NONE)
+                    stored[property.use] = value;
+                continue;
+            }
+
+            unsigned int count = (unsigned int)value;
+            bool wanted = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+
+            polygon.resize(count);
+
+            for (unsigned int c = 0; c < count; c++)
+            {
+                int index;
+
+                q = importParseInt(importSkipSpace(q, line_end), line_end, &index);
+                if (q == NULL)
+                    return false;
+
+                polygon[c] = (unsigned int)index;
+            }
+
+            if (wanted)
+                plyAddPolygon(indices, polygon.empty() ? NULL : &polygon[0], count);
+        }
+
+        if (vertices)
+            plyStoreVertex(mesh, item, stored);
+
+        p = line_end;
+    }
+
+    return true;
+}
+
+bool ImportPLY(const char * filename, VThreadPool & pool, ImportMesh & mesh)
+{
+    VMappedFile file;
+
+    if (!file.Open(filename))
+    {
+        fprintf(stderr, "import: unable to open %s\n", filename);
+        return false;
+    }
+
+    const char * data = (const char *)file.GetData();
+    std::vector<plyElement> elements;
+    plyFormat format = PLY_ASCII;
+    size_t body = 0;
+
+    if (!plyParseHeader(data, file.GetSize(), format, elements, body))
+    {
+        fprintf(stderr, "import: %s is not a PLY file\n", filename);
+        return false;
+    }
+
+    const plyElement * vertex = NULL;
+    bool uses[PLY_USE_COUNT] = { false, };
+    size_t e;
+
+    for (e = 0; e < elements.size(); e++)
+    {
+        if (elements[e].name != "vertex")
+            continue;
+
+        vertex = &elements[e];
+        for (size_t k = 0; k < vertex->properties.size(); k++)
+        {
+            if (vertex->properties[k].use != PLY_USE_NONE)
+                uses[vertex->properties[k].use] = true;
+        }
+    }
+
+    if (vertex == NULL || !uses[PLY_USE_X] || !uses[PLY_USE_Y] || !uses[PLY_USE_Z])
+    {
+        fprintf(stderr, "import: %s has no vertex positions\n", filename);
+        return false;
+    }
+
+    unsigned int num_vertices = vertex->count;
+
+    mesh.positions.resize(num_vertices * 3);
+    mesh.normals.resize(uses[PLY_USE_NX] && uses[PLY_USE_NY] && uses[PLY_USE_NZ] ? num_vertices * 3 : 0);
+    mesh.texcoords.resize(uses[PLY_USE_S] && uses[PLY_USE_T] ? num_vertices * 2 : 0);
+    mesh.indices.clear();
+    mesh.materials.clear();
+    mesh.chunks.clear();
+
+    bool ok;
+
+    if (format == PLY_ASCII)
+    {
+        const char * start = data + body;
+        size_t size = file.GetSize() - body;
+        std::vector<const char *> starts;
+
+        ImportSplitLines(start, size, PLY_PIECE_SIZE, starts);
+
+        unsigned int num_pieces = (unsigned int)starts.size() - 1;
+        std::vector<unsigned int> first_line(num_pieces + 1, 0);
+        std::vector<std::vector<unsigned int> > indices(num_pieces);
+        std::atomic<bool> failed(false);
+
+        // Lines in each piece, then where each piece starts
+        pool.ParallelFor(num_pieces, 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                unsigned int lines = 0;
+
+                for (const char * p = starts[i]; p < starts[i + 1]; p = importNextLine(p, starts[i + 1]))
+                    lines++;
+                first_line[i + 1] = lines;
+            }
+        });
+
+        for (unsigned int i = 0; i < num_pieces; i++)
+            first_line[i + 1] += first_line[i];
+
+        pool.ParallelFor(num_pieces, 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                if (!plyParseLines(starts[i], starts[i + 1], first_line[i], elements, mesh, indices[i]))
+                    failed = true;
+            }
+        });
+
+        ok = !failed;
+
+        size_t total = 0;
+        for (unsigned int i = 0; i < num_pieces; i++)
+            total += indices[i].size();
+
+        mesh.indices.reserve(total);
+        for (unsigned int i = 0; i < num_pieces; i++)
+            mesh.indices.insert(mesh.indices.end(), indices[i].begin(), indices[i].end());
+
+        unsigned long long expected = 0;
+        for (e = 0; e < elements.size(); e++)
+            expected += elements[e].count;
+
+        ok = ok && first_line[num_pieces] >= expected;
+    }
+    else
+    {
+        const unsigned char * start = (const unsigned char *)data + body;
+
+        ok = plyReadBinary(start, (const unsigned char *)data + file.GetSize(), (format == PLY_BINARY_BE) == plyHostIsLittleEndian(),
+                           elements, pool, mesh);
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "import: %s is truncated or corrupt\n", filename);
+        return false;
+    }
+
+    if (mesh.indices.empty())
+    {
+        fprintf(stderr, "import: %s has no faces\n", filename);
+        return false;
+    }
+
+    for (size_t i = 0; i < mesh.indices.size(); i++)
+    {
+        if (mesh.indices[i] >= num_vertices)
+        {
+            fprintf(stderr, "import: %s has a face using a vertex that doesn't exist\n", filename);
+            return false;
+        }
+    }
+
+    mesh.source.resize(num_vertices);
+    for (unsigned int v = 0; v < num_vertices; v++)
+        mesh.source[v] = v;
+
+    return true;
+}
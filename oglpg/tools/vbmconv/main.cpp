@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "vbmconv.h"
+
+struct ConvCommand
+{
+    const char * name;
+    int (*func)(int argc, char ** argv);
+    const char * usage;
+};
+
+static const ConvCommand commands[] =
+{
+    { "bounds",     ConvBounds,     "bounds in.vbm out.vbm" },
+    { "compact",    ConvCompact,    "compact in.vbm out.vbm" },
+    { "compress",   ConvCompress,   "compress [-d] [-b block_kb] in.vbm out.vbm" },
+    { "import",     ConvImport,     "import [-j threads] in.obj|in.ply out.vbm" },
+    { "interleave", ConvInterleave, "interleave in.vbm out.vbm" },
+    { "lod",        ConvLOD,        "lod [-l levels] [-r ratio] in.vbm out.vbm" },
+    { "meshlets",   ConvMeshlets,   "meshlets [-v max_vertices] [-t max_triangles] in.vbm out.vbm" },
+    { "optimize",   ConvOptimize,   "optimize [-c cache_size] in.vbm out.vbm" },
+    { "quantize",   ConvQuantize,   "quantize [-p float|half|norm16] [-n float|1010102|oct] [-t float|half|norm16] in.vbm out.vbm" },
+    { "tangents",   ConvTangents,   "tangents [-j threads] in.vbm out.vbm" },
+};
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage:\n");
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        fprintf(stderr, "    %s %s\n", name, commands[i].usage);
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (strcmp(argv[1], commands[i].name) == 0)
+        {
+            argv[1] = argv[0];
+            return commands[i].func(argc - 1, argv + 1);
+        }
+    }
+
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef __VBMCONV_H__
+#define __VBMCONV_H__
+
+// Offline VBM conversions, one per command line verb. Each takes the verb's
+// own arguments (argv[0] is the program name) and returns a process exit code.
+
+int ConvBounds(int argc, char ** argv);
+int ConvCompact(int argc, char ** argv);
+int ConvCompress(int argc, char ** argv);
+int ConvImport(int argc, char ** argv);
+int ConvInterleave(int argc, char ** argv);
+int ConvLOD(int argc, char ** argv);
+int ConvMeshlets(int argc, char ** argv);
+int ConvOptimize(int argc, char ** argv);
+int ConvQuantize(int argc, char ** argv);
+int ConvTangents(int argc, char ** argv);
+
+#endif /* __VBMCONV_H__ */
@@ -0,0 +1,533 @@
+// Offline texture cooker: TGA or raw RGB images in, block-compressed DDS
+// files with a full mip chain out, for vglLoadTexture to upload without
+// decompressing.
+//
+//     vtexcook [-f auto|bc1|bc2|bc3|bc4|bc5|bc7] [-s] [-n] [-m box|kaiser|lanczos] [-a cutoff]
+//              [-j threads] [-r width height] [-o dir] in.tga|in.raw ...
+//
+//     -f  block format. auto, the default, takes BC3 for images with any
+//         alpha below 255 and BC1 for the rest. BC2 stores alpha as is,
+//         at 4 bits. BC5 keeps red and green, for normal maps; BC4 keeps
+//         red.
+//     -s  mark the output sRGB (BC1, BC2, BC3 and BC7 only)
+//     -n  top level only, no mips
+//     -m  mip filter, kaiser by default; see VMipGenerator
+//     -a  keep the mips' alpha test coverage at this cutoff, for cutouts.
+//         BC4 images, masks, have it kept in red.
+//     -r  size of .raw files, which have no header. Square ones are
+//         recognized without it.
+//     -o  where the .dds files go, created if need be; by default next to
+//         their sources
+//
+// Images are cooked in parallel, one format after the other, and each one's
+// blocks and mip tiles are spread over the same threads. Mips are filtered
+// by VMipGenerator, in linear light with -s.
+// Prints the PSNR of every image over the channels its format keeps, and per
+// format the overall PSNR and how many megapixels (mips included) a second
+// were encoded and written.
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "vbcn.h"
+#include "vermilion.h"
+#include "vmipgen.h"
+#include "vtarga.h"
+#include "vthread.h"
+
+// DXGI formats for the DX10 header, _SRGB being one more than _UNORM
+#define DXGI_FORMAT_BC1_UNORM       71
+#define DXGI_FORMAT_BC2_UNORM       74
+#define DXGI_FORMAT_BC3_UNORM       77
+#define DXGI_FORMAT_BC4_UNORM       80
+#define DXGI_FORMAT_BC5_UNORM       83
+#define DXGI_FORMAT_BC7_UNORM       98
+
+struct CookImage
+{
+    std::string source;
+    std::string output;
+    VBCnCodec::Format format;
+    unsigned int width;
+    unsigned int height;
+    std::vector<unsigned char> rgba;
+
+    // Results
+    bool ok;
+    unsigned int mips;
+    double pixels;
+    double error;
+};
+
+static const char * format_names[] = { "bc1", "bc2", "bc3", "bc4", "bc5", "bc7" };
+
+static unsigned int dxgi_formats[] =
+{
+    DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC2_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_BC4_UNORM, DXGI_FORMAT_BC5_UNORM, DXGI_FORMAT_BC7_UNORM
+};
+
+static bool LoadRaw(const char * filename, unsigned int & width, unsigned int & height, std::vector<unsigned char> & rgba)
+{
+    FILE * f = fopen(filename, "rb");
+
+    if (f == NULL)
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (width == 0 || height == 0)
+    {
+        unsigned int side = (unsigned int)(sqrt((double)(size / 3)) + 0.5);
+        width = height = side;
+    }
+
+    size_t pixels = (size_t)width * height;
+    std::vector<unsigned char> rgb(pixels * 3);
+
+    if (size < 0 || (size_t)size != rgb.size() || fread(&rgb[0], 1, rgb.size(), f) != rgb.size())
+    {
+        fclose(f);
+        return false;
+    }
+
+    fclose(f);
+
+    rgba.resize(pixels * 4);
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        rgba[i * 4 + 0] = rgb[i * 3 + 0];
+        rgba[i * 4 + 1] = rgb[i * 3 + 1];
+        rgba[i * 4 + 2] = rgb[i * 3 + 2];
+        rgba[i * 4 + 3] = 255;
+    }
+
+    return true;
+}
+
+static bool LoadTGA(const char * filename, unsigned int & width, unsigned int & height, std::vector<unsigned char> & rgba)
+{
+    GLenum format;
+    int w, h;
+    unsigned char * data = vtarga::load_targa(filename, format, w, h);
+
+    if (data == NULL)
+        return false;
+
+    size_t pixels = (size_t)w * h;
+    unsigned int size = format == GL_RED ? 1 : (format == GL_BGR ? 3 : 4);
+
+    width = (unsigned int)w;
+    height = (unsigned int)h;
+    rgba.resize(pixels * 4);
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const unsigned char * texel = data + i * size;
+        unsigned char * out = &rgba[i * 4];
+
+        if (size == 1)
+        {
+            out[0] = out[1] = out[2] = texel[0];
+            out[3] = 255;
+        }
+        else
+        {
+            out[0] = texel[2];
+            out[1] = texel[1];
+            out[2] = texel[0];
+            out[3] = size == 4 ? texel[3] : 255;
+        }
+    }
+
+    delete [] data;
+
+    return true;
+}
+
+// Creates dir and any parents it lacks. Only the last step has to
+// succeed: earlier ones may be drive names or directories that exist.
+static bool MakeDirectory(const std::string & dir)
+{
+    size_t end = 0;
+    int result;
+
+    do
+    {
+        end = dir.find_first_of("/\\", end + 1);
+
+        std::string path = dir.substr(0, end);
+
+#ifdef _WIN32
+        result = _mkdir(path.c_str());
+#else
+        result = mkdir(path.c_str(), 0777);
+#endif
+    }
+    while (end != std::string::npos);
+
+    return result == 0 || errno == EEXIST;
+}
+
+static void Put32(std::vector<unsigned char> & out, size_t offset, unsigned int value)
+{
+    out[offset + 0] = (unsigned char)(value & 0xFF);
+    out[offset + 1] = (unsigned char)((value >> 8) & 0xFF);
+    out[offset + 2] = (unsigned char)((value >> 16) & 0xFF);
+    out[offset + 3] = (unsigned char)(value >> 24);
+}
+
+// Magic, DDS_HEADER and DDS_HEADER_DXT10 for a 2D texture
+static void WriteDDSHeader(std::vector<unsigned char> & out, unsigned int dxgi_format, unsigned int width, unsigned int height,
+                           unsigned int mips, unsigned int top_size)
+{
+    out.assign(4 + 124 + 20, 0);
+
+    Put32(out, 0, 0x20534444);                          // "DDS "
+    Put32(out, 4, 124);
+    Put32(out, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);   // caps, height, width, pixel format, mip count, linear size
+    Put32(out, 12, height);
+    Put32(out, 16, width);
+    Put32(out, 20, top_size);
+    Put32(out, 28, mips);
+    Put32(out, 76, 32);                                 // pixel format size
+    Put32(out, 80, 0x4);                                // DDPF_FOURCC
+    Put32(out, 84, 0x30315844);                         // "DX10"
+    Put32(out, 108, 0x1000 | (mips > 1 ? 0x400008 : 0));    // texture, mipmap and complex
+    Put32(out, 128, dxgi_format);
+    Put32(out, 132, 3);                                 // DDS_RESOURCE_DIMENSION_TEXTURE2D
+    Put32(out, 140, 1);                                 // array size
+}
+
+static void Cook(CookImage & image, bool srgb, bool mips, VMipGenerator::Filter filter, float alpha_cutoff, VThreadPool & pool)
+{
+    // BC4 keeps red alone, so its mips are made from red alone, and have
+    // coverage kept in red
+    bool red = image.format == VBCnCodec::BC4;
+    unsigned int channels = red ? 1 : 4;
+    std::vector<unsigned char> top;
+    std::vector<unsigned char> level;
+    std::vector<unsigned char> file;
+    unsigned int dxgi_format = dxgi_formats[image.format] + (srgb ? 1 : 0);
+    vglImageData source, chain;
+
+    if (red)
+    {
+        top.resize((size_t)image.width * image.height);
+        for (size_t i = 0; i < top.size(); i++)
+            top[i] = image.rgba[i * 4];
+    }
+
+    memset(&source, 0, sizeof(source));
+    source.target = GL_TEXTURE_2D;
+    source.internalFormat = red ? GL_R8 : (srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8);
+    source.format = red ? GL_RED : GL_RGBA;
+    source.type = GL_UNSIGNED_BYTE;
+    source.mipLevels = 1;
+    source.slices = 1;
+    source.mip[0].width = image.width;
+    source.mip[0].height = image.height;
+    source.mip[0].depth = 1;
+    source.mip[0].mipStride = (GLsizeiptr)image.width * image.height * channels;
+    source.mip[0].data = red ? &top[0] : &image.rgba[0];
+    source.sliceStride = source.mip[0].mipStride;
+    source.totalDataSize = source.mip[0].mipStride;
+
+    image.ok = false;
+    image.pixels = 0.0;
+    image.error = 0.0;
+
+    if (!mips)
+        chain = source;
+    else if (!VMipGenerator::Generate(source, chain, filter, alpha_cutoff, &pool))
+        return;
+
+    image.mips = chain.mipLevels;
+
+    WriteDDSHeader(file, dxgi_format, image.width, image.height, image.mips,
+                   (unsigned int)VBCnCodec::GetImageSize(image.format, image.width, image.height));
+
+    for (unsigned int mip = 0; mip < image.mips; mip++)
+    {
+        unsigned int width = chain.mip[mip].width;
+        unsigned int height = chain.mip[mip].height;
+        const unsigned char * texels = (const unsigned char *)chain.mip[mip].data;
+        size_t offset = file.size();
+
+        if (red)
+        {
+            level.resize((size_t)width * height * 4);
+            for (size_t i = 0; i < (size_t)width * height; i++)
+            {
+                level[i * 4 + 0] = level[i * 4 + 1] = level[i * 4 + 2] = texels[i];
+                level[i * 4 + 3] = 255;
+            }
+            texels = &level[0];
+        }
+
+        file.resize(offset + VBCnCodec::GetImageSize(image.format, width, height));
+
+        image.error += VBCnCodec::Encode(image.format, texels, width, height, &file[offset], &pool);
+        image.pixels += (double)width * height;
+    }
+
+    // As vglUnloadImage would, which comes with the GL texture loader
+    if (mips)
+        delete [] (unsigned char *)chain.mip[0].data;
+
+    FILE * f = fopen(image.output.c_str(), "wb");
+
+    image.ok = f != NULL && fwrite(&file[0], 1, file.size(), f) == file.size();
+
+    if (f != NULL)
+        fclose(f);
+}
+
+static double PSNR(double error, double samples)
+{
+    if (error <= 0.0)
+        return 99.99;
+
+    return 10.0 * log10(255.0 * 255.0 * samples / error);
+}
+
+int main(int argc, char ** argv)
+{
+    int format = -1;
+    bool srgb = false;
+    bool mips = true;
+    VMipGenerator::Filter filter = VMipGenerator::KAISER;
+    float alpha_cutoff = -1.0f;
+    unsigned int threads = 0;
+    unsigned int raw_width = 0;
+    unsigned int raw_height = 0;
+    std::string dir;
+    std::vector<CookImage> images;
+    int n;
+
+    for (n = 1; n < argc && argv[n][0] == '-'; n++)
+    {
+        if (strcmp(argv[n], "-f") == 0 && n + 1 < argc)
+        {
+            n++;
+            format = -1;
+            for (int i = 0; i < VBCnCodec::FORMAT_COUNT; i++)
+            {
+                if (strcmp(argv[n], format_names[i]) == 0)
+                    format = i;
+            }
+            if (format < 0 && strcmp(argv[n], "auto") != 0)
+            {
+                fprintf(stderr, "vtexcook: unknown format %s\n", argv[n]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[n], "-s") == 0)
+        {
+            srgb = true;
+        }
+        else if (strcmp(argv[n], "-n") == 0)
+        {
+            mips = false;
+        }
+        else if (strcmp(argv[n], "-m") == 0 && n + 1 < argc)
+        {
+            n++;
+            if (strcmp(argv[n], "box") == 0)
+                filter = VMipGenerator::BOX;
+            else if (strcmp(argv[n], "kaiser") == 0)
+                filter = VMipGenerator::KAISER;
+            else if (strcmp(argv[n], "lanczos") == 0)
+                filter = VMipGenerator::LANCZOS;
+            else
+            {
+                fprintf(stderr, "vtexcook: unknown mip filter %s\n", argv[n]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[n], "-a") == 0 && n + 1 < argc)
+        {
+            alpha_cutoff = (float)atof(argv[++n]);
+            if (alpha_cutoff <= 0.0f || alpha_cutoff > 1.0f)
+            {
+                fprintf(stderr, "vtexcook: alpha cutoff %s isn't in (0, 1]\n", argv[n]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[n], "-j") == 0 && n + 1 < argc)
+        {
+            threads = (unsigned int)atoi(argv[++n]);
+        }
+        else if (strcmp(argv[n], "-r") == 0 && n + 2 < argc)
+        {
+            raw_width = (unsigned int)atoi(argv[++n]);
+            raw_height = (unsigned int)atoi(argv[++n]);
+        }
+        else if (strcmp(argv[n], "-o") == 0 && n + 1 < argc)
+        {
+            dir = argv[++n];
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (n >= argc)
+    {
+        fprintf(stderr, "usage: %s [-f auto|bc1|bc2|bc3|bc4|bc5|bc7] [-s] [-n] [-m box|kaiser|lanczos] [-a cutoff]\n"
+                        "    [-j threads] [-r width height] [-o dir] in.tga|in.raw ...\n", argv[0]);
+        return 1;
+    }
+
+    if (srgb && (format == VBCnCodec::BC4 || format == VBCnCodec::BC5))
+    {
+        fprintf(stderr, "vtexcook: bc4 and bc5 have no sRGB variant\n");
+        return 1;
+    }
+
+    if (!dir.empty() && !MakeDirectory(dir))
+    {
+        fprintf(stderr, "vtexcook: unable to create directory %s: %s\n", dir.c_str(), strerror(errno));
+        return 1;
+    }
+
+    images.resize(argc - n);
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        CookImage & image = images[i];
+        std::string source = argv[n + i];
+        size_t slash = source.find_last_of("/\\");
+        size_t dot = source.find_last_of('.');
+        std::string ext = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? source.substr(dot) : "";
+        std::string base = source.substr(0, source.size() - ext.size());
+
+        if (!dir.empty())
+            base = dir + "/" + (slash == std::string::npos ? base : base.substr(slash + 1));
+
+        image.source = source;
+        image.output = base + ".dds";
+        image.width = raw_width;
+        image.height = raw_height;
+        image.ok = false;
+
+        bool loaded = (ext == ".raw" || ext == ".RAW") ?
+                      LoadRaw(source.c_str(), image.width, image.height, image.rgba) :
+                      LoadTGA(source.c_str(), image.width, image.height, image.rgba);
+
+        if (!loaded)
+        {
+            fprintf(stderr, "vtexcook: unable to load %s\n", source.c_str());
+            return 1;
+        }
+
+        if (format >= 0)
+        {
+            image.format = (VBCnCodec::Format)format;
+        }
+        else
+        {
+            image.format = VBCnCodec::BC1;
+            for (size_t t = 3; t < image.rgba.size(); t += 4)
+            {
+                if (image.rgba[t] != 255)
+                {
+                    image.format = VBCnCodec::BC3;
+                    break;
+                }
+            }
+        }
+    }
+
+    VThreadPool pool(threads);
+    double format_seconds[VBCnCodec::FORMAT_COUNT];
+    double seconds = 0.0;
+
+    for (int f = 0; f < VBCnCodec::FORMAT_COUNT; f++)
+    {
+        std::vector<CookImage *> group;
+
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (images[i].format == f)
+                group.push_back(&images[i]);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        pool.ParallelFor((unsigned int)group.size(), 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int i = begin; i < end; i++)
+                Cook(*group[i], srgb, mips, filter, alpha_cutoff, pool);
+        });
+
+        format_seconds[f] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        seconds += format_seconds[f];
+    }
+
+    double total_pixels = 0.0;
+    int failed = 0;
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const CookImage & image = images[i];
+
+        if (!image.ok)
+        {
+            fprintf(stderr, "vtexcook: unable to write %s\n", image.output.c_str());
+            failed++;
+            continue;
+        }
+
+        printf("%s: %ux%u, %u mips, %s, %.2f dB\n", image.output.c_str(), image.width, image.height, image.mips,
+               format_names[image.format], PSNR(image.error, image.pixels * VBCnCodec::GetChannelCount(image.format)));
+        total_pixels += image.pixels;
+    }
+
+    for (int f = 0; f < VBCnCodec::FORMAT_COUNT; f++)
+    {
+        double pixels = 0.0, error = 0.0;
+        unsigned int count = 0;
+
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (images[i].ok && images[i].format == f)
+            {
+                pixels += images[i].pixels;
+                error += images[i].error;
+                count++;
+            }
+        }
+
+        if (count != 0)
+        {
+            printf("%s: %u images, %.1f Mpixels, %.2f dB, %.1f Mpixels/s\n", format_names[f], count, pixels / 1e6,
+                   PSNR(error, pixels * VBCnCodec::GetChannelCount((VBCnCodec::Format)f)),
+                   pixels / 1e6 / format_seconds[f]);
+        }
+    }
+
+    printf("%.1f Mpixels in %.2f s, %.1f Mpixels/s with %u worker threads (%s, mips %s)\n",
+           total_pixels / 1e6, seconds, total_pixels / 1e6 / seconds, pool.GetThreadCount(), VBCnCodec::GetPath(),
+           VMipGenerator::GetPath());
+
+    return failed ? 1 : 0;
+}
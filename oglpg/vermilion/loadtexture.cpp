@@ -10,6 +10,7 @@
 //#include <cstdint>
 
 extern "C" void vglLoadDDS(const char* filename, vglImageData* image);
+extern "C" void vglUnmapDDS(vglImageData* image);
 
 void vglLoadImage(const char* filename, vglImageData* image)
 {
@@ -19,7 +20,12 @@ void vglLoadImage(const char* filename, vglImageData* image)
 
 void vglUnloadImage(vglImageData* image)
 {
-    delete [] reinterpret_cast<uint8_t *>(image->mip[0].data);
+    if (image->mapping != NULL)
+        vglUnmapDDS(image);
+    else
+        delete [] reinterpret_cast<uint8_t *>(image->mip[0].data);
+
+    image->mip[0].data = NULL;
 }
 
 GLuint vglLoadTexture(const char* filename,
@@ -42,6 +48,11 @@ GLuint vglLoadTexture(const char* filename,
     glBindTexture(image->target, texture);
 
     GLubyte * ptr = (GLubyte *)image->mip[0].data;
+    int layers;
+
+    // Block-compressed images go to the GPU as they are, and stay
+    // compressed there
+    bool compressed = image->type == GL_NONE && image->format != GL_NONE;
 
     switch (image->target)
     {
@@ -84,6 +95,17 @@ GLuint vglLoadTexture(const char* filename,
                            image->mip[0].height);
             for (level = 0; level < image->mipLevels; ++level)
             {
+                if (compressed)
+                {
+                    glCompressedTexSubImage2D(GL_TEXTURE_2D,
+                                              level,
+                                              0, 0,
+                                              image->mip[level].width, image->mip[level].height,
+                                              image->internalFormat,
+                                              (GLsizei)image->mip[level].mipStride,
+                                              image->mip[level].data);
+                    continue;
+                }
                 glTexSubImage2D(GL_TEXTURE_2D,
                                 level,
                                 0, 0,
@@ -98,6 +120,17 @@ GLuint vglLoadTexture(const char* filename,
                 ptr = (GLubyte *)image->mip[level].data;
                 for (int face = 0; face < 6; face++)
                 {
+                    if (compressed)
+                    {
+                        glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                                               level,
+                                               image->internalFormat,
+                                               image->mip[level].width, image->mip[level].height,
+                                               0,
+                                               (GLsizei)image->mip[level].mipStride,
+                                               ptr + image->sliceStride * face);
+                        continue;
+                    }
                     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
                                  level,
                                  image->internalFormat,
@@ -109,30 +142,41 @@ GLuint vglLoadTexture(const char* filename,
             }
             break;
         case GL_TEXTURE_2D_ARRAY:
+        case GL_TEXTURE_CUBE_MAP_ARRAY:
+            // Layers are faces for cube map arrays. A DDS file keeps all
+            // the mips of a layer together, so upload layer by layer.
+            layers = image->target == GL_TEXTURE_CUBE_MAP_ARRAY ? image->slices * 6 : image->slices;
             glTexStorage3D(image->target,
                            image->mipLevels,
                            image->internalFormat,
                            image->mip[0].width,
                            image->mip[0].height,
-                           image->slices);
+                           layers);
             for (level = 0; level < image->mipLevels; ++level)
             {
-                glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
-                                level,
-                                0, 0, 0,
-                                image->mip[level].width, image->mip[level].height, image->slices,
-                                image->format, image->type,
-                                image->mip[level].data);
+                ptr = (GLubyte *)image->mip[level].data;
+                for (int layer = 0; layer < layers; layer++)
+                {
+                    if (compressed)
+                    {
+                        glCompressedTexSubImage3D(image->target,
+                                                  level,
+                                                  0, 0, layer,
+                                                  image->mip[level].width, image->mip[level].height, 1,
+                                                  image->internalFormat,
+                                                  (GLsizei)image->mip[level].mipStride,
+                                                  ptr + image->sliceStride * layer);
+                        continue;
+                    }
+                    glTexSubImage3D(image->target,
+                                    level,
+                                    0, 0, layer,
+                                    image->mip[level].width, image->mip[level].height, 1,
+                                    image->format, image->type,
+                                    ptr + image->sliceStride * layer);
+                }
             }
             break;
-        case GL_TEXTURE_CUBE_MAP_ARRAY:
-            glTexStorage3D(image->target,
-                           image->mipLevels,
-                           image->internalFormat,
-                           image->mip[0].width,
-                           image->mip[0].height,
-                           image->slices);
-            break;
         case GL_TEXTURE_3D:
             glTexStorage3D(image->target,
                            image->mipLevels,
@@ -142,6 +186,17 @@ GLuint vglLoadTexture(const char* filename,
                            image->mip[0].depth);
             for (level = 0; level < image->mipLevels; ++level)
             {
+                if (compressed)
+                {
+                    glCompressedTexSubImage3D(GL_TEXTURE_3D,
+                                              level,
+                                              0, 0, 0,
+                                              image->mip[level].width, image->mip[level].height, image->mip[level].depth,
+                                              image->internalFormat,
+                                              (GLsizei)image->mip[level].mipStride,
+                                              image->mip[level].data);
+                    continue;
+                }
                 glTexSubImage3D(GL_TEXTURE_3D,
                                 level,
                                 0, 0, 0,
@@ -9,6 +9,15 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif /* _MSC_VER */
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #define VERMILION_BUILD_LIB
 #include <vermilion.h>
 
@@ -174,6 +183,13 @@ enum
     DDS_FOURCC_DXT3                         = 0x33545844,
     DDS_FOURCC_DXT4                         = 0x34545844,
     DDS_FOURCC_DXT5                         = 0x35545844,
+    DDS_FOURCC_ATI1                         = 0x31495441,
+    DDS_FOURCC_ATI2                         = 0x32495441,
+    DDS_FOURCC_BC4U                         = 0x55344342,
+    DDS_FOURCC_BC4S                         = 0x53344342,
+    DDS_FOURCC_BC5U                         = 0x55354342,
+    DDS_FOURCC_BC5S                         = 0x53354342,
+    DDS_FOURCC_A32B32G32R32F                = 116,
 
     DDS_DDPF_ALPHAPIXELS                    = 0x00000001,
     DDS_DDPF_ALPHA                          = 0x00000002,
@@ -251,7 +267,9 @@ struct DDS_FORMAT_GL_INFO
 
 static const DDS_FORMAT_GL_INFO gl_info_table[] =
 {
-    // format,              type,               internalFormat,     swizzle_r,      swizzle_g,      swizzle_b,      swizzle_a
+    // format,              type,               internalFormat,     swizzle_r,      swizzle_g,      swizzle_b,      swizzle_a,  bits_per_texel
+    // Block-compressed formats have type GL_NONE, the compressed format as
+    // format and the average bits per texel of their 4x4 blocks.
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    0 },        // DDS_FORMAT_UNKNOWN
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    0 },        // DDS_FORMAT_R32G32B32A32_TYPELESS
     { GL_RGBA,              GL_FLOAT,           GL_RGBA32F,         GL_RED,         GL_GREEN,       GL_BLUE,        GL_ALPHA,   128 },      // DDS_FORMAT_R32G32B32A32_FLOAT
@@ -322,47 +340,36 @@ static const DDS_FORMAT_GL_INFO gl_info_table[] =
     { GL_RGB,               GL_UNSIGNED_SHORT,  GL_RGB9_E5,         GL_RED,         GL_GREEN,       GL_BLUE,        GL_ONE,     16 },      // DDS_FORMAT_R9G9B9E5_SHAREDEXP
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    16 },      // DDS_FORMAT_R8G8_B8G8_UNORM
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    16 },      // DDS_FORMAT_G8R8_G8B8_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC1_TYPELESS
-#if defined GL_EXT_texture_compression_s3tc
-    { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_NONE, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_RED, GL_GREEN,  GL_BLUE,        GL_ONE              },      // DDS_FORMAT_BC1_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC1_UNORM_SRGB
-#else
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC1_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC1_UNORM_SRGB
-#endif
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC2_TYPELESS
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC2_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC2_UNORM_SRGB
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_TYPELESS
-#if defined GL_EXT_texture_compression_s3tc
-//    { GL_COMPRESSED_RGB_S3TC_DXT3_EXT,  GL_NONE, GL_COMPRESSED_RGB_S3TC_DXT3_EXT, GL_ZERO, GL_ZERO, GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_UNORM_SRGB
-#else
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC3_UNORM_SRGB
-#endif
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC4_TYPELESS
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC4_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC4_SNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC5_TYPELESS
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC5_UNORM
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC5_SNORM
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    4 },       // DDS_FORMAT_BC1_TYPELESS
+    { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_NONE, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 4 },      // DDS_FORMAT_BC1_UNORM
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, GL_NONE, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 4 },      // DDS_FORMAT_BC1_UNORM_SRGB
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    8 },       // DDS_FORMAT_BC2_TYPELESS
+    { GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_NONE, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC2_UNORM
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, GL_NONE, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC2_UNORM_SRGB
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    8 },       // DDS_FORMAT_BC3_TYPELESS
+    { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_NONE, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC3_UNORM
+    { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, GL_NONE, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC3_UNORM_SRGB
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    4 },       // DDS_FORMAT_BC4_TYPELESS
+    { GL_COMPRESSED_RED_RGTC1, GL_NONE, GL_COMPRESSED_RED_RGTC1, GL_RED, GL_ZERO, GL_ZERO, GL_ONE, 4 },      // DDS_FORMAT_BC4_UNORM
+    { GL_COMPRESSED_SIGNED_RED_RGTC1, GL_NONE, GL_COMPRESSED_SIGNED_RED_RGTC1, GL_RED, GL_ZERO, GL_ZERO, GL_ONE, 4 },      // DDS_FORMAT_BC4_SNORM
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    8 },       // DDS_FORMAT_BC5_TYPELESS
+    { GL_COMPRESSED_RG_RGTC2, GL_NONE, GL_COMPRESSED_RG_RGTC2, GL_RED, GL_GREEN, GL_ZERO, GL_ONE, 8 },      // DDS_FORMAT_BC5_UNORM
+    { GL_COMPRESSED_SIGNED_RG_RGTC2, GL_NONE, GL_COMPRESSED_SIGNED_RG_RGTC2, GL_RED, GL_GREEN, GL_ZERO, GL_ONE, 8 },      // DDS_FORMAT_BC5_SNORM
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_B5G6R5_UNORM
-    { GL_RGBA,              GL_UNSIGNED_SHORT,  GL_RGB5_A1,         GL_RED,         GL_GREEN,       GL_BLUE,        GL_ALPHA            },      // DDS_FORMAT_B5G5R5A1_UNORM
-    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_RGBA8,           GL_BLUE,        GL_GREEN,       GL_RED,         GL_ALPHA            },      // DDS_FORMAT_B8G8R8A8_UNORM
-    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_RGBA8,           GL_RED,         GL_GREEN,       GL_BLUE,        GL_ONE              },      // DDS_FORMAT_B8G8R8X8_UNORM
+    { GL_RGBA,              GL_UNSIGNED_SHORT,  GL_RGB5_A1,         GL_RED,         GL_GREEN,       GL_BLUE,        GL_ALPHA,   16 },      // DDS_FORMAT_B5G5R5A1_UNORM
+    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_RGBA8,           GL_BLUE,        GL_GREEN,       GL_RED,         GL_ALPHA,   32 },      // DDS_FORMAT_B8G8R8A8_UNORM
+    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_RGBA8,           GL_RED,         GL_GREEN,       GL_BLUE,        GL_ONE,     32 },      // DDS_FORMAT_B8G8R8X8_UNORM
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_R10G10B10_XR_BIAS_A2_UNORM
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_B8G8R8A8_TYPELESS
-    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_SRGB8_ALPHA8,    GL_BLUE,        GL_GREEN,       GL_RED,         GL_ALPHA            },      // DDS_FORMAT_B8G8R8A8_UNORM_SRGB
+    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_SRGB8_ALPHA8,    GL_BLUE,        GL_GREEN,       GL_RED,         GL_ALPHA,   32 },      // DDS_FORMAT_B8G8R8A8_UNORM_SRGB
     { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_B8G8R8X8_TYPELESS
-    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_SRGB8_ALPHA8,    GL_BLUE,        GL_GREEN,       GL_RED,         GL_ONE              },      // DDS_FORMAT_B8G8R8X8_UNORM_SRGB
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC6H_TYPELESS
-    { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, GL_NONE, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, GL_RED, GL_GREEN, GL_BLUE,     GL_ONE          },      // DDS_FORMAT_BC6H_UF16
-    { GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, GL_NONE, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ONE         },   // DDS_FORMAT_BC6H_SF16
-    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_BC7_TYPELESS
-    { GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, GL_NONE, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA            },      // DDS_FORMAT_BC7_UNORM
-    { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, GL_NONE, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA         }, // DDS_FORMAT_BC7_UNORM_SRGB
+    { GL_RGBA,              GL_UNSIGNED_BYTE,   GL_SRGB8_ALPHA8,    GL_BLUE,        GL_GREEN,       GL_RED,         GL_ONE,     32 },      // DDS_FORMAT_B8G8R8X8_UNORM_SRGB
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    8 },       // DDS_FORMAT_BC6H_TYPELESS
+    { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, GL_NONE, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ONE, 8 },      // DDS_FORMAT_BC6H_UF16
+    { GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, GL_NONE, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ONE, 8 },      // DDS_FORMAT_BC6H_SF16
+    { GL_NONE,              GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO,    8 },       // DDS_FORMAT_BC7_TYPELESS
+    { GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, GL_NONE, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC7_UNORM
+    { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, GL_NONE, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, 8 },      // DDS_FORMAT_BC7_UNORM_SRGB
     { GL_NONE,          GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_AYUV
     { GL_NONE,          GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_Y410
     { GL_NONE,          GL_NONE,            GL_NONE,            GL_ZERO,        GL_ZERO,        GL_ZERO,        GL_ZERO             },      // DDS_FORMAT_Y416
@@ -383,6 +390,51 @@ static const DDS_FORMAT_GL_INFO gl_info_table[] =
 
 #define NUM_DDS_FORMATS     (sizeof(gl_info_table) / sizeof(gl_info_table[0]))
 
+// Table entry for a DX10 header's format, or for the older FourCCs that
+// have an equivalent. NULL for everything else.
+static const DDS_FORMAT_GL_INFO* vgl_GetDDSFormatInfo(const DDS_FILE_HEADER& header)
+{
+    if (header.std_header.ddspf.dwFlags != DDS_DDPF_FOURCC)
+        return NULL;
+
+    switch (header.std_header.ddspf.dwFourCC)
+    {
+        case DDS_FOURCC_DX10:
+            if (header.dxt10_header.format < NUM_DDS_FORMATS)
+                return &gl_info_table[header.dxt10_header.format];
+            return NULL;
+        case DDS_FOURCC_DXT1:
+            return &gl_info_table[DDS_FORMAT_BC1_UNORM];
+        case DDS_FOURCC_DXT2:
+        case DDS_FOURCC_DXT3:
+            return &gl_info_table[DDS_FORMAT_BC2_UNORM];
+        case DDS_FOURCC_DXT4:
+        case DDS_FOURCC_DXT5:
+            return &gl_info_table[DDS_FORMAT_BC3_UNORM];
+        case DDS_FOURCC_ATI1:
+        case DDS_FOURCC_BC4U:
+            return &gl_info_table[DDS_FORMAT_BC4_UNORM];
+        case DDS_FOURCC_BC4S:
+            return &gl_info_table[DDS_FORMAT_BC4_SNORM];
+        case DDS_FOURCC_ATI2:
+        case DDS_FOURCC_BC5U:
+            return &gl_info_table[DDS_FORMAT_BC5_UNORM];
+        case DDS_FOURCC_BC5S:
+            return &gl_info_table[DDS_FORMAT_BC5_SNORM];
+        case DDS_FOURCC_A32B32G32R32F:
+            return &gl_info_table[DDS_FORMAT_R32G32B32A32_FLOAT];
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+static bool vgl_IsCompressedFormat(const DDS_FORMAT_GL_INFO& format)
+{
+    return format.type == GL_NONE && format.format != GL_NONE;
+}
+
 static bool vgl_DDSHeaderToImageDataHeader(const DDS_FILE_HEADER& header, vglImageData* image)
 {
     if (header.std_header.ddspf.dwFlags == DDS_DDPF_FOURCC &&
@@ -410,9 +462,24 @@ static bool vgl_DDSHeaderToImageDataHeader(const DDS_FILE_HEADER& header, vglIma
         image->swizzle[3] = GL_ALPHA;
         image->mipLevels = header.std_header.mip_levels;
 
+        const DDS_FORMAT_GL_INFO* format = vgl_GetDDSFormatInfo(header);
+
+        // DXT1-5, ATI1/2 and BC4/5: block-compressed data from before DX10
+        if (format != NULL && vgl_IsCompressedFormat(*format))
+        {
+            image->format = format->format;
+            image->type = format->type;
+            image->internalFormat = format->internalFormat;
+            image->swizzle[0] = format->swizzle_r;
+            image->swizzle[1] = format->swizzle_g;
+            image->swizzle[2] = format->swizzle_b;
+            image->swizzle[3] = format->swizzle_a;
+            return true;
+        }
+
         switch (header.std_header.ddspf.dwFourCC)
         {
-            case 116:
+            case DDS_FOURCC_A32B32G32R32F:
                 image->format = GL_RGBA;
                 image->type = GL_FLOAT;
                 image->internalFormat = GL_RGBA32F;
@@ -483,14 +550,12 @@ static bool vgl_DDSHeaderToImageDataHeader(const DDS_FILE_HEADER& header, vglIma
 
 static GLsizei vgl_GetDDSStride(const DDS_FILE_HEADER& header, GLsizei width)
 {
-    if (header.std_header.ddspf.dwFlags == DDS_DDPF_FOURCC &&
-        header.std_header.ddspf.dwFourCC == DDS_FOURCC_DX10)
+    if (header.std_header.ddspf.dwFlags == DDS_DDPF_FOURCC)
     {
-        if (header.dxt10_header.format < NUM_DDS_FORMATS)
-        {
-            const DDS_FORMAT_GL_INFO& format = gl_info_table[header.dxt10_header.format];
-            return (format.bits_per_texel * width + 7) / 8;
-        }
+        const DDS_FORMAT_GL_INFO* format = vgl_GetDDSFormatInfo(header);
+
+        if (format != NULL)
+            return (format->bits_per_texel * width + 7) / 8;
     }
     else
     {
@@ -511,6 +576,23 @@ static GLsizei vgl_GetDDSStride(const DDS_FILE_HEADER& header, GLsizei width)
     return 0;
 }
 
+// Bytes in one mip level of one slice (array element or cube face).
+// Block-compressed formats store whole 4x4 blocks, so their rows are four
+// texels high and the small mips still take one block each.
+static GLsizeiptr vgl_GetDDSMipSize(const DDS_FILE_HEADER& header, GLsizei width, GLsizei height, GLsizei depth)
+{
+    const DDS_FORMAT_GL_INFO* format = vgl_GetDDSFormatInfo(header);
+
+    if (format != NULL && vgl_IsCompressedFormat(*format))
+    {
+        GLsizeiptr blocks = (GLsizeiptr)((width + 3) / 4) * ((height + 3) / 4);
+
+        return blocks * format->bits_per_texel * 2 * depth;
+    }
+
+    return (GLsizeiptr)vgl_GetDDSStride(header, width) * height * depth;
+}
+
 static GLenum vgl_GetTargetFromDDSHeader(const DDS_FILE_HEADER& header)
 {
     // If the DX10 header is present it's format should be non-zero (unless it's unknown)
@@ -566,9 +648,44 @@ static GLenum vgl_GetTargetFromDDSHeader(const DDS_FILE_HEADER& header)
     return GL_TEXTURE_2D;
 }
 
+// Maps the whole of an open file read-only. The view outlives the file and
+// its handles, so only the view has to be unmapped later.
+static void* vgl_MapFile(FILE* f, size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(f));
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+        return NULL;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    return data;
+#else
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    // The upload reads it front to back, once
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    return data;
+#endif
+}
+
 extern "C"
 {
 
+void vglUnmapDDS(vglImageData* image);
+
+
 void vglLoadDDS(const char* filename, vglImageData* image)
 {
     FILE* f;
@@ -578,6 +695,7 @@ void vglLoadDDS(const char* filename, vglImageData* image)
     int width = 0;
     int height = 0;
     int depth = 0;
+    int faces = 1;
 
     memset(image, 0, sizeof(*image));
 
@@ -615,40 +733,95 @@ void vglLoadDDS(const char* filename, vglImageData* image)
     fseek(f, (long)current_pos, SEEK_SET);
 
     image->totalDataSize = file_size - current_pos;
-    image->mip[0].data = new uint8_t [image->totalDataSize];
 
-    fread(image->mip[0].data, file_size - current_pos, 1, f);
+    // Point the mips straight into a view of the file, so that the upload
+    // reads the page cache rather than a heap copy of it. Fall back to
+    // reading the file if it can't be mapped.
+    image->mapping = vgl_MapFile(f, file_size);
+
+    if (image->mapping != NULL)
+    {
+        image->mappingSize = file_size;
+        image->mip[0].data = reinterpret_cast<GLubyte*>(image->mapping) + current_pos;
+    }
+    else
+    {
+        image->mip[0].data = new uint8_t [image->totalDataSize];
+
+        fread(image->mip[0].data, file_size - current_pos, 1, f);
+    }
 
     int level;
     ptr = reinterpret_cast<GLubyte*>(image->mip[0].data);
 
     width = file_header.std_header.width;
     height = file_header.std_header.height;
-    depth = file_header.std_header.depth;
+    depth = image->target == GL_TEXTURE_3D ? file_header.std_header.depth : 1;
+
+    width = width > 0 ? width : 1;
+    height = height > 0 ? height : 1;
+    depth = depth > 0 ? depth : 1;
 
     image->sliceStride = 0;
+    image->slices = file_header.dxt10_header.array_size > 1 ? file_header.dxt10_header.array_size : 1;
 
     if (image->mipLevels == 0)
     {
         image->mipLevels = 1;
     }
 
+    if (image->mipLevels > MAX_TEXTURE_MIPS)
+    {
+        image->mipLevels = MAX_TEXTURE_MIPS;
+    }
+
+    // Slice after slice (each face of a cube map being one), each with all
+    // of its mips
     for (level = 0; level < image->mipLevels; ++level)
     {
         image->mip[level].data = ptr;
         image->mip[level].width = width;
         image->mip[level].height = height;
         image->mip[level].depth = depth;
-        image->mip[level].mipStride = vgl_GetDDSStride(file_header, width) * height;
+        image->mip[level].mipStride = vgl_GetDDSMipSize(file_header, width, height, depth);
         image->sliceStride += image->mip[level].mipStride;
         ptr += image->mip[level].mipStride;
-        width >>= 1;
-        height >>= 1;
-        depth >>= 1;
+        width = width > 1 ? width >> 1 : 1;
+        height = height > 1 ? height >> 1 : 1;
+        depth = depth > 1 ? depth >> 1 : 1;
+    }
+
+    // Don't hand out pointers past the end of the file - with a mapping
+    // that would fault during the upload
+    faces = (image->target == GL_TEXTURE_CUBE_MAP || image->target == GL_TEXTURE_CUBE_MAP_ARRAY) ? 6 : 1;
+
+    if (image->sliceStride * image->slices * faces > image->totalDataSize)
+    {
+        if (image->mapping != NULL)
+            vglUnmapDDS(image);
+        else
+            delete [] reinterpret_cast<uint8_t *>(image->mip[0].data);
+
+        memset(image, 0, sizeof(*image));
     }
 
 done_close_file:
     fclose(f);
 }
 
+void vglUnmapDDS(vglImageData* image)
+{
+    if (image->mapping == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(image->mapping);
+#else
+    munmap(image->mapping, image->mappingSize);
+#endif
+
+    image->mapping = NULL;
+    image->mappingSize = 0;
+}
+
 }